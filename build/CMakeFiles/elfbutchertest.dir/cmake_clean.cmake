@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/elfbutchertest.dir/test.c.o"
+  "CMakeFiles/elfbutchertest.dir/test.c.o.d"
+  "elfbutchertest"
+  "elfbutchertest.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/elfbutchertest.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,12 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/shelftestlib.dir/testlib.c.o"
+  "CMakeFiles/shelftestlib.dir/testlib.c.o.d"
+  "lib/libshelftest.pdb"
+  "lib/libshelftest.so"
+  "lib/libshelftest.so.1"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/shelftestlib.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,8 @@
+# CMake generated Testfile for 
+# Source directory: /root/repo/test
+# Build directory: /root/repo/build
+# 
+# This file includes the relevant testing commands required for 
+# testing this directory and lists subdirectories to be tested as well.
+add_test(elfbutchertest "/root/repo/build/elfbutchertest")
+set_tests_properties(elfbutchertest PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/test/CMakeLists.txt;21;add_test;/root/repo/test/CMakeLists.txt;0;")
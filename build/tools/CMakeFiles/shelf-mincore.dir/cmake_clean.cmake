@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/shelf-mincore.dir/mincore.c.o"
+  "CMakeFiles/shelf-mincore.dir/mincore.c.o.d"
+  "shelf-mincore"
+  "shelf-mincore.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/shelf-mincore.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,18 @@
+#ifndef SHELF_BUILDID_9F26C1
+#define SHELF_BUILDID_9F26C1
+
+#include "shelf.h"
+
+/* Largest build-id we accept, real ones are 16 or 20 bytes. */
+#define SHELF_BUILD_ID_MAX 64
+
+/*
+ * Readers for the identifiers used to match binaries with their debug files.
+ * They never map the file or decode its section or symbol tables: only the
+ * header, program headers and the note bytes are read with pread().
+ */
+extern ssize_t shelf_read_build_id(const char *path, unsigned char *buf);
+extern ssize_t shelf_read_debuglink(const char *path, char *name, size_t len, uint32_t *crc);
+extern ssize_t shelf_get_build_id(shelfobj_t *desc, unsigned char *buf);
+
+#endif // SHELF_BUILDID_9F26C1
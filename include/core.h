@@ -0,0 +1,97 @@
+#ifndef SHELF_CORE_A7D2C9
+#define SHELF_CORE_A7D2C9
+
+#include "shelf.h"
+#include "note.h"
+
+/*
+ * One thread, from an NT_PRSTATUS note. `regs` is the raw, machine specific
+ * pr_reg block (struct user_regs_struct on Linux).
+ */
+typedef struct shelf_core_thread {
+    uint32_t pid;
+    uint32_t ppid;
+    int32_t signo;              /* pr_cursig */
+    const unsigned char *regs;
+    size_t regs_len;
+} shelfcorethread_t;
+
+/* One file backed mapping, from the NT_FILE note. */
+typedef struct shelf_core_file {
+    uint64_t start;
+    uint64_t end;
+    uint64_t offset;            /* In bytes, already scaled by the page size. */
+    const char *path;
+} shelfcorefile_t;
+
+typedef struct shelf_core_auxv {
+    uint64_t type;
+    uint64_t val;
+} shelfcoreauxv_t;
+
+/* Memory reads go through a small LRU cache of file pages. */
+#define SHELF_CORE_PAGE        4096
+#define SHELF_CORE_CACHE_PAGES 64
+
+typedef struct shelf_core_cache {
+    unsigned char *pages;       /* SHELF_CORE_CACHE_PAGES * SHELF_CORE_PAGE bytes. */
+    uint64_t tag[SHELF_CORE_CACHE_PAGES];     /* File page number, plus one. */
+    uint32_t len[SHELF_CORE_CACHE_PAGES];     /* Valid bytes, short at EOF. */
+    uint64_t used[SHELF_CORE_CACHE_PAGES];
+    uint64_t clock;
+    uint64_t hits;
+    uint64_t misses;
+} shelfcorecache_t;
+
+/*
+ * State of a core file opened without mapping it. Every PT_NOTE payload is
+ * read once into `notes`; all records point into that buffer.
+ */
+typedef struct shelf_core {
+    unsigned char *notes;
+    size_t notes_len;
+
+    shelfnote_t *all;           /* Every note, in file order. */
+    size_t nall;
+
+    shelfcorethread_t *threads;
+    size_t nthreads;
+
+    shelfcorefile_t *files;     /* Sorted by start address. */
+    size_t nfiles;
+    uint64_t page_size;
+
+    shelfcoreauxv_t *auxv;
+    size_t nauxv;
+
+    const unsigned char *siginfo;
+    size_t siginfo_len;
+    int32_t si_signo;
+    int32_t si_code;
+    uint64_t si_addr;           /* Faulting address for SIGSEGV/SIGBUS/SIGILL/SIGFPE. */
+
+    shelfcorecache_t *cache;    /* Allocated on the first shelf_core_read(). */
+} shelfcore_t;
+
+/* Flags for shelf_core_minimize(). */
+#define SHELF_COREMIN_DENSE        (1 << 0)    /* Write zero pages instead of leaving holes. */
+#define SHELF_COREMIN_NO_ELF_HEADS (1 << 1)    /* Drop the ELF header page of dropped mappings too. */
+
+typedef struct shelf_coremin_stats {
+    uint64_t in_size;           /* Input file size. */
+    uint64_t out_size;          /* Output file size, holes included. */
+    uint64_t written;           /* Bytes actually written. */
+    uint64_t zero_pages;        /* Pages left as holes. */
+    size_t dropped;             /* Segments whose contents were dropped. */
+} shelfcoreminstats_t;
+
+/* Functions for reading core files. */
+extern int                    shelf_core_load(shelfobj_t *desc);
+extern void                   shelf_core_free(shelfobj_t *desc);
+extern const shelfcorefile_t *shelf_core_file_at(const shelfobj_t *desc, uint64_t vaddr);
+extern int                    shelf_core_auxv_get(const shelfobj_t *desc, uint64_t type, uint64_t *val);
+extern ssize_t                shelf_core_read(shelfobj_t *desc, uint64_t vaddr, void *buf, size_t len);
+extern int                    shelf_core_minimize(shelfobj_t *desc, const char *path, int flags,
+                                                  shelfcoreminstats_t *stats);
+
+#endif // SHELF_CORE_A7D2C9
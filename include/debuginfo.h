@@ -0,0 +1,44 @@
+#ifndef SHELF_DEBUGINFO_6A3D5E
+#define SHELF_DEBUGINFO_6A3D5E
+
+#include "shelf.h"
+#include "buildid.h"
+
+/* Debug root searched when none is configured. */
+#define SHELF_DEBUG_ROOT_DEFAULT "/usr/lib/debug"
+
+/*
+ * A build-id to path index over a set of debug roots. The index is built by
+ * walking the roots once and can be persisted to `cache_path`, so later
+ * processes load it instead of walking the directories again. The cache
+ * records the roots it covers and is rebuilt when they differ.
+ */
+typedef struct shelf_debugidx_ent {
+    char *build_id;     /* Lower case hex. */
+    char *path;
+} shelfdebugidxent_t;
+
+typedef struct shelf_debugidx {
+    char **roots;
+    size_t nroots;
+    char *cache_path;
+
+    shelfdebugidxent_t *table;  /* Open addressed, build_id NULL when empty. */
+    size_t mask;
+    size_t count;
+    char loaded;
+} shelfdebugidx_t;
+
+/* Functions for managing a debug file index. */
+extern shelfdebugidx_t *shelf_debugidx_new(const char *cache_path);
+extern int              shelf_debugidx_add_root(shelfdebugidx_t *idx, const char *root);
+extern int              shelf_debugidx_build(shelfdebugidx_t *idx);
+extern int              shelf_debugidx_rebuild(shelfdebugidx_t *idx);
+extern const char      *shelf_debugidx_lookup(shelfdebugidx_t *idx, const unsigned char *id, size_t len);
+extern void             shelf_debugidx_free(shelfdebugidx_t *idx);
+
+/* Locate and attach a stripped binary's debug file as desc->debug. */
+extern char       *shelf_find_debug_file(shelfobj_t *desc, shelfdebugidx_t *idx);
+extern shelfobj_t *shelf_open_debug(shelfobj_t *desc, shelfdebugidx_t *idx);
+
+#endif // SHELF_DEBUGINFO_6A3D5E
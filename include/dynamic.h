@@ -0,0 +1,65 @@
+#ifndef SHELF_DYNAMIC_E27A94
+#define SHELF_DYNAMIC_E27A94
+
+#include "shelf.h"
+
+/*
+ * A single decoded dynamic entry.
+ */
+typedef struct shelf_dynent {
+    int64_t  tag;
+    uint64_t val;
+} shelfdynent_t;
+
+/*
+ * Parsed dynamic table, built once per descriptor by shelf_dyn_load().
+ *
+ * entries: Every entry up to DT_NULL, stably sorted by tag so repeated tags
+ *   such as DT_NEEDED form one run in file order.
+ * val/present: The first value of each generic tag (< DT_NUM), indexed by
+ *   tag, with one presence bit per tag.
+ * start/count: Where each generic tag's run lives in entries.
+ * os/nos: The run of OS and processor specific tags at the end of entries,
+ *   searched with a binary search.
+ */
+typedef struct shelf_dyn {
+    shelfdynent_t *entries;
+    size_t count;
+
+    uint64_t val[DT_NUM];
+    uint64_t present;
+    uint32_t start[DT_NUM];
+    uint32_t tagcount[DT_NUM];
+
+    shelfdynent_t *os;
+    size_t nos;
+
+    const char *strtab;     /* Dynamic string table, NULL if not in the file. */
+    uint64_t strsz;
+} shelfdyn_t;
+
+/* Functions for loading the dynamic table. */
+extern shelfdyn_t *shelf_dyn_load(shelfobj_t *desc);
+extern void        shelf_dyn_free(shelfobj_t *desc);
+
+/* Functions for looking up tags. */
+extern int                  shelf_dyn_get(shelfobj_t *desc, int64_t tag, uint64_t *val);
+extern const shelfdynent_t *shelf_dyn_get_all(shelfobj_t *desc, int64_t tag, size_t *count);
+extern const char          *shelf_dyn_string(shelfobj_t *desc, uint64_t offset);
+
+/* Helpers for the common string valued tags. */
+extern size_t      shelf_dyn_needed_count(shelfobj_t *desc);
+extern const char *shelf_dyn_needed(shelfobj_t *desc, size_t index);
+extern const char *shelf_dyn_soname(shelfobj_t *desc);
+extern const char *shelf_dyn_runpath(shelfobj_t *desc);
+
+/*
+ * Constant time lookup of a generic tag once the table is loaded.
+ */
+static inline int shelf_dyn_has(const shelfobj_t *desc, int64_t tag)
+{
+    return desc->dyn != NULL && tag >= 0 && tag < DT_NUM &&
+           (desc->dyn->present >> tag) & 1;
+}
+
+#endif // SHELF_DYNAMIC_E27A94
@@ -0,0 +1,93 @@
+#ifndef SHELF_ITER_5C21E9
+#define SHELF_ITER_5C21E9
+
+#include "shelf.h"
+
+/* Matches any section, symbol or segment type in an iterator filter. */
+#define SHELF_ITER_ANY 0xffffffffu
+
+/* Symbol tables an iterator can walk. */
+#define SHELF_SYMTAB_STATIC  0  /* .symtab, desc->symtab */
+#define SHELF_SYMTAB_DYNAMIC 1  /* .dynsym, desc->dynsym */
+
+/*
+ * Iterators live on the caller's stack and walk the object's own tables, so
+ * no call allocates. An entry is returned when its type matches (or the type
+ * is SHELF_ITER_ANY), every bit of flags_set is set and no bit of
+ * flags_clear is; symbol iterators started with `defined` also skip
+ * SHN_UNDEF entries. `index` is the table index of the entry last returned.
+ */
+typedef struct shelf_sect_iter {
+    shelfobj_t *desc;
+    size_t next;
+    size_t index;
+    uint32_t type;
+    uint64_t flags_set;     /* sh_flags */
+    uint64_t flags_clear;
+} shelfsectiter_t;
+
+typedef struct shelf_sym_iter {
+    shelfsym_t *syms;
+    size_t count;
+    size_t next;
+    size_t index;
+    uint32_t type;          /* STT_* */
+    uint32_t bind_mask;     /* 1 << STB_*; 0 matches any binding. */
+    char defined;           /* Skip SHN_UNDEF entries. */
+} shelfsymiter_t;
+
+typedef struct shelf_seg_iter {
+    shelfobj_t *desc;
+    size_t next;
+    size_t index;
+    uint32_t type;
+    uint32_t flags_set;     /* p_flags */
+    uint32_t flags_clear;
+} shelfsegiter_t;
+
+/*
+ * Streaming view of a symbol table. Entries are decoded from the mapped
+ * table one at a time into a caller-owned shelfsym_t, so nothing is
+ * allocated and desc->symtab need never be built.
+ */
+typedef struct shelf_sym_stream {
+    shelfobj_t *desc;
+    const unsigned char *base;
+    size_t entsize;
+    size_t count;
+    size_t next;
+    const char *strtab;
+    uint64_t strsz;
+} shelfsymstream_t;
+
+/* Visitors return non-zero to stop the walk; that value is passed back. */
+typedef int (*shelf_sect_visitor)(shelfobj_t *desc, shelfsect_t *sect, size_t index, void *arg);
+typedef int (*shelf_sym_visitor)(shelfobj_t *desc, shelfsym_t *sym, size_t index, void *arg);
+typedef int (*shelf_seg_visitor)(shelfobj_t *desc, Elf64_Phdr *phdr, size_t index, void *arg);
+
+/* Functions for iterating sections. */
+extern void        shelf_sect_iter_init(shelfsectiter_t *it, shelfobj_t *desc, uint32_t type,
+                                        uint64_t flags_set, uint64_t flags_clear);
+extern shelfsect_t *shelf_sect_iter_next(shelfsectiter_t *it);
+extern int         shelf_sect_visit(shelfobj_t *desc, uint32_t type, uint64_t flags_set,
+                                    uint64_t flags_clear, shelf_sect_visitor fn, void *arg);
+
+/* Functions for iterating symbols. */
+extern int         shelf_sym_iter_init(shelfsymiter_t *it, shelfobj_t *desc, int table,
+                                       uint32_t type, uint32_t bind_mask, int defined);
+extern shelfsym_t  *shelf_sym_iter_next(shelfsymiter_t *it);
+extern int         shelf_sym_visit(shelfobj_t *desc, int table, uint32_t type, uint32_t bind_mask,
+                                   int defined, shelf_sym_visitor fn, void *arg);
+
+/* Functions for streaming symbols. */
+extern int         shelf_sym_stream_init(shelfsymstream_t *st, shelfobj_t *desc, int table);
+extern int         shelf_sym_stream_next(shelfsymstream_t *st, shelfsym_t *sym);
+
+/* Functions for iterating segments. */
+extern void        shelf_seg_iter_init(shelfsegiter_t *it, shelfobj_t *desc, uint32_t type,
+                                       uint32_t flags_set, uint32_t flags_clear);
+extern Elf64_Phdr  *shelf_seg_iter_next(shelfsegiter_t *it);
+extern int         shelf_seg_visit(shelfobj_t *desc, uint32_t type, uint32_t flags_set,
+                                   uint32_t flags_clear, shelf_seg_visitor fn, void *arg);
+
+#endif // SHELF_ITER_5C21E9
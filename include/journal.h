@@ -0,0 +1,58 @@
+#ifndef SHELF_JOURNAL_5D93F0
+#define SHELF_JOURNAL_5D93F0
+
+#include "shelf.h"
+#include "layout.h"
+
+/*
+ * A transaction over a descriptor. Byte edits are kept as an overlay of
+ * changed file ranges, sorted and merged so no two extents touch, and the
+ * file mapping is never written. Edits to the decoded tables (desc->hdr,
+ * desc->pht, desc->sht) and to sections through get_section_data_rw() are
+ * made in place as usual, as are pending layout changes (see layout.h);
+ * the journal holds what they were at shelf_journal_begin() so they can
+ * be rolled back.
+ *
+ * get_section_data() and shelf_journal_read() see the overlay. Committing
+ * writes everything in one shelf_write() pass.
+ */
+typedef struct shelf_extent {
+    uint64_t offset;
+    uint64_t len;
+    unsigned char *bytes;
+} shelfextent_t;
+
+typedef struct shelf_journal {
+    shelfextent_t *extents;
+    size_t count;
+    size_t cap;
+
+    /* Table state at begin. */
+    shelf_Ehdr hdr;
+    Elf64_Phdr *pht;
+    shelf_Shdr *sht;
+
+    /*
+     * Section private copies at begin: owned[i] is set for sections that
+     * already had one, saved[i] holding its saved_len[i] bytes.
+     */
+    uint16_t nsects;
+    uint8_t *owned;
+    void **saved;
+    size_t *saved_len;
+
+    shelflayout_t *layout;      /* Copy of the pending layout, NULL if none. */
+} shelfjournal_t;
+
+/* Functions for managing a transaction. */
+extern shelfjournal_t *shelf_journal_begin(shelfobj_t *desc);
+extern ssize_t         shelf_journal_commit(shelfobj_t *desc, const char *path);
+extern void            shelf_journal_rollback(shelfobj_t *desc);
+
+/* Functions for staging and reading edits. */
+extern int     shelf_journal_write(shelfobj_t *desc, uint64_t offset, const void *buf, size_t len);
+extern ssize_t shelf_journal_read(shelfobj_t *desc, uint64_t offset, void *buf, size_t len);
+extern int     shelf_journal_overlaps(const shelfobj_t *desc, uint64_t offset, uint64_t len);
+extern void   *shelf_journal_section(shelfobj_t *desc, shelfsect_t *sect);
+
+#endif // SHELF_JOURNAL_5D93F0
@@ -0,0 +1,100 @@
+#ifndef SHELF_LAYOUT_A41C7E
+#define SHELF_LAYOUT_A41C7E
+
+#include "shelf.h"
+#include "strtab.h"
+
+/*
+ * Pending changes to a descriptor's section list. add_section(),
+ * remove_section(), shift_section() and swap_sections() only record what
+ * they were asked to do, so each costs O(1) however many sections follow;
+ * no bytes move and no index is rewritten until shelf_write(), which lays
+ * the output out from the plan in one pass (see shelf_layout_plan()).
+ *
+ * Sections are named by index in one space: [0, norig) are the file's
+ * own, in desc->sht order, and added sections follow in the order they
+ * were added. sh_link and sh_info of added sections use the same space.
+ *
+ * Symbols added to or renamed in the file's symbol tables are pending too,
+ * their names interned in a string table builder per string table (see
+ * strtab.h) that is laid out once, when the plan is made.
+ */
+typedef struct shelf_lsect {
+    shelfsect_t sect;       /* Name, header and contents of added sections. */
+    shelf_Shdr shdr;
+    uint32_t index;
+    uint32_t pos;           /* Place in the output order. */
+    uint64_t pad;           /* Extra bytes before the section. */
+    char removed;
+} shelflsect_t;
+
+typedef struct shelf_lsym {
+    uint32_t table;         /* Index of the symbol table. */
+    uint32_t index;         /* Symbol renamed, UINT32_MAX for added ones. */
+    uint32_t name;          /* Id in the string table's builder. */
+    shelfsym_t sym;
+} shelflsym_t;
+
+typedef struct shelf_layout {
+    shelflsect_t **order;   /* Output order, removed entries included. */
+    size_t count;
+    size_t cap;
+    size_t norig;
+    size_t nremoved;
+    shelflsect_t *orig;     /* Entries of the file's sections, by index. */
+    shelflsect_t **added;   /* Entries of added sections, by index - norig. */
+    size_t nadded;
+    size_t added_cap;
+    shelflsym_t *syms;
+    size_t nsyms;
+    size_t syms_cap;
+    shelfstrtab_t **strtabs;    /* Builders of the file's string tables, by index. */
+    char changed;
+} shelflayout_t;
+
+/*
+ * A computed layout. Output bytes [0, prefix) are the source's at the same
+ * offsets: the headers, every segment and, outside ET_REL files, the
+ * SHF_ALLOC sections, whose offsets are tied to their addresses and never
+ * move. Everything else is listed in places.
+ */
+typedef struct shelf_lplace {
+    uint64_t offset;        /* In the output. */
+    uint64_t len;
+    uint64_t src;           /* In the source, when buf is NULL. */
+    const void *buf;
+} shelflplace_t;
+
+typedef struct shelf_lplan {
+    shelf_Ehdr hdr;
+    Elf64_Phdr *pht;        /* desc->hdr.e_phnum entries. */
+    shelf_Shdr *sht;        /* hdr.e_shnum entries. */
+    uint64_t prefix;
+    uint64_t size;
+    shelflplace_t *places;
+    size_t nplaces;
+    void **owned;           /* Buffers made for the plan. */
+    size_t nowned;
+    shelfstrtab_t *names;   /* The new section name table. */
+} shelflplan_t;
+
+/* Functions for managing pending changes. */
+extern shelflayout_t *shelf_layout_load(shelfobj_t *desc);
+extern void           shelf_layout_free(shelfobj_t *desc);
+extern void           shelf_layout_attach(shelfobj_t *desc, shelflayout_t *layout);
+extern int            shelf_layout_pending(const shelfobj_t *desc);
+extern shelflayout_t *shelf_layout_copy(const shelflayout_t *layout);
+extern void           shelf_layout_drop(shelflayout_t *layout);
+
+/* Functions for editing symbol tables. */
+extern shelfstrtab_t *shelf_layout_strtab(shelfobj_t *desc, uint32_t index);
+extern int            shelf_layout_add_symbol(shelfobj_t *desc, uint32_t table, const shelfsym_t *sym,
+                                              const char *name);
+extern int            shelf_layout_rename_symbol(shelfobj_t *desc, uint32_t table, uint32_t index,
+                                                 const char *name);
+
+/* Functions for laying out the output. */
+extern int  shelf_layout_plan(shelfobj_t *desc, shelflplan_t *plan);
+extern void shelf_layout_plan_free(shelflplan_t *plan);
+
+#endif // SHELF_LAYOUT_A41C7E
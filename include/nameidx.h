@@ -0,0 +1,30 @@
+#ifndef SHELF_NAMEIDX_4E7B10
+#define SHELF_NAMEIDX_4E7B10
+
+#include "shelf.h"
+
+/*
+ * Name index over one symbol table, built on first use and cached on the
+ * descriptor. `names` holds every named symbol sorted by name, with
+ * `order` giving the symbol table index of each entry, so a prefix is a
+ * contiguous range. Substring queries go through a hashed trigram index
+ * over the distinct names (`gram_start`/`postings`, in CSR form).
+ */
+typedef struct shelf_nameidx {
+    size_t count;
+    const char **names;
+    uint32_t *order;
+
+    size_t nbuckets;
+    uint32_t *gram_start;   /* nbuckets + 1 offsets into postings. */
+    uint32_t *postings;     /* Positions in names[] of a run of equal names. */
+} shelfnameidx_t;
+
+/* Functions for searching symbol names. */
+extern shelfnameidx_t *shelf_nameidx_load(shelfobj_t *desc, int table);
+extern void            shelf_nameidx_free(shelfobj_t *desc);
+extern size_t          shelf_nameidx_prefix(const shelfnameidx_t *idx, const char *prefix, size_t *first);
+extern size_t          shelf_nameidx_substr(const shelfnameidx_t *idx, const char *needle,
+                                            uint32_t *out, size_t max);
+
+#endif // SHELF_NAMEIDX_4E7B10
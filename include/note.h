@@ -0,0 +1,23 @@
+#ifndef SHELF_NOTE_0D4B7F
+#define SHELF_NOTE_0D4B7F
+
+#include "shelf.h"
+
+/*
+ * A single note, pointing into the buffer it was parsed from.
+ */
+typedef struct shelf_note {
+    uint32_t type;
+    const char *name;           /* Owner name, namesz bytes. */
+    uint32_t namesz;
+    const unsigned char *desc;  /* Descriptor, descsz bytes. */
+    uint32_t descsz;
+} shelfnote_t;
+
+/* Functions for walking a buffer of notes. */
+extern int shelf_note_next(const shelfobj_t *desc, const unsigned char *buf, size_t len,
+                           size_t align, size_t *offset, shelfnote_t *note);
+extern int shelf_note_find(const shelfobj_t *desc, const unsigned char *buf, size_t len,
+                           size_t align, const char *name, uint32_t type, shelfnote_t *note);
+
+#endif // SHELF_NOTE_0D4B7F
@@ -0,0 +1,39 @@
+#ifndef SHELF_PATCH_B7204E
+#define SHELF_PATCH_B7204E
+
+#include "shelf.h"
+
+/*
+ * In-place patching of descriptors opened with SHELF_OPEN_PATCH, whose
+ * file is mapped MAP_SHARED read-write. Writes land in the page cache and
+ * are visible to every reader of the file at once; the byte ranges they
+ * touched are tracked so shelf_patch_flush() only has to msync() those.
+ * Patches never change the size of the file.
+ */
+typedef struct shelf_range {
+    uint64_t offset;
+    uint64_t len;
+} shelfrange_t;
+
+typedef struct shelf_dirty {
+    shelfrange_t *ranges;   /* In write order, merged with their neighbours on flush. */
+    size_t count;
+    size_t cap;
+} shelfdirty_t;
+
+/* Flags for shelf_patch_flush(). */
+#define SHELF_FLUSH_SYNC  0         /* Wait for the data to reach the disk. */
+#define SHELF_FLUSH_ASYNC (1 << 0)  /* Only start writeback. */
+
+/* Functions for patching file bytes. */
+extern int   shelf_patch(shelfobj_t *desc, uint64_t offset, const void *buf, size_t len);
+extern int   shelf_patch_vaddr(shelfobj_t *desc, uint64_t vaddr, const void *buf, size_t len);
+extern void *shelf_patch_ptr(shelfobj_t *desc, uint64_t offset, size_t len);
+extern int   shelf_patch_mark(shelfobj_t *desc, uint64_t offset, uint64_t len);
+extern int   shelf_patch_headers(shelfobj_t *desc);
+
+/* Functions for writing patches back. */
+extern int   shelf_patch_flush(shelfobj_t *desc, int flags);
+extern void  shelf_patch_free(shelfobj_t *desc);
+
+#endif // SHELF_PATCH_B7204E
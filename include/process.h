@@ -0,0 +1,56 @@
+#ifndef SHELF_PROCESS_3F9E62
+#define SHELF_PROCESS_3F9E62
+
+#include <sys/types.h>
+
+#include "shelf.h"
+
+/* One line of /proc/<pid>/maps. */
+typedef struct shelf_map {
+    uint64_t start;
+    uint64_t end;
+    uint64_t offset;
+    uint32_t prot;              /* PF_R | PF_W | PF_X */
+    uint32_t dev_major;
+    uint32_t dev_minor;
+    uint64_t inode;
+    char *path;                 /* Empty for anonymous mappings. */
+} shelfmap_t;
+
+/* Reads of remote memory go through a small LRU cache of pages. */
+#define SHELF_PROC_PAGE        4096
+#define SHELF_PROC_CACHE_PAGES 256
+
+/*
+ * An attached process. Reads use process_vm_readv(), falling back to
+ * /proc/<pid>/mem where it is not permitted.
+ */
+typedef struct shelf_proc {
+    pid_t pid;
+    int memfd;                  /* /proc/<pid>/mem, opened on first fallback. */
+    int use_vm_readv;
+
+    unsigned char *pages;
+    uint64_t tag[SHELF_PROC_CACHE_PAGES];     /* Page address, plus one. */
+    uint64_t used[SHELF_PROC_CACHE_PAGES];
+    uint64_t clock;
+    uint64_t syscalls;
+} shelfproc_t;
+
+/* Functions for reading process mappings. */
+extern char *shelf_proc_maps_text(pid_t pid, size_t *len);
+extern int   shelf_proc_maps(pid_t pid, shelfmap_t **maps, size_t *count);
+extern int   shelf_proc_maps_parse(const char *text, size_t len, shelfmap_t **maps, size_t *count);
+extern void  shelf_proc_maps_free(shelfmap_t *maps, size_t count);
+
+/* Functions for reading process memory. */
+extern shelfproc_t *shelf_proc_attach(pid_t pid);
+extern void         shelf_proc_detach(shelfproc_t *proc);
+extern ssize_t      shelf_proc_read(shelfproc_t *proc, uint64_t addr, void *buf, size_t len);
+extern size_t       shelf_proc_prefetch(shelfproc_t *proc, const uint64_t *addrs, size_t count);
+extern void         shelf_proc_invalidate(shelfproc_t *proc);
+
+/* Functions for opening loaded images. */
+extern shelfobj_t *shelf_proc_open_image(shelfproc_t *proc, uint64_t base);
+
+#endif // SHELF_PROCESS_3F9E62
@@ -0,0 +1,54 @@
+#ifndef SHELF_RELOC_51B0C8
+#define SHELF_RELOC_51B0C8
+
+#include "shelf.h"
+
+/*
+ * A decoded SHT_REL or SHT_RELA section. Entries are stored column by column
+ * and sorted by relocation type (stable, so file order is kept within a type),
+ * which makes every type a contiguous run that can be applied in one loop.
+ *
+ * Entries of the group g are [group_start[g], group_start[g + 1]) and
+ * all have type group_type[g]. index[i] is entry i's position in the file.
+ */
+typedef struct shelf_reltab {
+    uint32_t section;       /* Index of the relocation section. */
+    uint32_t target;        /* Section the relocations apply to (sh_info). */
+    uint32_t symtab;        /* Associated symbol table (sh_link). */
+    char     rela;          /* Entries carry explicit addends. */
+    uint16_t machine;
+
+    size_t   count;
+    uint64_t *offset;
+    uint32_t *type;
+    uint32_t *sym;
+    int64_t  *addend;
+    uint32_t *index;
+
+    size_t   ngroups;
+    uint32_t *group_type;
+    size_t   *group_start;
+} shelfreltab_t;
+
+/* Functions for decoding relocation sections. */
+extern shelfreltab_t  *shelf_reltab_load(shelfobj_t *desc, shelfsect_t *sect);
+extern shelfreltab_t **shelf_reltab_load_all(shelfobj_t *desc, size_t *count);
+extern void            shelf_reltab_free(shelfreltab_t *tab);
+extern int             shelf_reltab_group(const shelfreltab_t *tab, uint32_t type,
+                                          size_t *start, size_t *count);
+
+/*
+ * Functions for applying relocations to a buffer holding the bytes at virtual
+ * address (or, for ET_REL, section offset) `buf_addr`. `base` is the load
+ * bias and `symvals` the resolved value of each of the `nsymvals` symbols
+ * in the associated symbol table; relocations naming a symbol past them
+ * are rejected. They return the number of relocations applied or -1.
+ */
+extern ssize_t shelf_reloc_apply_group(shelfobj_t *desc, const shelfreltab_t *tab, uint32_t type,
+                                       unsigned char *buf, uint64_t buf_addr, uint64_t buf_len,
+                                       uint64_t base, const uint64_t *symvals, size_t nsymvals);
+extern ssize_t shelf_reloc_apply_relative(shelfobj_t *desc, const shelfreltab_t *tab,
+                                          unsigned char *buf, uint64_t buf_addr, uint64_t buf_len,
+                                          uint64_t base);
+
+#endif // SHELF_RELOC_51B0C8
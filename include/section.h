@@ -16,15 +16,21 @@ extern shelfsect_t *get_section_list(shelfobj_t *desc);
 extern shelfsect_t *get_tail_section(shelfobj_t *desc);
 
 /* Functions for reading/writing section data. */
-extern void        *get_section_data(shelfobj_t *desc, Elf64_Shdr shdr); // TODO:
+extern const void *get_section_data(shelfobj_t *desc, shelfsect_t *sect);
+extern void        *get_section_data_rw(shelfobj_t *desc, shelfsect_t *sect);
+extern void        release_section_data(shelfsect_t *sect);
 extern int         *write_section_data(shelfobj_t *desc, Elf64_Addr addr); // TODO:
 extern int         *append_data_to_section(shelfobj_t *desc, void *data, size_t len); // TODO:
 
-/* Functions for adding and removing sections. */
-extern shelfsect_t *add_section(shelfobj_t *desc, Elf64_Addr addr); // TODO:
-extern int         *remove_section(shelfobj_t *desc, char *name); // TODO:
-extern int         *shift_section(shelfobj_t *desc, Elf64_Addr addr); // TODO:
-extern int         *swap_sections(shelfobj_t *desc, Elf64_Shdr *shdr_a, Elf64_Shdr *shdr_b); // TODO:
+/*
+ * Functions for adding and removing sections. Changes are recorded in the
+ * descriptor's layout and applied by shelf_write(), see layout.h.
+ */
+extern shelfsect_t *add_section(shelfobj_t *desc, const char *name, const shelf_Shdr *shdr,
+                                const void *data, size_t len);
+extern int         remove_section(shelfobj_t *desc, const char *name);
+extern int         shift_section(shelfobj_t *desc, shelfsect_t *sect, uint64_t pad);
+extern int         swap_sections(shelfobj_t *desc, shelfsect_t *sect_a, shelfsect_t *sect_b);
 
 /* Misc. */
 extern void        free_shelfsect(shelfsect_t *sect);
@@ -0,0 +1,78 @@
+#ifndef SHELF_SEGMENT_61C0A3
+#define SHELF_SEGMENT_61C0A3
+
+#include "shelf.h"
+
+/*
+ * Section to segment mapping, as in readelf's "Section to Segment mapping".
+ * Stored as two bit matrices: row s of sect_segs has bit p set when section
+ * s lies in segment p, and seg_sects is its transpose.
+ */
+typedef struct shelf_segmap {
+    size_t nsects;
+    size_t nsegs;
+    size_t sect_words;      /* Words per sect_segs row. */
+    size_t seg_words;       /* Words per seg_sects row. */
+    uint64_t *sect_segs;
+    uint64_t *seg_sects;
+} shelfsegmap_t;
+
+/*
+ * PT_LOAD entries sorted by address and by file offset, for translating
+ * between the two. Built on first use and cached on the descriptor.
+ */
+typedef struct shelf_loadseg {
+    uint64_t vaddr;
+    uint64_t offset;
+    uint64_t filesz;
+    uint64_t memsz;
+    uint32_t index;         /* Index in desc->pht. */
+} shelfloadseg_t;
+
+typedef struct shelf_loadidx {
+    size_t count;
+    shelfloadseg_t *by_vaddr;
+    shelfloadseg_t *by_offset;
+} shelfloadidx_t;
+
+/* Results of address translation. */
+#define SHELF_ADDR_UNMAPPED 0   /* Outside every PT_LOAD. */
+#define SHELF_ADDR_IN_FILE  1   /* Backed by file bytes. */
+#define SHELF_ADDR_IN_MEMSZ 2   /* In the zero-filled tail past p_filesz. */
+
+/* Functions for translating addresses. */
+extern shelfloadidx_t *shelf_loadidx_load(shelfobj_t *desc);
+extern void            shelf_loadidx_free(shelfobj_t *desc);
+extern const shelfloadseg_t *shelf_loadseg_find(shelfobj_t *desc, uint64_t vaddr);
+extern int             shelf_vaddr_to_offset(shelfobj_t *desc, uint64_t vaddr, uint64_t *offset);
+extern int             shelf_offset_to_vaddr(shelfobj_t *desc, uint64_t offset, uint64_t *vaddr);
+extern size_t          shelf_vaddr_to_offset_batch(shelfobj_t *desc, const uint64_t *vaddrs,
+                                                   uint64_t *offsets, uint8_t *status, size_t count);
+
+/* Functions for mapping sections to segments. */
+extern shelfsegmap_t *shelf_segmap_load(shelfobj_t *desc);
+extern void           shelf_segmap_free(shelfobj_t *desc);
+extern int            shelf_section_in_segment(const shelfobj_t *desc, const shelf_Shdr *shdr,
+                                               const Elf64_Phdr *phdr);
+
+/*
+ * Constant time queries on a loaded map. The row getters return bitsets of
+ * nsegs or nsects bits.
+ */
+static inline int shelf_segmap_contains(const shelfsegmap_t *map, size_t sect, size_t seg)
+{
+    return sect < map->nsects && seg < map->nsegs &&
+           (map->sect_segs[sect * map->sect_words + seg / 64] >> (seg % 64)) & 1;
+}
+
+static inline const uint64_t *shelf_segmap_segments_of(const shelfsegmap_t *map, size_t sect)
+{
+    return sect < map->nsects ? &map->sect_segs[sect * map->sect_words] : NULL;
+}
+
+static inline const uint64_t *shelf_segmap_sections_of(const shelfsegmap_t *map, size_t seg)
+{
+    return seg < map->nsegs ? &map->seg_sects[seg * map->seg_words] : NULL;
+}
+
+#endif // SHELF_SEGMENT_61C0A3
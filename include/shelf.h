@@ -219,6 +219,40 @@ typedef struct {
 
 typedef Elf64_Shdr shelf_Shdr;
 
+/*
+ * Sections with SHF_COMPRESSED set start with a compression header describing
+ * the uncompressed data that follows.
+ *
+ * ch_type: The compression algorithm, one of ELFCOMPRESS_*.
+ * ch_size: The size in bytes of the uncompressed data.
+ * ch_addralign: The required alignment of the uncompressed data.
+ */
+typedef struct {
+    uint32_t ch_type;
+    uint32_t ch_size;
+    uint32_t ch_addralign;
+} Elf32_Chdr;
+
+typedef struct {
+    uint32_t ch_type;
+    uint32_t ch_reserved;
+    uint64_t ch_size;
+    uint64_t ch_addralign;
+} Elf64_Chdr;
+
+/*
+ * Ownership of shelfsect_t.data. Section contents are normally borrowed views
+ * into the file mapping and data stays NULL; it is only set once a section
+ * needs its own pages.
+ *
+ * SECT_DATA_NONE:   No private copy, reads go straight to the mapping.
+ * SECT_DATA_MALLOC: Heap copy made on the first write access.
+ * SECT_DATA_ANON:   Anonymous zero-filled mapping backing an SHT_NOBITS section.
+ */
+#define SECT_DATA_NONE   0
+#define SECT_DATA_MALLOC 1
+#define SECT_DATA_ANON   2
+
 /*
  * Elf section descriptor.
  */
@@ -226,7 +260,10 @@ typedef struct shelf_sect {
     char *name;         /* Cached name. */
     shelf_Shdr *shdr;   /* Associated Elf64_Shdr for this section. */
     int index;          /* Index in sht. */
-    void *data;         /* Pointer to sections data cache. */
+    void *data;         /* Pointer to sections private data, if any. */
+    size_t data_len;    /* Size of the allocation behind data. */
+    char data_owner;    /* One of SECT_DATA_*. */
+    char verified;      /* Section contents lie inside the file. */
 } shelfsect_t;
 
 /*
@@ -252,6 +289,127 @@ typedef struct {
     uint64_t st_size;
 } Elf64_Sym;
 
+/*
+ * Relocation entries. Sections of type SHT_REL hold Elf*_Rel entries whose
+ * addend is stored at the location being relocated, SHT_RELA sections hold
+ * Elf*_Rela entries carrying an explicit addend.
+ *
+ * r_offset: The location to apply the relocation to. For relocatable files
+ *   this is an offset into the section named by the relocation section's
+ *   sh_info, for executables and shared objects it is a virtual address.
+ * r_info: The symbol table index and relocation type, see ELF*_R_SYM and
+ *   ELF*_R_TYPE.
+ * r_addend: A constant addend used to compute the value to be stored.
+ */
+typedef struct {
+    Elf32_Addr r_offset;
+    uint32_t   r_info;
+} Elf32_Rel;
+
+typedef struct {
+    Elf32_Addr r_offset;
+    uint32_t   r_info;
+    int32_t    r_addend;
+} Elf32_Rela;
+
+typedef struct {
+    Elf64_Addr r_offset;
+    uint64_t   r_info;
+} Elf64_Rel;
+
+typedef struct {
+    Elf64_Addr r_offset;
+    uint64_t   r_info;
+    int64_t    r_addend;
+} Elf64_Rela;
+
+/*
+ * Note sections and PT_NOTE segments hold a sequence of notes, each an Nhdr
+ * followed by the owner name and the descriptor, both padded to the note
+ * alignment (4, or 8 for some 64-bit notes).
+ *
+ * n_namesz: Length of the name including its terminator.
+ * n_descsz: Length of the descriptor.
+ * n_type: Note type, interpreted according to the owner name.
+ */
+typedef struct {
+    uint32_t n_namesz;
+    uint32_t n_descsz;
+    uint32_t n_type;
+} Elf32_Nhdr;
+
+typedef Elf32_Nhdr Elf64_Nhdr;
+
+/*
+ * Symbol versioning structures found in SHT_GNU_verdef and SHT_GNU_verneed
+ * sections. SHT_GNU_versym holds one Elf*_Versym per dynamic symbol giving
+ * the index of its version, with VERSYM_HIDDEN set for non-default versions.
+ *
+ * Verdef entries define versions provided by this object, each followed by
+ * vd_cnt Verdaux entries whose first names the version. Verneed entries name
+ * a needed file, each followed by vn_cnt Vernaux entries naming the versions
+ * needed from it and the index (vna_other) versym uses for them. All vd_aux,
+ * vd_next, vn_aux, vn_next, vda_next and vna_next members are byte offsets
+ * relative to the start of the current entry.
+ */
+typedef struct {
+    uint16_t vd_version;
+    uint16_t vd_flags;
+    uint16_t vd_ndx;
+    uint16_t vd_cnt;
+    uint32_t vd_hash;
+    uint32_t vd_aux;
+    uint32_t vd_next;
+} Elf64_Verdef;
+
+typedef struct {
+    uint32_t vda_name;
+    uint32_t vda_next;
+} Elf64_Verdaux;
+
+typedef struct {
+    uint16_t vn_version;
+    uint16_t vn_cnt;
+    uint32_t vn_file;
+    uint32_t vn_aux;
+    uint32_t vn_next;
+} Elf64_Verneed;
+
+typedef struct {
+    uint32_t vna_hash;
+    uint16_t vna_flags;
+    uint16_t vna_other;
+    uint32_t vna_name;
+    uint32_t vna_next;
+} Elf64_Vernaux;
+
+/* The layout is the same for both classes. */
+typedef Elf64_Verdef  Elf32_Verdef;
+typedef Elf64_Verdaux Elf32_Verdaux;
+typedef Elf64_Verneed Elf32_Verneed;
+typedef Elf64_Vernaux Elf32_Vernaux;
+
+/*
+ * The dynamic section (and the PT_DYNAMIC segment) holds an array of these,
+ * terminated by a DT_NULL entry. d_val/d_ptr is interpreted according to
+ * d_tag.
+ */
+typedef struct {
+    Elf32_Sword d_tag;
+    union {
+        Elf32_Word d_val;
+        Elf32_Addr d_ptr;
+    } d_un;
+} Elf32_Dyn;
+
+typedef struct {
+    Elf64_Sxword d_tag;
+    union {
+        Elf64_Xword d_val;
+        Elf64_Addr  d_ptr;
+    } d_un;
+} Elf64_Dyn;
+
 /*
  * Elf symbol table entry structure
  */
@@ -274,6 +432,9 @@ typedef struct s_elfobj {
     Elf64_Phdr  *pht;
     shelfsect_t *sect_list;
     shelfsym_t  *symtab;
+    size_t      symcount;
+    shelfsym_t  *dynsym;
+    size_t      dynsymcount;
 
     unsigned char *e_ident;
     char    *ei_magic;
@@ -283,6 +444,16 @@ typedef struct s_elfobj {
     uint8_t ei_osabi;
     uint8_t ei_abiversion;
 
+    /* Readers matching the file's data encoding. */
+    uint16_t (*read_word)(const unsigned char *src);
+    uint32_t (*read_dword)(const unsigned char *src);
+    uint64_t (*read_qword)(const unsigned char *src);
+
+    /* Writers matching the file's data encoding. */
+    void (*write_word)(unsigned char *dst, uint16_t v);
+    void (*write_dword)(unsigned char *dst, uint32_t v);
+    void (*write_qword)(unsigned char *dst, uint64_t v);
+
     int fd;
     char *filename;
     unsigned char *data;
@@ -290,7 +461,24 @@ typedef struct s_elfobj {
     int type;
     int writable;
     time_t load_time;
+    int flags;
     char hdr_corrupt;
+    char pht_verified;
+    char sht_verified;
+    char symtab_loaded;
+    uint8_t *sect_verified;
+    struct shelf_zcache *zcache;
+    struct shelf_dyn *dyn;
+    struct shelf_symver *symver;
+    struct shelf_symcols *symcols[2];
+    struct shelf_nameidx *nameidx[2];
+    struct shelf_segmap *segmap;
+    struct shelf_loadidx *loadidx;
+    struct shelf_core *core;    /* ET_CORE state, see core.h. */
+    struct shelf_dirty *dirty;  /* Patched ranges, see patch.h. */
+    struct shelf_journal *journal;  /* Open transaction, see journal.h. */
+    struct shelf_layout *layout;    /* Pending section changes, see layout.h. */
+    struct s_elfobj *debug;     /* Separate debug file, see shelf_open_debug(). */
     char read;
     char mmapped;
     char malloced;
@@ -301,6 +489,26 @@ typedef struct s_elfobj {
 
 
 
+/*
+ * Flags for shelf_open_flags().
+ *
+ * SHELF_OPEN_STRICT: Refuse to open files whose tables or sections reach
+ *   outside of the file instead of quarantining the bad regions.
+ * SHELF_OPEN_LAZY_SYMBOLS: Don't decode .symtab into desc->symtab at open
+ *   time. It is loaded on first use by the symbol lookups, or can be read
+ *   without materializing it through shelf_sym_stream_init().
+ * SHELF_OPEN_MAP_CORE: Map ET_CORE files like any other object. By default
+ *   cores are read with pread only and desc->data stays NULL; see core.h.
+ * SHELF_OPEN_PATCH: Open the file read-write and map it MAP_SHARED, so
+ *   edits go straight to the file; see patch.h. Fails on files we can't
+ *   write.
+ */
+#define SHELF_OPEN_DEFAULT       0
+#define SHELF_OPEN_STRICT        (1 << 0)
+#define SHELF_OPEN_LAZY_SYMBOLS  (1 << 1)
+#define SHELF_OPEN_MAP_CORE      (1 << 2)
+#define SHELF_OPEN_PATCH         (1 << 3)
+
 /*
  * Extern globals.
  */
@@ -310,9 +518,24 @@ extern char *shelf_error;
  * Functions for creating and managing struct Elf_Desc objects.
  */
 extern shelfobj_t *shelf_open(const char *path);
-// extern ssize_t Elf_Write(Elf_Desc *elf_desc, const char *path);
+extern shelfobj_t *shelf_open_flags(const char *path, int flags);
+extern ssize_t shelf_write(shelfobj_t *desc, const char *path);
 extern void shelf_close(shelfobj_t **desc);
 
+/*
+ * Decoders and encoders for raw header bytes in the descriptor's class and
+ * byte order. shelf_decode_ehdr() also picks the class, encoding, readers
+ * and writers.
+ */
+extern void shelf_decode_ehdr(shelfobj_t *desc, const unsigned char *src);
+extern void shelf_decode_phdr(const shelfobj_t *desc, const unsigned char *src, shelf_Phdr *phdr);
+extern void shelf_decode_shdr(const shelfobj_t *desc, const unsigned char *src, shelf_Shdr *shdr);
+extern size_t shelf_encode_ehdr(const shelfobj_t *desc, const shelf_Ehdr *hdr, unsigned char *dst);
+extern size_t shelf_encode_phdr(const shelfobj_t *desc, const shelf_Phdr *phdr, unsigned char *dst);
+extern size_t shelf_encode_shdr(const shelfobj_t *desc, const shelf_Shdr *shdr, unsigned char *dst);
+extern int  shelf_pread_full(int fd, void *buf, size_t len, uint64_t offset);
+extern int  shelf_pread_headers(shelfobj_t *desc);
+
 /*
  * Accessor functions for individual header fields
  */
@@ -367,11 +590,38 @@ extern const char *get_phdr_flags_str(unsigned int flags);
 extern const char *get_shdr_type_str(uint32_t type);
 extern const char *get_shdr_flags_str(unsigned int flags);
 
+/*
+ * Section data accessors. Every section is bounds checked once when the file
+ * is opened so the unchecked variant is safe for any section that passed
+ * verification and costs nothing on hot paths. SHT_NOBITS sections have no
+ * bytes in the file: the checked variant returns NULL for them, and
+ * get_section_data() gives them zero pages.
+ */
+static inline unsigned char *shelf_sect_ptr_unchecked(const shelfobj_t *desc, uint32_t index)
+{
+    return desc->data + desc->sht[index].sh_offset;
+}
+
+static inline unsigned char *shelf_sect_ptr(const shelfobj_t *desc, uint32_t index)
+{
+    if (index >= desc->hdr.e_shnum || !desc->sect_verified[index] ||
+        desc->sht[index].sh_type == SHT_NOBITS)
+        return NULL;
+
+    return shelf_sect_ptr_unchecked(desc, index);
+}
+
 uint16_t read_word_le(const unsigned char *src);
 uint16_t read_word_be(const unsigned char *src);
 uint32_t read_dword_le(const unsigned char *src);
 uint32_t read_dword_be(const unsigned char *src);
 uint64_t read_qword_le(const unsigned char *src);
 uint64_t read_qword_be(const unsigned char *src);
+void write_word_le(unsigned char *dst, uint16_t v);
+void write_word_be(unsigned char *dst, uint16_t v);
+void write_dword_le(unsigned char *dst, uint32_t v);
+void write_dword_be(unsigned char *dst, uint32_t v);
+void write_qword_le(unsigned char *dst, uint64_t v);
+void write_qword_be(unsigned char *dst, uint64_t v);
 
 #endif // SHELF_B8FA07
@@ -0,0 +1,29 @@
+#ifndef SHELF_COMPRESS_A4E017
+#define SHELF_COMPRESS_A4E017
+
+#include "shelf.h"
+
+/* Default upper bound on decompressed bytes cached per descriptor. */
+#define SHELF_ZCACHE_DEFAULT_LIMIT (64UL << 20)
+
+/*
+ * Compressed sections are either SHF_COMPRESSED with an Elf32/64_Chdr in front
+ * of the data, or old style .zdebug* sections starting with "ZLIB" and a big
+ * endian 64-bit size. Both kinds are inflated lazily into a per-descriptor
+ * LRU cache bounded by `limit` bytes the first time their data is requested.
+ * A .zdebug* section without the magic isn't compressed and is read as is.
+ *
+ * Pointers returned by shelf_section_decompressed() stay valid until the cache
+ * has to evict that section to make room for another one. Use
+ * get_section_data_rw() to get a copy that outlives the cache.
+ */
+extern int         shelf_section_is_compressed(shelfobj_t *desc, shelfsect_t *sect);
+extern int         shelf_section_sizes(shelfobj_t *desc, shelfsect_t *sect,
+                                       uint64_t *compressed, uint64_t *uncompressed);
+extern const void *shelf_section_decompressed(shelfobj_t *desc, shelfsect_t *sect);
+extern int         shelf_decompress_sections(shelfobj_t *desc, shelfsect_t **sects,
+                                             size_t count, int threads);
+extern void        shelf_zcache_set_limit(shelfobj_t *desc, size_t limit);
+extern void        shelf_zcache_free(shelfobj_t *desc);
+
+#endif // SHELF_COMPRESS_A4E017
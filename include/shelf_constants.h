@@ -273,6 +273,7 @@
 #define SHF_OS_NONCONFORMING (1 << 8)
 #define SHF_GROUP            (1 << 9)
 #define SHF_TLS              (1 << 10)
+#define SHF_COMPRESSED       (1 << 11)
 #define SHF_RELA_LIVEPATCH   (1 << 20)
 #define SHF_RO_AFTER_INIT    (1 << 21)
 #define SHF_MASKOS           0x0ff00000
@@ -280,6 +281,17 @@
 #define SHF_EXCLUDE          (1 << 27)
 #define SHF_MASKPROC         0xf0000000
 
+/*
+ * Compression algorithms found in the ch_type member of a compressed
+ * section's header (sections with SHF_COMPRESSED set).
+ */
+#define ELFCOMPRESS_ZLIB   1
+#define ELFCOMPRESS_ZSTD   2
+#define ELFCOMPRESS_LOOS   0x60000000
+#define ELFCOMPRESS_HIOS   0x6fffffff
+#define ELFCOMPRESS_LOPROC 0x70000000
+#define ELFCOMPRESS_HIPROC 0x7fffffff
+
 /*
  * Defined constants for st_info.
  */
@@ -324,5 +336,153 @@
 #define STV_HIDDEN    2
 #define STV_PROTECTED 3
 
+/*
+ * Dynamic array tags, d_tag. Tags below DT_NUM are the generic ones and are
+ * looked up by direct indexing, the rest are OS or processor specific.
+ */
+#define DT_NULL            0
+#define DT_NEEDED          1
+#define DT_PLTRELSZ        2
+#define DT_PLTGOT          3
+#define DT_HASH            4
+#define DT_STRTAB          5
+#define DT_SYMTAB          6
+#define DT_RELA            7
+#define DT_RELASZ          8
+#define DT_RELAENT         9
+#define DT_STRSZ           10
+#define DT_SYMENT          11
+#define DT_INIT            12
+#define DT_FINI            13
+#define DT_SONAME          14
+#define DT_RPATH           15
+#define DT_SYMBOLIC        16
+#define DT_REL             17
+#define DT_RELSZ           18
+#define DT_RELENT          19
+#define DT_PLTREL          20
+#define DT_DEBUG           21
+#define DT_TEXTREL         22
+#define DT_JMPREL          23
+#define DT_BIND_NOW        24
+#define DT_INIT_ARRAY      25
+#define DT_FINI_ARRAY      26
+#define DT_INIT_ARRAYSZ    27
+#define DT_FINI_ARRAYSZ    28
+#define DT_RUNPATH         29
+#define DT_FLAGS           30
+#define DT_ENCODING        32
+#define DT_PREINIT_ARRAY   32
+#define DT_PREINIT_ARRAYSZ 33
+#define DT_SYMTAB_SHNDX    34
+#define DT_NUM             35
+#define DT_LOOS            0x6000000d
+#define DT_HIOS            0x6ffff000
+#define DT_GNU_HASH        0x6ffffef5
+#define DT_VERSYM          0x6ffffff0
+#define DT_RELACOUNT       0x6ffffff9
+#define DT_RELCOUNT        0x6ffffffa
+#define DT_FLAGS_1         0x6ffffffb
+#define DT_VERDEF          0x6ffffffc
+#define DT_VERDEFNUM       0x6ffffffd
+#define DT_VERNEED         0x6ffffffe
+#define DT_VERNEEDNUM      0x6fffffff
+#define DT_LOPROC          0x70000000
+#define DT_HIPROC          0x7fffffff
+
+/*
+ * Flag values for DT_FLAGS and DT_FLAGS_1.
+ */
+#define DF_ORIGIN     0x1
+#define DF_SYMBOLIC   0x2
+#define DF_TEXTREL    0x4
+#define DF_BIND_NOW   0x8
+#define DF_STATIC_TLS 0x10
+
+#define DF_1_NOW      0x1
+#define DF_1_GLOBAL   0x2
+#define DF_1_GROUP    0x4
+#define DF_1_NODELETE 0x8
+#define DF_1_NOOPEN   0x40
+#define DF_1_ORIGIN   0x80
+#define DF_1_PIE      0x08000000
+
+/*
+ * Note types found in notes named "GNU".
+ */
+#define NT_GNU_ABI_TAG         1
+#define NT_GNU_HWCAP           2
+#define NT_GNU_BUILD_ID        3
+#define NT_GNU_GOLD_VERSION    4
+#define NT_GNU_PROPERTY_TYPE_0 5
+
+/*
+ * Note types found in core files, in notes named "CORE" or "LINUX".
+ */
+#define NT_PRSTATUS 1
+#define NT_PRFPREG  2
+#define NT_PRPSINFO 3
+#define NT_AUXV     6
+#define NT_SIGINFO  0x53494749
+#define NT_FILE     0x46494c45
+
+/*
+ * Special Elf*_Versym values.
+ */
+#define VER_NDX_LOCAL  0      /* Symbol is local. */
+#define VER_NDX_GLOBAL 1      /* Symbol is global and unversioned. */
+#define VERSYM_HIDDEN  0x8000 /* Symbol is not the default version. */
+#define VERSYM_VERSION 0x7fff /* Mask for the version index. */
+#define VER_FLG_BASE   0x1    /* Verdef naming the file itself. */
+
+/*
+ * Extract the symbol index and relocation type from an r_info value, or build
+ * one from them.
+ */
+#define ELF32_R_SYM(info)        ((info) >> 8)
+#define ELF32_R_TYPE(info)       ((unsigned char)(info))
+#define ELF32_R_INFO(sym, type)  (((sym) << 8) + (unsigned char)(type))
+#define ELF64_R_SYM(info)        ((info) >> 32)
+#define ELF64_R_TYPE(info)       ((info) & 0xffffffff)
+#define ELF64_R_INFO(sym, type)  ((((uint64_t)(sym)) << 32) + (type))
+
+/*
+ * x86-64 relocation types.
+ */
+#define R_X86_64_NONE      0  /* No reloc */
+#define R_X86_64_64        1  /* Direct 64 bit */
+#define R_X86_64_PC32      2  /* PC relative 32 bit signed */
+#define R_X86_64_GOT32     3  /* 32 bit GOT entry */
+#define R_X86_64_PLT32     4  /* 32 bit PLT address */
+#define R_X86_64_COPY      5  /* Copy symbol at runtime */
+#define R_X86_64_GLOB_DAT  6  /* Create GOT entry */
+#define R_X86_64_JUMP_SLOT 7  /* Create PLT entry */
+#define R_X86_64_RELATIVE  8  /* Adjust by program base */
+#define R_X86_64_GOTPCREL  9  /* 32 bit signed PC relative offset to GOT */
+#define R_X86_64_32        10 /* Direct 32 bit zero extended */
+#define R_X86_64_32S       11 /* Direct 32 bit sign extended */
+#define R_X86_64_16        12 /* Direct 16 bit zero extended */
+#define R_X86_64_PC16      13 /* 16 bit sign extended pc relative */
+#define R_X86_64_8         14 /* Direct 8 bit sign extended  */
+#define R_X86_64_PC8       15 /* 8 bit sign extended pc relative */
+#define R_X86_64_DTPMOD64  16 /* ID of module containing symbol */
+#define R_X86_64_DTPOFF64  17 /* Offset in module's TLS block */
+#define R_X86_64_TPOFF64   18 /* Offset in initial TLS block */
+#define R_X86_64_PC64      24 /* PC relative 64 bit */
+#define R_X86_64_IRELATIVE 37 /* Adjust indirectly by program base */
+
+/*
+ * i386 relocation types.
+ */
+#define R_386_NONE     0  /* No reloc */
+#define R_386_32       1  /* Direct 32 bit  */
+#define R_386_PC32     2  /* PC relative 32 bit */
+#define R_386_GOT32    3  /* 32 bit GOT entry */
+#define R_386_PLT32    4  /* 32 bit PLT address */
+#define R_386_COPY     5  /* Copy symbol at runtime */
+#define R_386_GLOB_DAT 6  /* Create GOT entry */
+#define R_386_JMP_SLOT 7  /* Create PLT entry */
+#define R_386_RELATIVE 8  /* Adjust by program base */
+
 
 #endif // SHELF_CONSTANTS_4E9D67
@@ -26,8 +26,8 @@ static char buffer[BUFFER_LENGTH];
 #define PROFILE_ALLOC (1 << 2)
 #define PROFILE_DEBUG (1 << 3)
 
-int profiler_depth; /* How deep are we in function trace depth? */
-int profiler_level; /* How verbose should the profiler be? */
+extern int profiler_depth; /* How deep are we in function trace depth? */
+extern int profiler_level; /* How verbose should the profiler be? */
 
 /* Believe it or not this sets the `profiler_level` variable. */
 extern void set_profiler_level(int level);
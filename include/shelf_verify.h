@@ -0,0 +1,16 @@
+#ifndef SHELF_VERIFY_3C91E2
+#define SHELF_VERIFY_3C91E2
+
+#include "shelf.h"
+
+/*
+ * Open time validation. Each pass checks a whole table against the file size
+ * in one go and records the result in the descriptor so the accessors can
+ * skip bounds checks afterwards. All of them return the number of bad regions
+ * found, zero meaning everything is in bounds.
+ */
+extern int shelf_verify_tables(shelfobj_t *desc);
+extern int shelf_verify_sections(shelfobj_t *desc);
+extern int shelf_verify_symbols(shelfobj_t *desc, uint64_t strtab_size);
+
+#endif // SHELF_VERIFY_3C91E2
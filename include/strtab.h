@@ -0,0 +1,62 @@
+#ifndef SHELF_STRTAB_3E9B52
+#define SHELF_STRTAB_3E9B52
+
+#include "shelf.h"
+
+/*
+ * A string table under construction, for .strtab, .dynstr and .shstrtab.
+ *
+ * Strings are interned in an open addressed hash, so adding one is an
+ * amortized O(1) probe and each distinct string is stored once; a string
+ * is named by the id shelf_strtab_add() returns. Offsets are assigned in a
+ * single pass by shelf_strtab_finalize(), which also tail merges: a string
+ * that ends another ("text" in ".rela.text") points into it instead of
+ * being stored, as linkers do.
+ *
+ * A builder may start from an existing table, whose bytes are kept as a
+ * prefix at their offsets so names already pointing into it stay valid;
+ * its strings are found by shelf_strtab_add() and can host new suffixes.
+ */
+typedef struct shelf_strent {
+    const char *str;
+    uint32_t len;
+    uint32_t hash;
+    uint32_t offset;    /* Valid once finalized. */
+} shelfstrent_t;
+
+typedef struct shelf_strtab {
+    const char *base;       /* The existing table, not owned. */
+    size_t base_len;
+    uint32_t nbase;         /* Entries [0, nbase) come from base. */
+
+    shelfstrent_t *strs;
+    size_t count;
+    size_t cap;
+
+    uint32_t *slots;        /* Entry index plus one; 0 marks an empty slot. */
+    size_t mask;
+
+    /* Storage for added strings, in chunks so they never move. */
+    char **chunks;
+    size_t nchunks;
+    size_t chunk_used;
+    size_t chunk_size;
+
+    char *data;             /* The laid out table, once finalized. */
+    size_t size;
+    char finalized;
+} shelfstrtab_t;
+
+/* Functions for building a table. */
+extern shelfstrtab_t *shelf_strtab_new(const char *base, size_t base_len);
+extern shelfstrtab_t *shelf_strtab_copy(const shelfstrtab_t *tab);
+extern uint32_t       shelf_strtab_add(shelfstrtab_t *tab, const char *str);
+extern int            shelf_strtab_finalize(shelfstrtab_t *tab);
+extern void           shelf_strtab_free(shelfstrtab_t *tab);
+
+/* Functions for reading a table. */
+extern const char *shelf_strtab_str(const shelfstrtab_t *tab, uint32_t id);
+extern uint32_t    shelf_strtab_offset(const shelfstrtab_t *tab, uint32_t id);
+extern int         shelf_strtab_hosts(const shelfstrtab_t *tab, const char *str);
+
+#endif // SHELF_STRTAB_3E9B52
@@ -11,12 +11,74 @@ void		*elfsh_get_symtab(shelfsect_t *desc, int *num);
 shelfsym_t	*elfsh_get_symbol_by_value(shelfsect_t *desc, Elf64_Addr vaddr, int *off, int mode);
 shelfsym_t	*elfsh_get_dynsymbol_by_value(shelfsect_t *desc, Elf64_Addr vaddr, int *off, int mode);
 int		    elfsh_strip(shelfsect_t *desc);
-int		    elfsh_set_symbol_name(shelfsect_t *desc, shelfsym_t *s, char *name);
 int		    elfsh_shift_symtab(shelfsect_t *desc, Elf64_Addr lim, int inc);
 int		    elfsh_insert_sectsym(shelfsect_t *desc, shelfsect_t *sect);
 int		    elfsh_get_symbol_foffset(shelfsect_t *desc, shelfsym_t *sym);
-int		    elfsh_insert_symbol(shelfsect_t *sect, shelfsym_t *sym, char *name);
-int		    elfsh_insert_funcsym(shelfsect_t *desc, char *name, Elf64_Addr vaddr, 
-                             uint32_t sz, uint32_t sctidx);
+
+/*
+ * Symbol versioning for the dynamic symbol table, built by shelf_load_symver().
+ *
+ * versym and verid are parallel to desc->dynsym. versym holds the raw
+ * Elf*_Versym value and verid the symbol's interned version name, an index
+ * into names where 0 is the empty name of unversioned symbols. Both verdef
+ * and verneed indexes resolve through index_name/index_file.
+ *
+ * table is an open addressed hash of (name, version) pairs so that a
+ * "name@VERSION" lookup is a single probe sequence. Only definitions are
+ * entered, default versions also under their bare name.
+ */
+typedef struct shelf_symver_slot {
+    uint32_t hash;
+    uint32_t sym;   /* Index into desc->dynsym, plus one; 0 marks an empty slot. */
+    uint32_t bare;  /* Entered under its bare name as the default version. */
+} shelfsymverslot_t;
+
+typedef struct shelf_symver {
+    uint16_t *versym;
+    uint32_t *verid;
+
+    const char **names;
+    size_t nnames;
+    size_t names_cap;
+    uint32_t *name_slots;       /* Hash of names: index plus one, 0 marks an empty slot. */
+    size_t name_mask;
+
+    uint32_t *index_name;
+    const char **index_file;    /* Needed file for verneed indexes, else NULL. */
+    size_t nindex;
+
+    shelfsymverslot_t *table;
+    size_t mask;
+} shelfsymver_t;
+
+/* Functions for decoding symbols. */
+extern void        shelf_decode_sym(const shelfobj_t *desc, const unsigned char *src, shelfsym_t *sym);
+extern void        shelf_encode_sym(const shelfobj_t *desc, const shelfsym_t *sym, unsigned char *dst);
+extern int         shelf_load_symtab(shelfobj_t *desc);
+extern shelfsym_t *shelf_load_dynsym(shelfobj_t *desc, size_t *count);
+extern const char *shelf_get_strtab(shelfobj_t *desc, uint32_t index, uint64_t *size);
+
+/*
+ * Lookups over the file's .symtab and .dynsym, then over the attached debug
+ * file's, if any (see shelf_open_debug()).
+ */
+extern shelfsym_t *shelf_get_symbol_by_name(shelfobj_t *desc, const char *name);
+extern shelfsym_t *shelf_get_symbol_by_addr(shelfobj_t *desc, Elf64_Addr addr, uint64_t *offset);
+
+/*
+ * Functions for editing symbol tables. Edits are pending until
+ * shelf_write(), which lays the tables and their string tables out once
+ * (see layout.h); names are interned with tail merging (see strtab.h).
+ */
+extern int elfsh_insert_symbol(shelfobj_t *desc, shelfsect_t *symtab, shelfsym_t *sym, char *name);
+extern int elfsh_set_symbol_name(shelfobj_t *desc, shelfsym_t *s, char *name);
+extern int elfsh_insert_funcsym(shelfobj_t *desc, char *name, Elf64_Addr vaddr,
+                               uint32_t sz, uint32_t sctidx);
+
+/* Functions for symbol versioning. */
+extern shelfsymver_t *shelf_load_symver(shelfobj_t *desc);
+extern void           shelf_symver_free(shelfobj_t *desc);
+extern const char    *shelf_get_symbol_version(shelfobj_t *desc, size_t index, int *hidden);
+extern shelfsym_t    *shelf_get_symbol_by_versioned_name(shelfobj_t *desc, const char *name);
 
 #endif // SHELF_SYMBOL_DDD0C4
@@ -0,0 +1,99 @@
+#ifndef SHELF_SYMBOLIZER_8C41D7
+#define SHELF_SYMBOLIZER_8C41D7
+
+#include <sys/types.h>
+
+#include "shelf.h"
+#include "debuginfo.h"
+#include "process.h"
+
+/*
+ * A function symbol in link time address order. Names point into the
+ * owning descriptor.
+ */
+typedef struct shelf_addrsym {
+    uint64_t addr;
+    uint64_t size;              /* 0 means "up to the next symbol". */
+    const char *name;
+} shelfaddrsym_t;
+
+/*
+ * One ELF file opened through the descriptor cache, keyed by the device
+ * and inode it was mapped from. Files with no inode ([vdso]) are keyed by
+ * path, mapping size and build-id instead. refs counts the symbolizers
+ * currently using it.
+ */
+typedef struct shelf_module {
+    uint32_t dev_major;
+    uint32_t dev_minor;
+    uint64_t inode;
+    char *path;
+    uint64_t size;              /* Of the mapping, for files with no inode. */
+    unsigned char build_id[SHELF_BUILD_ID_MAX];
+    size_t build_id_len;
+
+    shelfobj_t *desc;
+    shelfaddrsym_t *syms;
+    size_t nsyms;
+    size_t refs;
+} shelfmodule_t;
+
+/*
+ * Descriptors shared between symbolizers, so a library mapped by many
+ * processes is opened and indexed once.
+ */
+typedef struct shelf_desccache {
+    shelfmodule_t **table;      /* Open addressed, NULL when empty. */
+    size_t mask;
+    size_t count;
+    shelfdebugidx_t *debugidx;  /* Where to look for stripped symbols, may be NULL. */
+} shelfdesccache_t;
+
+/* An executable mapping of a module in one process. */
+typedef struct shelf_procmod {
+    uint64_t start;
+    uint64_t end;
+    uint64_t bias;              /* Run time address minus link time address. */
+    shelfmodule_t *mod;
+} shelfprocmod_t;
+
+typedef struct shelf_symbolizer {
+    pid_t pid;
+    shelfdesccache_t *cache;
+    char owns_cache;
+    shelfproc_t *proc;          /* For images that can't be opened from disk. */
+
+    shelfprocmod_t *mods;       /* Sorted by start. */
+    size_t nmods;
+    uint64_t maps_hash;         /* Of the maps text the table was built from. */
+    size_t hint;                /* Module of the last hit. */
+} shelfsymbolizer_t;
+
+/*
+ * Where a PC resolved to. symbol is NULL when the PC is inside a module
+ * but not inside a known function, in which case offset is from the start
+ * of the module's link time address space.
+ */
+typedef struct shelf_symloc {
+    const char *module;
+    const char *symbol;
+    uint64_t offset;
+    uint64_t addr;              /* Link time address of the PC. */
+} shelfsymloc_t;
+
+/* Functions for managing a descriptor cache. */
+extern shelfdesccache_t *shelf_desccache_new(shelfdebugidx_t *debugidx);
+extern size_t            shelf_desccache_prune(shelfdesccache_t *cache);
+extern void              shelf_desccache_free(shelfdesccache_t *cache);
+
+/* Functions for managing a symbolizer. */
+extern shelfsymbolizer_t *shelf_symbolizer_new(pid_t pid, shelfdesccache_t *cache);
+extern int                shelf_symbolizer_refresh(shelfsymbolizer_t *sym);
+extern void               shelf_symbolizer_free(shelfsymbolizer_t *sym);
+
+/* Functions for resolving PCs. */
+extern int    shelf_symbolize(shelfsymbolizer_t *sym, uint64_t pc, shelfsymloc_t *loc);
+extern size_t shelf_symbolize_batch(shelfsymbolizer_t *sym, const uint64_t *pcs, size_t count,
+                                    shelfsymloc_t *locs);
+
+#endif // SHELF_SYMBOLIZER_8C41D7
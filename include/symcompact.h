@@ -0,0 +1,40 @@
+#ifndef SHELF_SYMCOMPACT_B83F5A
+#define SHELF_SYMCOMPACT_B83F5A
+
+#include "shelf.h"
+
+/* Symbols per block; a lookup decodes at most one block. */
+#define SHELF_SYMBLOCK 64
+
+typedef struct shelf_symblock {
+    uint64_t addr;          /* Address of the block's first symbol. */
+    uint32_t offset;        /* Start of the block in data. */
+} shelfsymblock_t;
+
+/*
+ * Compact, address sorted copy of a symbol table's defined, named symbols.
+ * Each entry is stored as varints: zigzag address delta from the end of
+ * the previous entry, size, (shndx << 8 | st_other) and the name's string
+ * table offset, followed by the raw st_info byte. Names resolve against the
+ * descriptor's mapped string table, so the descriptor must outlive the
+ * table; its decoded symtab/dynsym arrays need not.
+ */
+typedef struct shelf_symcompact {
+    size_t count;
+    size_t nblocks;
+    shelfsymblock_t *blocks;
+    unsigned char *data;
+    size_t data_len;
+    const char *strtab;
+    uint64_t strsz;
+} shelfsymcompact_t;
+
+/* Functions for compact symbol tables. */
+extern shelfsymcompact_t *shelf_symcompact_build(shelfobj_t *desc, int table);
+extern void               shelf_symcompact_free(shelfsymcompact_t *comp);
+extern size_t             shelf_symcompact_memsize(const shelfsymcompact_t *comp);
+extern int                shelf_symcompact_get(const shelfsymcompact_t *comp, size_t index, shelfsym_t *sym);
+extern int                shelf_symcompact_lookup(const shelfsymcompact_t *comp, Elf64_Addr addr,
+                                                  shelfsym_t *sym, uint64_t *offset);
+
+#endif // SHELF_SYMCOMPACT_B83F5A
@@ -0,0 +1,50 @@
+#ifndef SHELF_SYMQUERY_92A4D1
+#define SHELF_SYMQUERY_92A4D1
+
+#include "shelf.h"
+
+/*
+ * Symbol table split into one array per field so predicates can run as
+ * straight loops over a single column. Built on first query and cached on
+ * the descriptor, one per table (SHELF_SYMTAB_STATIC/DYNAMIC).
+ */
+typedef struct shelf_symcols {
+    size_t count;
+    uint8_t *type;
+    uint8_t *bind;
+    uint8_t *vis;
+    uint16_t *shndx;
+    uint64_t *value;
+    uint64_t *size;
+    const char **name;
+} shelfsymcols_t;
+
+/*
+ * Conjunction of predicates. Masks are sets of (1 << STT_*), (1 << STB_*)
+ * and (1 << STV_*), 0 matching anything. Ranges are inclusive. Use
+ * shelf_symquery_init() to start from a query that matches every symbol.
+ */
+typedef struct shelf_symquery {
+    uint32_t type_mask;
+    uint32_t bind_mask;
+    uint32_t vis_mask;
+    uint32_t shndx;         /* SHELF_ITER_ANY for any section. */
+    uint64_t value_min;
+    uint64_t value_max;
+    uint64_t size_min;
+    uint64_t size_max;
+    const char *prefix;     /* Name prefix, or NULL. */
+} shelfsymquery_t;
+
+/* Number of 64-bit words in a result bitmap for `count` symbols. */
+#define SHELF_SYMQUERY_WORDS(count) (((count) + 63) / 64)
+
+/* Functions for querying symbols. */
+extern shelfsymcols_t *shelf_symcols_load(shelfobj_t *desc, int table);
+extern void            shelf_symcols_free(shelfobj_t *desc);
+extern void            shelf_symquery_init(shelfsymquery_t *query);
+extern ssize_t         shelf_symquery_bitmap(shelfobj_t *desc, int table, const shelfsymquery_t *query,
+                                             uint64_t *bits);
+extern size_t          shelf_symquery_indices(const uint64_t *bits, size_t count, uint32_t *out);
+
+#endif // SHELF_SYMQUERY_92A4D1
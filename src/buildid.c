@@ -0,0 +1,273 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "shelf.h"
+#include "shelf_profiler.h"
+#include "section.h"
+#include "buildid.h"
+#include "note.h"
+
+
+/* Note regions and debuglink sections larger than this are ignored. */
+#define NOTE_READ_MAX (1 << 20)
+
+static ssize_t copy_build_id(const shelfnote_t *note, unsigned char *buf)
+{
+    if (note->descsz == 0 || note->descsz > SHELF_BUILD_ID_MAX)
+        return -1;
+
+    memcpy(buf, note->desc, note->descsz);
+
+    return note->descsz;
+}
+
+/*
+ * pread() a region of notes and look for NT_GNU_BUILD_ID in it.
+ */
+static ssize_t read_note_region(shelfobj_t *desc, uint64_t offset, uint64_t size,
+                                uint64_t align, unsigned char *buf)
+{
+    unsigned char *notes;
+    shelfnote_t note;
+    ssize_t ret = -1;
+
+    if (size == 0 || size > NOTE_READ_MAX ||
+        offset > (uint64_t) desc->file_stat.st_size ||
+        size > (uint64_t) desc->file_stat.st_size - offset) {
+        return -1;
+    }
+
+    if ((notes = malloc(size)) == NULL)
+        return -1;
+
+    if (shelf_pread_full(desc->fd, notes, size, offset) == 0 &&
+        shelf_note_find(desc, notes, size, align, "GNU", NT_GNU_BUILD_ID, &note) == 0) {
+        ret = copy_build_id(&note, buf);
+    }
+
+    free(notes);
+
+    return ret;
+}
+
+/*
+ * pread() and decode the section header table, for the fallbacks that need
+ * sections.
+ */
+static int pread_sht(shelfobj_t *desc)
+{
+    unsigned char *raw;
+    size_t len;
+
+    if (!desc->sht_verified || desc->hdr.e_shnum == 0)
+        return -1;
+
+    len = (size_t) desc->hdr.e_shnum * desc->hdr.e_shentsize;
+    desc->sht = calloc(desc->hdr.e_shnum, sizeof(Elf64_Shdr));
+    raw = malloc(len);
+
+    if (desc->sht == NULL || raw == NULL || shelf_pread_full(desc->fd, raw, len, desc->hdr.e_shoff) != 0) {
+        free(raw);
+        return -1;
+    }
+
+    for (size_t i = 0; i < desc->hdr.e_shnum; i++)
+        shelf_decode_shdr(desc, raw + i * desc->hdr.e_shentsize, &desc->sht[i]);
+
+    free(raw);
+
+    return 0;
+}
+
+static int open_headers(shelfobj_t *desc, const char *path)
+{
+    memset(desc, 0, sizeof(*desc));
+
+    if ((desc->fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+        shelf_error = "Unable to open provided file";
+        return -1;
+    }
+
+    if (fstat(desc->fd, &desc->file_stat) != 0 || shelf_pread_headers(desc) != 0)
+        return -1;
+
+    return 0;
+}
+
+static void close_headers(shelfobj_t *desc)
+{
+    free(desc->pht);
+    free(desc->sht);
+
+    if (desc->fd > 0)
+        close(desc->fd);
+}
+
+/*
+ * Read the GNU build-id of the file at `path` into `buf`, which must hold
+ * SHELF_BUILD_ID_MAX bytes. Returns the build-id length or -1.
+ */
+ssize_t shelf_read_build_id(const char *path, unsigned char *buf)
+{
+    shelfobj_t desc;
+    ssize_t ret = -1;
+    int have_pt_note = 0;
+
+    PROFILER_IN();
+
+    if (path == NULL || buf == NULL)
+        PROFILER_RERR("Null argument passed to shelf_read_build_id()\n", -1);
+
+    if (open_headers(&desc, path) != 0) {
+        close_headers(&desc);
+        PROFILER_RERR(shelf_error, -1);
+    }
+
+    for (size_t i = 0; i < desc.hdr.e_phnum && ret < 0; i++) {
+        const shelf_Phdr *ph = &desc.pht[i];
+
+        if (ph->p_type == PT_NOTE) {
+            have_pt_note = 1;
+            ret = read_note_region(&desc, ph->p_offset, ph->p_filesz, ph->p_align, buf);
+        }
+    }
+
+    /* Relocatable objects and odd links only have note sections. */
+    if (!have_pt_note && pread_sht(&desc) == 0) {
+        for (size_t i = 0; i < desc.hdr.e_shnum && ret < 0; i++) {
+            const shelf_Shdr *sh = &desc.sht[i];
+
+            if (sh->sh_type == SHT_NOTE)
+                ret = read_note_region(&desc, sh->sh_offset, sh->sh_size, sh->sh_addralign, buf);
+        }
+    }
+
+    close_headers(&desc);
+
+    if (ret < 0)
+        PROFILER_RERR("No build-id note in file", -1);
+
+    PROFILER_ROUT(ret, "%zd");
+}
+
+/*
+ * Read the .gnu_debuglink section of the file at `path`: the debug file name
+ * into `name` (at most `len` bytes including the terminator) and its CRC32
+ * into `crc`. Returns the name length or -1.
+ */
+ssize_t shelf_read_debuglink(const char *path, char *name, size_t len, uint32_t *crc)
+{
+    shelfobj_t desc;
+    char *shstrtab = NULL;
+    unsigned char *link = NULL;
+    ssize_t ret = -1;
+
+    PROFILER_IN();
+
+    if (path == NULL || name == NULL || len == 0)
+        PROFILER_RERR("Bad argument passed to shelf_read_debuglink()\n", -1);
+
+    if (open_headers(&desc, path) != 0 || pread_sht(&desc) != 0)
+        goto out;
+
+    const shelf_Shdr *strsh = &desc.sht[desc.hdr.e_shstrndx];
+    uint64_t file_size = desc.file_stat.st_size;
+
+    if (strsh->sh_size == 0 || strsh->sh_size > NOTE_READ_MAX ||
+        strsh->sh_offset > file_size || strsh->sh_size > file_size - strsh->sh_offset ||
+        (shstrtab = malloc(strsh->sh_size)) == NULL ||
+        shelf_pread_full(desc.fd, shstrtab, strsh->sh_size, strsh->sh_offset) != 0) {
+        goto out;
+    }
+
+    shstrtab[strsh->sh_size - 1] = '\0';
+
+    for (size_t i = 0; i < desc.hdr.e_shnum; i++) {
+        const shelf_Shdr *sh = &desc.sht[i];
+
+        if (sh->sh_name >= strsh->sh_size || strcmp(shstrtab + sh->sh_name, ".gnu_debuglink"))
+            continue;
+
+        if (sh->sh_size < 8 || sh->sh_size > NOTE_READ_MAX ||
+            sh->sh_offset > file_size || sh->sh_size > file_size - sh->sh_offset ||
+            (link = malloc(sh->sh_size)) == NULL ||
+            shelf_pread_full(desc.fd, link, sh->sh_size, sh->sh_offset) != 0) {
+            break;
+        }
+
+        /* Name, NUL padded to 4 bytes, then the CRC. */
+        size_t name_len = strnlen((char *) link, sh->sh_size);
+        size_t crc_off = (name_len + 4) & ~(size_t) 3;
+
+        if (name_len == 0 || name_len >= len || crc_off + 4 > sh->sh_size)
+            break;
+
+        memcpy(name, link, name_len + 1);
+
+        if (crc)
+            *crc = desc.read_dword(link + crc_off);
+
+        ret = name_len;
+        break;
+    }
+
+out:
+    free(shstrtab);
+    free(link);
+    close_headers(&desc);
+
+    if (ret < 0)
+        PROFILER_RERR("No .gnu_debuglink in file", -1);
+
+    PROFILER_ROUT(ret, "%zd");
+}
+
+/*
+ * Same as shelf_read_build_id() for a descriptor that is already open.
+ */
+ssize_t shelf_get_build_id(shelfobj_t *desc, unsigned char *buf)
+{
+    uint64_t file_size;
+    shelfnote_t note;
+    int have_pt_note = 0;
+
+    PROFILER_IN();
+
+    if (desc == NULL || buf == NULL || desc->data == NULL)
+        PROFILER_RERR("Bad argument passed to shelf_get_build_id()\n", -1);
+
+    file_size = desc->file_stat.st_size;
+
+    for (size_t i = 0; i < desc->hdr.e_phnum; i++) {
+        const shelf_Phdr *ph = &desc->pht[i];
+
+        if (ph->p_type != PT_NOTE)
+            continue;
+
+        have_pt_note = 1;
+
+        if (ph->p_offset <= file_size && ph->p_filesz <= file_size - ph->p_offset &&
+            shelf_note_find(desc, desc->data + ph->p_offset, ph->p_filesz, ph->p_align,
+                            "GNU", NT_GNU_BUILD_ID, &note) == 0) {
+            PROFILER_ROUT(copy_build_id(&note, buf), "%zd");
+        }
+    }
+
+    for (size_t i = 0; !have_pt_note && i < desc->hdr.e_shnum; i++) {
+        const unsigned char *p;
+
+        if (desc->sht[i].sh_type == SHT_NOTE && (p = shelf_sect_ptr(desc, i)) != NULL &&
+            shelf_note_find(desc, p, desc->sht[i].sh_size, desc->sht[i].sh_addralign,
+                            "GNU", NT_GNU_BUILD_ID, &note) == 0) {
+            PROFILER_ROUT(copy_build_id(&note, buf), "%zd");
+        }
+    }
+
+    PROFILER_RERR("No build-id note in file", -1);
+}
@@ -0,0 +1,452 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "shelf.h"
+#include "shelf_profiler.h"
+#include "note.h"
+#include "segment.h"
+#include "core.h"
+
+
+/* Layout of struct elf_prstatus ahead of pr_reg. */
+#define PRSTATUS_CURSIG     12
+#define PRSTATUS_PID32      24
+#define PRSTATUS_PID64      32
+#define PRSTATUS_REG32      72
+#define PRSTATUS_REG64      112
+
+/* si_addr in siginfo_t for the fault signals. */
+#define SIGINFO_ADDR32      12
+#define SIGINFO_ADDR64      16
+
+static uint64_t read_long(const shelfobj_t *desc, const unsigned char *src)
+{
+    return desc->ei_class == ELFCLASS64 ? desc->read_qword(src) : desc->read_dword(src);
+}
+
+static int note_is(const shelfnote_t *note, const char *name)
+{
+    size_t len = strlen(name) + 1;
+
+    return note->namesz == len && !memcmp(note->name, name, len);
+}
+
+static void parse_prstatus(const shelfobj_t *desc, const shelfnote_t *note, shelfcorethread_t *thr)
+{
+    int is64 = desc->ei_class == ELFCLASS64;
+    size_t pid = is64 ? PRSTATUS_PID64 : PRSTATUS_PID32;
+    size_t reg = is64 ? PRSTATUS_REG64 : PRSTATUS_REG32;
+    size_t tail = is64 ? 8 : 4;     /* pr_fpvalid and padding */
+
+    memset(thr, 0, sizeof(*thr));
+
+    if (note->descsz < pid + 8)
+        return;
+
+    thr->signo = (int16_t) desc->read_word(note->desc + PRSTATUS_CURSIG);
+    thr->pid = desc->read_dword(note->desc + pid);
+    thr->ppid = desc->read_dword(note->desc + pid + 4);
+
+    if (note->descsz >= reg + tail) {
+        thr->regs = note->desc + reg;
+        thr->regs_len = note->descsz - reg - tail;
+    }
+}
+
+/*
+ * NT_FILE: count and page size, then count (start, end, page offset)
+ * triples, then count terminated path names.
+ */
+static size_t parse_file(const shelfobj_t *desc, const shelfnote_t *note, shelfcorefile_t *out,
+                         uint64_t *page_size)
+{
+    size_t word = desc->ei_class == ELFCLASS64 ? 8 : 4;
+    const unsigned char *p = note->desc;
+    const unsigned char *end = note->desc + note->descsz;
+
+    if (note->descsz < 2 * word)
+        return 0;
+
+    uint64_t count = read_long(desc, p);
+
+    *page_size = read_long(desc, p + word);
+
+    if (count > (note->descsz - 2 * word) / (3 * word))
+        return 0;
+
+    const char *names = (const char *) p + 2 * word + count * 3 * word;
+    size_t n = 0;
+
+    for (uint64_t i = 0; i < count; i++) {
+        const unsigned char *e = p + 2 * word + i * 3 * word;
+        const char *nul = memchr(names, '\0', (const char *) end - names);
+
+        if (nul == NULL)
+            break;
+
+        if (out != NULL) {
+            out[n].start = read_long(desc, e);
+            out[n].end = read_long(desc, e + word);
+            out[n].offset = read_long(desc, e + 2 * word) * *page_size;
+            out[n].path = names;
+        }
+        n++;
+        names = nul + 1;
+    }
+
+    return n;
+}
+
+static int cmp_file(const void *a, const void *b)
+{
+    const shelfcorefile_t *x = a, *y = b;
+
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+/*
+ * Read every PT_NOTE payload back to back into one buffer with pread. The
+ * memory segments are never touched.
+ */
+static int read_notes(shelfobj_t *desc, shelfcore_t *core)
+{
+    uint64_t file_size = desc->file_stat.st_size;
+    size_t total = 0;
+
+    for (size_t i = 0; i < desc->hdr.e_phnum; i++) {
+        const Elf64_Phdr *ph = &desc->pht[i];
+
+        if (ph->p_type != PT_NOTE)
+            continue;
+
+        if (ph->p_offset > file_size || ph->p_filesz > file_size - ph->p_offset) {
+            shelf_error = "Core note segment lies outside of the file";
+            return -1;
+        }
+
+        total += ph->p_filesz;
+    }
+
+    if ((core->notes = malloc(total ? total : 1)) == NULL) {
+        shelf_error = "Malloc for core notes failed";
+        return -1;
+    }
+
+    for (size_t i = 0; i < desc->hdr.e_phnum; i++) {
+        const Elf64_Phdr *ph = &desc->pht[i];
+
+        if (ph->p_type != PT_NOTE)
+            continue;
+
+        if (shelf_pread_full(desc->fd, core->notes + core->notes_len, ph->p_filesz, ph->p_offset) != 0) {
+            shelf_error = "Reading core notes failed";
+            return -1;
+        }
+
+        core->notes_len += ph->p_filesz;
+    }
+
+    return 0;
+}
+
+/*
+ * Walk the notes of every PT_NOTE region. The first pass (`fill` unset)
+ * only counts records so the second can fill exactly sized arrays.
+ */
+static void walk_notes(shelfobj_t *desc, shelfcore_t *core, int fill)
+{
+    size_t base = 0;
+
+    core->nall = core->nthreads = core->nfiles = core->nauxv = 0;
+
+    for (size_t i = 0; i < desc->hdr.e_phnum; i++) {
+        const Elf64_Phdr *ph = &desc->pht[i];
+        shelfnote_t note;
+        size_t off = 0;
+
+        if (ph->p_type != PT_NOTE)
+            continue;
+
+        while (shelf_note_next(desc, core->notes + base, ph->p_filesz, ph->p_align, &off, &note) == 0) {
+            if (fill)
+                core->all[core->nall] = note;
+            core->nall++;
+
+            if (note_is(&note, "CORE") && note.type == NT_PRSTATUS) {
+                if (fill)
+                    parse_prstatus(desc, &note, &core->threads[core->nthreads]);
+                core->nthreads++;
+            } else if (note_is(&note, "CORE") && note.type == NT_FILE) {
+                core->nfiles += parse_file(desc, &note, fill ? core->files + core->nfiles : NULL,
+                                           &core->page_size);
+            } else if (note_is(&note, "CORE") && note.type == NT_AUXV) {
+                size_t word = desc->ei_class == ELFCLASS64 ? 8 : 4;
+
+                for (size_t j = 0; j + 2 * word <= note.descsz; j += 2 * word) {
+                    if (fill) {
+                        core->auxv[core->nauxv].type = read_long(desc, note.desc + j);
+                        core->auxv[core->nauxv].val = read_long(desc, note.desc + j + word);
+                    }
+                    core->nauxv++;
+                }
+            } else if (note_is(&note, "CORE") && note.type == NT_SIGINFO && fill && note.descsz >= 12) {
+                size_t addr = desc->ei_class == ELFCLASS64 ? SIGINFO_ADDR64 : SIGINFO_ADDR32;
+
+                core->siginfo = note.desc;
+                core->siginfo_len = note.descsz;
+                core->si_signo = (int32_t) desc->read_dword(note.desc);
+                core->si_code = (int32_t) desc->read_dword(note.desc + 8);
+
+                if (note.descsz >= addr + (desc->ei_class == ELFCLASS64 ? 8 : 4))
+                    core->si_addr = read_long(desc, note.desc + addr);
+            }
+        }
+
+        base += ph->p_filesz;
+    }
+}
+
+/*
+ * Set up an ET_CORE descriptor whose fd is open: read the headers and the
+ * notes with pread, leaving desc->data unset. Called by shelf_open() so
+ * multi-gigabyte cores are never mapped. Core section headers are not
+ * loaded.
+ */
+int shelf_core_load(shelfobj_t *desc)
+{
+    shelfcore_t *core;
+
+    PROFILER_IN();
+
+    if (shelf_pread_headers(desc) != 0)
+        PROFILER_RERR(shelf_error, -1);
+
+    // Section headers of cores (gcore writes some) are ignored.
+    desc->hdr.e_shnum = 0;
+    desc->hdr.e_shstrndx = 0;
+    desc->sht = calloc(1, sizeof(Elf64_Shdr));
+
+    if ((core = calloc(1, sizeof(shelfcore_t))) == NULL || desc->sht == NULL) {
+        free(core);
+        PROFILER_RERR("Malloc for core state failed", -1);
+    }
+
+    desc->core = core;
+
+    if (read_notes(desc, core) != 0)
+        PROFILER_RERR(shelf_error, -1);
+
+    walk_notes(desc, core, 0);
+
+    core->all = malloc((core->nall + 1) * sizeof(shelfnote_t));
+    core->threads = malloc((core->nthreads + 1) * sizeof(shelfcorethread_t));
+    core->files = malloc((core->nfiles + 1) * sizeof(shelfcorefile_t));
+    core->auxv = malloc((core->nauxv + 1) * sizeof(shelfcoreauxv_t));
+
+    if (!core->all || !core->threads || !core->files || !core->auxv)
+        PROFILER_RERR("Malloc for core records failed", -1);
+
+    walk_notes(desc, core, 1);
+    qsort(core->files, core->nfiles, sizeof(shelfcorefile_t), cmp_file);
+
+    PROFILER_ROUT(0, "%d");
+}
+
+void shelf_core_free(shelfobj_t *desc)
+{
+    shelfcore_t *core;
+
+    if (desc == NULL || (core = desc->core) == NULL)
+        return;
+
+    free(core->notes);
+    free(core->all);
+    free(core->threads);
+    free(core->files);
+    free(core->auxv);
+
+    if (core->cache != NULL) {
+        free(core->cache->pages);
+        free(core->cache);
+    }
+
+    free(core);
+    desc->core = NULL;
+}
+
+/*
+ * The NT_FILE mapping containing `vaddr`, or NULL.
+ */
+const shelfcorefile_t *shelf_core_file_at(const shelfobj_t *desc, uint64_t vaddr)
+{
+    const shelfcore_t *core;
+    size_t lo = 0, hi;
+
+    if (desc == NULL || (core = desc->core) == NULL)
+        return NULL;
+
+    hi = core->nfiles;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (core->files[mid].start <= vaddr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == 0 || vaddr >= core->files[lo - 1].end)
+        return NULL;
+
+    return &core->files[lo - 1];
+}
+
+int shelf_core_auxv_get(const shelfobj_t *desc, uint64_t type, uint64_t *val)
+{
+    if (desc == NULL || desc->core == NULL)
+        return -1;
+
+    for (size_t i = 0; i < desc->core->nauxv; i++) {
+        if (desc->core->auxv[i].type == type) {
+            *val = desc->core->auxv[i].val;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Copy `len` file bytes at `offset` through the page cache. Requests of
+ * more than a quarter of the cache bypass it so one big read doesn't evict
+ * everything the unwinder is working on.
+ */
+static int cached_pread(shelfobj_t *desc, unsigned char *dst, size_t len, uint64_t offset)
+{
+    shelfcore_t *core = desc->core;
+    shelfcorecache_t *c = core->cache;
+
+    if (len > SHELF_CORE_CACHE_PAGES / 4 * SHELF_CORE_PAGE)
+        return shelf_pread_full(desc->fd, dst, len, offset);
+
+    if (c == NULL) {
+        if ((c = calloc(1, sizeof(shelfcorecache_t))) == NULL ||
+            (c->pages = malloc(SHELF_CORE_CACHE_PAGES * SHELF_CORE_PAGE)) == NULL) {
+            free(c);
+            return shelf_pread_full(desc->fd, dst, len, offset);
+        }
+        core->cache = c;
+    }
+
+    while (len > 0) {
+        uint64_t page = offset / SHELF_CORE_PAGE;
+        size_t in_page = offset % SHELF_CORE_PAGE;
+        size_t n = SHELF_CORE_PAGE - in_page < len ? SHELF_CORE_PAGE - in_page : len;
+        size_t slot = 0, victim = 0;
+        int hit = 0;
+
+        for (size_t i = 0; i < SHELF_CORE_CACHE_PAGES; i++) {
+            if (c->tag[i] == page + 1) {
+                slot = i;
+                hit = 1;
+                break;
+            }
+            if (c->used[i] < c->used[victim])
+                victim = i;
+        }
+
+        if (!hit) {
+            uint64_t start = page * SHELF_CORE_PAGE;
+            uint64_t avail = (uint64_t) desc->file_stat.st_size - start;
+            size_t want = avail < SHELF_CORE_PAGE ? avail : SHELF_CORE_PAGE;
+
+            slot = victim;
+            c->tag[slot] = 0;
+
+            if (start >= (uint64_t) desc->file_stat.st_size ||
+                shelf_pread_full(desc->fd, c->pages + slot * SHELF_CORE_PAGE, want, start) != 0) {
+                return -1;
+            }
+
+            c->tag[slot] = page + 1;
+            c->len[slot] = want;
+            c->misses++;
+        } else {
+            c->hits++;
+        }
+
+        if (in_page + n > c->len[slot])
+            return -1;
+
+        memcpy(dst, c->pages + slot * SHELF_CORE_PAGE + in_page, n);
+        c->used[slot] = ++c->clock;
+
+        dst += n;
+        offset += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/*
+ * Read process memory from a core by virtual address. Segments are found
+ * by binary search over PT_LOAD, file bytes come through the page cache
+ * and the part of a segment past p_filesz reads as zeroes. Returns the
+ * number of bytes read, which is short if the range runs into unmapped
+ * memory, or -1 if `vaddr` itself is unmapped or the file can't be read.
+ */
+ssize_t shelf_core_read(shelfobj_t *desc, uint64_t vaddr, void *buf, size_t len)
+{
+    unsigned char *dst = buf;
+    size_t done = 0;
+
+    PROFILER_IN();
+
+    if (desc == NULL || buf == NULL)
+        PROFILER_RERR("Null argument passed to shelf_core_read()\n", -1);
+
+    if (desc->core == NULL && desc->data == NULL)
+        PROFILER_RERR("Descriptor has no core state\n", -1);
+
+    while (done < len) {
+        uint64_t addr = vaddr + done;
+        const shelfloadseg_t *seg = shelf_loadseg_find(desc, addr);
+
+        if (seg == NULL)
+            break;
+
+        uint64_t rel = addr - seg->vaddr;
+        size_t n = seg->memsz - rel < len - done ? seg->memsz - rel : len - done;
+
+        if (rel < seg->filesz) {
+            size_t in_file = seg->filesz - rel < n ? seg->filesz - rel : n;
+            uint64_t offset = seg->offset + rel;
+
+            if (desc->data != NULL) {
+                if (offset > (uint64_t) desc->file_stat.st_size ||
+                    in_file > (uint64_t) desc->file_stat.st_size - offset)
+                    break;
+                memcpy(dst + done, desc->data + offset, in_file);
+            } else if (cached_pread(desc, dst + done, in_file, offset) != 0) {
+                break;
+            }
+
+            n = in_file;
+        } else {
+            memset(dst + done, 0, n);
+        }
+
+        done += n;
+    }
+
+    if (done == 0 && len > 0)
+        PROFILER_RERR("Address is not mapped in the core", -1);
+
+    PROFILER_ROUT((ssize_t) done, "%zd");
+}
@@ -0,0 +1,314 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "shelf.h"
+#include "shelf_profiler.h"
+#include "core.h"
+
+
+#define PAGE        SHELF_CORE_PAGE
+#define COPY_CHUNK  (1 << 20)
+
+static uint64_t align_up(uint64_t v, uint64_t align)
+{
+    return (v + align - 1) & ~(align - 1);
+}
+
+static int read_in(shelfobj_t *desc, void *buf, size_t len, uint64_t offset)
+{
+    if (desc->data != NULL) {
+        if (offset > (uint64_t) desc->file_stat.st_size || len > desc->file_stat.st_size - offset)
+            return -1;
+        memcpy(buf, desc->data + offset, len);
+        return 0;
+    }
+
+    return shelf_pread_full(desc->fd, buf, len, offset);
+}
+
+static int write_full(int fd, const void *buf, size_t len, uint64_t offset)
+{
+    const unsigned char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, offset);
+
+        if (n <= 0)
+            return -1;
+
+        p += n;
+        len -= n;
+        offset += n;
+    }
+
+    return 0;
+}
+
+static int page_is_zero(const unsigned char *p, size_t len)
+{
+    uint64_t acc = 0;
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        acc |= w;
+    }
+
+    for (; i < len; i++)
+        acc |= p[i];
+
+    return acc == 0;
+}
+
+/*
+ * A read-only mapping of a file named in NT_FILE can be restored from the
+ * file, like the kernel's coredump_filter does for file-backed private
+ * mappings, but only when its dumped bytes still match the file: RELRO
+ * and other mprotect()ed copy-on-write pages were written to before they
+ * became read-only. Stacks, heap and every writable or anonymous mapping
+ * are kept, and so is anything whose file can't be read.
+ */
+static int droppable(shelfobj_t *desc, const Elf64_Phdr *ph, uint64_t filesz, unsigned char *buf)
+{
+    const shelfcorefile_t *f;
+    uint64_t in_off = ph->p_offset, file_off;
+    size_t half = COPY_CHUNK / 2;
+    int fd, same = 1;
+
+    if ((ph->p_flags & PF_W) || (f = shelf_core_file_at(desc, ph->p_vaddr)) == NULL)
+        return 0;
+
+    if (filesz > f->end - ph->p_vaddr || (fd = open(f->path, O_RDONLY | O_CLOEXEC)) < 0)
+        return 0;
+
+    file_off = f->offset + (ph->p_vaddr - f->start);
+
+    while (same && filesz > 0) {
+        size_t n = filesz < half ? filesz : half;
+
+        same = read_in(desc, buf, n, in_off) == 0 &&
+               shelf_pread_full(fd, buf + half, n, file_off) == 0 &&
+               memcmp(buf, buf + half, n) == 0;
+
+        in_off += n;
+        file_off += n;
+        filesz -= n;
+    }
+
+    close(fd);
+
+    return same;
+}
+
+/*
+ * Copy `len` bytes from `in_off` to `out_off`, leaving all-zero pages as
+ * holes when `sparse` is set. Both offsets are page aligned for PT_LOAD data.
+ */
+static int copy_range(shelfobj_t *desc, int fd, unsigned char *buf, uint64_t in_off,
+                      uint64_t out_off, uint64_t len, int sparse, shelfcoreminstats_t *st)
+{
+    while (len > 0) {
+        size_t n = len < COPY_CHUNK ? len : COPY_CHUNK;
+
+        if (read_in(desc, buf, n, in_off) != 0)
+            return -1;
+
+        for (size_t p = 0; p < n; p += PAGE) {
+            size_t m = n - p < PAGE ? n - p : PAGE;
+
+            if (sparse && page_is_zero(buf + p, m)) {
+                st->zero_pages++;
+                continue;
+            }
+
+            if (write_full(fd, buf + p, m, out_off + p) != 0)
+                return -1;
+
+            st->written += m;
+        }
+
+        in_off += n;
+        out_off += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/*
+ * Write a smaller copy of the core in `desc` to `path`. Notes and every
+ * writable or anonymous segment are kept; read-only file-backed segments
+ * whose bytes match the mapped file, as found on this host, keep only
+ * their first page when it holds an ELF header (so build-ids survive, as
+ * with the kernel's own filter) and have p_filesz cut otherwise. All-zero
+ * pages of PT_LOAD data are written as holes unless SHELF_COREMIN_DENSE is
+ * given. The result is a valid ET_CORE that libshelf and gdb open as usual;
+ * section headers are not carried over.
+ */
+int shelf_core_minimize(shelfobj_t *desc, const char *path, int flags, shelfcoreminstats_t *stats)
+{
+    shelfcoreminstats_t st = {0};
+    shelf_Ehdr hdr;
+    Elf64_Phdr *out = NULL;
+    unsigned char *buf = NULL, *hdrbuf = NULL;
+    uint64_t offset, file_size;
+    int fd = -1;
+
+    PROFILER_IN();
+
+    if (desc == NULL || path == NULL)
+        PROFILER_RERR("Null argument passed to shelf_core_minimize()\n", -1);
+
+    if (desc->hdr.e_type != ET_CORE || desc->pht == NULL)
+        PROFILER_RERR("Descriptor is not a core file\n", -1);
+
+    file_size = desc->file_stat.st_size;
+    st.in_size = file_size;
+
+    out = malloc((desc->hdr.e_phnum ? desc->hdr.e_phnum : 1) * sizeof(Elf64_Phdr));
+    buf = malloc(COPY_CHUNK);
+
+    if (out == NULL || buf == NULL) {
+        shelf_error = "Malloc for core minimizer failed";
+        goto error;
+    }
+
+    /*
+     * Lay out the new file: headers, then non-load data such as notes, then
+     * page aligned PT_LOAD contents.
+     */
+    size_t ehsize = desc->ei_class == ELFCLASS64 ? sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr);
+    size_t phentsize = desc->ei_class == ELFCLASS64 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
+
+    offset = ehsize + (uint64_t) desc->hdr.e_phnum * phentsize;
+
+    for (int load = 0; load < 2; load++) {
+        for (size_t i = 0; i < desc->hdr.e_phnum; i++) {
+            const Elf64_Phdr *ph = &desc->pht[i];
+            uint64_t filesz = ph->p_filesz;
+
+            if ((ph->p_type == PT_LOAD) != load)
+                continue;
+
+            out[i] = *ph;
+
+            // Clamp segments of truncated cores to what the input holds.
+            if (ph->p_offset > file_size)
+                filesz = 0;
+            else if (filesz > file_size - ph->p_offset)
+                filesz = file_size - ph->p_offset;
+
+            if (load) {
+                if (filesz != 0 && droppable(desc, ph, filesz, buf)) {
+                    unsigned char magic[4] = {0};
+
+                    if (!(flags & SHELF_COREMIN_NO_ELF_HEADS) && filesz >= PAGE &&
+                        read_in(desc, magic, 4, ph->p_offset) == 0 && magic[EI_MAG0] == ELFMAG0 &&
+                        magic[EI_MAG1] == ELFMAG1 && magic[EI_MAG2] == ELFMAG2 &&
+                        magic[EI_MAG3] == ELFMAG3) {
+                        filesz = PAGE;
+                    } else {
+                        filesz = 0;
+                    }
+
+                    st.dropped++;
+                }
+
+                offset = align_up(offset, PAGE);
+            } else {
+                uint64_t align = ph->p_align;
+
+                offset = align_up(offset, align && !(align & (align - 1)) && align <= PAGE ? align : 4);
+            }
+
+            out[i].p_offset = offset;
+            out[i].p_filesz = filesz;
+            offset += filesz;
+        }
+    }
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0) {
+        shelf_error = "Unable to create output file";
+        goto error;
+    }
+
+    // Size first so trailing zero pages become a hole too.
+    if (ftruncate(fd, offset) != 0) {
+        shelf_error = "Unable to size output file";
+        goto error;
+    }
+
+    st.out_size = offset;
+
+    hdr = desc->hdr;
+    hdr.e_phoff = ehsize;
+    hdr.e_ehsize = ehsize;
+    hdr.e_phentsize = phentsize;
+    hdr.e_shoff = 0;
+    hdr.e_shnum = 0;
+    hdr.e_shentsize = 0;
+    hdr.e_shstrndx = 0;
+
+    if ((hdrbuf = malloc(ehsize + (size_t) desc->hdr.e_phnum * phentsize)) == NULL) {
+        shelf_error = "Malloc for core minimizer failed";
+        goto error;
+    }
+
+    size_t hdr_len = shelf_encode_ehdr(desc, &hdr, hdrbuf);
+
+    for (size_t i = 0; i < desc->hdr.e_phnum; i++)
+        hdr_len += shelf_encode_phdr(desc, &out[i], hdrbuf + hdr_len);
+
+    if (write_full(fd, hdrbuf, hdr_len, 0) != 0) {
+        shelf_error = "Writing core headers failed";
+        goto error;
+    }
+
+    st.written += hdr_len;
+
+    for (size_t i = 0; i < desc->hdr.e_phnum; i++) {
+        const Elf64_Phdr *ph = &desc->pht[i];
+
+        if (out[i].p_filesz == 0)
+            continue;
+
+        if (copy_range(desc, fd, buf, ph->p_offset, out[i].p_offset, out[i].p_filesz,
+                       ph->p_type == PT_LOAD && !(flags & SHELF_COREMIN_DENSE), &st) != 0) {
+            shelf_error = "Copying core data failed";
+            goto error;
+        }
+    }
+
+    if (close(fd) != 0) {
+        fd = -1;
+        shelf_error = "Writing core failed";
+        goto error;
+    }
+
+    free(out);
+    free(buf);
+    free(hdrbuf);
+
+    if (stats != NULL)
+        *stats = st;
+
+    PROFILER_ROUT(0, "%d");
+
+error:
+    if (fd >= 0) {
+        close(fd);
+        unlink(path);
+    }
+
+    free(out);
+    free(buf);
+    free(hdrbuf);
+
+    PROFILER_RERR(shelf_error, -1);
+}
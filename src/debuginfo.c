@@ -0,0 +1,550 @@
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "shelf.h"
+#include "shelf_profiler.h"
+#include "debuginfo.h"
+
+
+#define DEBUGIDX_MAGIC "shelf-debugidx 2\n"
+
+static void hex_id(const unsigned char *id, size_t len, char *out)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    for (size_t i = 0; i < len; i++) {
+        out[i * 2] = digits[id[i] >> 4];
+        out[i * 2 + 1] = digits[id[i] & 0xf];
+    }
+
+    out[len * 2] = '\0';
+}
+
+static uint32_t hash_str(const char *s)
+{
+    uint32_t h = 2166136261u;
+
+    while (*s) {
+        h ^= (unsigned char) *s++;
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+static int table_grow(shelfdebugidx_t *idx)
+{
+    size_t cap = idx->mask ? (idx->mask + 1) * 2 : 256;
+    shelfdebugidxent_t *table = calloc(cap, sizeof(shelfdebugidxent_t));
+
+    if (table == NULL)
+        return -1;
+
+    for (size_t i = 0; idx->mask && i <= idx->mask; i++) {
+        if (idx->table[i].build_id == NULL)
+            continue;
+
+        size_t j = hash_str(idx->table[i].build_id) & (cap - 1);
+
+        while (table[j].build_id != NULL)
+            j = (j + 1) & (cap - 1);
+
+        table[j] = idx->table[i];
+    }
+
+    free(idx->table);
+    idx->table = table;
+    idx->mask = cap - 1;
+
+    return 0;
+}
+
+/*
+ * Add a build-id to path mapping. The first path seen for a build-id wins.
+ */
+static int table_insert(shelfdebugidx_t *idx, const char *build_id, const char *path)
+{
+    if ((idx->count + 1) * 2 > idx->mask + 1 && table_grow(idx) != 0)
+        return -1;
+
+    size_t i = hash_str(build_id) & idx->mask;
+
+    while (idx->table[i].build_id != NULL) {
+        if (!strcmp(idx->table[i].build_id, build_id))
+            return 0;
+        i = (i + 1) & idx->mask;
+    }
+
+    idx->table[i].build_id = strdup(build_id);
+    idx->table[i].path = strdup(path);
+
+    if (idx->table[i].build_id == NULL || idx->table[i].path == NULL) {
+        free(idx->table[i].build_id);
+        free(idx->table[i].path);
+        idx->table[i].build_id = NULL;
+        return -1;
+    }
+
+    idx->count++;
+
+    return 0;
+}
+
+static const char *table_lookup(const shelfdebugidx_t *idx, const char *build_id)
+{
+    if (idx->table == NULL)
+        return NULL;
+
+    for (size_t i = hash_str(build_id) & idx->mask; idx->table[i].build_id; i = (i + 1) & idx->mask) {
+        if (!strcmp(idx->table[i].build_id, build_id))
+            return idx->table[i].path;
+    }
+
+    return NULL;
+}
+
+static void table_clear(shelfdebugidx_t *idx)
+{
+    for (size_t i = 0; idx->table && i <= idx->mask; i++) {
+        free(idx->table[i].build_id);
+        free(idx->table[i].path);
+    }
+
+    free(idx->table);
+    idx->table = NULL;
+    idx->mask = 0;
+    idx->count = 0;
+}
+
+shelfdebugidx_t *shelf_debugidx_new(const char *cache_path)
+{
+    shelfdebugidx_t *idx;
+
+    PROFILER_IN();
+
+    if ((idx = calloc(1, sizeof(shelfdebugidx_t))) == NULL)
+        PROFILER_RERR("Malloc for debug index failed\n", NULL);
+
+    if (cache_path != NULL && (idx->cache_path = strdup(cache_path)) == NULL) {
+        free(idx);
+        PROFILER_RERR("Malloc for debug index failed\n", NULL);
+    }
+
+    PROFILER_ROUT(idx, "shelfdebugidx_t *: %p");
+}
+
+int shelf_debugidx_add_root(shelfdebugidx_t *idx, const char *root)
+{
+    char **roots;
+
+    if (idx == NULL || root == NULL)
+        return -1;
+
+    if ((roots = realloc(idx->roots, (idx->nroots + 1) * sizeof(char *))) == NULL)
+        return -1;
+
+    idx->roots = roots;
+
+    if ((idx->roots[idx->nroots] = strdup(root)) == NULL)
+        return -1;
+
+    idx->nroots++;
+
+    return 0;
+}
+
+void shelf_debugidx_free(shelfdebugidx_t *idx)
+{
+    if (idx == NULL)
+        return;
+
+    table_clear(idx);
+
+    for (size_t i = 0; i < idx->nroots; i++)
+        free(idx->roots[i]);
+
+    free(idx->roots);
+    free(idx->cache_path);
+    free(idx);
+}
+
+/*
+ * Recursively index every ELF file with a build-id below `dir`. Symlinks are
+ * not followed so the .build-id link farm doesn't index everything twice.
+ */
+static void scan_dir(shelfdebugidx_t *idx, const char *dir, int depth)
+{
+    char path[PATH_MAX];
+    unsigned char id[SHELF_BUILD_ID_MAX];
+    char hex[SHELF_BUILD_ID_MAX * 2 + 1];
+    struct dirent *ent;
+    struct stat st;
+    DIR *d;
+
+    if (depth > 32 || (d = opendir(dir)) == NULL)
+        return;
+
+    while ((ent = readdir(d)) != NULL) {
+        if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, ".."))
+            continue;
+
+        if (snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name) >= (int) sizeof(path))
+            continue;
+
+        if (ent->d_type == DT_UNKNOWN) {
+            if (lstat(path, &st) != 0)
+                continue;
+            ent->d_type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_LNK;
+        }
+
+        if (ent->d_type == DT_DIR) {
+            scan_dir(idx, path, depth + 1);
+        } else if (ent->d_type == DT_REG) {
+            ssize_t len = shelf_read_build_id(path, id);
+
+            if (len > 0) {
+                hex_id(id, len, hex);
+                table_insert(idx, hex, path);
+            }
+        }
+    }
+
+    closedir(d);
+}
+
+/*
+ * The cache holds the roots it was built from, then one record per entry.
+ * Every string is written as "<length>:<bytes>", so paths may hold any
+ * byte, tabs and newlines included; the newlines between records are only
+ * there for people reading the file.
+ */
+static void write_field(FILE *f, const char *s)
+{
+    fprintf(f, "%zu:", strlen(s));
+    fputs(s, f);
+}
+
+/* Reads one field into a malloc'd string, NULL if malformed. */
+static char *read_field(FILE *f)
+{
+    size_t len;
+    char *s;
+
+    if (fscanf(f, "%zu:", &len) != 1 || len >= PATH_MAX || (s = malloc(len + 1)) == NULL)
+        return NULL;
+
+    if (fread(s, 1, len, f) != len || memchr(s, '\0', len) != NULL) {
+        free(s);
+        return NULL;
+    }
+
+    s[len] = '\0';
+
+    return s;
+}
+
+/* Loads the persisted index, unless it was built over other roots. */
+static int load_cache(shelfdebugidx_t *idx)
+{
+    char magic[sizeof(DEBUGIDX_MAGIC)];
+    size_t nroots;
+    FILE *f;
+
+    if (idx->cache_path == NULL || (f = fopen(idx->cache_path, "r")) == NULL)
+        return -1;
+
+    if (fgets(magic, sizeof(magic), f) == NULL || strcmp(magic, DEBUGIDX_MAGIC) ||
+        fscanf(f, "%zu", &nroots) != 1 || nroots != idx->nroots) {
+        fclose(f);
+        return -1;
+    }
+
+    for (size_t i = 0; i < nroots; i++) {
+        char *root = read_field(f);
+        int same = root != NULL && !strcmp(root, idx->roots[i]);
+
+        free(root);
+
+        if (!same) {
+            fclose(f);
+            return -1;
+        }
+    }
+
+    for (;;) {
+        char *build_id = read_field(f), *path;
+
+        if (build_id == NULL)
+            break;
+
+        if ((path = read_field(f)) != NULL)
+            table_insert(idx, build_id, path);
+
+        free(build_id);
+        free(path);
+
+        if (path == NULL)
+            break;
+    }
+
+    fclose(f);
+
+    return 0;
+}
+
+/*
+ * Write the index next to its final location and rename it into place so
+ * concurrent readers never see a partial file.
+ */
+static int save_cache(shelfdebugidx_t *idx)
+{
+    char tmp[PATH_MAX];
+    FILE *f;
+
+    if (idx->cache_path == NULL)
+        return 0;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.%d.tmp", idx->cache_path, (int) getpid()) >= (int) sizeof(tmp))
+        return -1;
+
+    if ((f = fopen(tmp, "w")) == NULL)
+        return -1;
+
+    fputs(DEBUGIDX_MAGIC, f);
+    fprintf(f, "%zu\n", idx->nroots);
+
+    for (size_t i = 0; i < idx->nroots; i++) {
+        write_field(f, idx->roots[i]);
+        fputc('\n', f);
+    }
+
+    for (size_t i = 0; idx->table && i <= idx->mask; i++) {
+        if (idx->table[i].build_id != NULL) {
+            write_field(f, idx->table[i].build_id);
+            write_field(f, idx->table[i].path);
+            fputc('\n', f);
+        }
+    }
+
+    if (fclose(f) != 0 || rename(tmp, idx->cache_path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Make the index usable: load the persisted copy if there is one built over
+ * the same roots, otherwise walk the roots once and persist the result.
+ * Later calls are free.
+ */
+int shelf_debugidx_build(shelfdebugidx_t *idx)
+{
+    PROFILER_IN();
+
+    if (idx == NULL)
+        PROFILER_RERR("Null argument passed to shelf_debugidx_build()\n", -1);
+
+    if (idx->loaded)
+        PROFILER_ROUT(0, "%d");
+
+    if (idx->nroots == 0)
+        shelf_debugidx_add_root(idx, SHELF_DEBUG_ROOT_DEFAULT);
+
+    if (load_cache(idx) != 0) {
+        table_clear(idx);
+
+        for (size_t i = 0; i < idx->nroots; i++)
+            scan_dir(idx, idx->roots[i], 0);
+
+        save_cache(idx);
+    }
+
+    idx->loaded = 1;
+
+    PROFILER_ROUT(0, "%d");
+}
+
+/*
+ * Drop the index and walk the roots again, e.g. after new debug packages were
+ * installed.
+ */
+int shelf_debugidx_rebuild(shelfdebugidx_t *idx)
+{
+    if (idx == NULL)
+        return -1;
+
+    table_clear(idx);
+
+    if (idx->cache_path != NULL)
+        unlink(idx->cache_path);
+
+    idx->loaded = 0;
+
+    return shelf_debugidx_build(idx);
+}
+
+const char *shelf_debugidx_lookup(shelfdebugidx_t *idx, const unsigned char *id, size_t len)
+{
+    char hex[SHELF_BUILD_ID_MAX * 2 + 1];
+
+    if (idx == NULL || id == NULL || len == 0 || len > SHELF_BUILD_ID_MAX)
+        return NULL;
+
+    if (shelf_debugidx_build(idx) != 0)
+        return NULL;
+
+    hex_id(id, len, hex);
+
+    return table_lookup(idx, hex);
+}
+
+/*
+ * Returns non-zero when the file at `path` exists and, if the binary has a
+ * build-id, carries the same one.
+ */
+static int candidate_matches(const char *path, const unsigned char *id, ssize_t id_len)
+{
+    unsigned char other[SHELF_BUILD_ID_MAX];
+
+    if (access(path, R_OK) != 0)
+        return 0;
+
+    if (id_len <= 0)
+        return 1;
+
+    return shelf_read_build_id(path, other) == id_len && !memcmp(id, other, id_len);
+}
+
+/* Whether two paths name the same file, however they are spelled. */
+static int same_file(const char *a, const char *b)
+{
+    struct stat sa, sb;
+
+    return stat(a, &sa) == 0 && stat(b, &sb) == 0 && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+/*
+ * Concatenate into a PATH_MAX buffer, returning zero if the result would not
+ * fit.
+ */
+static int join_path(char *out, const char *a, const char *b, const char *c, const char *d)
+{
+    size_t la = strlen(a), lb = strlen(b), lc = strlen(c), ld = strlen(d);
+
+    if (la + lb + lc + ld >= PATH_MAX)
+        return 0;
+
+    memcpy(out, a, la);
+    memcpy(out + la, b, lb);
+    memcpy(out + la + lb, c, lc);
+    memcpy(out + la + lb + lc, d, ld + 1);
+
+    return 1;
+}
+
+/*
+ * Locate the debug file for `desc`. Tries, in order, the .build-id tree under
+ * every root, the build-id index, then the .gnu_debuglink name next to the
+ * binary, in its .debug directory and mirrored under every root. Returns a
+ * malloc'd path or NULL.
+ */
+char *shelf_find_debug_file(shelfobj_t *desc, shelfdebugidx_t *idx)
+{
+    unsigned char id[SHELF_BUILD_ID_MAX];
+    char hex[SHELF_BUILD_ID_MAX * 2 + 1];
+    char path[PATH_MAX], link[PATH_MAX], dir[PATH_MAX];
+    const char *found;
+    ssize_t id_len;
+
+    PROFILER_IN();
+
+    if (desc == NULL || idx == NULL)
+        PROFILER_RERR("Null argument passed to shelf_find_debug_file()\n", NULL);
+
+    if (idx->nroots == 0)
+        shelf_debugidx_add_root(idx, SHELF_DEBUG_ROOT_DEFAULT);
+
+    id_len = shelf_get_build_id(desc, id);
+
+    if (id_len > 1) {
+        hex_id(id, id_len, hex);
+
+        for (size_t i = 0; i < idx->nroots; i++) {
+            snprintf(path, sizeof(path), "%s/.build-id/%.2s/%s.debug", idx->roots[i], hex, hex + 2);
+
+            if (access(path, R_OK) == 0)
+                PROFILER_ROUT(strdup(path), "char *: %p");
+        }
+
+        if ((found = shelf_debugidx_lookup(idx, id, id_len)) != NULL && access(found, R_OK) == 0)
+            PROFILER_ROUT(strdup(found), "char *: %p");
+    }
+
+    if (desc->filename == NULL || shelf_read_debuglink(desc->filename, link, sizeof(link), NULL) < 0)
+        PROFILER_RERR("No debug file found", NULL);
+
+    if (realpath(desc->filename, dir) == NULL)
+        snprintf(dir, sizeof(dir), "%s", desc->filename);
+
+    char *slash = strrchr(dir, '/');
+
+    if (slash != NULL)
+        *slash = '\0';
+    else
+        snprintf(dir, sizeof(dir), ".");
+
+    /* Don't pick the binary itself when the link names its own file. */
+    if (join_path(path, "", dir, "/", link) && !same_file(path, desc->filename) &&
+        candidate_matches(path, id, id_len)) {
+        PROFILER_ROUT(strdup(path), "char *: %p");
+    }
+
+    if (join_path(path, "", dir, "/.debug/", link) && candidate_matches(path, id, id_len))
+        PROFILER_ROUT(strdup(path), "char *: %p");
+
+    for (size_t i = 0; i < idx->nroots; i++) {
+        if (join_path(path, idx->roots[i], dir, "/", link) && candidate_matches(path, id, id_len))
+            PROFILER_ROUT(strdup(path), "char *: %p");
+    }
+
+    PROFILER_RERR("No debug file found", NULL);
+}
+
+/*
+ * Find, open and attach the debug file for `desc`. The result is kept in
+ * desc->debug, closed along with desc, and searched by the symbol lookups in
+ * symbol.h after desc's own tables.
+ */
+shelfobj_t *shelf_open_debug(shelfobj_t *desc, shelfdebugidx_t *idx)
+{
+    char *path;
+
+    PROFILER_IN();
+
+    if (desc == NULL)
+        PROFILER_RERR("Null argument passed to shelf_open_debug()\n", NULL);
+
+    if (desc->debug != NULL)
+        PROFILER_ROUT(desc->debug, "shelfobj_t *: %p");
+
+    if ((path = shelf_find_debug_file(desc, idx)) == NULL)
+        PROFILER_RERR(shelf_error, NULL);
+
+    desc->debug = shelf_open(path);
+    free(path);
+
+    if (desc->debug == NULL)
+        PROFILER_RERR(shelf_error, NULL);
+
+    PROFILER_ROUT(desc->debug, "shelfobj_t *: %p");
+}
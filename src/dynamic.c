@@ -0,0 +1,313 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "shelf.h"
+#include "shelf_profiler.h"
+#include "dynamic.h"
+#include "segment.h"
+
+
+/*
+ * Locate the dynamic array in the file. PT_DYNAMIC is preferred since it is
+ * what the loader uses and it survives section header stripping; SHT_DYNAMIC
+ * is the fallback for objects without program headers.
+ */
+static int find_dynamic(shelfobj_t *desc, uint64_t *offset, uint64_t *size)
+{
+    uint64_t file_size = desc->file_stat.st_size;
+
+    *size = 0;
+
+    for (size_t i = 0; i < desc->hdr.e_phnum; i++) {
+        if (desc->pht[i].p_type == PT_DYNAMIC) {
+            *offset = desc->pht[i].p_offset;
+            *size = desc->pht[i].p_filesz;
+            break;
+        }
+    }
+
+    for (size_t i = 0; *size == 0 && i < desc->hdr.e_shnum; i++) {
+        if (desc->sht[i].sh_type == SHT_DYNAMIC && desc->sect_verified[i]) {
+            *offset = desc->sht[i].sh_offset;
+            *size = desc->sht[i].sh_size;
+        }
+    }
+
+    if (*size == 0)
+        return -1;
+
+    if (*offset > file_size || *size > file_size - *offset)
+        return -1;
+
+    return 0;
+}
+
+static void load_dynstr(shelfobj_t *desc, shelfdyn_t *dyn)
+{
+    uint64_t file_size = desc->file_stat.st_size;
+    uint64_t offset, size;
+
+    if (!((dyn->present >> DT_STRTAB) & 1) || !((dyn->present >> DT_STRSZ) & 1))
+        return;
+
+    if (shelf_vaddr_to_offset(desc, dyn->val[DT_STRTAB], &offset) != SHELF_ADDR_IN_FILE)
+        return;
+
+    // Segment extents aren't checked against the file, so the offset may lie past it.
+    if (offset >= file_size)
+        return;
+
+    size = dyn->val[DT_STRSZ];
+
+    if (size > file_size - offset)
+        size = file_size - offset;
+
+    /*
+     * Trim back to the last terminator once so any offset below strsz is a
+     * terminated string.
+     */
+    while (size > 0 && desc->data[offset + size - 1] != '\0')
+        size--;
+
+    if (size == 0)
+        return;
+
+    dyn->strtab = (const char *) desc->data + offset;
+    dyn->strsz = size;
+}
+
+void shelf_dyn_free(shelfobj_t *desc)
+{
+    if (desc == NULL || desc->dyn == NULL)
+        return;
+
+    free(desc->dyn->entries);
+    free(desc->dyn);
+    desc->dyn = NULL;
+}
+
+/*
+ * Parse the dynamic array into desc->dyn. Returns the cached table on later
+ * calls.
+ */
+shelfdyn_t *shelf_dyn_load(shelfobj_t *desc)
+{
+    shelfdyn_t *dyn;
+    const unsigned char *base;
+    uint64_t offset, size;
+    size_t entsize, max, n = 0, nos = 0;
+
+    PROFILER_IN();
+
+    if (desc == NULL)
+        PROFILER_RERR("Null argument passed to shelf_dyn_load()\n", NULL);
+
+    if (desc->dyn != NULL)
+        PROFILER_ROUT(desc->dyn, "shelfdyn_t *: %p");
+
+    if (desc->data == NULL || find_dynamic(desc, &offset, &size) != 0)
+        PROFILER_RERR("No dynamic section in file\n", NULL);
+
+    entsize = desc->ei_class == ELFCLASS64 ? sizeof(Elf64_Dyn) : sizeof(Elf32_Dyn);
+    base = desc->data + offset;
+    max = size / entsize;
+
+    if ((dyn = calloc(1, sizeof(shelfdyn_t))) == NULL)
+        PROFILER_RERR("Malloc for dynamic table failed\n", NULL);
+
+    /* Decode in file order into a scratch array, up to DT_NULL. */
+    shelfdynent_t *raw = malloc((max ? max : 1) * sizeof(shelfdynent_t));
+
+    if (raw == NULL || (dyn->entries = malloc((max ? max : 1) * sizeof(shelfdynent_t))) == NULL) {
+        free(raw);
+        free(dyn);
+        PROFILER_RERR("Malloc for dynamic entries failed\n", NULL);
+    }
+
+    for (; n < max; n++) {
+        const unsigned char *ent = base + n * entsize;
+
+        if (desc->ei_class == ELFCLASS64) {
+            raw[n].tag = (int64_t) desc->read_qword(ent);
+            raw[n].val = desc->read_qword(ent + 8);
+        } else {
+            raw[n].tag = (int32_t) desc->read_dword(ent);
+            raw[n].val = desc->read_dword(ent + 4);
+        }
+
+        if (raw[n].tag == DT_NULL)
+            break;
+
+        if (raw[n].tag >= 0 && raw[n].tag < DT_NUM)
+            dyn->tagcount[raw[n].tag]++;
+        else
+            nos++;
+    }
+
+    /* Generic tags in tag order, each run keeping file order. */
+    uint32_t next = 0;
+
+    for (size_t t = 0; t < DT_NUM; t++) {
+        dyn->start[t] = next;
+        next += dyn->tagcount[t];
+    }
+
+    uint32_t fill[DT_NUM];
+    memcpy(fill, dyn->start, sizeof(fill));
+
+    size_t os_fill = next;
+
+    for (size_t i = 0; i < n; i++) {
+        if (raw[i].tag >= 0 && raw[i].tag < DT_NUM)
+            dyn->entries[fill[raw[i].tag]++] = raw[i];
+        else
+            dyn->entries[os_fill++] = raw[i];
+    }
+
+    free(raw);
+
+    dyn->count = n;
+    dyn->os = dyn->entries + next;
+    dyn->nos = nos;
+
+    /* The OS specific run is short, a stable insertion sort will do. */
+    for (size_t i = 1; i < nos; i++) {
+        shelfdynent_t cur = dyn->os[i];
+        size_t j = i;
+
+        while (j > 0 && dyn->os[j - 1].tag > cur.tag) {
+            dyn->os[j] = dyn->os[j - 1];
+            j--;
+        }
+
+        dyn->os[j] = cur;
+    }
+
+    for (size_t t = 0; t < DT_NUM; t++) {
+        if (dyn->tagcount[t]) {
+            dyn->val[t] = dyn->entries[dyn->start[t]].val;
+            dyn->present |= (uint64_t) 1 << t;
+        }
+    }
+
+    load_dynstr(desc, dyn);
+    desc->dyn = dyn;
+
+    PROFILER_ROUT(dyn, "shelfdyn_t *: %p");
+}
+
+/*
+ * Returns every entry with tag `tag` as a run of `count` entries in file order,
+ * or NULL when the tag is absent.
+ */
+const shelfdynent_t *shelf_dyn_get_all(shelfobj_t *desc, int64_t tag, size_t *count)
+{
+    shelfdyn_t *dyn;
+    size_t lo, hi, end;
+
+    *count = 0;
+
+    if ((dyn = shelf_dyn_load(desc)) == NULL)
+        return NULL;
+
+    if (tag >= 0 && tag < DT_NUM) {
+        *count = dyn->tagcount[tag];
+        return *count ? &dyn->entries[dyn->start[tag]] : NULL;
+    }
+
+    lo = 0;
+    hi = dyn->nos;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (dyn->os[mid].tag < tag)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for (end = lo; end < dyn->nos && dyn->os[end].tag == tag; end++)
+        ;
+
+    *count = end - lo;
+
+    return *count ? &dyn->os[lo] : NULL;
+}
+
+/*
+ * Fetch the first value of `tag`. Returns 0 on success, -1 if the tag is
+ * absent.
+ */
+int shelf_dyn_get(shelfobj_t *desc, int64_t tag, uint64_t *val)
+{
+    const shelfdynent_t *ent;
+    size_t count;
+
+    if (desc != NULL && desc->dyn != NULL && tag >= 0 && tag < DT_NUM) {
+        if (!((desc->dyn->present >> tag) & 1))
+            return -1;
+        *val = desc->dyn->val[tag];
+        return 0;
+    }
+
+    if ((ent = shelf_dyn_get_all(desc, tag, &count)) == NULL)
+        return -1;
+
+    *val = ent->val;
+
+    return 0;
+}
+
+const char *shelf_dyn_string(shelfobj_t *desc, uint64_t offset)
+{
+    shelfdyn_t *dyn = shelf_dyn_load(desc);
+
+    if (dyn == NULL || dyn->strtab == NULL || offset >= dyn->strsz)
+        return NULL;
+
+    return dyn->strtab + offset;
+}
+
+size_t shelf_dyn_needed_count(shelfobj_t *desc)
+{
+    size_t count;
+
+    shelf_dyn_get_all(desc, DT_NEEDED, &count);
+
+    return count;
+}
+
+const char *shelf_dyn_needed(shelfobj_t *desc, size_t index)
+{
+    const shelfdynent_t *ent;
+    size_t count;
+
+    if ((ent = shelf_dyn_get_all(desc, DT_NEEDED, &count)) == NULL || index >= count)
+        return NULL;
+
+    return shelf_dyn_string(desc, ent[index].val);
+}
+
+const char *shelf_dyn_soname(shelfobj_t *desc)
+{
+    uint64_t val;
+
+    if (shelf_dyn_load(desc) == NULL || shelf_dyn_get(desc, DT_SONAME, &val) != 0)
+        return NULL;
+
+    return shelf_dyn_string(desc, val);
+}
+
+const char *shelf_dyn_runpath(shelfobj_t *desc)
+{
+    uint64_t val;
+
+    if (shelf_dyn_load(desc) == NULL)
+        return NULL;
+
+    if (shelf_dyn_get(desc, DT_RUNPATH, &val) != 0 && shelf_dyn_get(desc, DT_RPATH, &val) != 0)
+        return NULL;
+
+    return shelf_dyn_string(desc, val);
+}
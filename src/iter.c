@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shelf.h"
+#include "shelf_profiler.h"
+#include "section.h"
+#include "symbol.h"
+#include "iter.h"
+
+
+/*
+ * Section iteration starts past the SHT_NULL entry at index 0.
+ */
+void shelf_sect_iter_init(shelfsectiter_t *it, shelfobj_t *desc, uint32_t type,
+                          uint64_t flags_set, uint64_t flags_clear)
+{
+    memset(it, 0, sizeof(*it));
+
+    if (desc == NULL)
+        return;
+
+    if (desc->sect_list == NULL && desc->sht != NULL)
+        load_section_list(desc);
+
+    it->desc = desc;
+    it->next = 1;
+    it->type = type;
+    it->flags_set = flags_set;
+    it->flags_clear = flags_clear;
+}
+
+shelfsect_t *shelf_sect_iter_next(shelfsectiter_t *it)
+{
+    shelfobj_t *desc = it->desc;
+
+    if (desc == NULL || desc->sect_list == NULL)
+        return NULL;
+
+    while (it->next < desc->hdr.e_shnum) {
+        size_t i = it->next++;
+        const shelf_Shdr *shdr = &desc->sht[i];
+
+        if ((it->type == SHELF_ITER_ANY || shdr->sh_type == it->type) &&
+            (shdr->sh_flags & it->flags_set) == it->flags_set &&
+            (shdr->sh_flags & it->flags_clear) == 0) {
+            it->index = i;
+            return &desc->sect_list[i];
+        }
+    }
+
+    return NULL;
+}
+
+int shelf_sect_visit(shelfobj_t *desc, uint32_t type, uint64_t flags_set,
+                     uint64_t flags_clear, shelf_sect_visitor fn, void *arg)
+{
+    shelfsectiter_t it;
+    shelfsect_t *sect;
+    int ret;
+
+    shelf_sect_iter_init(&it, desc, type, flags_set, flags_clear);
+
+    while ((sect = shelf_sect_iter_next(&it)) != NULL) {
+        if ((ret = fn(desc, sect, it.index, arg)) != 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+/*
+ * The dynamic table is decoded on first use and cached on desc, so only the
+ * first iteration over it allocates.
+ */
+int shelf_sym_iter_init(shelfsymiter_t *it, shelfobj_t *desc, int table,
+                        uint32_t type, uint32_t bind_mask, int defined)
+{
+    PROFILER_IN();
+
+    memset(it, 0, sizeof(*it));
+
+    if (desc == NULL)
+        PROFILER_RERR("Null argument passed to shelf_sym_iter_init()\n", -1);
+
+    if (table == SHELF_SYMTAB_DYNAMIC) {
+        it->syms = shelf_load_dynsym(desc, &it->count);
+    } else if (table == SHELF_SYMTAB_STATIC) {
+        if (shelf_load_symtab(desc) != 0)
+            PROFILER_RERR(shelf_error, -1);
+        it->syms = desc->symtab;
+        it->count = desc->symcount;
+    } else {
+        PROFILER_RERR("Invalid symbol table passed to shelf_sym_iter_init()\n", -1);
+    }
+
+    if (it->syms == NULL)
+        it->count = 0;
+
+    it->type = type;
+    it->bind_mask = bind_mask;
+    it->defined = defined != 0;
+
+    PROFILER_ROUT(0, "%d");
+}
+
+shelfsym_t *shelf_sym_iter_next(shelfsymiter_t *it)
+{
+    while (it->next < it->count) {
+        size_t i = it->next++;
+        shelfsym_t *sym = &it->syms[i];
+
+        if ((it->type == SHELF_ITER_ANY || ELF64_ST_TYPE(sym->st_info) == it->type) &&
+            (it->bind_mask == 0 || (it->bind_mask & (1u << ELF64_ST_BIND(sym->st_info)))) &&
+            (!it->defined || sym->st_shndx != SHN_UNDEF)) {
+            it->index = i;
+            return sym;
+        }
+    }
+
+    return NULL;
+}
+
+int shelf_sym_visit(shelfobj_t *desc, int table, uint32_t type, uint32_t bind_mask, int defined,
+                    shelf_sym_visitor fn, void *arg)
+{
+    shelfsymiter_t it;
+    shelfsym_t *sym;
+    int ret;
+
+    if (shelf_sym_iter_init(&it, desc, table, type, bind_mask, defined) != 0)
+        return -1;
+
+    while ((sym = shelf_sym_iter_next(&it)) != NULL) {
+        if ((ret = fn(desc, sym, it.index, arg)) != 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+/*
+ * Set up a stream over .symtab or .dynsym. A missing table yields an empty
+ * stream rather than an error.
+ */
+int shelf_sym_stream_init(shelfsymstream_t *st, shelfobj_t *desc, int table)
+{
+    uint32_t want;
+
+    PROFILER_IN();
+
+    memset(st, 0, sizeof(*st));
+
+    if (desc == NULL)
+        PROFILER_RERR("Null argument passed to shelf_sym_stream_init()\n", -1);
+
+    if (table == SHELF_SYMTAB_STATIC)
+        want = SHT_SYMTAB;
+    else if (table == SHELF_SYMTAB_DYNAMIC)
+        want = SHT_DYNSYM;
+    else
+        PROFILER_RERR("Invalid symbol table passed to shelf_sym_stream_init()\n", -1);
+
+    st->desc = desc;
+    st->entsize = desc->ei_class == ELFCLASS64 ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym);
+
+    for (uint32_t i = 0; desc->sht != NULL && i < desc->hdr.e_shnum; i++) {
+        if (desc->sht[i].sh_type != want)
+            continue;
+
+        if ((st->base = shelf_sect_ptr(desc, i)) != NULL) {
+            st->count = desc->sht[i].sh_size / st->entsize;
+            st->strtab = shelf_get_strtab(desc, desc->sht[i].sh_link, &st->strsz);
+        }
+        break;
+    }
+
+    PROFILER_ROUT(0, "%d");
+}
+
+/*
+ * Decode the next entry into `sym`. Returns 1 while entries remain, else 0.
+ * sym->name points into the mapped string table, or is NULL when the offset
+ * is out of range.
+ */
+int shelf_sym_stream_next(shelfsymstream_t *st, shelfsym_t *sym)
+{
+    if (st->next >= st->count)
+        return 0;
+
+    shelf_decode_sym(st->desc, st->base + st->next++ * st->entsize, sym);
+    sym->name = sym->st_name < st->strsz ? (char *) st->strtab + sym->st_name : NULL;
+
+    return 1;
+}
+
+void shelf_seg_iter_init(shelfsegiter_t *it, shelfobj_t *desc, uint32_t type,
+                         uint32_t flags_set, uint32_t flags_clear)
+{
+    memset(it, 0, sizeof(*it));
+
+    it->desc = desc;
+    it->type = type;
+    it->flags_set = flags_set;
+    it->flags_clear = flags_clear;
+}
+
+Elf64_Phdr *shelf_seg_iter_next(shelfsegiter_t *it)
+{
+    shelfobj_t *desc = it->desc;
+
+    if (desc == NULL || desc->pht == NULL)
+        return NULL;
+
+    while (it->next < desc->hdr.e_phnum) {
+        size_t i = it->next++;
+        Elf64_Phdr *phdr = &desc->pht[i];
+
+        if ((it->type == SHELF_ITER_ANY || phdr->p_type == it->type) &&
+            (phdr->p_flags & it->flags_set) == it->flags_set &&
+            (phdr->p_flags & it->flags_clear) == 0) {
+            it->index = i;
+            return phdr;
+        }
+    }
+
+    return NULL;
+}
+
+int shelf_seg_visit(shelfobj_t *desc, uint32_t type, uint32_t flags_set,
+                    uint32_t flags_clear, shelf_seg_visitor fn, void *arg)
+{
+    shelfsegiter_t it;
+    Elf64_Phdr *phdr;
+    int ret;
+
+    shelf_seg_iter_init(&it, desc, type, flags_set, flags_clear);
+
+    while ((phdr = shelf_seg_iter_next(&it)) != NULL) {
+        if ((ret = fn(desc, phdr, it.index, arg)) != 0)
+            return ret;
+    }
+
+    return 0;
+}
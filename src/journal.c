@@ -0,0 +1,423 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "shelf.h"
+#include "shelf_profiler.h"
+#include "section.h"
+#include "segment.h"
+#include "shelf_compress.h"
+#include "journal.h"
+
+
+static void *memdup(const void *src, size_t len)
+{
+    void *dst = malloc(len ? len : 1);
+
+    if (dst != NULL)
+        memcpy(dst, src, len);
+
+    return dst;
+}
+
+/* Index of the first extent ending at or after `offset`. */
+static size_t first_touching(const shelfjournal_t *j, uint64_t offset)
+{
+    size_t lo = 0, hi = j->count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (j->extents[mid].offset + j->extents[mid].len < offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+static void journal_free(shelfjournal_t *j)
+{
+    for (size_t i = 0; i < j->count; i++)
+        free(j->extents[i].bytes);
+
+    for (size_t i = 0; j->saved != NULL && i < j->nsects; i++)
+        free(j->saved[i]);
+
+    free(j->extents);
+    free(j->pht);
+    free(j->sht);
+    free(j->owned);
+    free(j->saved);
+    free(j->saved_len);
+    shelf_layout_drop(j->layout);
+    free(j);
+}
+
+/*
+ * The address translation and section to segment caches are derived from
+ * the tables a transaction may have changed.
+ */
+static void drop_derived(shelfobj_t *desc)
+{
+    shelf_segmap_free(desc);
+    shelf_loadidx_free(desc);
+}
+
+static int section_takes_overlay(shelfobj_t *desc, shelfsect_t *sect)
+{
+    return sect->shdr->sh_type != SHT_NOBITS && sect->verified &&
+           !shelf_section_is_compressed(desc, sect);
+}
+
+/*
+ * Start a transaction. Only one can be open on a descriptor at a time.
+ */
+shelfjournal_t *shelf_journal_begin(shelfobj_t *desc)
+{
+    shelfjournal_t *j;
+    size_t shnum;
+
+    PROFILER_IN();
+
+    if (desc == NULL)
+        PROFILER_RERR("Null argument passed to shelf_journal_begin()\n", NULL);
+
+    if (desc->journal != NULL)
+        PROFILER_RERR("A transaction is already open on this descriptor", NULL);
+
+    if (desc->sect_list == NULL && desc->hdr.e_shnum != 0 && desc->data != NULL)
+        load_section_list(desc);
+
+    shnum = desc->sect_list != NULL ? desc->hdr.e_shnum : 0;
+
+    if ((j = calloc(1, sizeof(shelfjournal_t))) == NULL)
+        PROFILER_RERR("Malloc for journal failed", NULL);
+
+    j->hdr = desc->hdr;
+    j->nsects = shnum;
+    j->pht = memdup(desc->pht, desc->hdr.e_phnum * sizeof(Elf64_Phdr));
+    j->sht = memdup(desc->sht, desc->hdr.e_shnum * sizeof(shelf_Shdr));
+    j->owned = calloc(shnum ? shnum : 1, sizeof(uint8_t));
+    j->saved = calloc(shnum ? shnum : 1, sizeof(void *));
+    j->saved_len = calloc(shnum ? shnum : 1, sizeof(size_t));
+
+    if (j->pht == NULL || j->sht == NULL || j->owned == NULL || j->saved == NULL ||
+        j->saved_len == NULL) {
+        journal_free(j);
+        PROFILER_RERR("Malloc for journal failed", NULL);
+    }
+
+    if (desc->layout != NULL && (j->layout = shelf_layout_copy(desc->layout)) == NULL) {
+        journal_free(j);
+        PROFILER_RERR("Malloc for journal failed", NULL);
+    }
+
+    for (size_t i = 0; i < shnum; i++) {
+        shelfsect_t *sect = &desc->sect_list[i];
+
+        if (sect->data_owner != SECT_DATA_MALLOC)
+            continue;
+
+        j->owned[i] = 1;
+        j->saved_len[i] = sect->data_len;
+
+        if ((j->saved[i] = memdup(sect->data, sect->data_len)) == NULL) {
+            journal_free(j);
+            PROFILER_RERR("Malloc for journal failed", NULL);
+        }
+    }
+
+    desc->journal = j;
+
+    PROFILER_ROUT(j, "shelfjournal_t *: %p");
+}
+
+/*
+ * Stage `len` bytes at file offset `offset`. The write is merged into the
+ * overlay and copied into any section private copy it lands in. A pointer
+ * get_section_data() returned earlier into the file mapping is stale after
+ * the write; call it again to get a private copy with the overlay applied.
+ * Writes past the end of the file extend it on commit.
+ */
+int shelf_journal_write(shelfobj_t *desc, uint64_t offset, const void *buf, size_t len)
+{
+    shelfjournal_t *j;
+
+    PROFILER_IN();
+
+    if (desc == NULL || buf == NULL)
+        PROFILER_RERR("Null argument passed to shelf_journal_write()\n", -1);
+
+    if ((j = desc->journal) == NULL)
+        PROFILER_RERR("No transaction is open on this descriptor", -1);
+
+    if (len == 0)
+        PROFILER_ROUT(0, "%d");
+
+    /* Extents [first, last) touch the new range and fold into it. */
+    size_t first = first_touching(j, offset), last = first;
+    uint64_t start = offset, end = offset + len;
+
+    while (last < j->count && j->extents[last].offset <= end) {
+        if (j->extents[last].offset < start)
+            start = j->extents[last].offset;
+        if (j->extents[last].offset + j->extents[last].len > end)
+            end = j->extents[last].offset + j->extents[last].len;
+        last++;
+    }
+
+    unsigned char *bytes = malloc(end - start);
+
+    if (bytes == NULL)
+        PROFILER_RERR("Malloc for journal extent failed", -1);
+
+    for (size_t i = first; i < last; i++) {
+        memcpy(bytes + (j->extents[i].offset - start), j->extents[i].bytes, j->extents[i].len);
+        free(j->extents[i].bytes);
+    }
+
+    memcpy(bytes + (offset - start), buf, len);
+
+    if (first == last && j->count == j->cap) {
+        size_t cap = j->cap ? j->cap * 2 : 16;
+        shelfextent_t *grown = realloc(j->extents, cap * sizeof(shelfextent_t));
+
+        if (grown == NULL) {
+            free(bytes);
+            PROFILER_RERR("Malloc for journal extents failed", -1);
+        }
+
+        j->extents = grown;
+        j->cap = cap;
+    }
+
+    // Replace [first, last) with the merged extent.
+    size_t removed = last - first;
+
+    if (removed != 1) {
+        memmove(&j->extents[first + 1], &j->extents[last], (j->count - last) * sizeof(shelfextent_t));
+        j->count = j->count + 1 - removed;
+    }
+
+    j->extents[first] = (shelfextent_t) { start, end - start, bytes };
+
+    for (size_t i = 0; desc->sect_list != NULL && i < desc->hdr.e_shnum; i++) {
+        shelfsect_t *sect = &desc->sect_list[i];
+        uint64_t s_start = sect->shdr->sh_offset;
+        uint64_t s_end = s_start + (sect->data_len < sect->shdr->sh_size ? sect->data_len : sect->shdr->sh_size);
+
+        if (sect->data_owner != SECT_DATA_MALLOC || !section_takes_overlay(desc, sect) ||
+            offset >= s_end || offset + len <= s_start)
+            continue;
+
+        uint64_t lo = offset > s_start ? offset : s_start;
+        uint64_t hi = offset + len < s_end ? offset + len : s_end;
+
+        memcpy((unsigned char *) sect->data + (lo - s_start), (const unsigned char *) buf + (lo - offset), hi - lo);
+    }
+
+    PROFILER_ROUT(0, "%d");
+}
+
+int shelf_journal_overlaps(const shelfobj_t *desc, uint64_t offset, uint64_t len)
+{
+    const shelfjournal_t *j;
+
+    if (desc == NULL || (j = desc->journal) == NULL || len == 0)
+        return 0;
+
+    size_t i = first_touching(j, offset + 1);
+
+    return i < j->count && j->extents[i].offset < offset + len;
+}
+
+/*
+ * Read file bytes as the transaction sees them: the mapping with the
+ * overlay on top, and zeroes past the end of the file.
+ */
+ssize_t shelf_journal_read(shelfobj_t *desc, uint64_t offset, void *buf, size_t len)
+{
+    uint64_t size;
+    unsigned char *dst = buf;
+
+    PROFILER_IN();
+
+    if (desc == NULL || buf == NULL)
+        PROFILER_RERR("Null argument passed to shelf_journal_read()\n", -1);
+
+    if (desc->data == NULL)
+        PROFILER_RERR("Descriptor has no file mapping", -1);
+
+    size = desc->file_stat.st_size;
+    memset(dst, 0, len);
+
+    if (offset < size)
+        memcpy(dst, desc->data + offset, size - offset < len ? size - offset : len);
+
+    const shelfjournal_t *j = desc->journal;
+
+    for (size_t i = j ? first_touching(j, offset + 1) : 0; j && i < j->count; i++) {
+        const shelfextent_t *e = &j->extents[i];
+
+        if (e->offset >= offset + len)
+            break;
+
+        uint64_t lo = e->offset > offset ? e->offset : offset;
+        uint64_t hi = e->offset + e->len < offset + len ? e->offset + e->len : offset + len;
+
+        memcpy(dst + (lo - offset), e->bytes + (lo - e->offset), hi - lo);
+    }
+
+    PROFILER_ROUT((ssize_t) len, "%zd");
+}
+
+/*
+ * Give a section a private copy with the overlay applied. This is what
+ * get_section_data() returns for sections the transaction has written to.
+ */
+void *shelf_journal_section(shelfobj_t *desc, shelfsect_t *sect)
+{
+    uint64_t size;
+
+    PROFILER_IN();
+
+    if (desc == NULL || sect == NULL)
+        PROFILER_RERR("Null argument passed to shelf_journal_section()\n", NULL);
+
+    if (sect->data != NULL)
+        PROFILER_ROUT(sect->data, "void *: %p");
+
+    if (!section_takes_overlay(desc, sect))
+        PROFILER_RERR("Section can't carry journal edits", NULL);
+
+    size = sect->shdr->sh_size;
+
+    if ((sect->data = malloc(size ? size : 1)) == NULL)
+        PROFILER_RERR("Malloc for section data failed\n", NULL);
+
+    if (shelf_journal_read(desc, sect->shdr->sh_offset, sect->data, size) < 0) {
+        free(sect->data);
+        sect->data = NULL;
+        PROFILER_RERR(shelf_error, NULL);
+    }
+
+    sect->data_len = size ? size : 1;
+    sect->data_owner = SECT_DATA_MALLOC;
+
+    PROFILER_ROUT(sect->data, "void *: %p");
+}
+
+/*
+ * Write the descriptor with every staged edit to `path`, or over its own
+ * file if `path` is NULL, through a temporary file and a rename. On
+ * success the transaction is closed; sections it wrote to keep private
+ * copies with the committed bytes, but the file is not mapped again, so
+ * desc->data and everything read through it still show the old contents.
+ * Reopen the file to see it as written. On failure the transaction stays
+ * open, to retry or roll back. Returns the size written, or -1.
+ */
+ssize_t shelf_journal_commit(shelfobj_t *desc, const char *path)
+{
+    shelfjournal_t *j;
+    ssize_t written;
+
+    PROFILER_IN();
+
+    if (desc == NULL)
+        PROFILER_RERR("Null argument passed to shelf_journal_commit()\n", -1);
+
+    if ((j = desc->journal) == NULL)
+        PROFILER_RERR("No transaction is open on this descriptor", -1);
+
+    if ((written = shelf_write(desc, path != NULL ? path : desc->filename)) < 0)
+        PROFILER_RERR(shelf_error, -1);
+
+    for (size_t i = 0; desc->sect_list != NULL && i < desc->hdr.e_shnum; i++) {
+        shelfsect_t *sect = &desc->sect_list[i];
+
+        if (section_takes_overlay(desc, sect) &&
+            shelf_journal_overlaps(desc, sect->shdr->sh_offset, sect->shdr->sh_size))
+            shelf_journal_section(desc, sect);
+    }
+
+    desc->journal = NULL;
+    journal_free(j);
+    drop_derived(desc);
+
+    PROFILER_ROUT(written, "%zd");
+}
+
+/*
+ * Discard the transaction: drop the overlay, put the tables back and
+ * restore or drop section private copies to how they were at begin.
+ */
+void shelf_journal_rollback(shelfobj_t *desc)
+{
+    shelfjournal_t *j;
+
+    PROFILER_IN();
+
+    if (desc == NULL || (j = desc->journal) == NULL)
+        PROFILER_OUT();
+
+    desc->journal = NULL;
+
+    int same_sections = desc->sect_list != NULL && desc->hdr.e_shnum == j->nsects;
+
+    // The saved layout's string tables point into section data kept in place.
+    int keep_layout = same_sections;
+
+    for (size_t i = 0; desc->sect_list != NULL && i < desc->hdr.e_shnum; i++) {
+        shelfsect_t *sect = &desc->sect_list[i];
+
+        if (same_sections && j->owned[i] && sect->data_owner == SECT_DATA_MALLOC &&
+            sect->data_len == j->saved_len[i]) {
+            memcpy(sect->data, j->saved[i], sect->data_len);
+            continue;
+        }
+
+        if (i < j->nsects && j->owned[i])
+            keep_layout = 0;
+
+        release_section_data(sect);
+
+        if (!same_sections)
+            free(sect->name);
+    }
+
+    if (!same_sections && desc->sect_list != NULL) {
+        free(desc->sect_list);
+        desc->sect_list = NULL;
+    }
+
+    desc->hdr = j->hdr;
+
+    free(desc->pht);
+    free(desc->sht);
+    desc->pht = j->pht;
+    desc->sht = j->sht;
+    j->pht = NULL;
+    j->sht = NULL;
+
+    if (desc->sect_list != NULL) {
+        for (size_t i = 0; i < desc->hdr.e_shnum; i++)
+            desc->sect_list[i].shdr = &desc->sht[i];
+    } else if (desc->hdr.e_shnum != 0 && desc->data != NULL) {
+        load_section_list(desc);
+    }
+
+    if (keep_layout) {
+        shelf_layout_attach(desc, j->layout);
+        j->layout = NULL;
+    } else {
+        shelf_layout_free(desc);
+    }
+
+    journal_free(j);
+    drop_derived(desc);
+
+    PROFILER_OUT();
+}
@@ -0,0 +1,1212 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shelf.h"
+#include "shelf_profiler.h"
+#include "section.h"
+#include "symbol.h"
+#include "segment.h"
+#include "shelf_compress.h"
+#include "symquery.h"
+#include "nameidx.h"
+#include "journal.h"
+#include "layout.h"
+
+
+shelflayout_t *shelf_layout_load(shelfobj_t *desc)
+{
+    shelflayout_t *layout;
+    size_t n;
+
+    PROFILER_IN();
+
+    if (desc == NULL)
+        PROFILER_RERR("Null argument passed to shelf_layout_load()\n", NULL);
+
+    if (desc->layout != NULL)
+        PROFILER_ROUT(desc->layout, "shelflayout_t: %p");
+
+    if (desc->sht == NULL || !desc->sht_verified || (n = desc->hdr.e_shnum) == 0)
+        PROFILER_RERR("No section header table to lay out", NULL);
+
+    if (desc->sect_list == NULL)
+        load_section_list(desc);
+
+    if ((layout = calloc(1, sizeof(shelflayout_t))) == NULL ||
+        (layout->orig = calloc(n, sizeof(shelflsect_t))) == NULL ||
+        (layout->order = malloc(n * sizeof(shelflsect_t *))) == NULL) {
+        if (layout != NULL)
+            free(layout->orig);
+        free(layout);
+        PROFILER_RERR("Malloc for section layout failed", NULL);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        layout->orig[i].index = i;
+        layout->orig[i].pos = i;
+        layout->order[i] = &layout->orig[i];
+    }
+
+    layout->count = layout->cap = layout->norig = n;
+    desc->layout = layout;
+
+    PROFILER_ROUT(layout, "shelflayout_t: %p");
+}
+
+/* Frees a layout that isn't, or is no longer, attached to a descriptor. */
+void shelf_layout_drop(shelflayout_t *layout)
+{
+    if (layout == NULL)
+        return;
+
+    for (size_t i = 0; i < layout->nadded; i++) {
+        free(layout->added[i]->sect.name);
+        release_section_data(&layout->added[i]->sect);
+        free(layout->added[i]);
+    }
+
+    for (size_t i = 0; layout->strtabs != NULL && i < layout->norig; i++)
+        shelf_strtab_free(layout->strtabs[i]);
+
+    free(layout->strtabs);
+    free(layout->syms);
+    free(layout->added);
+    free(layout->orig);
+    free(layout->order);
+    free(layout);
+}
+
+/* The decoded entry of symbol `index` of table `table`, if it is decoded. */
+static shelfsym_t *decoded_sym(shelfobj_t *desc, uint32_t table, uint32_t index)
+{
+    uint32_t type = desc->sht[table].sh_type;
+
+    if (type == SHT_SYMTAB && desc->symtab != NULL && index < desc->symcount)
+        return &desc->symtab[index];
+
+    if (type == SHT_DYNSYM && desc->dynsym != NULL && index < desc->dynsymcount)
+        return &desc->dynsym[index];
+
+    return NULL;
+}
+
+/*
+ * Points the decoded symbol of a rename at its new name, held by the
+ * layout's string table builder, or back at the file's name if `restore`
+ * is set. Returns whether the symbol is decoded.
+ */
+static int sync_name(shelfobj_t *desc, const shelflayout_t *layout, const shelflsym_t *s, int restore)
+{
+    uint32_t link = desc->sht[s->table].sh_link;
+    shelfsym_t *sym;
+
+    if (s->index == UINT32_MAX || (sym = decoded_sym(desc, s->table, s->index)) == NULL)
+        return 0;
+
+    if (restore) {
+        uint64_t size;
+        const char *strtab = shelf_get_strtab(desc, link, &size);
+
+        sym->name = strtab != NULL && sym->st_name < size ? (char *) strtab + sym->st_name : NULL;
+    } else {
+        sym->name = (char *) shelf_strtab_str(layout->strtabs[link], s->name);
+    }
+
+    return 1;
+}
+
+/* Name keyed caches built over the old names are dropped. */
+static void sync_names(shelfobj_t *desc, const shelflayout_t *layout, int restore)
+{
+    int renamed = 0;
+
+    for (size_t i = 0; i < layout->nsyms; i++)
+        renamed |= sync_name(desc, layout, &layout->syms[i], restore);
+
+    if (renamed) {
+        shelf_symcols_free(desc);
+        shelf_nameidx_free(desc);
+    }
+}
+
+/* Drops every pending change, decoded symbols getting their names back. */
+void shelf_layout_free(shelfobj_t *desc)
+{
+    if (desc == NULL || desc->layout == NULL)
+        return;
+
+    sync_names(desc, desc->layout, 1);
+    shelf_layout_drop(desc->layout);
+    desc->layout = NULL;
+}
+
+/*
+ * Makes a detached layout, such as one from shelf_layout_copy(), the
+ * descriptor's pending changes in place of the current ones.
+ */
+void shelf_layout_attach(shelfobj_t *desc, shelflayout_t *layout)
+{
+    if (desc == NULL)
+        return;
+
+    shelf_layout_free(desc);
+    desc->layout = layout;
+
+    if (layout != NULL)
+        sync_names(desc, layout, 0);
+}
+
+/*
+ * A deep copy of `layout`, for shelf_journal_begin() to put back on
+ * rollback. String table builders keep pointing into the same section
+ * data, so the copy is only good while that data stays where it is.
+ */
+shelflayout_t *shelf_layout_copy(const shelflayout_t *layout)
+{
+    shelflayout_t *copy;
+
+    PROFILER_IN();
+
+    if (layout == NULL)
+        PROFILER_RERR("Null argument passed to shelf_layout_copy()\n", NULL);
+
+    if ((copy = calloc(1, sizeof(shelflayout_t))) == NULL)
+        PROFILER_RERR("Malloc for section layout failed", NULL);
+
+    *copy = *layout;
+    copy->orig = malloc(layout->norig * sizeof(shelflsect_t));
+    copy->order = malloc(layout->cap * sizeof(shelflsect_t *));
+    copy->added = calloc(layout->added_cap ? layout->added_cap : 1, sizeof(shelflsect_t *));
+    copy->syms = malloc((layout->syms_cap ? layout->syms_cap : 1) * sizeof(shelflsym_t));
+    copy->strtabs = layout->strtabs ? calloc(layout->norig, sizeof(shelfstrtab_t *)) : NULL;
+    copy->nadded = 0;
+
+    if (copy->orig == NULL || copy->order == NULL || copy->added == NULL || copy->syms == NULL ||
+        (layout->strtabs != NULL && copy->strtabs == NULL))
+        goto error;
+
+    memcpy(copy->orig, layout->orig, layout->norig * sizeof(shelflsect_t));
+
+    if (layout->nsyms != 0)
+        memcpy(copy->syms, layout->syms, layout->nsyms * sizeof(shelflsym_t));
+
+    for (size_t i = 0; i < layout->nadded; i++) {
+        const shelflsect_t *src = layout->added[i];
+        shelflsect_t *e;
+
+        if ((e = malloc(sizeof(shelflsect_t))) == NULL)
+            goto error;
+
+        *e = *src;
+        e->sect.shdr = &e->shdr;
+        e->sect.data = NULL;
+        e->sect.data_owner = SECT_DATA_NONE;
+
+        if ((e->sect.name = strdup(src->sect.name)) == NULL) {
+            free(e);
+            goto error;
+        }
+
+        copy->added[copy->nadded++] = e;
+
+        // Only malloced contents are the section's own; others are rebuilt on demand.
+        if (src->sect.data_owner == SECT_DATA_MALLOC) {
+            if ((e->sect.data = malloc(src->sect.data_len)) == NULL)
+                goto error;
+
+            memcpy(e->sect.data, src->sect.data, src->sect.data_len);
+            e->sect.data_owner = SECT_DATA_MALLOC;
+        } else {
+            e->sect.data_len = 0;
+        }
+    }
+
+    for (size_t i = 0; i < layout->count; i++) {
+        uint32_t index = layout->order[i]->index;
+
+        copy->order[i] = index < layout->norig ? &copy->orig[index] : copy->added[index - layout->norig];
+    }
+
+    for (size_t i = 0; layout->strtabs != NULL && i < layout->norig; i++) {
+        if (layout->strtabs[i] != NULL && (copy->strtabs[i] = shelf_strtab_copy(layout->strtabs[i])) == NULL)
+            goto error;
+    }
+
+    PROFILER_ROUT(copy, "shelflayout_t: %p");
+
+error:
+    shelf_layout_drop(copy);
+
+    PROFILER_RERR("Malloc for section layout failed", NULL);
+}
+
+int shelf_layout_pending(const shelfobj_t *desc)
+{
+    return desc != NULL && desc->layout != NULL && desc->layout->changed;
+}
+
+static const char *entry_name(const shelfobj_t *desc, const shelflsect_t *e)
+{
+    if (e->index < desc->layout->norig)
+        return desc->sect_list[e->index].name;
+
+    return e->sect.name;
+}
+
+static const shelf_Shdr *entry_shdr(const shelfobj_t *desc, const shelflsect_t *e)
+{
+    if (e->index < desc->layout->norig)
+        return &desc->sht[e->index];
+
+    return &e->shdr;
+}
+
+/* The entry behind a section of the descriptor or one add_section() made. */
+static shelflsect_t *entry_of(shelfobj_t *desc, shelfsect_t *sect)
+{
+    shelflayout_t *layout = desc->layout;
+
+    if (sect == NULL || sect->index < 0)
+        return NULL;
+
+    if ((size_t) sect->index < layout->norig)
+        return &layout->orig[sect->index];
+
+    if ((size_t) sect->index - layout->norig >= layout->nadded)
+        return NULL;
+
+    shelflsect_t *e = layout->added[sect->index - layout->norig];
+
+    return &e->sect == sect ? e : NULL;
+}
+
+/*
+ * Appends a section to the section header table. `shdr` supplies its type,
+ * flags, alignment, entry size, address and links, NULL meaning an
+ * SHT_PROGBITS section aligned to a byte; its size is `len`, the number
+ * of bytes copied from `data`, except for SHT_NOBITS sections, which keep
+ * shdr->sh_size. The offset is assigned by shelf_write().
+ *
+ * New sections are never placed in a segment, SHF_ALLOC or not. The
+ * returned section reads like any other through get_section_data() and
+ * stays valid until the descriptor is closed or the layout dropped.
+ */
+shelfsect_t *add_section(shelfobj_t *desc, const char *name, const shelf_Shdr *shdr,
+                         const void *data, size_t len)
+{
+    shelflayout_t *layout;
+    shelflsect_t *e;
+
+    PROFILER_IN();
+
+    if (desc == NULL || name == NULL || (data == NULL && len != 0))
+        PROFILER_RERR("Null argument passed to add_section()\n", NULL);
+
+    if ((layout = shelf_layout_load(desc)) == NULL)
+        PROFILER_RERR(shelf_error, NULL);
+
+    if (layout->count == layout->cap) {
+        size_t cap = layout->cap * 2;
+        shelflsect_t **grown = realloc(layout->order, cap * sizeof(shelflsect_t *));
+
+        if (grown == NULL)
+            PROFILER_RERR("Malloc for section layout failed", NULL);
+
+        layout->order = grown;
+        layout->cap = cap;
+    }
+
+    if (layout->nadded == layout->added_cap) {
+        size_t cap = layout->added_cap ? layout->added_cap * 2 : 16;
+        shelflsect_t **grown = realloc(layout->added, cap * sizeof(shelflsect_t *));
+
+        if (grown == NULL)
+            PROFILER_RERR("Malloc for section layout failed", NULL);
+
+        layout->added = grown;
+        layout->added_cap = cap;
+    }
+
+    if ((e = calloc(1, sizeof(shelflsect_t))) == NULL || (e->sect.name = strdup(name)) == NULL) {
+        free(e);
+        PROFILER_RERR("Malloc for new section failed", NULL);
+    }
+
+    if (shdr != NULL)
+        e->shdr = *shdr;
+    else {
+        e->shdr.sh_type = SHT_PROGBITS;
+        e->shdr.sh_addralign = 1;
+    }
+
+    e->shdr.sh_name = 0;
+    e->shdr.sh_offset = 0;
+
+    if (e->shdr.sh_type != SHT_NOBITS) {
+        e->shdr.sh_size = len;
+        e->sect.data_len = len ? len : 1;
+
+        if ((e->sect.data = malloc(e->sect.data_len)) == NULL) {
+            free(e->sect.name);
+            free(e);
+            PROFILER_RERR("Malloc for new section failed", NULL);
+        }
+
+        memcpy(e->sect.data, data, len);
+        e->sect.data_owner = SECT_DATA_MALLOC;
+    }
+
+    e->index = layout->norig + layout->nadded;
+    e->pos = layout->count;
+    e->sect.shdr = &e->shdr;
+    e->sect.index = e->index;
+    e->sect.verified = 1;
+
+    layout->added[layout->nadded++] = e;
+    layout->order[layout->count++] = e;
+    layout->changed = 1;
+
+    PROFILER_ROUT(&e->sect, "shelfsect_t: %p");
+}
+
+/*
+ * Drops the first remaining section called `name`. Links to it become
+ * SHN_UNDEF in the output, as do the indices of symbols defined in it.
+ */
+int remove_section(shelfobj_t *desc, const char *name)
+{
+    shelflayout_t *layout;
+
+    PROFILER_IN();
+
+    if (desc == NULL || name == NULL)
+        PROFILER_RERR("Null argument passed to remove_section()\n", -1);
+
+    if ((layout = shelf_layout_load(desc)) == NULL)
+        PROFILER_RERR(shelf_error, -1);
+
+    for (size_t i = 1; i < layout->count; i++) {
+        shelflsect_t *e = layout->order[i];
+
+        if (e->removed || strcmp(entry_name(desc, e), name) != 0)
+            continue;
+
+        if (e->index == desc->hdr.e_shstrndx)
+            PROFILER_RERR("The section name table can't be removed", -1);
+
+        e->removed = 1;
+        layout->nremoved++;
+        layout->changed = 1;
+
+        PROFILER_ROUT(0, "%d");
+    }
+
+    PROFILER_RERR("No such section", -1);
+}
+
+/*
+ * Leaves `pad` more zero bytes before a section, moving it and everything
+ * laid out after it. Outside ET_REL files allocated sections of the file
+ * have offsets fixed by their addresses and can't be shifted.
+ */
+int shift_section(shelfobj_t *desc, shelfsect_t *sect, uint64_t pad)
+{
+    shelflsect_t *e;
+
+    PROFILER_IN();
+
+    if (desc == NULL || sect == NULL)
+        PROFILER_RERR("Null argument passed to shift_section()\n", -1);
+
+    if (shelf_layout_load(desc) == NULL)
+        PROFILER_RERR(shelf_error, -1);
+
+    if ((e = entry_of(desc, sect)) == NULL || e->removed || e->index == 0)
+        PROFILER_RERR("Section is not part of the layout", -1);
+
+    if (desc->hdr.e_type != ET_REL && e->index < desc->layout->norig &&
+        (entry_shdr(desc, e)->sh_flags & SHF_ALLOC))
+        PROFILER_RERR("Loaded sections of a linked file can't move", -1);
+
+    e->pad += pad;
+    desc->layout->changed |= pad != 0;
+
+    PROFILER_ROUT(0, "%d");
+}
+
+/*
+ * Exchanges two sections' places in the section header table, and with
+ * them their order in the file where they aren't fixed by a segment.
+ */
+int swap_sections(shelfobj_t *desc, shelfsect_t *sect_a, shelfsect_t *sect_b)
+{
+    shelflsect_t *a, *b;
+    uint32_t pos;
+
+    PROFILER_IN();
+
+    if (desc == NULL || sect_a == NULL || sect_b == NULL)
+        PROFILER_RERR("Null argument passed to swap_sections()\n", -1);
+
+    if (shelf_layout_load(desc) == NULL)
+        PROFILER_RERR(shelf_error, -1);
+
+    if ((a = entry_of(desc, sect_a)) == NULL || (b = entry_of(desc, sect_b)) == NULL ||
+        a->removed || b->removed || a->index == 0 || b->index == 0)
+        PROFILER_RERR("Section is not part of the layout", -1);
+
+    pos = a->pos;
+    a->pos = b->pos;
+    b->pos = pos;
+    desc->layout->order[a->pos] = a;
+    desc->layout->order[b->pos] = b;
+    desc->layout->changed |= a != b;
+
+    PROFILER_ROUT(0, "%d");
+}
+
+/*
+ * The builder for one of the file's string tables, made over its current
+ * contents the first time names are added to it.
+ */
+shelfstrtab_t *shelf_layout_strtab(shelfobj_t *desc, uint32_t index)
+{
+    shelflayout_t *layout;
+    const void *base;
+
+    PROFILER_IN();
+
+    if (desc == NULL)
+        PROFILER_RERR("Null argument passed to shelf_layout_strtab()\n", NULL);
+
+    if ((layout = shelf_layout_load(desc)) == NULL)
+        PROFILER_RERR(shelf_error, NULL);
+
+    if (index >= layout->norig || desc->sht[index].sh_type != SHT_STRTAB)
+        PROFILER_RERR("Not a string table", NULL);
+
+    if (layout->strtabs == NULL && (layout->strtabs = calloc(layout->norig, sizeof(shelfstrtab_t *))) == NULL)
+        PROFILER_RERR("Malloc for string tables failed", NULL);
+
+    if (layout->strtabs[index] != NULL)
+        PROFILER_ROUT(layout->strtabs[index], "shelfstrtab_t: %p");
+
+    if ((base = get_section_data(desc, &desc->sect_list[index])) == NULL)
+        PROFILER_RERR("Section data lies outside of the file", NULL);
+
+    layout->strtabs[index] = shelf_strtab_new(base, desc->sht[index].sh_size);
+
+    PROFILER_ROUT(layout->strtabs[index], "shelfstrtab_t: %p");
+}
+
+/*
+ * Whether one of the file's sections keeps its offset and size: outside
+ * ET_REL files, allocated sections are tied to their addresses.
+ */
+static int is_pinned(const shelfobj_t *desc, uint32_t index)
+{
+    return desc->hdr.e_type != ET_REL && (desc->sht[index].sh_flags & SHF_ALLOC) &&
+           index != desc->hdr.e_shstrndx;
+}
+
+/*
+ * Records a symbol edit, interning its name in the table's string table.
+ * Edits that would grow a pinned table are refused here rather than when
+ * the layout is planned, so they never enter the layout.
+ */
+static int stage_symbol(shelfobj_t *desc, uint32_t table, uint32_t index, const shelfsym_t *sym,
+                        const char *name)
+{
+    shelflayout_t *layout = desc->layout;
+    shelfstrtab_t *tab;
+    shelflsym_t *s;
+    uint32_t id, link;
+
+    if (table >= layout->norig || layout->orig[table].removed ||
+        (desc->sht[table].sh_type != SHT_SYMTAB && desc->sht[table].sh_type != SHT_DYNSYM)) {
+        shelf_error = "Not a symbol table";
+        return -1;
+    }
+
+    // DT_HASH and DT_GNU_HASH are keyed by name and aren't rebuilt.
+    if (desc->sht[table].sh_type == SHT_DYNSYM && index != UINT32_MAX &&
+        (desc->hdr.e_type == ET_EXEC || desc->hdr.e_type == ET_DYN)) {
+        shelf_error = "Dynamic symbols of a linked file can't be renamed";
+        return -1;
+    }
+
+    if ((link = desc->sht[table].sh_link) >= layout->norig) {
+        shelf_error = "Symbol table has no string table";
+        return -1;
+    }
+
+    if (index == UINT32_MAX && is_pinned(desc, table)) {
+        shelf_error = "Loaded sections of a linked file can't change size";
+        return -1;
+    }
+
+    if ((tab = shelf_layout_strtab(desc, link)) == NULL)
+        return -1;
+
+    if (is_pinned(desc, link) && !shelf_strtab_hosts(tab, name)) {
+        shelf_error = "Loaded sections of a linked file can't change size";
+        return -1;
+    }
+
+    if ((id = shelf_strtab_add(tab, name)) == UINT32_MAX) {
+        shelf_error = "Malloc for symbol name failed";
+        return -1;
+    }
+
+    if (layout->nsyms == layout->syms_cap) {
+        size_t cap = layout->syms_cap ? layout->syms_cap * 2 : 64;
+        shelflsym_t *grown = realloc(layout->syms, cap * sizeof(shelflsym_t));
+
+        if (grown == NULL) {
+            shelf_error = "Malloc for symbol edits failed";
+            return -1;
+        }
+
+        layout->syms = grown;
+        layout->syms_cap = cap;
+    }
+
+    s = &layout->syms[layout->nsyms++];
+    s->table = table;
+    s->index = index;
+    s->name = id;
+
+    if (sym != NULL)
+        s->sym = *sym;
+
+    layout->changed = 1;
+
+    return 0;
+}
+
+/*
+ * Adds a symbol to a symbol table. Local symbols go after the table's
+ * last local, which renumbers the globals after them; relocations and
+ * group signatures referring to those are renumbered to match. Global
+ * symbols are appended. st_shndx is in the layout's index space.
+ */
+int shelf_layout_add_symbol(shelfobj_t *desc, uint32_t table, const shelfsym_t *sym, const char *name)
+{
+    PROFILER_IN();
+
+    if (desc == NULL || sym == NULL || name == NULL)
+        PROFILER_RERR("Null argument passed to shelf_layout_add_symbol()\n", -1);
+
+    if (shelf_layout_load(desc) == NULL || stage_symbol(desc, table, UINT32_MAX, sym, name) != 0)
+        PROFILER_RERR(shelf_error, -1);
+
+    PROFILER_ROUT(0, "%d");
+}
+
+/*
+ * Renames symbol `index` of a symbol table. The last rename wins. The
+ * .dynsym of an executable or shared object can't be renamed, since its
+ * hash tables would still find the old names. A decoded symbol takes its
+ * new name right away, and gets the file's back if the rename is dropped.
+ */
+int shelf_layout_rename_symbol(shelfobj_t *desc, uint32_t table, uint32_t index, const char *name)
+{
+    size_t symsize;
+
+    PROFILER_IN();
+
+    if (desc == NULL || name == NULL)
+        PROFILER_RERR("Null argument passed to shelf_layout_rename_symbol()\n", -1);
+
+    if (shelf_layout_load(desc) == NULL)
+        PROFILER_RERR(shelf_error, -1);
+
+    symsize = desc->ei_class == ELFCLASS64 ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym);
+
+    if (table < desc->layout->norig && index >= desc->sht[table].sh_size / symsize)
+        PROFILER_RERR("No such symbol", -1);
+
+    if (stage_symbol(desc, table, index, NULL, name) != 0)
+        PROFILER_RERR(shelf_error, -1);
+
+    // Name keyed caches were built over the old name.
+    if (sync_name(desc, desc->layout, &desc->layout->syms[desc->layout->nsyms - 1], 0)) {
+        shelf_symcols_free(desc);
+        shelf_nameidx_free(desc);
+    }
+
+    PROFILER_ROUT(0, "%d");
+}
+
+static uint64_t align_up(uint64_t v, uint64_t align)
+{
+    return align > 1 ? (v + align - 1) / align * align : v;
+}
+
+static void *plan_own(shelflplan_t *plan, void *buf, size_t *cap)
+{
+    if (plan->nowned == *cap) {
+        size_t grown_cap = *cap ? *cap * 2 : 16;
+        void **grown = realloc(plan->owned, grown_cap * sizeof(void *));
+
+        if (grown == NULL)
+            return NULL;
+
+        plan->owned = grown;
+        *cap = grown_cap;
+    }
+
+    return plan->owned[plan->nowned++] = buf;
+}
+
+/*
+ * A copy of a symbol table or group with its section indices renumbered.
+ * Indices of removed sections become SHN_UNDEF; reserved ones are kept.
+ */
+static void *remap_contents(shelfobj_t *desc, const shelf_Shdr *shdr, const void *src,
+                            const uint32_t *newidx, size_t nidx)
+{
+    unsigned char *buf = malloc(shdr->sh_size ? shdr->sh_size : 1);
+
+    if (buf == NULL)
+        return NULL;
+
+    memcpy(buf, src, shdr->sh_size);
+
+    if (shdr->sh_type == SHT_GROUP) {
+        for (uint64_t at = 4; at + 4 <= shdr->sh_size; at += 4) {
+            uint32_t idx = desc->read_dword(buf + at);
+
+            if (idx < nidx)
+                desc->write_dword(buf + at, newidx[idx]);
+        }
+        return buf;
+    }
+
+    size_t symsize = desc->ei_class == ELFCLASS64 ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym);
+    size_t shndx = desc->ei_class == ELFCLASS64 ? 6 : 14;
+
+    for (uint64_t at = 0; at + symsize <= shdr->sh_size; at += symsize) {
+        uint16_t idx = desc->read_word(buf + at + shndx);
+
+        if (idx != SHN_UNDEF && idx < SHN_LORESERVE && idx < nidx)
+            desc->write_word(buf + at + shndx, newidx[idx]);
+    }
+
+    return buf;
+}
+
+/*
+ * Where the bytes of a section of the file come from: the private copy,
+ * the transaction's overlay, or the file itself.
+ */
+static int source_of(shelfobj_t *desc, uint32_t index, shelflplace_t *place)
+{
+    shelfsect_t *sect = &desc->sect_list[index];
+    const shelf_Shdr *shdr = &desc->sht[index];
+
+    place->len = shdr->sh_size;
+    place->buf = NULL;
+    place->src = shdr->sh_offset;
+
+    if (sect->data_owner == SECT_DATA_MALLOC) {
+        if (shelf_section_is_compressed(desc, sect)) {
+            shelf_error = "Writing edited compressed sections is not supported";
+            return -1;
+        }
+        place->buf = sect->data;
+        if (place->len > sect->data_len)
+            place->len = sect->data_len;
+        return 0;
+    }
+
+    if (!sect->verified) {
+        shelf_error = "Section data lies outside of the file";
+        return -1;
+    }
+
+    if (shelf_journal_overlaps(desc, shdr->sh_offset, shdr->sh_size) &&
+        !shelf_section_is_compressed(desc, sect)) {
+        if ((place->buf = shelf_journal_section(desc, sect)) == NULL)
+            return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * A symbol table with the pending edits applied: added locals after the
+ * last local, added globals at the end, and names pointing into the laid
+ * out string table.
+ */
+static void *build_symtab(shelfobj_t *desc, uint32_t table, const unsigned char *src, uint64_t size,
+                          uint32_t newlocals, uint64_t *len)
+{
+    shelflayout_t *layout = desc->layout;
+    shelfstrtab_t *tab = layout->strtabs[desc->sht[table].sh_link];
+    size_t symsize = desc->ei_class == ELFCLASS64 ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym);
+    uint64_t n = size / symsize, info = desc->sht[table].sh_info, count = n;
+    unsigned char *buf, *at;
+
+    if (info > n)
+        info = n;
+
+    if (shelf_strtab_finalize(tab) != 0)
+        return NULL;
+
+    for (size_t i = 0; i < layout->nsyms; i++)
+        count += layout->syms[i].table == table && layout->syms[i].index == UINT32_MAX;
+
+    if ((buf = malloc(count ? count * symsize : 1)) == NULL)
+        return NULL;
+
+    memcpy(buf, src, info * symsize);
+    at = buf + info * symsize;
+
+    for (int global = 0; global < 2; global++) {
+        for (size_t i = 0; i < layout->nsyms; i++) {
+            shelflsym_t *s = &layout->syms[i];
+
+            if (s->table != table || s->index != UINT32_MAX ||
+                (ELF64_ST_BIND(s->sym.st_info) != STB_LOCAL) != global)
+                continue;
+
+            s->sym.st_name = shelf_strtab_offset(tab, s->name);
+            shelf_encode_sym(desc, &s->sym, at);
+            at += symsize;
+        }
+
+        if (!global) {
+            memcpy(at, src + info * symsize, (n - info) * symsize);
+            at += (n - info) * symsize;
+        }
+    }
+
+    for (size_t i = 0; i < layout->nsyms; i++) {
+        const shelflsym_t *s = &layout->syms[i];
+
+        if (s->table == table && s->index != UINT32_MAX) {
+            uint64_t idx = s->index < info ? s->index : s->index + newlocals;
+
+            desc->write_dword(buf + idx * symsize, shelf_strtab_offset(tab, s->name));
+        }
+    }
+
+    *len = count * symsize;
+
+    return buf;
+}
+
+/*
+ * A copy of a relocation section with references to symbols at or past
+ * `first` moved up by `shift`, for locals added before them.
+ */
+static void *shift_relocs(shelfobj_t *desc, const shelf_Shdr *shdr, const unsigned char *src,
+                          uint32_t first, uint32_t shift)
+{
+    int is64 = desc->ei_class == ELFCLASS64;
+    size_t entsize = shdr->sh_type == SHT_RELA ? (is64 ? 24 : 12) : (is64 ? 16 : 8);
+    unsigned char *buf = malloc(shdr->sh_size ? shdr->sh_size : 1);
+
+    if (buf == NULL)
+        return NULL;
+
+    memcpy(buf, src, shdr->sh_size);
+
+    for (uint64_t at = 0; at + entsize <= shdr->sh_size; at += entsize) {
+        if (is64) {
+            uint64_t info = desc->read_qword(buf + at + 8);
+
+            if (ELF64_R_SYM(info) >= first)
+                desc->write_qword(buf + at + 8, info + ((uint64_t) shift << 32));
+        } else {
+            uint32_t info = desc->read_dword(buf + at + 4);
+
+            if (ELF32_R_SYM(info) >= first)
+                desc->write_dword(buf + at + 4, info + (shift << 8));
+        }
+    }
+
+    return buf;
+}
+
+/*
+ * Lay out the descriptor's sections with the pending changes applied, in
+ * one pass over the output order for each of:
+ *
+ *  - indices: the output index of every section is its place among those
+ *    kept, and sh_link, sh_info (for relocations and SHF_INFO_LINK),
+ *    e_shstrndx, symbol st_shndx and group members are renumbered through
+ *    that map;
+ *  - names: the section name table is rebuilt with tail merging;
+ *  - contents: pending symbols are written into their tables, string
+ *    tables with a builder are laid out and symbol references past added
+ *    locals renumbered;
+ *  - offsets: sections not fixed in the prefix are packed after it in
+ *    order, each after its padding and aligned to sh_addralign, SHT_NOBITS
+ *    ones taking no space, and the section header table follows them.
+ *
+ * Segments holding sections that moved are then stretched over their
+ * members' new extents. The descriptor is left as it is. Free the plan
+ * with shelf_layout_plan_free().
+ */
+int shelf_layout_plan(shelfobj_t *desc, shelflplan_t *plan)
+{
+    shelflayout_t *layout;
+    uint32_t *newidx = NULL, *names = NULL, *newlocals = NULL, *edits = NULL;
+    uint64_t *oldoff = NULL;
+    shelflplace_t *content = NULL;
+    size_t owned_cap = 0;
+
+    PROFILER_IN();
+
+    if (desc == NULL || plan == NULL)
+        PROFILER_RERR("Null argument passed to shelf_layout_plan()\n", -1);
+
+    memset(plan, 0, sizeof(shelflplan_t));
+
+    if ((layout = shelf_layout_load(desc)) == NULL)
+        PROFILER_RERR(shelf_error, -1);
+
+    size_t norig = layout->norig;
+    size_t nidx = norig + layout->nadded;
+    size_t kept = layout->count - layout->nremoved;
+    int rel = desc->hdr.e_type == ET_REL;
+    size_t shentsize = desc->ei_class == ELFCLASS64 ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr);
+    uint64_t ehsize = desc->ei_class == ELFCLASS64 ? sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr);
+    uint64_t file_size = desc->file_stat.st_size;
+    int renumbered = 0;
+
+    if (kept >= SHN_LORESERVE) {
+        shelf_error = "Too many sections for the section header table";
+        goto error;
+    }
+
+    plan->hdr = desc->hdr;
+
+    if ((newidx = calloc(nidx, sizeof(uint32_t))) == NULL ||
+        (oldoff = calloc(norig, sizeof(uint64_t))) == NULL ||
+        (names = calloc(kept, sizeof(uint32_t))) == NULL ||
+        (newlocals = calloc(norig, sizeof(uint32_t))) == NULL ||
+        (edits = calloc(norig, sizeof(uint32_t))) == NULL ||
+        (content = calloc(kept, sizeof(shelflplace_t))) == NULL ||
+        (plan->sht = calloc(kept, sizeof(shelf_Shdr))) == NULL ||
+        (plan->places = calloc(kept + (desc->journal ? desc->journal->count : 0), sizeof(shelflplace_t))) == NULL ||
+        (desc->hdr.e_phnum && (plan->pht = malloc(desc->hdr.e_phnum * sizeof(Elf64_Phdr))) == NULL) ||
+        (plan->names = shelf_strtab_new(NULL, 0)) == NULL) {
+        shelf_error = "Malloc for layout failed";
+        goto error;
+    }
+
+    if (desc->hdr.e_phnum)
+        memcpy(plan->pht, desc->pht, desc->hdr.e_phnum * sizeof(Elf64_Phdr));
+
+    for (size_t i = 0, j = 0; i < layout->count; i++) {
+        shelflsect_t *e = layout->order[i];
+
+        if (e->removed)
+            continue;
+
+        newidx[e->index] = j;
+        renumbered |= e->index != j;
+        j++;
+    }
+
+    renumbered |= layout->nremoved != 0;
+
+    for (size_t i = 0; i < layout->nsyms; i++) {
+        const shelflsym_t *s = &layout->syms[i];
+
+        edits[s->table]++;
+        newlocals[s->table] += s->index == UINT32_MAX && ELF64_ST_BIND(s->sym.st_info) == STB_LOCAL;
+    }
+
+    /* Headers with their links in the new numbering. */
+    for (size_t i = 0, j = 0; i < layout->count; i++) {
+        shelflsect_t *e = layout->order[i];
+        shelf_Shdr *shdr = &plan->sht[j];
+
+        if (e->removed)
+            continue;
+
+        *shdr = *entry_shdr(desc, e);
+        names[j] = shelf_strtab_add(plan->names, e->index ? entry_name(desc, e) : "");
+
+        if (names[j] == UINT32_MAX) {
+            shelf_error = "Malloc for section name table failed";
+            goto error;
+        }
+
+        // Group signatures are symbols, renumbered past added locals.
+        if (shdr->sh_type == SHT_GROUP && shdr->sh_link < norig && newlocals[shdr->sh_link] &&
+            shdr->sh_info >= desc->sht[shdr->sh_link].sh_info)
+            shdr->sh_info += newlocals[shdr->sh_link];
+
+        if (shdr->sh_link < nidx)
+            shdr->sh_link = newidx[shdr->sh_link];
+
+        if ((shdr->sh_type == SHT_REL || shdr->sh_type == SHT_RELA ||
+             (shdr->sh_flags & SHF_INFO_LINK)) && shdr->sh_info < nidx)
+            shdr->sh_info = newidx[shdr->sh_info];
+
+        j++;
+    }
+
+    if (shelf_strtab_finalize(plan->names) != 0)
+        goto error;
+
+    for (size_t j = 0; j < kept; j++)
+        plan->sht[j].sh_name = shelf_strtab_offset(plan->names, names[j]);
+
+    plan->hdr.e_shnum = kept;
+    plan->hdr.e_shentsize = shentsize;
+    plan->hdr.e_shstrndx = newidx[desc->hdr.e_shstrndx];
+
+    /* Contents. */
+    for (size_t i = 0, j = 0; i < layout->count; i++) {
+        shelflsect_t *e = layout->order[i];
+        shelf_Shdr *shdr = &plan->sht[j];
+        shelflplace_t *place = &content[j];
+        uint32_t index = e->index;
+        void *copy = NULL;
+
+        if (e->removed)
+            continue;
+
+        j++;
+
+        if (index == 0 || shdr->sh_type == SHT_NOBITS)
+            continue;
+
+        if (index == desc->hdr.e_shstrndx) {
+            place->buf = plan->names->data;
+            shdr->sh_size = place->len = plan->names->size;
+            continue;
+        }
+
+        if (index >= norig) {
+            place->buf = e->sect.data;
+            place->len = shdr->sh_size;
+        } else if (source_of(desc, index, place) != 0) {
+            goto error;
+        }
+
+        if (place->len == 0)
+            continue;
+
+        if (place->buf == NULL && desc->data == NULL) {
+            shelf_error = "Section data lies outside of the file";
+            goto error;
+        }
+
+        const unsigned char *src = place->buf ? place->buf : desc->data + place->src;
+        uint32_t link = index < norig ? desc->sht[index].sh_link : norig;
+
+        if (index < norig && layout->strtabs != NULL && layout->strtabs[index] != NULL) {
+            if (shelf_strtab_finalize(layout->strtabs[index]) != 0)
+                goto error;
+            place->buf = layout->strtabs[index]->data;
+            shdr->sh_size = place->len = layout->strtabs[index]->size;
+        } else if (index < norig && edits[index]) {
+            uint64_t len;
+
+            if ((copy = build_symtab(desc, index, src, place->len, newlocals[index], &len)) == NULL)
+                goto nomem;
+            shdr->sh_size = place->len = len;
+            shdr->sh_info += newlocals[index];
+        } else if ((shdr->sh_type == SHT_REL || shdr->sh_type == SHT_RELA) && link < norig && newlocals[link]) {
+            if ((copy = shift_relocs(desc, shdr, src, desc->sht[link].sh_info, newlocals[link])) == NULL)
+                goto nomem;
+        }
+
+        if (copy != NULL) {
+            if (plan_own(plan, copy, &owned_cap) == NULL) {
+                free(copy);
+                goto nomem;
+            }
+            place->buf = copy;
+        }
+
+        if (renumbered && (shdr->sh_type == SHT_SYMTAB || shdr->sh_type == SHT_DYNSYM ||
+                           shdr->sh_type == SHT_GROUP)) {
+            copy = remap_contents(desc, shdr, place->buf ? place->buf : src, newidx, nidx);
+
+            if (copy == NULL || plan_own(plan, copy, &owned_cap) == NULL) {
+                free(copy);
+                goto nomem;
+            }
+
+            place->buf = copy;
+        }
+    }
+
+    /*
+     * The prefix: the headers, and outside ET_REL files all segments and
+     * every allocated section of the file, at their old offsets.
+     */
+    plan->prefix = ehsize;
+
+    if (desc->hdr.e_phnum && desc->hdr.e_phoff + (uint64_t) desc->hdr.e_phnum * desc->hdr.e_phentsize > plan->prefix)
+        plan->prefix = desc->hdr.e_phoff + (uint64_t) desc->hdr.e_phnum * desc->hdr.e_phentsize;
+
+    for (size_t i = 0; !rel && i < desc->hdr.e_phnum; i++) {
+        if (desc->pht[i].p_offset + desc->pht[i].p_filesz > plan->prefix)
+            plan->prefix = desc->pht[i].p_offset + desc->pht[i].p_filesz;
+    }
+
+    for (size_t i = 0; !rel && i < norig; i++) {
+        const shelf_Shdr *shdr = &desc->sht[i];
+
+        if (!layout->orig[i].removed && (shdr->sh_flags & SHF_ALLOC) && shdr->sh_type != SHT_NOBITS &&
+            i != desc->hdr.e_shstrndx && shdr->sh_offset + shdr->sh_size > plan->prefix)
+            plan->prefix = shdr->sh_offset + shdr->sh_size;
+    }
+
+    if (plan->prefix > file_size)
+        plan->prefix = file_size;
+
+    /* Offsets. */
+    uint64_t cursor = plan->prefix;
+
+    for (size_t i = 0, j = 0; i < layout->count; i++) {
+        shelflsect_t *e = layout->order[i];
+        shelf_Shdr *shdr = &plan->sht[j];
+        shelflplace_t *place = &content[j];
+        int orig = e->index < norig;
+
+        if (e->removed)
+            continue;
+
+        j++;
+
+        if (orig)
+            oldoff[e->index] = shdr->sh_offset;
+
+        if (e->index == 0)
+            continue;
+
+        int pinned = orig && is_pinned(desc, e->index);
+
+        if (pinned && shdr->sh_size != desc->sht[e->index].sh_size) {
+            shelf_error = "Loaded sections of a linked file can't change size";
+            goto error;
+        }
+
+        if (!pinned) {
+            shdr->sh_offset = align_up(cursor + e->pad, shdr->sh_addralign);
+            if (shdr->sh_type != SHT_NOBITS)
+                cursor = shdr->sh_offset + shdr->sh_size;
+        }
+
+        if (shdr->sh_type == SHT_NOBITS || place->len == 0)
+            continue;
+
+        /* Pinned sections are in the prefix already unless they changed. */
+        if (pinned && place->buf == NULL)
+            continue;
+
+        place->offset = shdr->sh_offset;
+        plan->places[plan->nplaces++] = *place;
+    }
+
+    /*
+     * Segments over sections that moved keep their bytes before the first
+     * member and after the last one.
+     */
+    shelfsegmap_t *map = rel || !desc->hdr.e_phnum ? NULL : shelf_segmap_load(desc);
+
+    for (size_t p = 0; map != NULL && p < map->nsegs && p < desc->hdr.e_phnum; p++) {
+        const uint64_t *row = shelf_segmap_sections_of(map, p);
+        Elf64_Phdr *phdr = &plan->pht[p];
+        uint64_t first = UINT64_MAX, last = 0, first_new = 0, last_new = 0;
+        int moved = 0;
+
+        for (size_t s = 0; s < map->nsects && s < layout->norig; s++) {
+            const shelf_Shdr *old = &desc->sht[s];
+
+            if (!(row[s / 64] >> (s % 64) & 1) || layout->orig[s].removed || old->sh_type == SHT_NOBITS)
+                continue;
+
+            uint64_t now = plan->sht[newidx[s]].sh_offset;
+
+            moved |= now != oldoff[s];
+
+            if (old->sh_offset < first) {
+                first = old->sh_offset;
+                first_new = now;
+            }
+            if (old->sh_offset + old->sh_size >= last) {
+                last = old->sh_offset + old->sh_size;
+                last_new = now + plan->sht[newidx[s]].sh_size;
+            }
+        }
+
+        if (!moved || first == UINT64_MAX)
+            continue;
+
+        uint64_t head = first - desc->pht[p].p_offset;
+        uint64_t tail = desc->pht[p].p_offset + desc->pht[p].p_filesz - last;
+        uint64_t filesz = last_new + tail - (first_new - head);
+
+        phdr->p_offset = first_new - head;
+        phdr->p_memsz = phdr->p_memsz - phdr->p_filesz + filesz;
+        phdr->p_filesz = filesz;
+    }
+
+    /* Journal edits to the prefix; those past it were taken with their sections. */
+    for (size_t i = 0; desc->journal != NULL && i < desc->journal->count; i++) {
+        const shelfextent_t *x = &desc->journal->extents[i];
+
+        if (x->offset >= plan->prefix)
+            continue;
+
+        plan->places[plan->nplaces++] = (shelflplace_t) {
+            x->offset, x->offset + x->len > plan->prefix ? plan->prefix - x->offset : x->len, 0, x->bytes
+        };
+    }
+
+    plan->hdr.e_shoff = align_up(cursor, desc->ei_class == ELFCLASS64 ? 8 : 4);
+    plan->size = plan->hdr.e_shoff + kept * shentsize;
+
+    free(newidx);
+    free(oldoff);
+    free(names);
+    free(newlocals);
+    free(edits);
+    free(content);
+
+    PROFILER_ROUT(0, "%d");
+
+nomem:
+    shelf_error = "Malloc for section contents failed";
+
+error:
+    free(newidx);
+    free(oldoff);
+    free(names);
+    free(newlocals);
+    free(edits);
+    free(content);
+    shelf_layout_plan_free(plan);
+
+    PROFILER_RERR(shelf_error, -1);
+}
+
+void shelf_layout_plan_free(shelflplan_t *plan)
+{
+    if (plan == NULL)
+        return;
+
+    for (size_t i = 0; i < plan->nowned; i++)
+        free(plan->owned[i]);
+
+    free(plan->owned);
+    free(plan->places);
+    free(plan->pht);
+    free(plan->sht);
+    shelf_strtab_free(plan->names);
+    memset(plan, 0, sizeof(shelflplan_t));
+}
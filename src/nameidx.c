@@ -0,0 +1,263 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shelf.h"
+#include "shelf_profiler.h"
+#include "symbol.h"
+#include "iter.h"
+#include "nameidx.h"
+
+
+static uint32_t gram_hash(const unsigned char *s, size_t mask)
+{
+    return (((uint32_t) s[0] << 16 | (uint32_t) s[1] << 8 | s[2]) * 2654435761u >> 8) & mask;
+}
+
+static int cmp_names(const void *a, const void *b, void *arg)
+{
+    const shelfsym_t *syms = arg;
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    int r = strcmp(syms[x].name, syms[y].name);
+
+    // Keep table order within equal names.
+    return r ? r : (x > y) - (x < y);
+}
+
+/*
+ * Build the trigram postings in two passes over the distinct names: count
+ * per bucket, then fill. A name hitting the same bucket twice is posted
+ * once, since the bucket's last posting is then that name.
+ */
+static int build_grams(shelfnameidx_t *idx)
+{
+    size_t total = 0;
+
+    idx->nbuckets = 1024;
+    while (idx->nbuckets < idx->count * 2 && idx->nbuckets < (1u << 22))
+        idx->nbuckets <<= 1;
+
+    size_t mask = idx->nbuckets - 1;
+    uint32_t *last = malloc(idx->nbuckets * sizeof(uint32_t));
+
+    if (last == NULL || (idx->gram_start = calloc(idx->nbuckets + 1, sizeof(uint32_t))) == NULL) {
+        free(last);
+        return -1;
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        memset(last, 0xff, idx->nbuckets * sizeof(uint32_t));
+
+        for (size_t i = 0; i < idx->count; i++) {
+            if (i > 0 && !strcmp(idx->names[i], idx->names[i - 1]))
+                continue;
+
+            const unsigned char *s = (const unsigned char *) idx->names[i];
+
+            for (size_t j = 0; s[j] && s[j + 1] && s[j + 2]; j++) {
+                uint32_t b = gram_hash(s + j, mask);
+
+                if (last[b] == i)
+                    continue;
+
+                last[b] = i;
+
+                if (pass == 0)
+                    idx->gram_start[b + 1]++;
+                else
+                    idx->postings[idx->gram_start[b]++] = i;
+            }
+        }
+
+        if (pass == 0) {
+            for (size_t b = 0; b < idx->nbuckets; b++)
+                idx->gram_start[b + 1] += idx->gram_start[b];
+
+            total = idx->gram_start[idx->nbuckets];
+
+            if ((idx->postings = malloc((total ? total : 1) * sizeof(uint32_t))) == NULL) {
+                free(last);
+                return -1;
+            }
+        }
+    }
+
+    /* The fill pass advanced each gram_start[b] to the start of bucket b + 1. */
+    memmove(idx->gram_start + 1, idx->gram_start, idx->nbuckets * sizeof(uint32_t));
+    idx->gram_start[0] = 0;
+
+    free(last);
+
+    return 0;
+}
+
+static void free_idx(shelfnameidx_t *idx)
+{
+    if (idx == NULL)
+        return;
+
+    free(idx->names);
+    free(idx->order);
+    free(idx->gram_start);
+    free(idx->postings);
+    free(idx);
+}
+
+shelfnameidx_t *shelf_nameidx_load(shelfobj_t *desc, int table)
+{
+    shelfnameidx_t *idx;
+    shelfsym_t *syms;
+    size_t n;
+
+    PROFILER_IN();
+
+    if (desc == NULL || (table != SHELF_SYMTAB_STATIC && table != SHELF_SYMTAB_DYNAMIC))
+        PROFILER_RERR("Invalid argument passed to shelf_nameidx_load()\n", NULL);
+
+    if (desc->nameidx[table] != NULL)
+        PROFILER_ROUT(desc->nameidx[table], "shelfnameidx_t *: %p");
+
+    if (table == SHELF_SYMTAB_STATIC) {
+        if (shelf_load_symtab(desc) != 0)
+            PROFILER_RERR(shelf_error, NULL);
+        syms = desc->symtab;
+        n = desc->symcount;
+    } else if ((syms = shelf_load_dynsym(desc, &n)) == NULL) {
+        n = 0;
+    }
+
+    if ((idx = calloc(1, sizeof(shelfnameidx_t))) == NULL)
+        PROFILER_RERR("Malloc for name index failed\n", NULL);
+
+    idx->order = malloc((n ? n : 1) * sizeof(uint32_t));
+    idx->names = malloc((n ? n : 1) * sizeof(char *));
+
+    if (idx->order == NULL || idx->names == NULL) {
+        free_idx(idx);
+        PROFILER_RERR("Malloc for name index failed\n", NULL);
+    }
+
+    for (size_t i = 0; syms != NULL && i < n; i++) {
+        if (syms[i].name != NULL && syms[i].name[0] != '\0')
+            idx->order[idx->count++] = i;
+    }
+
+    qsort_r(idx->order, idx->count, sizeof(uint32_t), cmp_names, syms);
+
+    for (size_t i = 0; i < idx->count; i++)
+        idx->names[i] = syms[idx->order[i]].name;
+
+    if (build_grams(idx) != 0) {
+        free_idx(idx);
+        PROFILER_RERR("Malloc for name index failed\n", NULL);
+    }
+
+    desc->nameidx[table] = idx;
+
+    PROFILER_ROUT(idx, "shelfnameidx_t *: %p");
+}
+
+void shelf_nameidx_free(shelfobj_t *desc)
+{
+    if (desc == NULL)
+        return;
+
+    for (int i = 0; i < 2; i++) {
+        free_idx(desc->nameidx[i]);
+        desc->nameidx[i] = NULL;
+    }
+}
+
+/*
+ * Find the names starting with `prefix`. They are idx->names[*first] up to
+ * the returned count; idx->order maps them back to symbol indices.
+ */
+size_t shelf_nameidx_prefix(const shelfnameidx_t *idx, const char *prefix, size_t *first)
+{
+    size_t len = strlen(prefix);
+    size_t lo = 0, hi = idx->count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (strncmp(idx->names[mid], prefix, len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    *first = lo;
+    hi = idx->count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (strncmp(idx->names[mid], prefix, len) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo - *first;
+}
+
+/*
+ * Emit every entry of the run of equal names starting at `pos`.
+ */
+static size_t emit_run(const shelfnameidx_t *idx, size_t pos, uint32_t *out, size_t max, size_t n)
+{
+    size_t i = pos;
+
+    do {
+        if (n < max)
+            out[n] = idx->order[i];
+        n++;
+        i++;
+    } while (i < idx->count && !strcmp(idx->names[i], idx->names[pos]));
+
+    return n;
+}
+
+/*
+ * Find the symbols whose name contains `needle`, writing up to `max` symbol
+ * indices to `out`. Returns the total number of matches, which may exceed
+ * `max`. Needles of three or more bytes only check the names posted under
+ * the needle's rarest trigram bucket; shorter ones scan the sorted names.
+ */
+size_t shelf_nameidx_substr(const shelfnameidx_t *idx, const char *needle, uint32_t *out, size_t max)
+{
+    size_t len = strlen(needle);
+    size_t n = 0;
+
+    if (len < 3 || idx->count == 0) {
+        for (size_t i = 0; i < idx->count; i++) {
+            if (strstr(idx->names[i], needle) != NULL) {
+                if (n < max)
+                    out[n] = idx->order[i];
+                n++;
+            }
+        }
+        return n;
+    }
+
+    size_t mask = idx->nbuckets - 1;
+    uint32_t best = gram_hash((const unsigned char *) needle, mask);
+
+    for (size_t j = 1; j + 2 < len; j++) {
+        uint32_t b = gram_hash((const unsigned char *) needle + j, mask);
+
+        if (idx->gram_start[b + 1] - idx->gram_start[b] < idx->gram_start[best + 1] - idx->gram_start[best])
+            best = b;
+    }
+
+    for (uint32_t p = idx->gram_start[best]; p < idx->gram_start[best + 1]; p++) {
+        uint32_t pos = idx->postings[p];
+
+        if (strstr(idx->names[pos], needle) != NULL)
+            n = emit_run(idx, pos, out, max, n);
+    }
+
+    return n;
+}
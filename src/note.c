@@ -0,0 +1,65 @@
+#include <string.h>
+
+#include "shelf.h"
+#include "note.h"
+
+
+static inline size_t note_align(size_t v, size_t align)
+{
+    return (v + align - 1) & ~(align - 1);
+}
+
+/*
+ * Decode the note at `*offset` in `buf` and advance `*offset` past it.
+ * `align` is the segment or section alignment; anything but 8 means 4.
+ * Returns 0 on success, -1 at the end of the buffer or on a truncated note.
+ */
+int shelf_note_next(const shelfobj_t *desc, const unsigned char *buf, size_t len,
+                    size_t align, size_t *offset, shelfnote_t *note)
+{
+    size_t off = *offset;
+    size_t name_off, desc_off;
+
+    align = align == 8 ? 8 : 4;
+
+    if (off > len || len - off < sizeof(Elf64_Nhdr))
+        return -1;
+
+    note->namesz = desc->read_dword(buf + off);
+    note->descsz = desc->read_dword(buf + off + 4);
+    note->type = desc->read_dword(buf + off + 8);
+
+    name_off = off + sizeof(Elf64_Nhdr);
+
+    if (note->namesz > len - name_off)
+        return -1;
+
+    desc_off = note_align(name_off + note->namesz, align);
+
+    if (desc_off > len || note->descsz > len - desc_off)
+        return -1;
+
+    note->name = (const char *) buf + name_off;
+    note->desc = buf + desc_off;
+    *offset = note_align(desc_off + note->descsz, align);
+
+    return 0;
+}
+
+/*
+ * Find the first note with owner `name` and type `type`. Returns 0 and fills
+ * in `note` when found, -1 otherwise.
+ */
+int shelf_note_find(const shelfobj_t *desc, const unsigned char *buf, size_t len,
+                    size_t align, const char *name, uint32_t type, shelfnote_t *note)
+{
+    size_t off = 0;
+    size_t name_len = strlen(name) + 1;
+
+    while (shelf_note_next(desc, buf, len, align, &off, note) == 0) {
+        if (note->type == type && note->namesz == name_len && !memcmp(note->name, name, name_len))
+            return 0;
+    }
+
+    return -1;
+}
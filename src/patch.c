@@ -0,0 +1,258 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "shelf.h"
+#include "shelf_profiler.h"
+#include "segment.h"
+#include "patch.h"
+
+
+static int in_file(const shelfobj_t *desc, uint64_t offset, uint64_t len)
+{
+    uint64_t size = desc->file_stat.st_size;
+
+    return offset <= size && len <= size - offset;
+}
+
+/*
+ * Record [offset, offset + len) as dirty. Runs of adjacent or overlapping
+ * writes, the usual pattern, extend the last range instead of adding one.
+ */
+int shelf_patch_mark(shelfobj_t *desc, uint64_t offset, uint64_t len)
+{
+    shelfdirty_t *dirty;
+
+    if (desc == NULL || !desc->writable || !in_file(desc, offset, len))
+        return -1;
+
+    if (len == 0)
+        return 0;
+
+    if ((dirty = desc->dirty) == NULL) {
+        if ((dirty = calloc(1, sizeof(shelfdirty_t))) == NULL)
+            return -1;
+        desc->dirty = dirty;
+    }
+
+    if (dirty->count > 0) {
+        shelfrange_t *last = &dirty->ranges[dirty->count - 1];
+
+        if (offset <= last->offset + last->len && offset + len >= last->offset) {
+            uint64_t end = offset + len > last->offset + last->len ? offset + len : last->offset + last->len;
+
+            last->offset = offset < last->offset ? offset : last->offset;
+            last->len = end - last->offset;
+            return 0;
+        }
+    }
+
+    if (dirty->count == dirty->cap) {
+        size_t cap = dirty->cap ? dirty->cap * 2 : 16;
+        shelfrange_t *grown = realloc(dirty->ranges, cap * sizeof(shelfrange_t));
+
+        if (grown == NULL)
+            return -1;
+
+        dirty->ranges = grown;
+        dirty->cap = cap;
+    }
+
+    dirty->ranges[dirty->count++] = (shelfrange_t) { offset, len };
+
+    return 0;
+}
+
+/*
+ * Returns a pointer into the shared mapping for the caller to write `len`
+ * bytes at `offset` through, after marking them dirty.
+ */
+void *shelf_patch_ptr(shelfobj_t *desc, uint64_t offset, size_t len)
+{
+    PROFILER_IN();
+
+    if (desc == NULL)
+        PROFILER_RERR("Null argument passed to shelf_patch_ptr()\n", NULL);
+
+    if (!desc->writable || desc->data == NULL)
+        PROFILER_RERR("Descriptor was not opened for patching", NULL);
+
+    if (shelf_patch_mark(desc, offset, len) != 0)
+        PROFILER_RERR("Patch lies outside of the file", NULL);
+
+    PROFILER_ROUT(desc->data + offset, "void *: %p");
+}
+
+int shelf_patch(shelfobj_t *desc, uint64_t offset, const void *buf, size_t len)
+{
+    unsigned char *dst;
+
+    PROFILER_IN();
+
+    if (buf == NULL)
+        PROFILER_RERR("Null argument passed to shelf_patch()\n", -1);
+
+    if ((dst = shelf_patch_ptr(desc, offset, len)) == NULL)
+        PROFILER_RERR(shelf_error, -1);
+
+    memcpy(dst, buf, len);
+
+    PROFILER_ROUT(0, "%d");
+}
+
+/*
+ * Patch by virtual address, for GOT entries and branch targets. The range
+ * must be backed by file bytes of a single PT_LOAD.
+ */
+int shelf_patch_vaddr(shelfobj_t *desc, uint64_t vaddr, const void *buf, size_t len)
+{
+    const shelfloadseg_t *seg;
+    uint64_t offset;
+
+    PROFILER_IN();
+
+    if (desc == NULL || buf == NULL)
+        PROFILER_RERR("Null argument passed to shelf_patch_vaddr()\n", -1);
+
+    if ((seg = shelf_loadseg_find(desc, vaddr)) == NULL ||
+        shelf_vaddr_to_offset(desc, vaddr, &offset) != SHELF_ADDR_IN_FILE ||
+        len > seg->filesz - (vaddr - seg->vaddr))
+        PROFILER_RERR("Address is not backed by the file", -1);
+
+    PROFILER_ROUT(shelf_patch(desc, offset, buf, len), "%d");
+}
+
+/*
+ * Copy `len` encoded bytes into the mapping, marking only the bytes that
+ * actually changed so an untouched table costs nothing to flush.
+ */
+static void patch_changed(shelfobj_t *desc, uint64_t offset, const unsigned char *src, size_t len)
+{
+    size_t i = 0;
+
+    while (i < len) {
+        while (i < len && desc->data[offset + i] == src[i])
+            i++;
+
+        size_t start = i;
+
+        while (i < len && desc->data[offset + i] != src[i])
+            i++;
+
+        if (i > start) {
+            memcpy(desc->data + offset + start, src + start, i - start);
+            shelf_patch_mark(desc, offset + start, i - start);
+        }
+    }
+}
+
+/*
+ * Encode desc->hdr, desc->pht and desc->sht back into the mapping, for
+ * edits made to the decoded headers. Tables keep their place and size.
+ */
+int shelf_patch_headers(shelfobj_t *desc)
+{
+    unsigned char buf[sizeof(Elf64_Ehdr)];
+    size_t len;
+
+    PROFILER_IN();
+
+    if (desc == NULL)
+        PROFILER_RERR("Null argument passed to shelf_patch_headers()\n", -1);
+
+    if (!desc->writable || desc->data == NULL)
+        PROFILER_RERR("Descriptor was not opened for patching", -1);
+
+    size_t phsize = desc->ei_class == ELFCLASS64 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
+    size_t shsize = desc->ei_class == ELFCLASS64 ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr);
+
+    if ((desc->hdr.e_phnum && desc->hdr.e_phentsize < phsize) ||
+        (desc->hdr.e_shnum && desc->hdr.e_shentsize < shsize) ||
+        !in_file(desc, desc->hdr.e_phoff, (uint64_t) desc->hdr.e_phnum * desc->hdr.e_phentsize) ||
+        !in_file(desc, desc->hdr.e_shoff, (uint64_t) desc->hdr.e_shnum * desc->hdr.e_shentsize))
+        PROFILER_RERR("Header tables must keep their place in the file", -1);
+
+    len = shelf_encode_ehdr(desc, &desc->hdr, buf);
+    patch_changed(desc, 0, buf, len);
+
+    for (size_t i = 0; i < desc->hdr.e_phnum; i++) {
+        len = shelf_encode_phdr(desc, &desc->pht[i], buf);
+        patch_changed(desc, desc->hdr.e_phoff + i * desc->hdr.e_phentsize, buf, len);
+    }
+
+    for (size_t i = 0; i < desc->hdr.e_shnum; i++) {
+        len = shelf_encode_shdr(desc, &desc->sht[i], buf);
+        patch_changed(desc, desc->hdr.e_shoff + i * desc->hdr.e_shentsize, buf, len);
+    }
+
+    PROFILER_ROUT(0, "%d");
+}
+
+static int cmp_range(const void *a, const void *b)
+{
+    const shelfrange_t *x = a, *y = b;
+
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+/*
+ * msync() the dirty ranges, widened to pages and merged where they touch
+ * a common page, then forget them. Returns -1 if any range failed, in
+ * which case the ranges are kept for a retry.
+ */
+int shelf_patch_flush(shelfobj_t *desc, int flags)
+{
+    shelfdirty_t *dirty;
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    int ms = flags & SHELF_FLUSH_ASYNC ? MS_ASYNC : MS_SYNC;
+    size_t n = 0;
+
+    PROFILER_IN();
+
+    if (desc == NULL)
+        PROFILER_RERR("Null argument passed to shelf_patch_flush()\n", -1);
+
+    if ((dirty = desc->dirty) == NULL || dirty->count == 0)
+        PROFILER_ROUT(0, "%d");
+
+    qsort(dirty->ranges, dirty->count, sizeof(shelfrange_t), cmp_range);
+
+    for (size_t i = 0; i < dirty->count; i++) {
+        uint64_t start = dirty->ranges[i].offset & ~(page - 1);
+        uint64_t end = dirty->ranges[i].offset + dirty->ranges[i].len;
+
+        if (n > 0 && start <= dirty->ranges[n - 1].offset + dirty->ranges[n - 1].len) {
+            shelfrange_t *prev = &dirty->ranges[n - 1];
+
+            if (end > prev->offset + prev->len)
+                prev->len = end - prev->offset;
+            continue;
+        }
+
+        dirty->ranges[n++] = (shelfrange_t) { start, end - start };
+    }
+
+    dirty->count = n;
+
+    for (size_t i = 0; i < n; i++) {
+        if (msync(desc->data + dirty->ranges[i].offset, dirty->ranges[i].len, ms) != 0)
+            PROFILER_RERR("Flushing patched pages failed", -1);
+    }
+
+    dirty->count = 0;
+
+    PROFILER_ROUT(0, "%d");
+}
+
+void shelf_patch_free(shelfobj_t *desc)
+{
+    if (desc == NULL || desc->dirty == NULL)
+        return;
+
+    free(desc->dirty->ranges);
+    free(desc->dirty);
+    desc->dirty = NULL;
+}
@@ -0,0 +1,767 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "shelf.h"
+#include "shelf_profiler.h"
+#include "shelf_verify.h"
+#include "dynamic.h"
+#include "segment.h"
+#include "process.h"
+
+
+/* Largest image shelf_proc_open_image() will copy out of a process. */
+#define PROC_IMAGE_MAX      (1ULL << 32)
+
+/* Misses filled by one process_vm_readv() call. */
+#define PROC_BATCH          (SHELF_PROC_CACHE_PAGES / 4)
+
+static const char proc_shstrtab[] = "\0.dynsym\0.dynstr\0.shstrtab";
+
+/*
+ * Parse the text of a maps file. Lines that don't parse are skipped, so a
+ * format extension in a later kernel costs us the line, not the table.
+ */
+int shelf_proc_maps_parse(const char *text, size_t len, shelfmap_t **maps, size_t *count)
+{
+    shelfmap_t *out = NULL;
+    size_t n = 0, cap = 0;
+    const char *p = text, *end = text + len;
+
+    PROFILER_IN();
+
+    if (text == NULL || maps == NULL || count == NULL)
+        PROFILER_RERR("Null argument passed to shelf_proc_maps_parse()\n", -1);
+
+    while (p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+        size_t linelen = (eol ? eol : end) - p;
+        char line[4096 + 256], perms[5];
+        unsigned long start, stop, offset, inode;
+        unsigned int major, minor;
+        int consumed = 0;
+
+        if (linelen >= sizeof(line))
+            linelen = sizeof(line) - 1;
+
+        memcpy(line, p, linelen);
+        line[linelen] = '\0';
+        p = eol ? eol + 1 : end;
+
+        if (sscanf(line, "%lx-%lx %4s %lx %x:%x %lu %n",
+                   &start, &stop, perms, &offset, &major, &minor, &inode, &consumed) < 7)
+            continue;
+
+        if (n == cap) {
+            size_t ncap = cap ? cap * 2 : 64;
+            shelfmap_t *grown = realloc(out, ncap * sizeof(shelfmap_t));
+
+            if (grown == NULL) {
+                shelf_proc_maps_free(out, n);
+                PROFILER_RERR("Malloc for maps failed\n", -1);
+            }
+
+            out = grown;
+            cap = ncap;
+        }
+
+        shelfmap_t *m = &out[n];
+
+        m->start = start;
+        m->end = stop;
+        m->offset = offset;
+        m->prot = (perms[0] == 'r' ? PF_R : 0) |
+                  (perms[1] == 'w' ? PF_W : 0) |
+                  (perms[2] == 'x' ? PF_X : 0);
+        m->dev_major = major;
+        m->dev_minor = minor;
+        m->inode = inode;
+
+        // %n is left alone when the path is empty and sscanf stops early.
+        const char *path = consumed ? line + consumed : "";
+
+        if ((m->path = strdup(path)) == NULL) {
+            shelf_proc_maps_free(out, n);
+            PROFILER_RERR("Malloc for maps failed\n", -1);
+        }
+
+        n++;
+    }
+
+    *maps = out;
+    *count = n;
+
+    PROFILER_ROUT(0, "%d");
+}
+
+/*
+ * Read /proc/<pid>/maps in one go, which keeps the window in which the
+ * kernel can tear the listing as small as we can make it. Returns a
+ * malloced buffer of `*len` bytes.
+ */
+char *shelf_proc_maps_text(pid_t pid, size_t *len)
+{
+    char path[64];
+    char *text = NULL;
+    size_t cap = 0;
+    ssize_t r;
+    int fd;
+
+    PROFILER_IN();
+
+    *len = 0;
+    snprintf(path, sizeof(path), "/proc/%d/maps", (int) pid);
+
+    if ((fd = open(path, O_RDONLY)) == -1)
+        PROFILER_RERR("Unable to open process maps", NULL);
+
+    do {
+        if (cap - *len < 4096) {
+            char *grown = realloc(text, cap = cap ? cap * 2 : 65536);
+
+            if (grown == NULL) {
+                free(text);
+                close(fd);
+                PROFILER_RERR("Malloc for maps failed\n", NULL);
+            }
+
+            text = grown;
+        }
+
+        r = read(fd, text + *len, cap - *len);
+
+        if (r > 0)
+            *len += r;
+    } while (r > 0 || (r == -1 && errno == EINTR));
+
+    close(fd);
+
+    if (r == -1) {
+        free(text);
+        PROFILER_RERR("Reading process maps failed", NULL);
+    }
+
+    PROFILER_ROUT(text, "char *: %p");
+}
+
+int shelf_proc_maps(pid_t pid, shelfmap_t **maps, size_t *count)
+{
+    char *text;
+    size_t len;
+
+    PROFILER_IN();
+
+    if ((text = shelf_proc_maps_text(pid, &len)) == NULL)
+        PROFILER_RERR(shelf_error, -1);
+
+    int ret = shelf_proc_maps_parse(text, len, maps, count);
+
+    free(text);
+
+    PROFILER_ROUT(ret, "%d");
+}
+
+void shelf_proc_maps_free(shelfmap_t *maps, size_t count)
+{
+    for (size_t i = 0; maps != NULL && i < count; i++)
+        free(maps[i].path);
+
+    free(maps);
+}
+
+shelfproc_t *shelf_proc_attach(pid_t pid)
+{
+    shelfproc_t *proc;
+    char path[64];
+
+    PROFILER_IN();
+
+    snprintf(path, sizeof(path), "/proc/%d", (int) pid);
+
+    if (access(path, F_OK) != 0)
+        PROFILER_RERR("No such process", NULL);
+
+    if ((proc = calloc(1, sizeof(shelfproc_t))) == NULL ||
+        (proc->pages = malloc(SHELF_PROC_CACHE_PAGES * SHELF_PROC_PAGE)) == NULL) {
+        free(proc);
+        PROFILER_RERR("Malloc for process handle failed", NULL);
+    }
+
+    proc->pid = pid;
+    proc->memfd = -1;
+    proc->use_vm_readv = 1;
+
+    PROFILER_ROUT(proc, "shelfproc_t *: %p");
+}
+
+void shelf_proc_detach(shelfproc_t *proc)
+{
+    if (proc == NULL)
+        return;
+
+    if (proc->memfd != -1)
+        close(proc->memfd);
+
+    free(proc->pages);
+    free(proc);
+}
+
+/*
+ * Drop every cached page. The target keeps running, so callers that need
+ * fresh data rather than a consistent snapshot call this between passes.
+ */
+void shelf_proc_invalidate(shelfproc_t *proc)
+{
+    if (proc != NULL)
+        memset(proc->tag, 0, sizeof(proc->tag));
+}
+
+/*
+ * Fallback for kernels or policies that refuse process_vm_readv(). The
+ * mem file honours the same ptrace access check, but also works where
+ * the syscall is filtered out by seccomp.
+ */
+static ssize_t read_mem_file(shelfproc_t *proc, uint64_t addr, void *buf, size_t len)
+{
+    size_t done = 0;
+
+    if (proc->memfd == -1) {
+        char path[64];
+
+        snprintf(path, sizeof(path), "/proc/%d/mem", (int) proc->pid);
+
+        if ((proc->memfd = open(path, O_RDONLY)) == -1)
+            return -1;
+    }
+
+    while (done < len) {
+        ssize_t r = pread(proc->memfd, (char *) buf + done, len - done, (off_t) (addr + done));
+
+        proc->syscalls++;
+
+        if (r == -1 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            break;
+
+        done += r;
+    }
+
+    return done ? (ssize_t) done : -1;
+}
+
+/*
+ * One vectored read. process_vm_readv() stops at the first remote range it
+ * can't read, so the return value is the length of the readable prefix.
+ */
+static ssize_t read_vectored(shelfproc_t *proc, struct iovec *local, struct iovec *remote, size_t n)
+{
+    ssize_t r;
+
+    if (!proc->use_vm_readv)
+        return -1;
+
+    r = process_vm_readv(proc->pid, local, n, remote, n, 0);
+    proc->syscalls++;
+
+    if (r == -1 && (errno == ENOSYS || errno == EPERM))
+        proc->use_vm_readv = 0;
+
+    return r;
+}
+
+static size_t find_page(const shelfproc_t *proc, uint64_t page)
+{
+    for (size_t i = 0; i < SHELF_PROC_CACHE_PAGES; i++) {
+        if (proc->tag[i] == page + 1)
+            return i;
+    }
+
+    return SHELF_PROC_CACHE_PAGES;
+}
+
+/*
+ * Load up to PROC_BATCH missing pages with a single syscall. Victims are
+ * stamped as they are chosen so one batch never evicts its own pages.
+ * Returns the number of pages that made it into the cache.
+ */
+static size_t fill_pages(shelfproc_t *proc, const uint64_t *pages, size_t n)
+{
+    struct iovec local[PROC_BATCH] = { 0 }, remote[PROC_BATCH] = { 0 };
+    size_t slot[PROC_BATCH];
+    size_t filled = 0;
+    ssize_t r;
+
+    if (n == 0)
+        return 0;
+
+    for (size_t i = 0; i < n; i++) {
+        size_t victim = 0;
+
+        for (size_t s = 1; s < SHELF_PROC_CACHE_PAGES; s++) {
+            if (proc->used[s] < proc->used[victim])
+                victim = s;
+        }
+
+        slot[i] = victim;
+        proc->tag[victim] = 0;
+        proc->used[victim] = ++proc->clock;
+
+        local[i].iov_base = proc->pages + victim * SHELF_PROC_PAGE;
+        local[i].iov_len = SHELF_PROC_PAGE;
+        remote[i].iov_base = (void *) (uintptr_t) (pages[i] * SHELF_PROC_PAGE);
+        remote[i].iov_len = SHELF_PROC_PAGE;
+    }
+
+    r = read_vectored(proc, local, remote, n);
+
+    for (size_t i = 0; i < n; i++) {
+        int ok = r >= (ssize_t) ((i + 1) * SHELF_PROC_PAGE);
+
+        // Ranges after the first unreadable one were never tried.
+        if (!ok)
+            ok = read_mem_file(proc, pages[i] * SHELF_PROC_PAGE, local[i].iov_base,
+                               SHELF_PROC_PAGE) == SHELF_PROC_PAGE;
+
+        if (ok) {
+            proc->tag[slot[i]] = pages[i] + 1;
+            filled++;
+        }
+    }
+
+    return filled;
+}
+
+/*
+ * Read `len` bytes at `addr` in the target. Small reads go through the page
+ * cache, with every page they miss fetched in one process_vm_readv(); reads
+ * of more than a quarter of the cache go straight to the process. Returns
+ * the number of bytes read, short if the range runs into unmapped memory,
+ * or -1 if nothing at `addr` could be read.
+ */
+ssize_t shelf_proc_read(shelfproc_t *proc, uint64_t addr, void *buf, size_t len)
+{
+    unsigned char *dst = buf;
+    size_t done = 0;
+
+    PROFILER_IN();
+
+    if (proc == NULL || buf == NULL)
+        PROFILER_RERR("Null argument passed to shelf_proc_read()\n", -1);
+
+    if (len == 0)
+        PROFILER_ROUT((ssize_t) 0, "%zd");
+
+    // An unaligned range can touch one page more than its length suggests.
+    if (len > (PROC_BATCH - 1) * SHELF_PROC_PAGE) {
+        struct iovec local = { buf, len };
+        struct iovec remote = { (void *) (uintptr_t) addr, len };
+        ssize_t r = read_vectored(proc, &local, &remote, 1);
+
+        if (r <= 0)
+            r = read_mem_file(proc, addr, buf, len);
+
+        if (r <= 0)
+            PROFILER_RERR("Address is not readable in the process", -1);
+
+        PROFILER_ROUT(r, "%zd");
+    }
+
+    uint64_t first = addr / SHELF_PROC_PAGE;
+    uint64_t last = (addr + len - 1) / SHELF_PROC_PAGE;
+    uint64_t missing[PROC_BATCH];
+    size_t nmissing = 0;
+
+    // Hits are stamped first so filling the misses can't evict them.
+    for (uint64_t page = first; page <= last; page++) {
+        size_t slot = find_page(proc, page);
+
+        if (slot == SHELF_PROC_CACHE_PAGES)
+            missing[nmissing++] = page;
+        else
+            proc->used[slot] = ++proc->clock;
+    }
+
+    if (nmissing)
+        fill_pages(proc, missing, nmissing);
+
+    while (done < len) {
+        uint64_t at = addr + done;
+        size_t in_page = at % SHELF_PROC_PAGE;
+        size_t n = SHELF_PROC_PAGE - in_page < len - done ? SHELF_PROC_PAGE - in_page : len - done;
+        size_t slot = find_page(proc, at / SHELF_PROC_PAGE);
+
+        if (slot == SHELF_PROC_CACHE_PAGES)
+            break;
+
+        memcpy(dst + done, proc->pages + slot * SHELF_PROC_PAGE + in_page, n);
+        proc->used[slot] = ++proc->clock;
+        done += n;
+    }
+
+    if (done == 0)
+        PROFILER_RERR("Address is not readable in the process", -1);
+
+    PROFILER_ROUT((ssize_t) done, "%zd");
+}
+
+/*
+ * Pull the pages holding `addrs` into the cache ahead of use, batching the
+ * misses so a stack walk or a symbol pass costs one syscall per batch
+ * rather than one per address. Returns how many of the pages are cached.
+ */
+size_t shelf_proc_prefetch(shelfproc_t *proc, const uint64_t *addrs, size_t count)
+{
+    uint64_t missing[PROC_BATCH];
+    size_t nmissing = 0, cached = 0;
+
+    if (proc == NULL || addrs == NULL)
+        return 0;
+
+    for (size_t i = 0; i < count; i++) {
+        uint64_t page = addrs[i] / SHELF_PROC_PAGE;
+        int dup = 0;
+
+        for (size_t j = 0; j < nmissing && !dup; j++)
+            dup = missing[j] == page;
+
+        if (dup)
+            continue;
+
+        if (find_page(proc, page) != SHELF_PROC_CACHE_PAGES) {
+            cached++;
+            continue;
+        }
+
+        missing[nmissing++] = page;
+
+        if (nmissing == PROC_BATCH) {
+            cached += fill_pages(proc, missing, nmissing);
+            nmissing = 0;
+        }
+    }
+
+    if (nmissing)
+        cached += fill_pages(proc, missing, nmissing);
+
+    return cached;
+}
+
+/*
+ * The dynamic loader rewrites the pointer valued dynamic entries in place
+ * to run time addresses. Put them back to link time addresses so the rest
+ * of the library, which works in file terms, can use them. Entries already
+ * below the load address were left alone by the loader (the vDSO's are).
+ */
+static void unrelocate_dynamic(shelfobj_t *desc, uint64_t bias, uint64_t link_base)
+{
+    static const int64_t ptr_tags[] = {
+        DT_PLTGOT, DT_HASH, DT_STRTAB, DT_SYMTAB, DT_RELA, DT_INIT, DT_FINI,
+        DT_REL, DT_JMPREL, DT_INIT_ARRAY, DT_FINI_ARRAY, DT_PREINIT_ARRAY,
+        DT_GNU_HASH, DT_VERSYM, DT_VERDEF, DT_VERNEED,
+    };
+    int is64 = desc->ei_class == ELFCLASS64;
+    size_t entsize = is64 ? sizeof(Elf64_Dyn) : sizeof(Elf32_Dyn);
+    uint64_t offset = 0, size = 0;
+
+    if (bias == 0)
+        return;
+
+    for (size_t i = 0; i < desc->hdr.e_phnum; i++) {
+        if (desc->pht[i].p_type == PT_DYNAMIC) {
+            offset = desc->pht[i].p_offset;
+            size = desc->pht[i].p_filesz;
+            break;
+        }
+    }
+
+    if (offset > (uint64_t) desc->file_stat.st_size ||
+        size > (uint64_t) desc->file_stat.st_size - offset)
+        return;
+
+    for (uint64_t at = offset; at + entsize <= offset + size; at += entsize) {
+        unsigned char *ent = desc->data + at;
+        int64_t tag = is64 ? (int64_t) desc->read_qword(ent) : (int32_t) desc->read_dword(ent);
+        uint64_t val = is64 ? desc->read_qword(ent + 8) : desc->read_dword(ent + 4);
+
+        if (tag == DT_NULL)
+            break;
+
+        for (size_t t = 0; t < sizeof(ptr_tags) / sizeof(ptr_tags[0]); t++) {
+            if (tag != ptr_tags[t] || val < bias + link_base)
+                continue;
+
+            if (is64)
+                desc->write_qword(ent + 8, val - bias);
+            else
+                desc->write_dword(ent + 4, (uint32_t) (val - bias));
+        }
+    }
+}
+
+/*
+ * Number of .dynsym entries, which the dynamic table doesn't record
+ * directly: DT_HASH has it as nchain, with DT_GNU_HASH we follow the chain
+ * of the highest bucket to its end.
+ */
+static int dynsym_count(shelfobj_t *desc, uint64_t *count)
+{
+    uint64_t vaddr, offset;
+    uint64_t size = desc->file_stat.st_size;
+
+    if (shelf_dyn_get(desc, DT_HASH, &vaddr) == 0 &&
+        shelf_vaddr_to_offset(desc, vaddr, &offset) == SHELF_ADDR_IN_FILE &&
+        offset + 8 <= size) {
+        *count = desc->read_dword(desc->data + offset + 4);
+        return 0;
+    }
+
+    if (shelf_dyn_get(desc, DT_GNU_HASH, &vaddr) != 0 ||
+        shelf_vaddr_to_offset(desc, vaddr, &offset) != SHELF_ADDR_IN_FILE ||
+        offset + 16 > size)
+        return -1;
+
+    const unsigned char *h = desc->data + offset;
+    uint32_t nbuckets = desc->read_dword(h);
+    uint32_t symoffset = desc->read_dword(h + 4);
+    uint32_t bloom_size = desc->read_dword(h + 8);
+    uint64_t word = desc->ei_class == ELFCLASS64 ? 8 : 4;
+    uint64_t buckets = offset + 16 + bloom_size * word;
+    uint64_t chains = buckets + (uint64_t) nbuckets * 4;
+    uint32_t last = 0;
+
+    if (chains > size)
+        return -1;
+
+    for (uint32_t i = 0; i < nbuckets; i++) {
+        uint32_t b = desc->read_dword(desc->data + buckets + i * 4);
+
+        if (b > last)
+            last = b;
+    }
+
+    if (last < symoffset) {
+        *count = symoffset;
+        return 0;
+    }
+
+    for (;;) {
+        uint64_t at = chains + (uint64_t) (last - symoffset) * 4;
+
+        if (at + 4 > size)
+            return -1;
+
+        if (desc->read_dword(desc->data + at) & 1)
+            break;
+
+        last++;
+    }
+
+    *count = (uint64_t) last + 1;
+    return 0;
+}
+
+/*
+ * Give an image rebuilt from memory the minimal section table the symbol
+ * code needs: .dynsym and .dynstr, placed from the dynamic table, and a
+ * .shstrtab for their names appended past the end of the image.
+ */
+static void synthesize_sections(shelfobj_t *desc, uint64_t names_offset)
+{
+    uint64_t symtab, strtab, strsz, count, sym_off, str_off;
+    uint64_t syment = desc->ei_class == ELFCLASS64 ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym);
+
+    if (shelf_dyn_load(desc) == NULL ||
+        shelf_dyn_get(desc, DT_SYMTAB, &symtab) != 0 ||
+        shelf_dyn_get(desc, DT_STRTAB, &strtab) != 0 ||
+        shelf_dyn_get(desc, DT_STRSZ, &strsz) != 0 ||
+        shelf_vaddr_to_offset(desc, symtab, &sym_off) != SHELF_ADDR_IN_FILE ||
+        shelf_vaddr_to_offset(desc, strtab, &str_off) != SHELF_ADDR_IN_FILE ||
+        dynsym_count(desc, &count) != 0)
+        return;
+
+    shelf_Shdr *sht = calloc(4, sizeof(shelf_Shdr));
+
+    if (sht == NULL)
+        return;
+
+    sht[1].sh_name = 1;
+    sht[1].sh_type = SHT_DYNSYM;
+    sht[1].sh_flags = SHF_ALLOC;
+    sht[1].sh_addr = symtab;
+    sht[1].sh_offset = sym_off;
+    sht[1].sh_size = count * syment;
+    sht[1].sh_link = 2;
+    sht[1].sh_info = 1;
+    sht[1].sh_addralign = desc->ei_class == ELFCLASS64 ? 8 : 4;
+    sht[1].sh_entsize = syment;
+
+    sht[2].sh_name = 9;
+    sht[2].sh_type = SHT_STRTAB;
+    sht[2].sh_flags = SHF_ALLOC;
+    sht[2].sh_addr = strtab;
+    sht[2].sh_offset = str_off;
+    sht[2].sh_size = strsz;
+    sht[2].sh_addralign = 1;
+
+    sht[3].sh_name = 17;
+    sht[3].sh_type = SHT_STRTAB;
+    sht[3].sh_offset = names_offset;
+    sht[3].sh_size = sizeof(proc_shstrtab);
+    sht[3].sh_addralign = 1;
+
+    free(desc->sht);
+    desc->sht = sht;
+    desc->hdr.e_shoff = 0;
+    desc->hdr.e_shnum = 4;
+    desc->hdr.e_shstrndx = 3;
+    desc->sht_verified = 1;
+}
+
+/*
+ * Build a descriptor for the ELF image mapped at `base` in the process,
+ * which must be where its first PT_LOAD (and so its ELF header) is mapped.
+ * Loaded segments are copied back to their file offsets, so the result is
+ * a file image missing only what the loader doesn't map: the section
+ * header table and non-alloc sections. In their place it gets .dynsym and
+ * .dynstr sections rebuilt from the dynamic table, which is enough for the
+ * symbol, dynamic and version APIs. Writable segments hold their run time
+ * contents, relocations applied.
+ */
+shelfobj_t *shelf_proc_open_image(shelfproc_t *proc, uint64_t base)
+{
+    unsigned char ehdr[sizeof(Elf64_Ehdr)];
+    unsigned char *phdrs = NULL;
+    shelfobj_t *desc;
+    char name[64];
+
+    PROFILER_IN();
+
+    if (proc == NULL)
+        PROFILER_RERR("Null argument passed to shelf_proc_open_image()\n", NULL);
+
+    if (shelf_proc_read(proc, base, ehdr, sizeof(ehdr)) < (ssize_t) sizeof(Elf32_Ehdr) ||
+        ehdr[EI_MAG0] != ELFMAG0 || ehdr[EI_MAG1] != ELFMAG1 ||
+        ehdr[EI_MAG2] != ELFMAG2 || ehdr[EI_MAG3] != ELFMAG3 ||
+        (ehdr[EI_CLASS] != ELFCLASS32 && ehdr[EI_CLASS] != ELFCLASS64))
+        PROFILER_RERR("No ELF image at address", NULL);
+
+    if ((desc = calloc(1, sizeof(shelfobj_t))) == NULL)
+        PROFILER_RERR("Malloc for descriptor failed", NULL);
+
+    shelf_decode_ehdr(desc, ehdr);
+    desc->hdr.e_shnum = 0;
+    desc->hdr.e_shstrndx = 0;
+
+    size_t phentsize = desc->ei_class == ELFCLASS64 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
+    size_t phsize = (size_t) desc->hdr.e_phnum * desc->hdr.e_phentsize;
+
+    if (desc->hdr.e_phnum == 0 || desc->hdr.e_phentsize < phentsize ||
+        desc->hdr.e_phoff > PROC_IMAGE_MAX || phsize > PROC_IMAGE_MAX - desc->hdr.e_phoff) {
+        shelf_error = "Image has no usable program header table";
+        goto error;
+    }
+
+    desc->pht = calloc(desc->hdr.e_phnum, sizeof(Elf64_Phdr));
+    desc->sht = calloc(1, sizeof(shelf_Shdr));
+    phdrs = malloc(phsize);
+
+    if (desc->pht == NULL || desc->sht == NULL || phdrs == NULL) {
+        shelf_error = "Malloc for image headers failed";
+        goto error;
+    }
+
+    if (shelf_proc_read(proc, base + desc->hdr.e_phoff, phdrs, phsize) != (ssize_t) phsize) {
+        shelf_error = "Unable to read program headers";
+        goto error;
+    }
+
+    for (size_t i = 0; i < desc->hdr.e_phnum; i++)
+        shelf_decode_phdr(desc, phdrs + i * desc->hdr.e_phentsize, &desc->pht[i]);
+
+    desc->pht_verified = 1;
+
+    /*
+     * The first PT_LOAD maps file offset zero; where it landed gives the
+     * load bias, and the largest file extent of any PT_LOAD the image size.
+     */
+    const Elf64_Phdr *first = NULL;
+    uint64_t size = desc->hdr.e_phoff + phsize;
+
+    for (size_t i = 0; i < desc->hdr.e_phnum; i++) {
+        const Elf64_Phdr *ph = &desc->pht[i];
+
+        if (ph->p_type != PT_LOAD)
+            continue;
+
+        if (ph->p_offset > PROC_IMAGE_MAX || ph->p_filesz > PROC_IMAGE_MAX - ph->p_offset) {
+            shelf_error = "Image segment lies past the size limit";
+            goto error;
+        }
+
+        if (first == NULL || ph->p_vaddr < first->p_vaddr)
+            first = ph;
+
+        if (ph->p_offset + ph->p_filesz > size)
+            size = ph->p_offset + ph->p_filesz;
+    }
+
+    if (first == NULL || first->p_offset > first->p_vaddr || size > PROC_IMAGE_MAX) {
+        shelf_error = "Image has no usable PT_LOAD";
+        goto error;
+    }
+
+    uint64_t link_base = first->p_vaddr - first->p_offset;
+    uint64_t bias = base - link_base;
+
+    if ((desc->data = calloc(1, size + sizeof(proc_shstrtab))) == NULL) {
+        shelf_error = "Malloc for image failed";
+        goto error;
+    }
+
+    desc->malloced = 1;
+    desc->file_stat.st_size = size + sizeof(proc_shstrtab);
+
+    for (size_t i = 0; i < desc->hdr.e_phnum; i++) {
+        const Elf64_Phdr *ph = &desc->pht[i];
+        uint64_t filesz = ph->p_filesz < ph->p_memsz ? ph->p_filesz : ph->p_memsz;
+
+        // Unreadable ranges (guard pages, PROT_NONE gaps) stay zeroed.
+        if (ph->p_type == PT_LOAD && filesz)
+            shelf_proc_read(proc, ph->p_vaddr + bias, desc->data + ph->p_offset, filesz);
+    }
+
+    memcpy(desc->data, ehdr, desc->ei_class == ELFCLASS64 ? sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr));
+    memcpy(desc->data + desc->hdr.e_phoff, phdrs, phsize);
+    memcpy(desc->data + size, proc_shstrtab, sizeof(proc_shstrtab));
+    desc->e_ident = desc->data;
+
+    snprintf(name, sizeof(name), "/proc/%d/mem:0x%llx", (int) proc->pid, (unsigned long long) base);
+
+    if ((desc->filename = strdup(name)) == NULL) {
+        shelf_error = "Malloc for image name failed";
+        goto error;
+    }
+
+    unrelocate_dynamic(desc, bias, link_base);
+    synthesize_sections(desc, size);
+
+    if (shelf_verify_sections(desc) < 0)
+        goto error;
+
+    free(phdrs);
+
+    PROFILER_ROUT(desc, "Elf_Desc: %p");
+
+error:
+    free(phdrs);
+    shelf_close(&desc);
+
+    PROFILER_RERR(shelf_error, NULL);
+}
@@ -0,0 +1,459 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "shelf.h"
+#include "shelf_profiler.h"
+#include "section.h"
+#include "reloc.h"
+
+
+/* Types below this bound are grouped with a counting sort. */
+#define RELOC_TYPE_BUCKETS 1024
+
+static int host_is_le(void)
+{
+    const uint16_t probe = 1;
+    return *(const unsigned char *) &probe == 1;
+}
+
+static inline uint64_t load64(const unsigned char *p, int swap)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return swap ? __builtin_bswap64(v) : v;
+}
+
+static inline void store64(unsigned char *p, uint64_t v, int swap)
+{
+    v = swap ? __builtin_bswap64(v) : v;
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline uint32_t load32(const unsigned char *p, int swap)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return swap ? __builtin_bswap32(v) : v;
+}
+
+static inline void store32(unsigned char *p, uint32_t v, int swap)
+{
+    v = swap ? __builtin_bswap32(v) : v;
+    memcpy(p, &v, sizeof(v));
+}
+
+static int cmp_type_then_index(const void *a, const void *b, void *arg)
+{
+    const uint32_t *types = arg;
+    uint32_t ia = *(const uint32_t *) a, ib = *(const uint32_t *) b;
+    uint32_t ta = types[ia], tb = types[ib];
+
+    if (ta != tb)
+        return ta < tb ? -1 : 1;
+
+    return ia < ib ? -1 : (ia > ib);
+}
+
+void shelf_reltab_free(shelfreltab_t *tab)
+{
+    if (tab == NULL)
+        return;
+
+    free(tab->offset);
+    free(tab->type);
+    free(tab->sym);
+    free(tab->addend);
+    free(tab->index);
+    free(tab->group_type);
+    free(tab->group_start);
+    free(tab);
+}
+
+/*
+ * Decode one relocation section into a shelfreltab_t. The entries are read
+ * twice: once for their types, to work out where every entry lands once
+ * grouped, and once to decode each entry straight into its final slot.
+ */
+shelfreltab_t *shelf_reltab_load(shelfobj_t *desc, shelfsect_t *sect)
+{
+    shelfreltab_t *tab;
+    const unsigned char *base;
+    uint32_t *types = NULL;
+    uint32_t *pos = NULL;
+    size_t entsize;
+    int is64;
+
+    PROFILER_IN();
+
+    if (desc == NULL || sect == NULL)
+        PROFILER_RERR("Null argument passed to shelf_reltab_load()\n", NULL);
+
+    if (sect->shdr->sh_type != SHT_REL && sect->shdr->sh_type != SHT_RELA)
+        PROFILER_RERR("Section is not a relocation section\n", NULL);
+
+    if ((base = get_section_data(desc, sect)) == NULL)
+        PROFILER_RERR("Relocation section lies outside of the file\n", NULL);
+
+    if ((tab = calloc(1, sizeof(shelfreltab_t))) == NULL)
+        PROFILER_RERR("Malloc for relocation table failed\n", NULL);
+
+    is64 = desc->ei_class == ELFCLASS64;
+    tab->rela = sect->shdr->sh_type == SHT_RELA;
+    tab->section = sect->index;
+    tab->target = sect->shdr->sh_info;
+    tab->symtab = sect->shdr->sh_link;
+    tab->machine = desc->hdr.e_machine;
+
+    if (is64)
+        entsize = tab->rela ? sizeof(Elf64_Rela) : sizeof(Elf64_Rel);
+    else
+        entsize = tab->rela ? sizeof(Elf32_Rela) : sizeof(Elf32_Rel);
+
+    size_t n = sect->shdr->sh_size / entsize;
+    size_t alloc_n = n ? n : 1;
+
+    tab->count = n;
+    tab->offset = malloc(alloc_n * sizeof(uint64_t));
+    tab->type = malloc(alloc_n * sizeof(uint32_t));
+    tab->sym = malloc(alloc_n * sizeof(uint32_t));
+    tab->addend = malloc(alloc_n * sizeof(int64_t));
+    tab->index = malloc(alloc_n * sizeof(uint32_t));
+    types = malloc(alloc_n * sizeof(uint32_t));
+    pos = malloc(alloc_n * sizeof(uint32_t));
+
+    if (!tab->offset || !tab->type || !tab->sym || !tab->addend || !tab->index || !types || !pos) {
+        shelf_error = "Malloc for relocation columns failed";
+        goto error;
+    }
+
+    /* First pass: types only. */
+    uint32_t max_type = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        const unsigned char *ent = base + i * entsize;
+
+        types[i] = is64 ? ELF64_R_TYPE(desc->read_qword(ent + 8))
+                        : ELF32_R_TYPE(desc->read_dword(ent + 4));
+        max_type = types[i] > max_type ? types[i] : max_type;
+    }
+
+    /* Work out each entry's slot so that types end up contiguous. */
+    if (max_type < RELOC_TYPE_BUCKETS) {
+        size_t *start = calloc(RELOC_TYPE_BUCKETS + 1, sizeof(size_t));
+
+        if (start == NULL) {
+            shelf_error = "Malloc for relocation buckets failed";
+            goto error;
+        }
+
+        for (size_t i = 0; i < n; i++)
+            start[types[i] + 1]++;
+
+        for (size_t t = 0; t < RELOC_TYPE_BUCKETS; t++) {
+            tab->ngroups += start[t + 1] != 0;
+            start[t + 1] += start[t];
+        }
+
+        for (size_t i = 0; i < n; i++)
+            pos[i] = start[types[i]]++;
+
+        free(start);
+    } else {
+        uint32_t *order = malloc(alloc_n * sizeof(uint32_t));
+
+        if (order == NULL) {
+            shelf_error = "Malloc for relocation order failed";
+            goto error;
+        }
+
+        for (size_t i = 0; i < n; i++)
+            order[i] = i;
+
+        qsort_r(order, n, sizeof(uint32_t), cmp_type_then_index, types);
+
+        for (size_t i = 0; i < n; i++) {
+            pos[order[i]] = i;
+            tab->ngroups += i == 0 || types[order[i]] != types[order[i - 1]];
+        }
+
+        free(order);
+    }
+
+    /* Second pass: decode every entry into its slot. */
+    for (size_t i = 0; i < n; i++) {
+        const unsigned char *ent = base + i * entsize;
+        uint32_t slot = pos[i];
+
+        if (is64) {
+            uint64_t info = desc->read_qword(ent + 8);
+            tab->offset[slot] = desc->read_qword(ent);
+            tab->sym[slot] = ELF64_R_SYM(info);
+            tab->addend[slot] = tab->rela ? (int64_t) desc->read_qword(ent + 16) : 0;
+        } else {
+            uint32_t info = desc->read_dword(ent + 4);
+            tab->offset[slot] = desc->read_dword(ent);
+            tab->sym[slot] = ELF32_R_SYM(info);
+            tab->addend[slot] = tab->rela ? (int32_t) desc->read_dword(ent + 8) : 0;
+        }
+
+        tab->type[slot] = types[i];
+        tab->index[slot] = i;
+    }
+
+    tab->group_type = malloc((tab->ngroups ? tab->ngroups : 1) * sizeof(uint32_t));
+    tab->group_start = malloc((tab->ngroups + 1) * sizeof(size_t));
+
+    if (!tab->group_type || !tab->group_start) {
+        shelf_error = "Malloc for relocation groups failed";
+        goto error;
+    }
+
+    size_t g = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        if (i == 0 || tab->type[i] != tab->type[i - 1]) {
+            tab->group_type[g] = tab->type[i];
+            tab->group_start[g++] = i;
+        }
+    }
+
+    tab->group_start[g] = n;
+
+    free(types);
+    free(pos);
+
+    PROFILER_ROUT(tab, "shelfreltab_t *: %p");
+
+error:
+    free(types);
+    free(pos);
+    shelf_reltab_free(tab);
+
+    PROFILER_RERR(shelf_error, NULL);
+}
+
+/*
+ * Decode every SHT_REL and SHT_RELA section in the file. Returns an array of
+ * `count` tables which the caller frees with shelf_reltab_free() and free().
+ */
+shelfreltab_t **shelf_reltab_load_all(shelfobj_t *desc, size_t *count)
+{
+    shelfreltab_t **tabs;
+    size_t n = 0;
+
+    PROFILER_IN();
+
+    if (desc == NULL || count == NULL)
+        PROFILER_RERR("Null argument passed to shelf_reltab_load_all()\n", NULL);
+
+    if (desc->sect_list == NULL)
+        load_section_list(desc);
+
+    tabs = calloc(desc->hdr.e_shnum ? desc->hdr.e_shnum : 1, sizeof(shelfreltab_t *));
+
+    if (tabs == NULL)
+        PROFILER_RERR("Malloc for relocation table list failed\n", NULL);
+
+    for (size_t i = 0; i < desc->hdr.e_shnum; i++) {
+        uint32_t type = desc->sht[i].sh_type;
+
+        if (type != SHT_REL && type != SHT_RELA)
+            continue;
+
+        if ((tabs[n] = shelf_reltab_load(desc, &desc->sect_list[i])) == NULL) {
+            for (size_t j = 0; j < n; j++)
+                shelf_reltab_free(tabs[j]);
+            free(tabs);
+            PROFILER_RERR(shelf_error, NULL);
+        }
+
+        n++;
+    }
+
+    *count = n;
+
+    PROFILER_ROUT(tabs, "shelfreltab_t **: %p");
+}
+
+/*
+ * Find the run of entries with relocation type `type`. Returns 0 and fills in
+ * the run when there is one, -1 otherwise.
+ */
+int shelf_reltab_group(const shelfreltab_t *tab, uint32_t type, size_t *start, size_t *count)
+{
+    size_t lo = 0, hi;
+
+    if (tab == NULL)
+        return -1;
+
+    hi = tab->ngroups;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (tab->group_type[mid] < type)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == tab->ngroups || tab->group_type[lo] != type)
+        return -1;
+
+    *start = tab->group_start[lo];
+    *count = tab->group_start[lo + 1] - tab->group_start[lo];
+
+    return 0;
+}
+
+/*
+ * Apply every relocation of one type in a single loop. The whole group is
+ * bounds checked up front with a min/max reduction so the loops that follow
+ * carry no per-entry checks or type dispatch.
+ */
+ssize_t shelf_reloc_apply_group(shelfobj_t *desc, const shelfreltab_t *tab, uint32_t type,
+                                unsigned char *buf, uint64_t buf_addr, uint64_t buf_len,
+                                uint64_t base, const uint64_t *symvals, size_t nsymvals)
+{
+    size_t start, n;
+    int width, needs_sym = 1;
+    int swap;
+
+    PROFILER_IN();
+
+    if (desc == NULL || tab == NULL || buf == NULL)
+        PROFILER_RERR("Null argument passed to shelf_reloc_apply_group()\n", -1);
+
+    if (shelf_reltab_group(tab, type, &start, &n) != 0)
+        PROFILER_ROUT((ssize_t) 0, "%zd");
+
+    if (tab->machine == EM_X86_64) {
+        switch (type) {
+            case R_X86_64_NONE:      PROFILER_ROUT((ssize_t) 0, "%zd");
+            case R_X86_64_RELATIVE:  needs_sym = 0; /* fallthrough */
+            case R_X86_64_64:
+            case R_X86_64_GLOB_DAT:
+            case R_X86_64_JUMP_SLOT: width = 8; break;
+            case R_X86_64_PC32:
+            case R_X86_64_PLT32:
+            case R_X86_64_32:
+            case R_X86_64_32S:       width = 4; break;
+            default: PROFILER_RERR("Unsupported relocation type\n", -1);
+        }
+    } else if (tab->machine == EM_386) {
+        switch (type) {
+            case R_386_NONE:      PROFILER_ROUT((ssize_t) 0, "%zd");
+            case R_386_RELATIVE:  needs_sym = 0; /* fallthrough */
+            case R_386_32:
+            case R_386_PC32:
+            case R_386_GLOB_DAT:
+            case R_386_JMP_SLOT:  width = 4; break;
+            default: PROFILER_RERR("Unsupported relocation type\n", -1);
+        }
+    } else {
+        PROFILER_RERR("Unsupported machine for relocation\n", -1);
+    }
+
+    if (needs_sym && symvals == NULL)
+        PROFILER_RERR("Relocation type needs symbol values\n", -1);
+
+    const uint64_t *off = tab->offset + start;
+    const uint32_t *sym = tab->sym + start;
+    const int64_t *add = tab->addend + start;
+    uint64_t lo = UINT64_MAX, hi = 0;
+    uint32_t maxsym = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        lo = off[i] < lo ? off[i] : lo;
+        hi = off[i] > hi ? off[i] : hi;
+        maxsym = sym[i] > maxsym ? sym[i] : maxsym;
+    }
+
+    if (n && needs_sym && maxsym >= nsymvals)
+        PROFILER_RERR("Relocation symbol index out of range\n", -1);
+
+    if (n && (lo < buf_addr || hi - buf_addr > buf_len || buf_len - (hi - buf_addr) < (uint64_t) width))
+        PROFILER_RERR("Relocation target lies outside of the buffer\n", -1);
+
+    swap = (desc->ei_data == ELFDATA2MSB) == host_is_le();
+
+    /* Offsets are checked against buf_addr above, so buf + (off - buf_addr) is in bounds. */
+    if (tab->machine == EM_X86_64) {
+        switch (type) {
+            case R_X86_64_RELATIVE:
+                for (size_t i = 0; i < n; i++) {
+                    unsigned char *t = buf + (off[i] - buf_addr);
+                    store64(t, base + (tab->rela ? (uint64_t) add[i] : load64(t, swap)), swap);
+                }
+                break;
+            case R_X86_64_64:
+                for (size_t i = 0; i < n; i++)
+                    store64(buf + (off[i] - buf_addr), symvals[sym[i]] + add[i], swap);
+                break;
+            case R_X86_64_GLOB_DAT:
+            case R_X86_64_JUMP_SLOT:
+                for (size_t i = 0; i < n; i++)
+                    store64(buf + (off[i] - buf_addr), symvals[sym[i]], swap);
+                break;
+            case R_X86_64_PC32:
+            case R_X86_64_PLT32:
+                for (size_t i = 0; i < n; i++)
+                    store32(buf + (off[i] - buf_addr), symvals[sym[i]] + add[i] - (base + off[i]), swap);
+                break;
+            case R_X86_64_32:
+            case R_X86_64_32S:
+                for (size_t i = 0; i < n; i++)
+                    store32(buf + (off[i] - buf_addr), symvals[sym[i]] + add[i], swap);
+                break;
+        }
+    } else {
+        /* i386 uses SHT_REL, the addend lives at the target. */
+        switch (type) {
+            case R_386_RELATIVE:
+                for (size_t i = 0; i < n; i++) {
+                    unsigned char *t = buf + (off[i] - buf_addr);
+                    store32(t, base + add[i] + load32(t, swap), swap);
+                }
+                break;
+            case R_386_32:
+                for (size_t i = 0; i < n; i++) {
+                    unsigned char *t = buf + (off[i] - buf_addr);
+                    store32(t, symvals[sym[i]] + add[i] + load32(t, swap), swap);
+                }
+                break;
+            case R_386_PC32:
+                for (size_t i = 0; i < n; i++) {
+                    unsigned char *t = buf + (off[i] - buf_addr);
+                    store32(t, symvals[sym[i]] + add[i] + load32(t, swap) - (base + off[i]), swap);
+                }
+                break;
+            case R_386_GLOB_DAT:
+            case R_386_JMP_SLOT:
+                for (size_t i = 0; i < n; i++)
+                    store32(buf + (off[i] - buf_addr), symvals[sym[i]], swap);
+                break;
+        }
+    }
+
+    PROFILER_ROUT((ssize_t) n, "%zd");
+}
+
+/*
+ * Shorthand for the common load-time case: rebase every relative relocation
+ * by `base`.
+ */
+ssize_t shelf_reloc_apply_relative(shelfobj_t *desc, const shelfreltab_t *tab,
+                                   unsigned char *buf, uint64_t buf_addr, uint64_t buf_len,
+                                   uint64_t base)
+{
+    uint32_t type;
+
+    if (tab == NULL)
+        return -1;
+
+    type = tab->machine == EM_386 ? R_386_RELATIVE : R_X86_64_RELATIVE;
+
+    return shelf_reloc_apply_group(desc, tab, type, buf, buf_addr, buf_len, base, NULL, 0);
+}
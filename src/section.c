@@ -1,10 +1,17 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include "shelf.h"
 #include "shelf_profiler.h"
 #include "section.h"
+#include "shelf_compress.h"
+#include "iter.h"
+#include "patch.h"
+#include "journal.h"
 
 
 shelfsect_t *create_section(char *name)
@@ -67,6 +74,12 @@ shelfsect_t *get_section_by_index(shelfobj_t *desc, uint32_t index)
     PROFILER_ROUT(ret, "shelfsect_t: %p");    
 }
 
+/*
+ * Returns a malloc'd, NULL terminated array the caller must free. Unlike
+ * the section iterator it includes section 0, so SHT_NULL finds it.
+ * Prefer shelf_sect_iter_init() with the type filter, which doesn't
+ * allocate.
+ */
 shelfsect_t **get_sections_by_type(shelfobj_t *desc, uint32_t type)
 {
     shelfsect_t **sections = NULL;
@@ -86,7 +99,9 @@ shelfsect_t **get_sections_by_type(shelfobj_t *desc, uint32_t type)
             matches++;
     }
 
-    sections = malloc((matches + 1) * sizeof(shelfsect_t*));
+    if ((sections = malloc((matches + 1) * sizeof(shelfsect_t*))) == NULL)
+        PROFILER_RERR("Malloc for section array failed\n", NULL);
+
     // NULL pointer terminated array
     sections[matches] = NULL;
     size_t idx = 0;
@@ -170,6 +185,130 @@ shelfsect_t *get_tail_section(shelfobj_t *desc)
     PROFILER_ROUT(&(desc->sect_list[desc->hdr.e_shnum - 1]), "shelfsect_t: %p");
 }
 
+/*
+ * Returns a read-only view of a section's contents. Unless the section has
+ * been written to this is a pointer straight into the file mapping, so nothing
+ * is copied no matter how large the section is. SHT_NOBITS sections are backed
+ * by an anonymous mapping the kernel zero fills lazily, and compressed sections
+ * are returned decompressed from the descriptor's cache.
+ *
+ * The pointer for a compressed section belongs to that cache and dangles
+ * once the section is evicted, which any later decompression on the
+ * descriptor may do (see shelf_zcache_set_limit()). Callers that keep it
+ * across other section reads should use get_section_data_rw(), whose copy
+ * lives as long as the descriptor.
+ */
+const void *get_section_data(shelfobj_t *desc, shelfsect_t *sect)
+{
+    PROFILER_IN();
+
+    if (desc == NULL || sect == NULL)
+        PROFILER_RERR("Null argument passed to get_section_data()\n", NULL);
+
+    if (sect->data != NULL)
+        PROFILER_ROUT(sect->data, "void *: %p");
+
+    if (sect->shdr->sh_type == SHT_NOBITS) {
+        size_t len = sect->shdr->sh_size ? sect->shdr->sh_size : 1;
+        void *zero = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (zero == MAP_FAILED)
+            PROFILER_RERR("Mapping zero pages for SHT_NOBITS section failed\n", NULL);
+
+        sect->data = zero;
+        sect->data_len = len;
+        sect->data_owner = SECT_DATA_ANON;
+
+        PROFILER_ROUT(sect->data, "void *: %p");
+    }
+
+    if (!sect->verified || desc->data == NULL)
+        PROFILER_RERR("Section data lies outside of the file\n", NULL);
+
+    if (shelf_section_is_compressed(desc, sect))
+        PROFILER_ROUT(shelf_section_decompressed(desc, sect), "void *: %p");
+
+    /* Sections an open transaction has written to are read with its edits. */
+    if (shelf_journal_overlaps(desc, sect->shdr->sh_offset, sect->shdr->sh_size))
+        PROFILER_ROUT(shelf_journal_section(desc, sect), "void *: %p");
+
+    PROFILER_ROUT(shelf_sect_ptr_unchecked(desc, sect->index), "void *: %p");
+}
+
+/*
+ * Returns a writable copy of a section's contents, copying it out of the
+ * file mapping on the first call only. Later calls, and get_section_data(),
+ * return the same private buffer. On descriptors opened with
+ * SHELF_OPEN_PATCH the section is instead written in place: the pointer is
+ * into the shared mapping and the whole section is marked dirty.
+ */
+void *get_section_data_rw(shelfobj_t *desc, shelfsect_t *sect)
+{
+    const void *src;
+    uint64_t size;
+
+    PROFILER_IN();
+
+    if (desc == NULL || sect == NULL)
+        PROFILER_RERR("Null argument passed to get_section_data_rw()\n", NULL);
+
+    if (sect->data != NULL)
+        PROFILER_ROUT(sect->data, "void *: %p");
+
+    /* Anonymous zero pages are already private and writable. */
+    if (sect->shdr->sh_type == SHT_NOBITS)
+        PROFILER_ROUT((void *) get_section_data(desc, sect), "void *: %p");
+
+    /* With a journal open, edits go to a private copy until commit. */
+    if (desc->writable && desc->journal == NULL && sect->verified &&
+        !shelf_section_is_compressed(desc, sect)) {
+        if (shelf_patch_mark(desc, sect->shdr->sh_offset, sect->shdr->sh_size) != 0)
+            PROFILER_RERR("Marking section dirty failed\n", NULL);
+
+        PROFILER_ROUT(shelf_sect_ptr_unchecked(desc, sect->index), "void *: %p");
+    }
+
+    if ((src = get_section_data(desc, sect)) == NULL ||
+        shelf_section_sizes(desc, sect, NULL, &size) != 0) {
+        PROFILER_RERR("Section data lies outside of the file\n", NULL);
+    }
+
+    /* get_section_data() already made a copy holding journal edits. */
+    if (sect->data != NULL)
+        PROFILER_ROUT(sect->data, "void *: %p");
+
+    sect->data_len = size ? size : 1;
+    sect->data = malloc(sect->data_len);
+
+    if (sect->data == NULL)
+        PROFILER_RERR("Malloc for section data failed\n", NULL);
+
+    memcpy(sect->data, src, size);
+    sect->data_owner = SECT_DATA_MALLOC;
+
+    PROFILER_ROUT(sect->data, "void *: %p");
+}
+
+/*
+ * Drops a section's private data, if it has any, so reads go back to the file
+ * mapping.
+ */
+void release_section_data(shelfsect_t *sect)
+{
+    if (sect == NULL || sect->data == NULL)
+        return;
+
+    if (sect->data_owner == SECT_DATA_ANON)
+        munmap(sect->data, sect->data_len);
+    else if (sect->data_owner == SECT_DATA_MALLOC)
+        free(sect->data);
+
+    sect->data = NULL;
+    sect->data_len = 0;
+    sect->data_owner = SECT_DATA_NONE;
+}
+
 void free_shelfsect(shelfsect_t *sect)
 {
     if (sect == NULL) {
@@ -187,10 +326,7 @@ void free_shelfsect(shelfsect_t *sect)
         sect->shdr = NULL;
     }
 
-    if (sect->data) {
-        free(sect->data);
-        sect->data = NULL;
-    }
+    release_section_data(sect);
 
     free(sect);
     sect = NULL;
@@ -201,7 +337,11 @@ void load_section_list(shelfobj_t *desc)
     shelf_Shdr *cur_shdr;
 
     PROFILER_IN();
-    
+
+    // Nothing to list, and no header table to find names in.
+    if (desc->hdr.e_shnum == 0 || desc->data == NULL)
+        PROFILER_OUT();
+
     uint32_t section_count = desc->hdr.e_shnum;
     // pointer to the beginning of the shstrtab data in file
     char *strtab = (char *)(desc->data + desc->sht[desc->hdr.e_shstrndx].sh_offset);
@@ -210,8 +350,9 @@ void load_section_list(shelfobj_t *desc)
 
     for (uint32_t i = 0; i < section_count; i++) {
         cur_shdr = &desc->sht[i];
-        // copy name from shstrtab for current shdr
-        desc->sect_list[i].name = strdup(strtab + cur_shdr->sh_name);
+        // names were bounds checked at open time, quarantined sections get none
+        desc->sect_list[i].verified = desc->sect_verified[i];
+        desc->sect_list[i].name = strdup(desc->sect_verified[i] ? strtab + cur_shdr->sh_name : "");
         desc->sect_list[i].shdr = cur_shdr;
         desc->sect_list[i].index = i;
         // TODO: possibly load section contents here instead of lazy loading
@@ -219,4 +360,3 @@ void load_section_list(shelfobj_t *desc)
 
     PROFILER_OUT();
 }
-
@@ -0,0 +1,429 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shelf.h"
+#include "shelf_profiler.h"
+#include "segment.h"
+
+
+/*
+ * readelf's rule for section membership. Allocated sections must fit in
+ * the segment's memory image, and sections with file contents must also fit
+ * in its file image. .tbss only belongs to PT_TLS, PT_TLS only holds TLS
+ * sections, and non-allocated sections only appear in segments that aren't
+ * loaded. An empty section only counts when strictly inside a non-empty
+ * segment.
+ */
+int shelf_section_in_segment(const shelfobj_t *desc, const shelf_Shdr *shdr, const Elf64_Phdr *phdr)
+{
+    int tls = (shdr->sh_flags & SHF_TLS) != 0;
+    int alloc = (shdr->sh_flags & SHF_ALLOC) != 0;
+    int nobits = shdr->sh_type == SHT_NOBITS;
+    int tbss = tls && nobits;
+
+    (void) desc;
+
+    if (shdr->sh_type == SHT_NULL)
+        return 0;
+
+    if (!alloc && nobits)
+        return 0;
+
+    /* TLS sections only sit in PT_TLS and the segments holding its image. */
+    if (tls ? !(phdr->p_type == PT_TLS || phdr->p_type == PT_LOAD || phdr->p_type == PT_GNU_RELRO)
+            : phdr->p_type == PT_TLS)
+        return 0;
+
+    /* .tbss takes no space outside PT_TLS. */
+    if (tbss && phdr->p_type != PT_TLS)
+        return 0;
+
+    if (!alloc && (phdr->p_type == PT_LOAD || phdr->p_type == PT_DYNAMIC ||
+                   phdr->p_type == PT_GNU_EH_FRAME || phdr->p_type == PT_GNU_RELRO ||
+                   phdr->p_type == PT_GNU_STACK))
+        return 0;
+
+    uint64_t size = shdr->sh_size;
+
+    if (!nobits) {
+        if (shdr->sh_offset < phdr->p_offset)
+            return 0;
+
+        uint64_t rel = shdr->sh_offset - phdr->p_offset;
+
+        if (size == 0 ? (phdr->p_filesz ? rel >= phdr->p_filesz : rel > 0)
+                      : (rel >= phdr->p_filesz || size > phdr->p_filesz - rel))
+            return 0;
+    }
+
+    if (alloc) {
+        if (shdr->sh_addr < phdr->p_vaddr)
+            return 0;
+
+        uint64_t rel = shdr->sh_addr - phdr->p_vaddr;
+
+        if (size == 0 ? (phdr->p_memsz ? rel >= phdr->p_memsz : rel > 0)
+                      : (rel >= phdr->p_memsz || size > phdr->p_memsz - rel))
+            return 0;
+    }
+
+    return 1;
+}
+
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+    uint32_t index;
+} span_t;
+
+static int cmp_span(const void *a, const void *b)
+{
+    const span_t *x = a, *y = b;
+
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+/*
+ * Sweep sections and segments sorted by start in one space (addresses or
+ * file offsets). Segments are activated once they start at or below the
+ * current section and retired once they end below it, so each section is
+ * only tested against the few segments overlapping it.
+ */
+static int sweep(const shelfobj_t *desc, shelfsegmap_t *map, span_t *sects, size_t ns,
+                 span_t *segs, size_t np)
+{
+    uint32_t *active = malloc((np ? np : 1) * sizeof(uint32_t));
+    size_t nactive = 0, next = 0;
+
+    if (active == NULL)
+        return -1;
+
+    qsort(sects, ns, sizeof(span_t), cmp_span);
+    qsort(segs, np, sizeof(span_t), cmp_span);
+
+    for (size_t i = 0; i < ns; i++) {
+        while (next < np && segs[next].start <= sects[i].start)
+            active[nactive++] = next++;
+
+        for (size_t j = 0; j < nactive; ) {
+            const span_t *seg = &segs[active[j]];
+
+            if (seg->end < sects[i].start) {
+                active[j] = active[--nactive];
+                continue;
+            }
+
+            size_t s = sects[i].index, p = seg->index;
+
+            if (shelf_section_in_segment(desc, &desc->sht[s], &desc->pht[p])) {
+                map->sect_segs[s * map->sect_words + p / 64] |= 1ULL << (p % 64);
+                map->seg_sects[p * map->seg_words + s / 64] |= 1ULL << (s % 64);
+            }
+            j++;
+        }
+    }
+
+    free(active);
+
+    return 0;
+}
+
+/*
+ * Build the map on first use and cache it on the descriptor. Allocated
+ * sections are swept against segments by address, the rest by file offset;
+ * every candidate pair is confirmed with shelf_section_in_segment().
+ */
+shelfsegmap_t *shelf_segmap_load(shelfobj_t *desc)
+{
+    shelfsegmap_t *map;
+    span_t *sects, *segs;
+    size_t ns = desc != NULL && desc->sht ? desc->hdr.e_shnum : 0;
+    size_t np = desc != NULL && desc->pht ? desc->hdr.e_phnum : 0;
+    int ret = 0;
+
+    PROFILER_IN();
+
+    if (desc == NULL)
+        PROFILER_RERR("Null argument passed to shelf_segmap_load()\n", NULL);
+
+    if (desc->segmap != NULL)
+        PROFILER_ROUT(desc->segmap, "shelfsegmap_t *: %p");
+
+    if ((map = calloc(1, sizeof(shelfsegmap_t))) == NULL)
+        PROFILER_RERR("Malloc for segment map failed\n", NULL);
+
+    map->nsects = ns;
+    map->nsegs = np;
+    map->sect_words = (np + 63) / 64;
+    map->seg_words = (ns + 63) / 64;
+    map->sect_segs = calloc(ns * map->sect_words + 1, sizeof(uint64_t));
+    map->seg_sects = calloc(np * map->seg_words + 1, sizeof(uint64_t));
+    sects = malloc((ns + 1) * sizeof(span_t));
+    segs = malloc((np + 1) * sizeof(span_t));
+
+    if (map->sect_segs == NULL || map->seg_sects == NULL || sects == NULL || segs == NULL) {
+        free(sects);
+        free(segs);
+        desc->segmap = map;
+        shelf_segmap_free(desc);
+        PROFILER_RERR("Malloc for segment map failed\n", NULL);
+    }
+
+    for (int by_addr = 1; by_addr >= 0 && ret == 0; by_addr--) {
+        size_t nsect = 0, nseg = 0;
+
+        for (size_t i = 1; i < ns; i++) {
+            const shelf_Shdr *sh = &desc->sht[i];
+
+            if (!(sh->sh_flags & SHF_ALLOC) != !by_addr || sh->sh_type == SHT_NULL)
+                continue;
+
+            sects[nsect].start = by_addr ? sh->sh_addr : sh->sh_offset;
+            sects[nsect].index = i;
+            nsect++;
+        }
+
+        for (size_t i = 0; i < np; i++) {
+            const Elf64_Phdr *ph = &desc->pht[i];
+            uint64_t start = by_addr ? ph->p_vaddr : ph->p_offset;
+            uint64_t len = by_addr ? ph->p_memsz : ph->p_filesz;
+
+            segs[nseg].start = start;
+            segs[nseg].end = len > UINT64_MAX - start ? UINT64_MAX : start + len;
+            segs[nseg].index = i;
+            nseg++;
+        }
+
+        ret = sweep(desc, map, sects, nsect, segs, nseg);
+    }
+
+    free(sects);
+    free(segs);
+    desc->segmap = map;
+
+    if (ret != 0) {
+        shelf_segmap_free(desc);
+        PROFILER_RERR("Malloc for segment map failed\n", NULL);
+    }
+
+    PROFILER_ROUT(map, "shelfsegmap_t *: %p");
+}
+
+void shelf_segmap_free(shelfobj_t *desc)
+{
+    if (desc == NULL || desc->segmap == NULL)
+        return;
+
+    free(desc->segmap->sect_segs);
+    free(desc->segmap->seg_sects);
+    free(desc->segmap);
+    desc->segmap = NULL;
+}
+
+static int cmp_vaddr(const void *a, const void *b)
+{
+    const shelfloadseg_t *x = a, *y = b;
+
+    return (x->vaddr > y->vaddr) - (x->vaddr < y->vaddr);
+}
+
+static int cmp_offset(const void *a, const void *b)
+{
+    const shelfloadseg_t *x = a, *y = b;
+
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+shelfloadidx_t *shelf_loadidx_load(shelfobj_t *desc)
+{
+    shelfloadidx_t *idx;
+    size_t n = 0;
+
+    PROFILER_IN();
+
+    if (desc == NULL)
+        PROFILER_RERR("Null argument passed to shelf_loadidx_load()\n", NULL);
+
+    if (desc->loadidx != NULL)
+        PROFILER_ROUT(desc->loadidx, "shelfloadidx_t *: %p");
+
+    for (size_t i = 0; desc->pht != NULL && i < desc->hdr.e_phnum; i++)
+        n += desc->pht[i].p_type == PT_LOAD;
+
+    if ((idx = calloc(1, sizeof(shelfloadidx_t))) == NULL)
+        PROFILER_RERR("Malloc for load index failed\n", NULL);
+
+    idx->by_vaddr = malloc((n ? n : 1) * sizeof(shelfloadseg_t));
+    idx->by_offset = malloc((n ? n : 1) * sizeof(shelfloadseg_t));
+
+    if (idx->by_vaddr == NULL || idx->by_offset == NULL) {
+        desc->loadidx = idx;
+        shelf_loadidx_free(desc);
+        PROFILER_RERR("Malloc for load index failed\n", NULL);
+    }
+
+    for (size_t i = 0; n && i < desc->hdr.e_phnum; i++) {
+        const Elf64_Phdr *ph = &desc->pht[i];
+
+        if (ph->p_type != PT_LOAD)
+            continue;
+
+        shelfloadseg_t *seg = &idx->by_vaddr[idx->count++];
+
+        seg->vaddr = ph->p_vaddr;
+        seg->offset = ph->p_offset;
+        seg->memsz = ph->p_memsz;
+        // A segment can't hold more file bytes than it maps.
+        seg->filesz = ph->p_filesz < ph->p_memsz ? ph->p_filesz : ph->p_memsz;
+        seg->index = i;
+    }
+
+    memcpy(idx->by_offset, idx->by_vaddr, n * sizeof(shelfloadseg_t));
+    qsort(idx->by_vaddr, n, sizeof(shelfloadseg_t), cmp_vaddr);
+    qsort(idx->by_offset, n, sizeof(shelfloadseg_t), cmp_offset);
+
+    desc->loadidx = idx;
+
+    PROFILER_ROUT(idx, "shelfloadidx_t *: %p");
+}
+
+void shelf_loadidx_free(shelfobj_t *desc)
+{
+    if (desc == NULL || desc->loadidx == NULL)
+        return;
+
+    free(desc->loadidx->by_vaddr);
+    free(desc->loadidx->by_offset);
+    free(desc->loadidx);
+    desc->loadidx = NULL;
+}
+
+/*
+ * Index of the last entry starting at or below `key`, or -1.
+ */
+static ssize_t last_at_or_below(const shelfloadseg_t *segs, size_t n, uint64_t key, int by_offset)
+{
+    size_t lo = 0, hi = n;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if ((by_offset ? segs[mid].offset : segs[mid].vaddr) <= key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return (ssize_t) lo - 1;
+}
+
+static int classify(const shelfloadseg_t *seg, uint64_t vaddr, uint64_t *offset)
+{
+    uint64_t rel = vaddr - seg->vaddr;
+
+    if (vaddr < seg->vaddr || rel >= seg->memsz)
+        return SHELF_ADDR_UNMAPPED;
+
+    if (rel >= seg->filesz)
+        return SHELF_ADDR_IN_MEMSZ;
+
+    *offset = seg->offset + rel;
+
+    return SHELF_ADDR_IN_FILE;
+}
+
+/*
+ * The PT_LOAD whose memory image contains `vaddr`, or NULL.
+ */
+const shelfloadseg_t *shelf_loadseg_find(shelfobj_t *desc, uint64_t vaddr)
+{
+    shelfloadidx_t *idx;
+    ssize_t i;
+
+    if ((idx = shelf_loadidx_load(desc)) == NULL)
+        return NULL;
+
+    if ((i = last_at_or_below(idx->by_vaddr, idx->count, vaddr, 0)) < 0 ||
+        vaddr - idx->by_vaddr[i].vaddr >= idx->by_vaddr[i].memsz) {
+        return NULL;
+    }
+
+    return &idx->by_vaddr[i];
+}
+
+/*
+ * Translate a virtual address to a file offset. Returns one of the
+ * SHELF_ADDR_* codes; `offset` is only written for SHELF_ADDR_IN_FILE.
+ */
+int shelf_vaddr_to_offset(shelfobj_t *desc, uint64_t vaddr, uint64_t *offset)
+{
+    shelfloadidx_t *idx;
+    ssize_t i;
+
+    if ((idx = shelf_loadidx_load(desc)) == NULL)
+        return SHELF_ADDR_UNMAPPED;
+
+    if ((i = last_at_or_below(idx->by_vaddr, idx->count, vaddr, 0)) < 0)
+        return SHELF_ADDR_UNMAPPED;
+
+    return classify(&idx->by_vaddr[i], vaddr, offset);
+}
+
+/*
+ * Translate a file offset to the virtual address it is loaded at. When
+ * several segments map the same bytes the one starting last in the file
+ * wins. Returns SHELF_ADDR_IN_FILE or SHELF_ADDR_UNMAPPED.
+ */
+int shelf_offset_to_vaddr(shelfobj_t *desc, uint64_t offset, uint64_t *vaddr)
+{
+    shelfloadidx_t *idx;
+
+    if ((idx = shelf_loadidx_load(desc)) == NULL)
+        return SHELF_ADDR_UNMAPPED;
+
+    for (ssize_t i = last_at_or_below(idx->by_offset, idx->count, offset, 1); i >= 0; i--) {
+        const shelfloadseg_t *seg = &idx->by_offset[i];
+
+        if (offset - seg->offset < seg->filesz) {
+            *vaddr = seg->vaddr + (offset - seg->offset);
+            return SHELF_ADDR_IN_FILE;
+        }
+    }
+
+    return SHELF_ADDR_UNMAPPED;
+}
+
+/*
+ * Translate `count` addresses, writing each one's SHELF_ADDR_* code to
+ * `status` and, when in the file, its offset to `offsets`. The segment of
+ * the previous address is tried before searching, so runs of nearby
+ * addresses cost a compare each. Returns the number found in the file.
+ */
+size_t shelf_vaddr_to_offset_batch(shelfobj_t *desc, const uint64_t *vaddrs,
+                                   uint64_t *offsets, uint8_t *status, size_t count)
+{
+    shelfloadidx_t *idx;
+    const shelfloadseg_t *hint = NULL;
+    size_t found = 0;
+
+    if ((idx = shelf_loadidx_load(desc)) == NULL) {
+        memset(status, SHELF_ADDR_UNMAPPED, count);
+        return 0;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        uint64_t vaddr = vaddrs[i];
+
+        if (hint == NULL || vaddr < hint->vaddr || vaddr - hint->vaddr >= hint->memsz) {
+            ssize_t j = last_at_or_below(idx->by_vaddr, idx->count, vaddr, 0);
+
+            hint = j >= 0 ? &idx->by_vaddr[j] : NULL;
+        }
+
+        status[i] = hint != NULL ? classify(hint, vaddr, &offsets[i]) : SHELF_ADDR_UNMAPPED;
+        found += status[i] == SHELF_ADDR_IN_FILE;
+    }
+
+    return found;
+}
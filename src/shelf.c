@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include <assert.h>
 #include <errno.h>
 #include <stdio.h>
@@ -13,31 +15,59 @@
 #include "shelf_profiler.h"
 #include "section.h"
 #include "symbol.h"
+#include "symquery.h"
+#include "nameidx.h"
+#include "segment.h"
+#include "core.h"
+#include "patch.h"
+#include "journal.h"
+#include "layout.h"
+#include "shelf_verify.h"
+#include "shelf_compress.h"
+#include "dynamic.h"
 
 char *shelf_error;
 
+static int is_core_file(int fd)
+{
+    unsigned char ident[EI_NIDENT + 2];
+
+    if (shelf_pread_full(fd, ident, sizeof(ident), 0) != 0 ||
+        ident[EI_MAG0] != ELFMAG0 || ident[EI_MAG1] != ELFMAG1 ||
+        ident[EI_MAG2] != ELFMAG2 || ident[EI_MAG3] != ELFMAG3) {
+        return 0;
+    }
+
+    if (ident[EI_DATA] == ELFDATA2MSB)
+        return read_word_be(ident + EI_NIDENT) == ET_CORE;
+
+    return read_word_le(ident + EI_NIDENT) == ET_CORE;
+}
+
 shelfobj_t *shelf_open(const char *path)
+{
+    return shelf_open_flags(path, SHELF_OPEN_DEFAULT);
+}
+
+shelfobj_t *shelf_open_flags(const char *path, int flags)
 {
     shelfobj_t *desc;
     int o_flags = -1;
 
-    /* Function pointers we'll set later to handle different endianesses */
-    uint16_t (*read_word)(const unsigned char *src);
-    uint32_t (*read_dword)(const unsigned char *src);
-    uint64_t (*read_qword)(const unsigned char *src);
-
     PROFILER_IN();
 
     desc = calloc(1, sizeof(shelfobj_t));
+    desc->flags = flags;
 
     stat(path, &desc->file_stat);
 
-    if (access(path, R_OK) == 0)
+    if (flags & SHELF_OPEN_PATCH) {
+        if (access(path, R_OK | W_OK) == 0) {
+            o_flags = O_RDWR;
+            desc->writable = 1;
+        }
+    } else if (access(path, R_OK) == 0) {
         o_flags = O_RDONLY;
-
-    if (access(path, R_OK) == 0 && access(path, W_OK) != 0) {
-        o_flags = O_RDWR;
-        desc->writable = 1;
     }
 
     if (o_flags == -1 || (desc->fd = open(path, o_flags)) == -1) {
@@ -52,11 +82,22 @@ shelfobj_t *shelf_open(const char *path)
         goto error;
     }
 
+    /*
+     * Cores can be tens of gigabytes; read their headers and notes with
+     * pread instead of mapping them.
+     */
+    if (!(flags & SHELF_OPEN_MAP_CORE) && is_core_file(desc->fd)) {
+        if (shelf_core_load(desc) != 0)
+            goto error;
+
+        PROFILER_ROUT(desc, "Elf_Desc: %p");
+    }
+
     desc->data = mmap(
         NULL,
         desc->file_stat.st_size,
-        PROT_READ,
-        MAP_PRIVATE,
+        desc->writable ? PROT_READ | PROT_WRITE : PROT_READ,
+        desc->writable ? MAP_SHARED : MAP_PRIVATE,
         desc->fd,
         0
     );
@@ -69,63 +110,31 @@ shelfobj_t *shelf_open(const char *path)
 
     desc->mmapped = 1;
 
+    if (desc->data[EI_CLASS] == ELFCLASS64 && desc->file_stat.st_size < (off_t) sizeof(Elf64_Ehdr)) {
+        shelf_error = "File is smaller than the ELF header";
+        goto error;
+    }
+
     /*
     * Load header.
     */
 
     desc->e_ident = desc->data;
-    desc->ei_class = desc->e_ident[EI_CLASS];
-    desc->ei_data = desc->e_ident[EI_DATA];
+    shelf_decode_ehdr(desc, desc->data);
 
-    if (desc->ei_data != 2) { // little-endian
-        read_word = read_word_le;
-        read_dword = read_dword_le;
-        read_qword = read_qword_le;
-    } else {                     // big-endian
-        read_word = read_word_be;
-        read_dword = read_dword_be;
-        read_qword = read_qword_be;
-    }
-
-    size_t offset = EI_NIDENT;
-
-    if (desc->ei_class == 1) { // 32 bit
-        memcpy(desc->hdr.e_ident, desc->data, EI_NIDENT);
-        desc->hdr.e_type = read_word(desc->data + offset); offset += 2;
-        desc->hdr.e_machine = read_word(desc->data + offset); offset += 2;
-        desc->hdr.e_version = read_dword(desc->data + offset); offset += 4;
-        desc->hdr.e_entry = read_dword(desc->data + offset); offset += 4;
-        desc->hdr.e_phoff = read_dword(desc->data + offset); offset += 4;
-        desc->hdr.e_shoff = read_dword(desc->data + offset); offset += 4;
-        desc->hdr.e_flags = read_dword(desc->data + offset); offset += 4;
-        desc->hdr.e_ehsize = read_word(desc->data + offset); offset += 2;
-        desc->hdr.e_phentsize = read_word(desc->data + offset); offset += 2;
-        desc->hdr.e_phnum = read_word(desc->data + offset); offset += 2;
-        desc->hdr.e_shentsize = read_word(desc->data + offset); offset += 2;
-        desc->hdr.e_shnum = read_word(desc->data + offset); offset += 2;
-        desc->hdr.e_shstrndx = read_word(desc->data + offset); offset += 2;
-    } else if (desc->ei_class == 2) {  // 64 bit
-        memcpy(desc->hdr.e_ident, desc->data, EI_NIDENT);
-        desc->hdr.e_type = read_word(desc->data + offset); offset += 2;
-        desc->hdr.e_machine = read_word(desc->data + offset); offset += 2;
-        desc->hdr.e_version = read_dword(desc->data + offset); offset += 4;
-        desc->hdr.e_entry = read_qword(desc->data + offset); offset += 8;
-        desc->hdr.e_phoff = read_qword(desc->data + offset); offset += 8;
-        desc->hdr.e_shoff = read_qword(desc->data + offset); offset += 8;
-        desc->hdr.e_flags = read_dword(desc->data + offset); offset += 4;
-        desc->hdr.e_ehsize = read_word(desc->data + offset); offset += 2;
-        desc->hdr.e_phentsize = read_word(desc->data + offset); offset += 2;
-        desc->hdr.e_phnum = read_word(desc->data + offset); offset += 2;
-        desc->hdr.e_shentsize = read_word(desc->data + offset); offset += 2;
-        desc->hdr.e_shnum = read_word(desc->data + offset); offset += 2;
-        desc->hdr.e_shstrndx = read_word(desc->data + offset); offset += 2;
-    }
+    /*
+     * Make sure both header tables fit in the file before decoding them. In
+     * the default mode a bad table is quarantined: its entries are left zeroed
+     * (PT_NULL/SHT_NULL) so nothing downstream dereferences it.
+     */
+    if (shelf_verify_tables(desc) != 0 && (flags & SHELF_OPEN_STRICT))
+        goto error;
 
     /*
     * Load program header table.
     */
 
-    desc->pht = malloc(desc->hdr.e_phnum * sizeof(Elf64_Phdr));
+    desc->pht = calloc(desc->hdr.e_phnum ? desc->hdr.e_phnum : 1, sizeof(Elf64_Phdr));
 
     if (desc->pht == NULL) {
         shelf_error = "Malloc for pht failed";
@@ -134,33 +143,14 @@ shelfobj_t *shelf_open(const char *path)
 
     unsigned char *ph_base = desc->data + desc->hdr.e_phoff;
 
-    for (size_t i = 0; i < desc->hdr.e_phnum; i++) {
-        if (desc->ei_class != 2) { // 32-bit
-            desc->pht[i].p_type =   read_dword(ph_base + i * desc->hdr.e_phentsize);
-            desc->pht[i].p_offset = read_dword(ph_base + i * desc->hdr.e_phentsize + 4);
-            desc->pht[i].p_vaddr =  read_dword(ph_base + i * desc->hdr.e_phentsize + 8);
-            desc->pht[i].p_paddr =  read_dword(ph_base + i * desc->hdr.e_phentsize + 12);
-            desc->pht[i].p_filesz = read_dword(ph_base + i * desc->hdr.e_phentsize + 16);
-            desc->pht[i].p_memsz =  read_dword(ph_base + i * desc->hdr.e_phentsize + 20);
-            desc->pht[i].p_flags =  read_dword(ph_base + i * desc->hdr.e_phentsize + 24);
-            desc->pht[i].p_align =  read_dword(ph_base + i * desc->hdr.e_phentsize + 28);
-        } else { // 64-bit
-            desc->pht[i].p_type =   read_dword(ph_base + i * desc->hdr.e_phentsize);
-            desc->pht[i].p_flags =  read_dword(ph_base + i * desc->hdr.e_phentsize + 4);
-            desc->pht[i].p_offset = read_dword(ph_base + i * desc->hdr.e_phentsize + 8);
-            desc->pht[i].p_vaddr =  read_qword(ph_base + i * desc->hdr.e_phentsize + 16);
-            desc->pht[i].p_paddr =  read_qword(ph_base + i * desc->hdr.e_phentsize + 24);
-            desc->pht[i].p_filesz = read_qword(ph_base + i * desc->hdr.e_phentsize + 32);
-            desc->pht[i].p_memsz =  read_qword(ph_base + i * desc->hdr.e_phentsize + 40);
-            desc->pht[i].p_align =  read_qword(ph_base + i * desc->hdr.e_phentsize + 48);
-        }
-    }
+    for (size_t i = 0; desc->pht_verified && i < desc->hdr.e_phnum; i++)
+        shelf_decode_phdr(desc, ph_base + i * desc->hdr.e_phentsize, &desc->pht[i]);
 
     /*
     * Load section header table.
     */
 
-    desc->sht = malloc(desc->hdr.e_shnum * sizeof(Elf64_Shdr));
+    desc->sht = calloc(desc->hdr.e_shnum ? desc->hdr.e_shnum : 1, sizeof(Elf64_Shdr));
 
     if (desc->sht == NULL) {
         shelf_error = "Malloc for sht failed";
@@ -169,69 +159,37 @@ shelfobj_t *shelf_open(const char *path)
 
     unsigned char *sh_base = desc->data + desc->hdr.e_shoff;
 
-    for (size_t i = 0; i < desc->hdr.e_shnum; i++) {
-        if (desc->ei_class != 2) { // 32-bit
-            // TODO: Do this thingy boi
-        } else { // 64-bit
-            desc->sht[i].sh_name =      read_dword(sh_base + i * desc->hdr.e_shentsize);
-            desc->sht[i].sh_type =      read_dword(sh_base + i * desc->hdr.e_shentsize + 4);
-            desc->sht[i].sh_flags =     read_qword(sh_base + i * desc->hdr.e_shentsize + 8);
-            desc->sht[i].sh_addr =      read_qword(sh_base + i * desc->hdr.e_shentsize + 16);
-            desc->sht[i].sh_offset =    read_qword(sh_base + i * desc->hdr.e_shentsize + 24);
-            desc->sht[i].sh_size =      read_qword(sh_base + i * desc->hdr.e_shentsize + 32);
-            desc->sht[i].sh_link =      read_dword(sh_base + i * desc->hdr.e_shentsize + 40);
-            desc->sht[i].sh_info =      read_dword(sh_base + i * desc->hdr.e_shentsize + 44);
-            desc->sht[i].sh_addralign = read_qword(sh_base + i * desc->hdr.e_shentsize + 48);
-            desc->sht[i].sh_entsize =   read_qword(sh_base + i * desc->hdr.e_shentsize + 56);
-        }
-    }
+    for (size_t i = 0; desc->sht_verified && i < desc->hdr.e_shnum; i++)
+        shelf_decode_shdr(desc, sh_base + i * desc->hdr.e_shentsize, &desc->sht[i]);
 
     /*
-     * Load symbol table.
+     * Validate every section against the file once. Sections that fail are
+     * marked unverified and are never dereferenced by the accessors.
      */
+    int bad_sections = shelf_verify_sections(desc);
 
-    size_t num_symbols;
-    shelfsect_t *symtab_sect = get_section_by_name(desc, ".symtab");
-    shelfsect_t *strtab_sect = get_section_by_name(desc, ".strtab");
- 
-    if (symtab_sect != NULL) {
-        if (desc->ei_class == ELFCLASS64) {
-            num_symbols = symtab_sect->shdr->sh_size / sizeof(Elf64_Sym); 
-        } else {
-            num_symbols = symtab_sect->shdr->sh_size / sizeof(Elf32_Sym); 
-        }
-
-        desc->symtab = malloc(num_symbols * sizeof(shelfsym_t));
-
-        unsigned char *symtab_base = desc->data + symtab_sect->shdr->sh_offset;
-
-        for (size_t i = 0; i < num_symbols; i++) {
-            if (desc->ei_class == ELFCLASS64) { // 64-bit
-                desc->symtab[i].st_name =  read_dword((sizeof(Elf64_Sym) * i + symtab_base + 0));
-                desc->symtab[i].st_info =  (sizeof(Elf64_Sym) * i + symtab_base + 4);
-                desc->symtab[i].st_other = (sizeof(Elf64_Sym) * i + symtab_base + 5 );
-                desc->symtab[i].st_shndx = read_word((sizeof(Elf64_Sym) * i + symtab_base + 6));
-                desc->symtab[i].st_value = read_qword((sizeof(Elf64_Sym) * i + symtab_base + 8));
-                desc->symtab[i].st_size =  read_qword((sizeof(Elf64_Sym) * i + symtab_base + 16));
-            } else { // 32-bit.
-                desc->symtab[i].st_name =  read_dword((sizeof(Elf64_Sym) * i + symtab_base + 0));
-                desc->symtab[i].st_value = read_dword((sizeof(Elf64_Sym) * i + symtab_base + 4));
-                desc->symtab[i].st_size =  read_dword((sizeof(Elf64_Sym) * i + symtab_base + 8));
-                desc->symtab[i].st_info =  (sizeof(Elf64_Sym) * i + symtab_base + 12);
-                desc->symtab[i].st_other = (sizeof(Elf64_Sym) * i + symtab_base + 13 );
-                desc->symtab[i].st_shndx = read_word((sizeof(Elf64_Sym) * i + symtab_base + 14));
-            }
+    if (bad_sections < 0 || (bad_sections > 0 && (flags & SHELF_OPEN_STRICT)))
+        goto error;
 
-            if (desc->symtab[i].st_name != NULL) {
-                desc->symtab[i].name = desc->data + strtab_sect->shdr->sh_offset + desc->symtab[i].st_name;
-                printf("%s\n", desc->symtab[i].name);
-            }
-        }
-    }
+    /*
+     * Load symbol table, unless the caller streams symbols instead.
+     */
+    if (!(flags & SHELF_OPEN_LAZY_SYMBOLS) && shelf_load_symtab(desc) != 0)
+        goto error;
 
     PROFILER_ROUT(desc, "Elf_Desc: %p");
 
 error:
+    if (desc->sect_list) {
+        for (int i = 0; i < desc->hdr.e_shnum; i++)
+            free(desc->sect_list[i].name);
+        free(desc->sect_list);
+        desc->sect_list = NULL;
+    }
+
+    free(desc->sect_verified);
+    shelf_core_free(desc);
+
     if (desc->pht != NULL) {
         free(desc->pht);
         desc->pht = NULL;
@@ -263,9 +221,298 @@ error:
     PROFILER_RERR(shelf_error, NULL);
 }
 
-// ssize_t Elf_Write(desc *desc, const char *path) {
-//     return (ssize_t) 0;
-// }
+/*
+ * Decoders shared by shelf_open() and the readers that only pread() the bits
+ * of a file they need. They read raw file bytes of the descriptor's class and
+ * byte order into the class independent structures.
+ */
+void shelf_decode_ehdr(shelfobj_t *desc, const unsigned char *src)
+{
+    /* Function pointers to handle different endianesses */
+    uint16_t (*read_word)(const unsigned char *src);
+    uint32_t (*read_dword)(const unsigned char *src);
+    uint64_t (*read_qword)(const unsigned char *src);
+
+    desc->ei_class = src[EI_CLASS];
+    desc->ei_data = src[EI_DATA];
+
+    if (desc->ei_data != 2) { // little-endian
+        read_word = read_word_le;
+        read_dword = read_dword_le;
+        read_qword = read_qword_le;
+    } else {                     // big-endian
+        read_word = read_word_be;
+        read_dword = read_dword_be;
+        read_qword = read_qword_be;
+    }
+
+    desc->read_word = read_word;
+    desc->read_dword = read_dword;
+    desc->read_qword = read_qword;
+
+    if (desc->ei_data != 2) {
+        desc->write_word = write_word_le;
+        desc->write_dword = write_dword_le;
+        desc->write_qword = write_qword_le;
+    } else {
+        desc->write_word = write_word_be;
+        desc->write_dword = write_dword_be;
+        desc->write_qword = write_qword_be;
+    }
+
+    size_t offset = EI_NIDENT;
+
+    if (desc->ei_class == 1) { // 32 bit
+        memcpy(desc->hdr.e_ident, src, EI_NIDENT);
+        desc->hdr.e_type = read_word(src + offset); offset += 2;
+        desc->hdr.e_machine = read_word(src + offset); offset += 2;
+        desc->hdr.e_version = read_dword(src + offset); offset += 4;
+        desc->hdr.e_entry = read_dword(src + offset); offset += 4;
+        desc->hdr.e_phoff = read_dword(src + offset); offset += 4;
+        desc->hdr.e_shoff = read_dword(src + offset); offset += 4;
+        desc->hdr.e_flags = read_dword(src + offset); offset += 4;
+        desc->hdr.e_ehsize = read_word(src + offset); offset += 2;
+        desc->hdr.e_phentsize = read_word(src + offset); offset += 2;
+        desc->hdr.e_phnum = read_word(src + offset); offset += 2;
+        desc->hdr.e_shentsize = read_word(src + offset); offset += 2;
+        desc->hdr.e_shnum = read_word(src + offset); offset += 2;
+        desc->hdr.e_shstrndx = read_word(src + offset); offset += 2;
+    } else if (desc->ei_class == 2) {  // 64 bit
+        memcpy(desc->hdr.e_ident, src, EI_NIDENT);
+        desc->hdr.e_type = read_word(src + offset); offset += 2;
+        desc->hdr.e_machine = read_word(src + offset); offset += 2;
+        desc->hdr.e_version = read_dword(src + offset); offset += 4;
+        desc->hdr.e_entry = read_qword(src + offset); offset += 8;
+        desc->hdr.e_phoff = read_qword(src + offset); offset += 8;
+        desc->hdr.e_shoff = read_qword(src + offset); offset += 8;
+        desc->hdr.e_flags = read_dword(src + offset); offset += 4;
+        desc->hdr.e_ehsize = read_word(src + offset); offset += 2;
+        desc->hdr.e_phentsize = read_word(src + offset); offset += 2;
+        desc->hdr.e_phnum = read_word(src + offset); offset += 2;
+        desc->hdr.e_shentsize = read_word(src + offset); offset += 2;
+        desc->hdr.e_shnum = read_word(src + offset); offset += 2;
+        desc->hdr.e_shstrndx = read_word(src + offset); offset += 2;
+    }
+}
+
+void shelf_decode_phdr(const shelfobj_t *desc, const unsigned char *src, shelf_Phdr *phdr)
+{
+    if (desc->ei_class != 2) { // 32-bit
+        phdr->p_type =   desc->read_dword(src);
+        phdr->p_offset = desc->read_dword(src + 4);
+        phdr->p_vaddr =  desc->read_dword(src + 8);
+        phdr->p_paddr =  desc->read_dword(src + 12);
+        phdr->p_filesz = desc->read_dword(src + 16);
+        phdr->p_memsz =  desc->read_dword(src + 20);
+        phdr->p_flags =  desc->read_dword(src + 24);
+        phdr->p_align =  desc->read_dword(src + 28);
+    } else { // 64-bit
+        phdr->p_type =   desc->read_dword(src);
+        phdr->p_flags =  desc->read_dword(src + 4);
+        phdr->p_offset = desc->read_qword(src + 8);
+        phdr->p_vaddr =  desc->read_qword(src + 16);
+        phdr->p_paddr =  desc->read_qword(src + 24);
+        phdr->p_filesz = desc->read_qword(src + 32);
+        phdr->p_memsz =  desc->read_qword(src + 40);
+        phdr->p_align =  desc->read_qword(src + 48);
+    }
+}
+
+void shelf_decode_shdr(const shelfobj_t *desc, const unsigned char *src, shelf_Shdr *shdr)
+{
+    if (desc->ei_class != 2) { // 32-bit
+        shdr->sh_name =      desc->read_dword(src);
+        shdr->sh_type =      desc->read_dword(src + 4);
+        shdr->sh_flags =     desc->read_dword(src + 8);
+        shdr->sh_addr =      desc->read_dword(src + 12);
+        shdr->sh_offset =    desc->read_dword(src + 16);
+        shdr->sh_size =      desc->read_dword(src + 20);
+        shdr->sh_link =      desc->read_dword(src + 24);
+        shdr->sh_info =      desc->read_dword(src + 28);
+        shdr->sh_addralign = desc->read_dword(src + 32);
+        shdr->sh_entsize =   desc->read_dword(src + 36);
+    } else { // 64-bit
+        shdr->sh_name =      desc->read_dword(src);
+        shdr->sh_type =      desc->read_dword(src + 4);
+        shdr->sh_flags =     desc->read_qword(src + 8);
+        shdr->sh_addr =      desc->read_qword(src + 16);
+        shdr->sh_offset =    desc->read_qword(src + 24);
+        shdr->sh_size =      desc->read_qword(src + 32);
+        shdr->sh_link =      desc->read_dword(src + 40);
+        shdr->sh_info =      desc->read_dword(src + 44);
+        shdr->sh_addralign = desc->read_qword(src + 48);
+        shdr->sh_entsize =   desc->read_qword(src + 56);
+    }
+}
+
+/*
+ * Encoders, the inverse of the decoders above. Each writes one header in the
+ * descriptor's class and byte order and returns the number of bytes written.
+ */
+size_t shelf_encode_ehdr(const shelfobj_t *desc, const shelf_Ehdr *hdr, unsigned char *dst)
+{
+    size_t offset = EI_NIDENT;
+
+    memcpy(dst, hdr->e_ident, EI_NIDENT);
+    desc->write_word(dst + offset, hdr->e_type); offset += 2;
+    desc->write_word(dst + offset, hdr->e_machine); offset += 2;
+    desc->write_dword(dst + offset, hdr->e_version); offset += 4;
+
+    if (desc->ei_class != 2) { // 32-bit
+        desc->write_dword(dst + offset, hdr->e_entry); offset += 4;
+        desc->write_dword(dst + offset, hdr->e_phoff); offset += 4;
+        desc->write_dword(dst + offset, hdr->e_shoff); offset += 4;
+    } else { // 64-bit
+        desc->write_qword(dst + offset, hdr->e_entry); offset += 8;
+        desc->write_qword(dst + offset, hdr->e_phoff); offset += 8;
+        desc->write_qword(dst + offset, hdr->e_shoff); offset += 8;
+    }
+
+    desc->write_dword(dst + offset, hdr->e_flags); offset += 4;
+    desc->write_word(dst + offset, hdr->e_ehsize); offset += 2;
+    desc->write_word(dst + offset, hdr->e_phentsize); offset += 2;
+    desc->write_word(dst + offset, hdr->e_phnum); offset += 2;
+    desc->write_word(dst + offset, hdr->e_shentsize); offset += 2;
+    desc->write_word(dst + offset, hdr->e_shnum); offset += 2;
+    desc->write_word(dst + offset, hdr->e_shstrndx); offset += 2;
+
+    return offset;
+}
+
+size_t shelf_encode_phdr(const shelfobj_t *desc, const shelf_Phdr *phdr, unsigned char *dst)
+{
+    if (desc->ei_class != 2) { // 32-bit
+        desc->write_dword(dst, phdr->p_type);
+        desc->write_dword(dst + 4, phdr->p_offset);
+        desc->write_dword(dst + 8, phdr->p_vaddr);
+        desc->write_dword(dst + 12, phdr->p_paddr);
+        desc->write_dword(dst + 16, phdr->p_filesz);
+        desc->write_dword(dst + 20, phdr->p_memsz);
+        desc->write_dword(dst + 24, phdr->p_flags);
+        desc->write_dword(dst + 28, phdr->p_align);
+        return sizeof(Elf32_Phdr);
+    }
+
+    desc->write_dword(dst, phdr->p_type);
+    desc->write_dword(dst + 4, phdr->p_flags);
+    desc->write_qword(dst + 8, phdr->p_offset);
+    desc->write_qword(dst + 16, phdr->p_vaddr);
+    desc->write_qword(dst + 24, phdr->p_paddr);
+    desc->write_qword(dst + 32, phdr->p_filesz);
+    desc->write_qword(dst + 40, phdr->p_memsz);
+    desc->write_qword(dst + 48, phdr->p_align);
+    return sizeof(Elf64_Phdr);
+}
+
+size_t shelf_encode_shdr(const shelfobj_t *desc, const shelf_Shdr *shdr, unsigned char *dst)
+{
+    if (desc->ei_class != 2) { // 32-bit
+        desc->write_dword(dst, shdr->sh_name);
+        desc->write_dword(dst + 4, shdr->sh_type);
+        desc->write_dword(dst + 8, shdr->sh_flags);
+        desc->write_dword(dst + 12, shdr->sh_addr);
+        desc->write_dword(dst + 16, shdr->sh_offset);
+        desc->write_dword(dst + 20, shdr->sh_size);
+        desc->write_dword(dst + 24, shdr->sh_link);
+        desc->write_dword(dst + 28, shdr->sh_info);
+        desc->write_dword(dst + 32, shdr->sh_addralign);
+        desc->write_dword(dst + 36, shdr->sh_entsize);
+        return sizeof(Elf32_Shdr);
+    }
+
+    desc->write_dword(dst, shdr->sh_name);
+    desc->write_dword(dst + 4, shdr->sh_type);
+    desc->write_qword(dst + 8, shdr->sh_flags);
+    desc->write_qword(dst + 16, shdr->sh_addr);
+    desc->write_qword(dst + 24, shdr->sh_offset);
+    desc->write_qword(dst + 32, shdr->sh_size);
+    desc->write_dword(dst + 40, shdr->sh_link);
+    desc->write_dword(dst + 44, shdr->sh_info);
+    desc->write_qword(dst + 48, shdr->sh_addralign);
+    desc->write_qword(dst + 56, shdr->sh_entsize);
+    return sizeof(Elf64_Shdr);
+}
+
+/*
+ * pread() exactly `len` bytes at `offset`, retrying short reads. Returns 0 on
+ * success, -1 on error or end of file.
+ */
+int shelf_pread_full(int fd, void *buf, size_t len, uint64_t offset)
+{
+    unsigned char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = pread(fd, p, len, offset);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0)
+            return -1;
+
+        p += n;
+        len -= n;
+        offset += n;
+    }
+
+    return 0;
+}
+
+/*
+ * Read just the ELF header and program header table of desc->fd with pread()
+ * instead of mapping the file. desc->file_stat must already be filled in.
+ * Used by readers that only need a few small pieces of large files.
+ */
+int shelf_pread_headers(shelfobj_t *desc)
+{
+    unsigned char ehdr[sizeof(Elf64_Ehdr)];
+    unsigned char *raw;
+    size_t len;
+
+    PROFILER_IN();
+
+    if (desc->file_stat.st_size < (off_t) sizeof(Elf32_Ehdr) ||
+        shelf_pread_full(desc->fd, ehdr, sizeof(Elf32_Ehdr), 0) != 0) {
+        PROFILER_RERR("File is smaller than the smallest valid ELF file", -1);
+    }
+
+    if (ehdr[EI_MAG0] != ELFMAG0 || ehdr[EI_MAG1] != ELFMAG1 ||
+        ehdr[EI_MAG2] != ELFMAG2 || ehdr[EI_MAG3] != ELFMAG3) {
+        PROFILER_RERR("File is not an ELF file", -1);
+    }
+
+    if (ehdr[EI_CLASS] == ELFCLASS64 &&
+        shelf_pread_full(desc->fd, ehdr, sizeof(Elf64_Ehdr), 0) != 0) {
+        PROFILER_RERR("File is smaller than the ELF header", -1);
+    }
+
+    shelf_decode_ehdr(desc, ehdr);
+    desc->e_ident = desc->hdr.e_ident;
+
+    if (shelf_verify_tables(desc) != 0 && !desc->pht_verified)
+        PROFILER_RERR(shelf_error, -1);
+
+    len = (size_t) desc->hdr.e_phnum * desc->hdr.e_phentsize;
+    desc->pht = calloc(desc->hdr.e_phnum ? desc->hdr.e_phnum : 1, sizeof(Elf64_Phdr));
+    raw = malloc(len ? len : 1);
+
+    if (desc->pht == NULL || raw == NULL) {
+        free(raw);
+        PROFILER_RERR("Malloc for pht failed", -1);
+    }
+
+    if (shelf_pread_full(desc->fd, raw, len, desc->hdr.e_phoff) != 0) {
+        free(raw);
+        PROFILER_RERR("Reading program headers failed", -1);
+    }
+
+    for (size_t i = 0; i < desc->hdr.e_phnum; i++)
+        shelf_decode_phdr(desc, raw + i * desc->hdr.e_phentsize, &desc->pht[i]);
+
+    free(raw);
+
+    PROFILER_ROUT(0, "%d");
+}
 
 void shelf_close(shelfobj_t **desc)
 {
@@ -274,6 +521,10 @@ void shelf_close(shelfobj_t **desc)
     if (!(*desc))
         PROFILER_ERR("NULL pointer passed.");
 
+    // Rolling back needs the section list the journal was started on.
+    shelf_journal_rollback(*desc);
+    shelf_layout_free(*desc);
+
     if ((*desc)->sect_list) {
         for (int i = 0; i < (*desc)->hdr.e_shnum; i++) {
             // free section name string
@@ -281,16 +532,31 @@ void shelf_close(shelfobj_t **desc)
                 free((*desc)->sect_list[i].name);
                 (*desc)->sect_list[i].name = NULL;
             }
-            // free section data if it is allocated
-            if ((*desc)->sect_list[i].data != NULL) {
-                free((*desc)->sect_list[i].data);
-                (*desc)->sect_list[i].data = NULL;
-            }
+            // release section data if it has a private copy
+            release_section_data(&(*desc)->sect_list[i]);
         }
         free((*desc)->sect_list);
         (*desc)->sect_list = NULL;
     }
 
+    shelf_zcache_free(*desc);
+    shelf_dyn_free(*desc);
+    shelf_symver_free(*desc);
+    shelf_symcols_free(*desc);
+    shelf_nameidx_free(*desc);
+    shelf_segmap_free(*desc);
+    shelf_loadidx_free(*desc);
+    shelf_core_free(*desc);
+    shelf_patch_free(*desc);
+
+    if ((*desc)->debug != NULL)
+        shelf_close(&(*desc)->debug);
+
+    if ((*desc)->sect_verified != NULL) {
+        free((*desc)->sect_verified);
+        (*desc)->sect_verified = NULL;
+    }
+
     if ((*desc)->pht != NULL) {
         free((*desc)->pht);
         (*desc)->pht = NULL;
@@ -911,6 +1177,7 @@ const char *get_shdr_flags_str(unsigned int sh_flags)
             case SHF_OS_NONCONFORMING: *p++ = 'O'; break;
             case SHF_GROUP:            *p++ = 'G'; break;
             case SHF_TLS:              *p++ = 'T'; break;
+            case SHF_COMPRESSED:       *p++ = 'C'; break;
             case SHF_EXCLUDE:          *p++ = 'E'; break;
         }
     }
@@ -971,13 +1238,49 @@ uint64_t read_qword_le(const unsigned char *src)
 uint64_t read_qword_be(const unsigned char *src)
 {
     uint64_t ret = 0;
-    ret |= (uint64_t)src[3];
-    ret |= (uint64_t)src[2] << 8;
-    ret |= (uint64_t)src[1] << 16;
-    ret |= (uint64_t)src[0] << 24;
-    ret |= (uint64_t)src[0] << 32;
-    ret |= (uint64_t)src[0] << 40;
-    ret |= (uint64_t)src[0] << 48;
+    ret |= (uint64_t)src[7];
+    ret |= (uint64_t)src[6] << 8;
+    ret |= (uint64_t)src[5] << 16;
+    ret |= (uint64_t)src[4] << 24;
+    ret |= (uint64_t)src[3] << 32;
+    ret |= (uint64_t)src[2] << 40;
+    ret |= (uint64_t)src[1] << 48;
     ret |= (uint64_t)src[0] << 56;
     return ret;
 }
+
+void write_word_le(unsigned char *dst, uint16_t v)
+{
+    dst[0] = v;
+    dst[1] = v >> 8;
+}
+
+void write_word_be(unsigned char *dst, uint16_t v)
+{
+    dst[1] = v;
+    dst[0] = v >> 8;
+}
+
+void write_dword_le(unsigned char *dst, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        dst[i] = v >> (8 * i);
+}
+
+void write_dword_be(unsigned char *dst, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        dst[3 - i] = v >> (8 * i);
+}
+
+void write_qword_le(unsigned char *dst, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        dst[i] = v >> (8 * i);
+}
+
+void write_qword_be(unsigned char *dst, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        dst[7 - i] = v >> (8 * i);
+}
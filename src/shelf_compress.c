@@ -0,0 +1,433 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef SHELF_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef SHELF_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "shelf.h"
+#include "shelf_profiler.h"
+#include "shelf_compress.h"
+#include "section.h"
+
+
+/*
+ * One decompressed section. Entries form a doubly linked list ordered from
+ * most to least recently used and are also indexed by section index.
+ */
+struct zentry {
+    uint32_t index;
+    void *buf;
+    size_t len;
+    struct zentry *prev;
+    struct zentry *next;
+};
+
+struct shelf_zcache {
+    struct zentry **slots;  /* One slot per section header. */
+    struct zentry *head;    /* Most recently used. */
+    struct zentry *tail;    /* Least recently used, evicted first. */
+    size_t bytes;
+    size_t limit;
+};
+
+/* A section waiting to be inflated, possibly on another thread. */
+struct zjob {
+    shelfsect_t *sect;
+    uint32_t type;
+    const unsigned char *src;
+    uint64_t src_len;
+    void *buf;
+    uint64_t len;
+    int ok;
+};
+
+struct zpool {
+    struct zjob *jobs;
+    size_t count;
+    size_t next;
+};
+
+static int is_zdebug(const shelfsect_t *sect)
+{
+    return sect->name != NULL && !strncmp(sect->name, ".zdebug", 7);
+}
+
+/* Some tools leave .zdebug* sections uncompressed; only the magic tells. */
+static int has_zlib_magic(shelfobj_t *desc, shelfsect_t *sect)
+{
+    if (!sect->verified || sect->shdr->sh_type == SHT_NOBITS || desc->data == NULL ||
+        sect->shdr->sh_size < 12)
+        return 0;
+
+    return !memcmp(shelf_sect_ptr_unchecked(desc, sect->index), "ZLIB", 4);
+}
+
+/*
+ * Decode the compression header in front of a section's data. Returns 0 and
+ * fills in the algorithm, uncompressed size and compressed payload when the
+ * section is compressed, -1 otherwise.
+ */
+static int parse_chdr(shelfobj_t *desc, shelfsect_t *sect, uint32_t *type,
+                      uint64_t *size, const unsigned char **payload, uint64_t *payload_len)
+{
+    const unsigned char *p;
+    uint64_t sh_size = sect->shdr->sh_size;
+    uint64_t hdr_len;
+
+    if (!sect->verified || sect->shdr->sh_type == SHT_NOBITS || desc->data == NULL)
+        return -1;
+
+    p = shelf_sect_ptr_unchecked(desc, sect->index);
+
+    if (sect->shdr->sh_flags & SHF_COMPRESSED) {
+        if (desc->ei_class == ELFCLASS64) {
+            hdr_len = sizeof(Elf64_Chdr);
+            if (sh_size < hdr_len)
+                return -1;
+            *type = desc->read_dword(p);
+            *size = desc->read_qword(p + 8);
+        } else {
+            hdr_len = sizeof(Elf32_Chdr);
+            if (sh_size < hdr_len)
+                return -1;
+            *type = desc->read_dword(p);
+            *size = desc->read_dword(p + 4);
+        }
+    } else if (is_zdebug(sect)) {
+        hdr_len = 12;
+        if (sh_size < hdr_len || memcmp(p, "ZLIB", 4))
+            return -1;
+        *type = ELFCOMPRESS_ZLIB;
+        *size = read_qword_be(p + 4);
+    } else {
+        return -1;
+    }
+
+    *payload = p + hdr_len;
+    *payload_len = sh_size - hdr_len;
+
+    return 0;
+}
+
+static int inflate_buf(uint32_t type, const unsigned char *src, uint64_t src_len,
+                       void *dst, uint64_t dst_len)
+{
+    switch (type) {
+#ifdef SHELF_HAVE_ZLIB
+        case ELFCOMPRESS_ZLIB: {
+            uLongf out = dst_len;
+            return uncompress(dst, &out, src, src_len) == Z_OK && out == dst_len;
+        }
+#endif
+#ifdef SHELF_HAVE_ZSTD
+        case ELFCOMPRESS_ZSTD: {
+            size_t out = ZSTD_decompress(dst, dst_len, src, src_len);
+            return !ZSTD_isError(out) && out == dst_len;
+        }
+#endif
+        default:
+            (void) src; (void) src_len; (void) dst; (void) dst_len;
+            return 0;
+    }
+}
+
+static struct shelf_zcache *get_zcache(shelfobj_t *desc)
+{
+    if (desc->zcache != NULL)
+        return desc->zcache;
+
+    desc->zcache = calloc(1, sizeof(struct shelf_zcache));
+
+    if (desc->zcache == NULL)
+        return NULL;
+
+    desc->zcache->slots = calloc(desc->hdr.e_shnum ? desc->hdr.e_shnum : 1, sizeof(struct zentry *));
+
+    if (desc->zcache->slots == NULL) {
+        free(desc->zcache);
+        desc->zcache = NULL;
+        return NULL;
+    }
+
+    desc->zcache->limit = SHELF_ZCACHE_DEFAULT_LIMIT;
+
+    return desc->zcache;
+}
+
+static void lru_unlink(struct shelf_zcache *cache, struct zentry *e)
+{
+    if (e->prev) e->prev->next = e->next;
+    else         cache->head = e->next;
+
+    if (e->next) e->next->prev = e->prev;
+    else         cache->tail = e->prev;
+
+    e->prev = e->next = NULL;
+}
+
+static void lru_push_front(struct shelf_zcache *cache, struct zentry *e)
+{
+    e->prev = NULL;
+    e->next = cache->head;
+
+    if (cache->head) cache->head->prev = e;
+    else             cache->tail = e;
+
+    cache->head = e;
+}
+
+static void lru_evict(struct shelf_zcache *cache, size_t need)
+{
+    while (cache->tail != NULL && cache->bytes + need > cache->limit) {
+        struct zentry *victim = cache->tail;
+
+        lru_unlink(cache, victim);
+        cache->slots[victim->index] = NULL;
+        cache->bytes -= victim->len;
+        free(victim->buf);
+        free(victim);
+    }
+}
+
+/*
+ * Hand a freshly inflated buffer over to the cache. A section larger than the
+ * whole limit is still cached, it just pushes everything else out.
+ */
+static struct zentry *lru_insert(struct shelf_zcache *cache, uint32_t index, void *buf, size_t len)
+{
+    struct zentry *e = malloc(sizeof(struct zentry));
+
+    if (e == NULL)
+        return NULL;
+
+    lru_evict(cache, len);
+
+    e->index = index;
+    e->buf = buf;
+    e->len = len;
+    lru_push_front(cache, e);
+    cache->slots[index] = e;
+    cache->bytes += len;
+
+    return e;
+}
+
+int shelf_section_is_compressed(shelfobj_t *desc, shelfsect_t *sect)
+{
+    if (desc == NULL || sect == NULL)
+        return 0;
+
+    return (sect->shdr->sh_flags & SHF_COMPRESSED) || (is_zdebug(sect) && has_zlib_magic(desc, sect));
+}
+
+/*
+ * Report a section's size on disk and once decompressed. Both are sh_size for
+ * sections that aren't compressed.
+ */
+int shelf_section_sizes(shelfobj_t *desc, shelfsect_t *sect,
+                        uint64_t *compressed, uint64_t *uncompressed)
+{
+    const unsigned char *payload;
+    uint64_t payload_len, size;
+    uint32_t type;
+
+    PROFILER_IN();
+
+    if (desc == NULL || sect == NULL)
+        PROFILER_RERR("Null argument passed to shelf_section_sizes()\n", -1);
+
+    size = sect->shdr->sh_size;
+
+    if (shelf_section_is_compressed(desc, sect) &&
+        parse_chdr(desc, sect, &type, &size, &payload, &payload_len) != 0) {
+        PROFILER_RERR("Malformed compressed section header\n", -1);
+    }
+
+    if (compressed)
+        *compressed = sect->shdr->sh_size;
+
+    if (uncompressed)
+        *uncompressed = size;
+
+    PROFILER_ROUT(0, "%d");
+}
+
+const void *shelf_section_decompressed(shelfobj_t *desc, shelfsect_t *sect)
+{
+    struct shelf_zcache *cache;
+    struct zentry *e;
+    const unsigned char *payload;
+    uint64_t payload_len, size;
+    uint32_t type;
+    void *buf;
+
+    PROFILER_IN();
+
+    if (desc == NULL || sect == NULL)
+        PROFILER_RERR("Null argument passed to shelf_section_decompressed()\n", NULL);
+
+    if ((cache = get_zcache(desc)) == NULL)
+        PROFILER_RERR("Malloc for decompression cache failed\n", NULL);
+
+    if ((e = cache->slots[sect->index]) != NULL) {
+        lru_unlink(cache, e);
+        lru_push_front(cache, e);
+        PROFILER_ROUT(e->buf, "void *: %p");
+    }
+
+    if (parse_chdr(desc, sect, &type, &size, &payload, &payload_len) != 0)
+        PROFILER_RERR("Section is not compressed or its header is malformed\n", NULL);
+
+    if ((buf = malloc(size ? size : 1)) == NULL)
+        PROFILER_RERR("Malloc for decompressed section failed\n", NULL);
+
+    if (!inflate_buf(type, payload, payload_len, buf, size)) {
+        free(buf);
+        PROFILER_RERR("Decompressing section failed or algorithm unsupported\n", NULL);
+    }
+
+    if ((e = lru_insert(cache, sect->index, buf, size)) == NULL) {
+        free(buf);
+        PROFILER_RERR("Malloc for decompression cache entry failed\n", NULL);
+    }
+
+    PROFILER_ROUT(e->buf, "void *: %p");
+}
+
+static void *zworker(void *arg)
+{
+    struct zpool *pool = arg;
+    size_t i;
+
+    while ((i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < pool->count) {
+        struct zjob *job = &pool->jobs[i];
+        job->ok = inflate_buf(job->type, job->src, job->src_len, job->buf, job->len);
+    }
+
+    return NULL;
+}
+
+/*
+ * Decompress several sections at once on up to `threads` threads and add them
+ * to the cache. Sections that are already cached or not compressed are
+ * skipped, as are repeats within `sects`. Returns the number of sections
+ * inflated, or -1 on failure.
+ */
+int shelf_decompress_sections(shelfobj_t *desc, shelfsect_t **sects, size_t count, int threads)
+{
+    struct shelf_zcache *cache;
+    struct zpool pool = {0};
+    pthread_t *tids = NULL;
+    uint8_t *queued;
+    int spawned = 0;
+    int done = 0;
+
+    PROFILER_IN();
+
+    if (desc == NULL || sects == NULL)
+        PROFILER_RERR("Null argument passed to shelf_decompress_sections()\n", -1);
+
+    if ((cache = get_zcache(desc)) == NULL)
+        PROFILER_RERR("Malloc for decompression cache failed\n", -1);
+
+    /* Sections already given a job, by index. */
+    if ((queued = calloc(desc->hdr.e_shnum ? desc->hdr.e_shnum : 1, 1)) == NULL)
+        PROFILER_RERR("Malloc for decompression jobs failed\n", -1);
+
+    if ((pool.jobs = calloc(count ? count : 1, sizeof(struct zjob))) == NULL) {
+        free(queued);
+        PROFILER_RERR("Malloc for decompression jobs failed\n", -1);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        struct zjob *job = &pool.jobs[pool.count];
+
+        if (sects[i] == NULL || sects[i]->index < 0 || sects[i]->index >= desc->hdr.e_shnum ||
+            queued[sects[i]->index] || cache->slots[sects[i]->index] != NULL ||
+            !shelf_section_is_compressed(desc, sects[i]) ||
+            parse_chdr(desc, sects[i], &job->type, &job->len, &job->src, &job->src_len) != 0) {
+            continue;
+        }
+
+        if ((job->buf = malloc(job->len ? job->len : 1)) == NULL)
+            break;
+
+        job->sect = sects[i];
+        queued[sects[i]->index] = 1;
+        pool.count++;
+    }
+
+    free(queued);
+
+    if (threads > 1 && pool.count > 1) {
+        if ((size_t) threads > pool.count)
+            threads = pool.count;
+
+        tids = malloc((threads - 1) * sizeof(pthread_t));
+
+        for (int t = 0; tids != NULL && t < threads - 1; t++) {
+            if (pthread_create(&tids[t], NULL, zworker, &pool) != 0)
+                break;
+            spawned++;
+        }
+    }
+
+    /* The calling thread works through the queue too. */
+    zworker(&pool);
+
+    for (int t = 0; t < spawned; t++)
+        pthread_join(tids[t], NULL);
+
+    free(tids);
+
+    for (size_t i = 0; i < pool.count; i++) {
+        struct zjob *job = &pool.jobs[i];
+
+        if (job->ok && lru_insert(cache, job->sect->index, job->buf, job->len) != NULL) {
+            done++;
+        } else {
+            free(job->buf);
+        }
+    }
+
+    free(pool.jobs);
+
+    PROFILER_ROUT(done, "%d");
+}
+
+void shelf_zcache_set_limit(shelfobj_t *desc, size_t limit)
+{
+    struct shelf_zcache *cache;
+
+    if (desc == NULL || (cache = get_zcache(desc)) == NULL)
+        return;
+
+    cache->limit = limit;
+    lru_evict(cache, 0);
+}
+
+void shelf_zcache_free(shelfobj_t *desc)
+{
+    struct zentry *e, *next;
+
+    if (desc == NULL || desc->zcache == NULL)
+        return;
+
+    for (e = desc->zcache->head; e != NULL; e = next) {
+        next = e->next;
+        free(e->buf);
+        free(e);
+    }
+
+    free(desc->zcache->slots);
+    free(desc->zcache);
+    desc->zcache = NULL;
+}
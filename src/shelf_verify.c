@@ -0,0 +1,137 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "shelf.h"
+#include "shelf_profiler.h"
+#include "shelf_verify.h"
+
+
+/*
+ * Returns non-zero when [off, off + len) does not fit inside a file of
+ * `size` bytes, including the case where the addition wraps.
+ */
+static inline int out_of_bounds(uint64_t off, uint64_t len, uint64_t size)
+{
+    uint64_t end = off + len;
+    return (end < off) | (end > size);
+}
+
+/*
+ * Check that the program and section header tables described by the ELF
+ * header fit inside the file and that their entries are large enough to hold
+ * the fields we decode. A table that fails is marked unverified so that
+ * shelf_open() leaves its entries zeroed instead of decoding garbage.
+ */
+int shelf_verify_tables(shelfobj_t *desc)
+{
+    uint64_t size = desc->file_stat.st_size;
+    uint16_t min_phent, min_shent;
+    int bad = 0;
+
+    PROFILER_IN();
+
+    if (desc->ei_class == ELFCLASS64) {
+        min_phent = sizeof(Elf64_Phdr);
+        min_shent = sizeof(Elf64_Shdr);
+    } else {
+        min_phent = sizeof(Elf32_Phdr);
+        min_shent = sizeof(Elf32_Shdr);
+    }
+
+    desc->pht_verified = desc->hdr.e_phnum == 0 || (
+        desc->hdr.e_phentsize >= min_phent &&
+        !out_of_bounds(desc->hdr.e_phoff,
+                       (uint64_t) desc->hdr.e_phnum * desc->hdr.e_phentsize, size)
+    );
+
+    desc->sht_verified = desc->hdr.e_shnum == 0 || (
+        desc->hdr.e_shentsize >= min_shent &&
+        desc->hdr.e_shstrndx < desc->hdr.e_shnum &&
+        !out_of_bounds(desc->hdr.e_shoff,
+                       (uint64_t) desc->hdr.e_shnum * desc->hdr.e_shentsize, size)
+    );
+
+    if (!desc->pht_verified) {
+        shelf_error = "Program header table lies outside of the file";
+        bad++;
+    }
+
+    if (!desc->sht_verified) {
+        shelf_error = "Section header table lies outside of the file";
+        bad++;
+    }
+
+    desc->hdr_corrupt = bad != 0;
+
+    PROFILER_ROUT(bad, "%d");
+}
+
+/*
+ * Check every section's contents and name against the file in a single pass.
+ * The loop body is branch free so the compiler can vectorize it; the result
+ * lands in desc->sect_verified, one byte per section header.
+ */
+int shelf_verify_sections(shelfobj_t *desc)
+{
+    uint64_t size = desc->file_stat.st_size;
+    uint16_t shnum = desc->hdr.e_shnum;
+    uint64_t strtab_size = 0;
+    int bad = 0;
+
+    PROFILER_IN();
+
+    desc->sect_verified = calloc(shnum ? shnum : 1, sizeof(uint8_t));
+
+    if (desc->sect_verified == NULL)
+        PROFILER_RERR("Malloc for sect_verified failed", -1);
+
+    if (!desc->sht_verified || shnum == 0)
+        PROFILER_ROUT(shnum, "%d");
+
+    /*
+     * Names can only be trusted if the section name string table itself is in
+     * bounds and terminated, in which case any in-bounds sh_name yields a
+     * terminated string.
+     */
+    shelf_Shdr *shstrtab = &desc->sht[desc->hdr.e_shstrndx];
+
+    if (shstrtab->sh_size != 0 &&
+        !out_of_bounds(shstrtab->sh_offset, shstrtab->sh_size, size) &&
+        desc->data[shstrtab->sh_offset + shstrtab->sh_size - 1] == '\0') {
+        strtab_size = shstrtab->sh_size;
+    }
+
+    for (uint16_t i = 0; i < shnum; i++) {
+        const shelf_Shdr *shdr = &desc->sht[i];
+        int in_file = (shdr->sh_type == SHT_NOBITS) |
+                      !out_of_bounds(shdr->sh_offset, shdr->sh_size, size);
+        int named = shdr->sh_name < strtab_size;
+
+        desc->sect_verified[i] = in_file & named;
+        bad += !(in_file & named);
+    }
+
+    if (bad)
+        shelf_error = "Section data or name lies outside of the file";
+
+    PROFILER_ROUT(bad, "%d");
+}
+
+/*
+ * Check every decoded symbol's name offset against the size of its string
+ * table. Symbols that fail keep a NULL name.
+ */
+int shelf_verify_symbols(shelfobj_t *desc, uint64_t strtab_size)
+{
+    int bad = 0;
+
+    PROFILER_IN();
+
+    for (size_t i = 0; i < desc->symcount; i++)
+        bad += desc->symtab[i].st_name >= strtab_size;
+
+    if (bad)
+        shelf_error = "Symbol name lies outside of the string table";
+
+    PROFILER_ROUT(bad, "%d");
+}
@@ -0,0 +1,420 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <linux/fs.h>
+
+#include "shelf.h"
+#include "shelf_profiler.h"
+#include "shelf_compress.h"
+#include "journal.h"
+#include "layout.h"
+
+
+#define COPY_CHUNK  (1 << 20)
+#define WRITE_IOV   64
+
+/* A range of the output that doesn't come from the source file. */
+struct patch {
+    uint64_t offset;
+    const void *buf;
+    size_t len;
+};
+
+static int cmp_patch(const void *a, const void *b)
+{
+    const struct patch *x = a, *y = b;
+
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+static int write_full(int fd, const void *buf, size_t len, uint64_t offset)
+{
+    const unsigned char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, offset);
+
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+
+        p += n;
+        len -= n;
+        offset += n;
+    }
+
+    return 0;
+}
+
+/*
+ * Copy `len` bytes of the source at `src` to `dst` in the output through
+ * user space, from the mapping when there is one.
+ */
+static int copy_user(shelfobj_t *desc, int out, uint64_t src, uint64_t dst, uint64_t len)
+{
+    unsigned char *buf;
+
+    if (desc->data != NULL)
+        return write_full(out, desc->data + src, len, dst);
+
+    if ((buf = malloc(COPY_CHUNK)) == NULL)
+        return -1;
+
+    for (uint64_t at = 0; at < len; at += COPY_CHUNK) {
+        size_t n = len - at < COPY_CHUNK ? len - at : COPY_CHUNK;
+
+        if (shelf_pread_full(desc->fd, buf, n, src + at) != 0 || write_full(out, buf, n, dst + at) != 0) {
+            free(buf);
+            return -1;
+        }
+    }
+
+    free(buf);
+
+    return 0;
+}
+
+/*
+ * Copy a range of the source with copy_file_range(), finishing through
+ * user space where the kernel won't.
+ */
+static int copy_range(shelfobj_t *desc, int out, uint64_t src, uint64_t dst, uint64_t len)
+{
+    loff_t in_off = src, out_off = dst;
+
+    if (desc->fd <= 0)
+        return copy_user(desc, out, src, dst, len);
+
+    while ((uint64_t) in_off < src + len) {
+        ssize_t n = copy_file_range(desc->fd, &in_off, out, &out_off, src + len - in_off, 0);
+
+        if (n > 0)
+            continue;
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == 0 || errno == EXDEV || errno == ENOSYS || errno == EINVAL ||
+            errno == EOPNOTSUPP)
+            break;
+
+        return -1;
+    }
+
+    return copy_user(desc, out, in_off, out_off, src + len - in_off);
+}
+
+/*
+ * Give the output the source file's contents without moving them through
+ * user space: a reflink shares the source's extents outright, and failing
+ * that copy_file_range() copies in the kernel, or reflinks a range at a
+ * time on filesystems that can. Plain reads and writes are the last resort,
+ * for descriptors with no file behind them and copies across filesystems
+ * on kernels that refuse those.
+ */
+static int copy_source(shelfobj_t *desc, int out, uint64_t len)
+{
+    if (desc->fd > 0 && ioctl(out, FICLONE, desc->fd) == 0)
+        return 0;
+
+    return copy_range(desc, out, 0, 0, len);
+}
+
+/*
+ * Write patches in order, one pwritev() per run of adjacent ranges.
+ */
+static int write_patches(int out, const struct patch *patches, size_t count)
+{
+    struct iovec iov[WRITE_IOV];
+
+    for (size_t i = 0; i < count;) {
+        uint64_t end = patches[i].offset;
+        size_t n = 0;
+
+        while (i + n < count && n < WRITE_IOV && patches[i + n].offset == end) {
+            iov[n].iov_base = (void *) patches[i + n].buf;
+            iov[n].iov_len = patches[i + n].len;
+            end += patches[i + n].len;
+            n++;
+        }
+
+        ssize_t w = pwritev(out, iov, n, patches[i].offset);
+
+        // Short writes are rare enough to finish one range at a time.
+        if (w != (ssize_t) (end - patches[i].offset)) {
+            for (size_t j = 0; j < n; j++) {
+                if (write_full(out, patches[i + j].buf, patches[i + j].len, patches[i + j].offset) != 0)
+                    return -1;
+            }
+        }
+
+        i += n;
+    }
+
+    return 0;
+}
+
+/*
+ * A header table with its entries re-encoded from `pht` or `sht`. Entries
+ * wider than we encode keep their trailing bytes from the source table at
+ * `offset`, if it lies in the file.
+ */
+static unsigned char *encode_table(shelfobj_t *desc, uint64_t offset, size_t num, size_t entsize,
+                                   const Elf64_Phdr *pht, const shelf_Shdr *sht)
+{
+    size_t len = num * entsize;
+    unsigned char *buf = calloc(1, len ? len : 1);
+
+    if (buf == NULL)
+        return NULL;
+
+    if (desc->data != NULL && offset <= (uint64_t) desc->file_stat.st_size &&
+        len <= (uint64_t) desc->file_stat.st_size - offset)
+        memcpy(buf, desc->data + offset, len);
+
+    for (size_t i = 0; i < num; i++) {
+        if (sht != NULL)
+            shelf_encode_shdr(desc, &sht[i], buf + i * entsize);
+        else
+            shelf_encode_phdr(desc, &pht[i], buf + i * entsize);
+    }
+
+    return buf;
+}
+
+/* Everything written over the copied source, see shelf_write(). */
+struct plan {
+    struct patch *patches;
+    size_t npatches;
+    unsigned char ehdr[sizeof(Elf64_Ehdr)];
+    unsigned char *pht_buf;
+    unsigned char *sht_buf;
+    uint64_t size;
+};
+
+static void free_plan(struct plan *plan)
+{
+    free(plan->patches);
+    free(plan->pht_buf);
+    free(plan->sht_buf);
+}
+
+/*
+ * The staged bytes of an open transaction first, then sections edited
+ * through get_section_data_rw(), by offset, then the headers, which win
+ * if an edit overlaps them.
+ */
+static int plan_patches(shelfobj_t *desc, struct plan *plan, size_t phentsize, size_t shentsize)
+{
+    size_t nextents = desc->journal != NULL ? desc->journal->count : 0;
+    struct patch *patches;
+    size_t npatches = 0;
+
+    if ((patches = plan->patches = malloc((nextents + desc->hdr.e_shnum + 3) * sizeof(struct patch))) == NULL) {
+        shelf_error = "Malloc for write plan failed";
+        return -1;
+    }
+
+    for (size_t i = 0; i < nextents; i++) {
+        const shelfextent_t *e = &desc->journal->extents[i];
+
+        patches[npatches++] = (struct patch) { e->offset, e->bytes, e->len };
+    }
+
+    size_t first_sect = npatches;
+
+    for (size_t i = 0; desc->sect_list != NULL && i < desc->hdr.e_shnum; i++) {
+        shelfsect_t *sect = &desc->sect_list[i];
+        uint64_t len = sect->shdr->sh_size;
+
+        if (sect->data_owner != SECT_DATA_MALLOC || sect->shdr->sh_type == SHT_NOBITS || len == 0)
+            continue;
+
+        if (shelf_section_is_compressed(desc, sect)) {
+            shelf_error = "Writing edited compressed sections is not supported";
+            return -1;
+        }
+
+        if (len > sect->data_len)
+            len = sect->data_len;
+
+        patches[npatches++] = (struct patch) { sect->shdr->sh_offset, sect->data, len };
+    }
+
+    qsort(patches + first_sect, npatches - first_sect, sizeof(struct patch), cmp_patch);
+
+    if (desc->hdr.e_phnum != 0) {
+        if ((plan->pht_buf = encode_table(desc, desc->hdr.e_phoff, desc->hdr.e_phnum, phentsize,
+                                          desc->pht, NULL)) == NULL) {
+            shelf_error = "Malloc for program headers failed";
+            return -1;
+        }
+        patches[npatches++] = (struct patch) { desc->hdr.e_phoff, plan->pht_buf, desc->hdr.e_phnum * phentsize };
+    }
+
+    if (desc->hdr.e_shnum != 0) {
+        if ((plan->sht_buf = encode_table(desc, desc->hdr.e_shoff, desc->hdr.e_shnum, shentsize,
+                                          NULL, desc->sht)) == NULL) {
+            shelf_error = "Malloc for section headers failed";
+            return -1;
+        }
+        patches[npatches++] = (struct patch) { desc->hdr.e_shoff, plan->sht_buf, desc->hdr.e_shnum * shentsize };
+    }
+
+    patches[npatches++] = (struct patch) { 0, plan->ehdr, shelf_encode_ehdr(desc, &desc->hdr, plan->ehdr) };
+
+    plan->size = desc->file_stat.st_size;
+
+    for (size_t i = 0; i < npatches; i++) {
+        if (patches[i].offset + patches[i].len > plan->size)
+            plan->size = patches[i].offset + patches[i].len;
+    }
+
+    plan->npatches = npatches;
+
+    return 0;
+}
+
+/*
+ * Write the output of a pending layout (see layout.h): the prefix and every
+ * section the file already had are copied with copy_file_range() to their
+ * new offsets, and only new and edited contents and the headers pass
+ * through user space.
+ */
+static int write_layout(shelfobj_t *desc, int out, const shelflplan_t *lp, size_t phentsize)
+{
+    unsigned char ehdr[sizeof(Elf64_Ehdr)];
+    unsigned char *pht_buf = NULL, *sht_buf = NULL;
+    int ret = -1;
+
+    if (ftruncate(out, lp->size) != 0 || copy_range(desc, out, 0, 0, lp->prefix) != 0)
+        return -1;
+
+    for (size_t i = 0; i < lp->nplaces; i++) {
+        const shelflplace_t *place = &lp->places[i];
+
+        if (place->buf != NULL ? write_full(out, place->buf, place->len, place->offset) != 0
+                               : copy_range(desc, out, place->src, place->offset, place->len) != 0)
+            return -1;
+    }
+
+    if (lp->hdr.e_phnum != 0 &&
+        ((pht_buf = encode_table(desc, lp->hdr.e_phoff, lp->hdr.e_phnum, phentsize, lp->pht, NULL)) == NULL ||
+         write_full(out, pht_buf, lp->hdr.e_phnum * phentsize, lp->hdr.e_phoff) != 0))
+        goto out;
+
+    if ((sht_buf = encode_table(desc, UINT64_MAX, lp->hdr.e_shnum, lp->hdr.e_shentsize, NULL, lp->sht)) == NULL ||
+        write_full(out, sht_buf, (size_t) lp->hdr.e_shnum * lp->hdr.e_shentsize, lp->hdr.e_shoff) != 0)
+        goto out;
+
+    ret = write_full(out, ehdr, shelf_encode_ehdr(desc, &lp->hdr, ehdr), 0);
+
+out:
+    free(pht_buf);
+    free(sht_buf);
+
+    return ret;
+}
+
+/*
+ * Serialize a descriptor to `path`. The output starts as a copy of the
+ * source file made without passing its bytes through user space (see
+ * copy_source()), over which the ELF header, program and section header
+ * tables, encoded from desc->hdr, desc->pht and desc->sht, the contents
+ * of every section with a private copy and the overlay of an open
+ * transaction (see journal.h) are written with pwritev(). The cost of
+ * saving an edit is then the size of the edit, not of the file.
+ *
+ * Sections added, removed or moved through the layout functions in
+ * section.h change where everything after them goes, and the output is
+ * instead assembled from the computed layout (see write_layout()).
+ *
+ * The file is built under a temporary name next to `path` and renamed over
+ * it, so `path` may be the descriptor's own file and readers never see a
+ * partly written one. Returns the size of the output, or -1.
+ */
+ssize_t shelf_write(shelfobj_t *desc, const char *path)
+{
+    struct plan plan = { 0 };
+    shelflplan_t lplan = { 0 };
+    char *tmp = NULL;
+    int out = -1, created = 0, laid_out;
+
+    PROFILER_IN();
+
+    if (desc == NULL || path == NULL)
+        PROFILER_RERR("Null argument passed to shelf_write()\n", -1);
+
+    size_t phentsize = desc->ei_class == ELFCLASS64 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
+    size_t shentsize = desc->ei_class == ELFCLASS64 ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr);
+
+    if (desc->hdr.e_phentsize > phentsize)
+        phentsize = desc->hdr.e_phentsize;
+    if (desc->hdr.e_shentsize > shentsize)
+        shentsize = desc->hdr.e_shentsize;
+
+    if ((laid_out = shelf_layout_pending(desc))) {
+        if (shelf_layout_plan(desc, &lplan) != 0)
+            goto error;
+        plan.size = lplan.size;
+    } else if (plan_patches(desc, &plan, phentsize, shentsize) != 0) {
+        goto error;
+    }
+
+    if (asprintf(&tmp, "%s.XXXXXX", path) == -1) {
+        tmp = NULL;
+        shelf_error = "Malloc for temporary name failed";
+        goto error;
+    }
+
+    if ((out = mkstemp(tmp)) == -1) {
+        shelf_error = "Unable to create output file";
+        goto error;
+    }
+
+    created = 1;
+
+    fchmod(out, desc->file_stat.st_mode ? desc->file_stat.st_mode & 07777 : 0644);
+
+    if (laid_out ? write_layout(desc, out, &lplan, phentsize) != 0
+                 : copy_source(desc, out, desc->file_stat.st_size) != 0 || ftruncate(out, plan.size) != 0 ||
+                   write_patches(out, plan.patches, plan.npatches) != 0) {
+        shelf_error = "Writing output file failed";
+        goto error;
+    }
+
+    int closed = close(out);
+
+    out = -1;
+
+    if (closed != 0 || rename(tmp, path) != 0) {
+        shelf_error = "Unable to move output file into place";
+        goto error;
+    }
+
+    free(tmp);
+    free_plan(&plan);
+    shelf_layout_plan_free(&lplan);
+
+    PROFILER_ROUT((ssize_t) plan.size, "%zd");
+
+error:
+    if (out != -1)
+        close(out);
+
+    if (created)
+        unlink(tmp);
+
+    free(tmp);
+    free_plan(&plan);
+    shelf_layout_plan_free(&lplan);
+
+    PROFILER_RERR(shelf_error, -1);
+}
@@ -0,0 +1,372 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shelf.h"
+#include "shelf_profiler.h"
+#include "strtab.h"
+
+
+#define STRTAB_CHUNK (64 * 1024)
+
+static uint32_t hash_str(const char *s, size_t len)
+{
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char) s[i]) * 16777619u;
+
+    return h;
+}
+
+static uint32_t find(const shelfstrtab_t *tab, const char *str, size_t len, uint32_t hash, size_t *slot)
+{
+    size_t i = hash & tab->mask;
+
+    for (; tab->slots[i] != 0; i = (i + 1) & tab->mask) {
+        const shelfstrent_t *e = &tab->strs[tab->slots[i] - 1];
+
+        if (e->hash == hash && e->len == len && memcmp(e->str, str, len) == 0)
+            break;
+    }
+
+    *slot = i;
+
+    return tab->slots[i];
+}
+
+/* Doubles the hash table, keeping it at most half full. */
+static int grow_slots(shelfstrtab_t *tab)
+{
+    size_t size = (tab->mask + 1) * 2;
+    uint32_t *slots = calloc(size, sizeof(uint32_t));
+
+    if (slots == NULL)
+        return -1;
+
+    for (size_t i = 0; i < tab->count; i++) {
+        size_t s = tab->strs[i].hash & (size - 1);
+
+        while (slots[s] != 0)
+            s = (s + 1) & (size - 1);
+
+        slots[s] = i + 1;
+    }
+
+    free(tab->slots);
+    tab->slots = slots;
+    tab->mask = size - 1;
+
+    return 0;
+}
+
+/* Adds an entry for a string not in the table. Returns its id. */
+static uint32_t insert(shelfstrtab_t *tab, const char *str, size_t len, uint32_t hash)
+{
+    size_t slot;
+
+    if (tab->count == UINT32_MAX - 1)
+        return UINT32_MAX;
+
+    if ((tab->count + 1) * 2 > tab->mask + 1 && grow_slots(tab) != 0)
+        return UINT32_MAX;
+
+    if (tab->count == tab->cap) {
+        size_t cap = tab->cap ? tab->cap * 2 : 64;
+        shelfstrent_t *grown = realloc(tab->strs, cap * sizeof(shelfstrent_t));
+
+        if (grown == NULL)
+            return UINT32_MAX;
+
+        tab->strs = grown;
+        tab->cap = cap;
+    }
+
+    find(tab, str, len, hash, &slot);
+    tab->slots[slot] = tab->count + 1;
+    tab->strs[tab->count] = (shelfstrent_t) { str, len, hash, 0 };
+
+    return tab->count++;
+}
+
+/*
+ * Returns an empty builder, or one over the existing table `base` if it
+ * isn't NULL. `base` must outlive the builder.
+ */
+shelfstrtab_t *shelf_strtab_new(const char *base, size_t base_len)
+{
+    shelfstrtab_t *tab;
+
+    PROFILER_IN();
+
+    if ((tab = calloc(1, sizeof(shelfstrtab_t))) == NULL ||
+        (tab->slots = calloc(64, sizeof(uint32_t))) == NULL) {
+        free(tab);
+        PROFILER_RERR("Malloc for string table failed", NULL);
+    }
+
+    tab->mask = 63;
+
+    if (base == NULL)
+        base_len = 0;
+
+    tab->base = base;
+    tab->base_len = base_len;
+
+    /* Every terminated string of the table, at the first place it occurs. */
+    for (size_t at = 0; at < base_len;) {
+        const char *end = memchr(base + at, '\0', base_len - at);
+        size_t len, slot;
+        uint32_t hash;
+
+        if (end == NULL)
+            break;
+
+        len = end - (base + at);
+        hash = hash_str(base + at, len);
+
+        if (find(tab, base + at, len, hash, &slot) == 0) {
+            uint32_t id = insert(tab, base + at, len, hash);
+
+            if (id == UINT32_MAX) {
+                shelf_strtab_free(tab);
+                PROFILER_RERR("Malloc for string table failed", NULL);
+            }
+
+            tab->strs[id].offset = at;
+        }
+
+        at += len + 1;
+    }
+
+    tab->nbase = tab->count;
+
+    PROFILER_ROUT(tab, "shelfstrtab_t: %p");
+}
+
+/*
+ * Returns a builder over the same base holding the same strings under the
+ * same ids, unfinalized.
+ */
+shelfstrtab_t *shelf_strtab_copy(const shelfstrtab_t *tab)
+{
+    shelfstrtab_t *copy;
+
+    PROFILER_IN();
+
+    if (tab == NULL)
+        PROFILER_RERR("Null argument passed to shelf_strtab_copy()\n", NULL);
+
+    if ((copy = shelf_strtab_new(tab->base, tab->base_len)) == NULL)
+        PROFILER_RERR("Malloc for string table failed", NULL);
+
+    // Added strings are distinct from the base's, so each takes the next id.
+    for (size_t i = tab->nbase; i < tab->count; i++) {
+        if (shelf_strtab_add(copy, tab->strs[i].str) != i) {
+            shelf_strtab_free(copy);
+            PROFILER_RERR("Malloc for string table failed", NULL);
+        }
+    }
+
+    PROFILER_ROUT(copy, "shelfstrtab_t: %p");
+}
+
+/*
+ * Returns the id of `str`, adding a copy of it if the table doesn't hold
+ * it yet, or UINT32_MAX on failure. Adding a string undoes finalization.
+ */
+uint32_t shelf_strtab_add(shelfstrtab_t *tab, const char *str)
+{
+    size_t len, slot;
+    uint32_t hash, id;
+
+    if (tab == NULL || str == NULL)
+        return UINT32_MAX;
+
+    len = strlen(str);
+    hash = hash_str(str, len);
+
+    if ((id = find(tab, str, len, hash, &slot)) != 0)
+        return id - 1;
+
+    if (len + 1 > tab->chunk_size - tab->chunk_used) {
+        size_t size = len + 1 > STRTAB_CHUNK ? len + 1 : STRTAB_CHUNK;
+        char **chunks = realloc(tab->chunks, (tab->nchunks + 1) * sizeof(char *));
+
+        if (chunks == NULL)
+            return UINT32_MAX;
+
+        tab->chunks = chunks;
+
+        if ((chunks[tab->nchunks] = malloc(size)) == NULL)
+            return UINT32_MAX;
+
+        tab->nchunks++;
+        tab->chunk_used = 0;
+        tab->chunk_size = size;
+    }
+
+    char *copy = tab->chunks[tab->nchunks - 1] + tab->chunk_used;
+
+    memcpy(copy, str, len + 1);
+
+    if ((id = insert(tab, copy, len, hash)) == UINT32_MAX)
+        return UINT32_MAX;
+
+    tab->chunk_used += len + 1;
+    tab->finalized = 0;
+
+    return id;
+}
+
+/*
+ * Nonzero if `str` is in the table or ends one of its strings, in which
+ * case adding it won't grow the laid out table.
+ */
+int shelf_strtab_hosts(const shelfstrtab_t *tab, const char *str)
+{
+    size_t len, slot;
+
+    if (tab == NULL || str == NULL)
+        return 0;
+
+    len = strlen(str);
+
+    if (find(tab, str, len, hash_str(str, len), &slot) != 0)
+        return 1;
+
+    for (size_t i = 0; i < tab->count; i++) {
+        const shelfstrent_t *e = &tab->strs[i];
+
+        if (e->len >= len && memcmp(e->str + e->len - len, str, len) == 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Orders strings by their reversed bytes, descending, so that each string
+ * directly follows the strings it is a suffix of.
+ */
+static int cmp_suffix(const void *a, const void *b)
+{
+    const shelfstrent_t *x = *(const shelfstrent_t * const *) a;
+    const shelfstrent_t *y = *(const shelfstrent_t * const *) b;
+    size_t i = x->len, j = y->len;
+
+    while (i > 0 && j > 0) {
+        unsigned char cx = x->str[--i], cy = y->str[--j];
+
+        if (cx != cy)
+            return (int) cy - (int) cx;
+    }
+
+    return (j > 0) - (i > 0);
+}
+
+/*
+ * Lay the table out: the base first, as it was, then each added string
+ * that isn't the tail of a string already placed. Strings are visited in
+ * suffix order, so only the one visited before a string can host it.
+ */
+int shelf_strtab_finalize(shelfstrtab_t *tab)
+{
+    shelfstrent_t **order;
+    const shelfstrent_t *prev = NULL;
+    uint64_t size;
+
+    PROFILER_IN();
+
+    if (tab == NULL)
+        PROFILER_RERR("Null argument passed to shelf_strtab_finalize()\n", -1);
+
+    if (tab->finalized)
+        PROFILER_ROUT(0, "%d");
+
+    if ((order = malloc((tab->count ? tab->count : 1) * sizeof(shelfstrent_t *))) == NULL)
+        PROFILER_RERR("Malloc for string table layout failed", -1);
+
+    for (size_t i = 0; i < tab->count; i++)
+        order[i] = &tab->strs[i];
+
+    qsort(order, tab->count, sizeof(shelfstrent_t *), cmp_suffix);
+
+    // A table always starts with the empty string.
+    size = tab->base_len ? tab->base_len : 1;
+
+    for (size_t i = 0; i < tab->count; i++) {
+        shelfstrent_t *e = order[i];
+
+        if (e < tab->strs + tab->nbase) {
+            prev = e;
+            continue;
+        }
+
+        if (e->len == 0 && tab->base_len == 0)
+            e->offset = 0;
+        else if (prev != NULL && prev->len >= e->len &&
+                 memcmp(prev->str + prev->len - e->len, e->str, e->len) == 0)
+            e->offset = prev->offset + prev->len - e->len;
+        else {
+            e->offset = size;
+            size += e->len + 1;
+        }
+
+        prev = e;
+    }
+
+    free(order);
+
+    if (size > UINT32_MAX)
+        PROFILER_RERR("String table grew past 4GB", -1);
+
+    char *data = realloc(tab->data, size);
+
+    if (data == NULL)
+        PROFILER_RERR("Malloc for string table failed", -1);
+
+    tab->data = data;
+    tab->size = size;
+
+    if (tab->base_len)
+        memcpy(data, tab->base, tab->base_len);
+    else
+        data[0] = '\0';
+
+    // A tail merged string is the same bytes as the end of its host.
+    for (size_t i = tab->nbase; i < tab->count; i++)
+        memcpy(data + tab->strs[i].offset, tab->strs[i].str, tab->strs[i].len + 1);
+
+    tab->finalized = 1;
+
+    PROFILER_ROUT(0, "%d");
+}
+
+const char *shelf_strtab_str(const shelfstrtab_t *tab, uint32_t id)
+{
+    return tab != NULL && id < tab->count ? tab->strs[id].str : NULL;
+}
+
+/* Offset of a string in the laid out table, or UINT32_MAX before that. */
+uint32_t shelf_strtab_offset(const shelfstrtab_t *tab, uint32_t id)
+{
+    return tab != NULL && tab->finalized && id < tab->count ? tab->strs[id].offset : UINT32_MAX;
+}
+
+void shelf_strtab_free(shelfstrtab_t *tab)
+{
+    if (tab == NULL)
+        return;
+
+    for (size_t i = 0; i < tab->nchunks; i++)
+        free(tab->chunks[i]);
+
+    free(tab->chunks);
+    free(tab->strs);
+    free(tab->slots);
+    free(tab->data);
+    free(tab);
+}
@@ -5,4 +5,727 @@
 #include "shelf.h"
 #include "shelf_profiler.h"
 #include "section.h"
+#include "symbol.h"
+#include "shelf_verify.h"
+#include "layout.h"
+#include "iter.h"
 
+
+/*
+ * Decode one symbol table entry of the file's class into a shelfsym_t. The
+ * name is left for the caller to resolve against the right string table.
+ */
+void shelf_decode_sym(const shelfobj_t *desc, const unsigned char *src, shelfsym_t *sym)
+{
+    if (desc->ei_class == ELFCLASS64) { // 64-bit
+        sym->st_name =  desc->read_dword(src + 0);
+        sym->st_info =  src[4];
+        sym->st_other = src[5];
+        sym->st_shndx = desc->read_word(src + 6);
+        sym->st_value = desc->read_qword(src + 8);
+        sym->st_size =  desc->read_qword(src + 16);
+    } else { // 32-bit.
+        sym->st_name =  desc->read_dword(src + 0);
+        sym->st_value = desc->read_dword(src + 4);
+        sym->st_size =  desc->read_dword(src + 8);
+        sym->st_info =  src[12];
+        sym->st_other = src[13];
+        sym->st_shndx = desc->read_word(src + 14);
+    }
+    sym->name = NULL;
+}
+
+/* Encode a symbol as an entry of the file's class, the inverse of the above. */
+void shelf_encode_sym(const shelfobj_t *desc, const shelfsym_t *sym, unsigned char *dst)
+{
+    if (desc->ei_class == ELFCLASS64) { // 64-bit
+        desc->write_dword(dst + 0, sym->st_name);
+        dst[4] = sym->st_info;
+        dst[5] = sym->st_other;
+        desc->write_word(dst + 6, sym->st_shndx);
+        desc->write_qword(dst + 8, sym->st_value);
+        desc->write_qword(dst + 16, sym->st_size);
+    } else { // 32-bit.
+        desc->write_dword(dst + 0, sym->st_name);
+        desc->write_dword(dst + 4, sym->st_value);
+        desc->write_dword(dst + 8, sym->st_size);
+        dst[12] = sym->st_info;
+        dst[13] = sym->st_other;
+        desc->write_word(dst + 14, sym->st_shndx);
+    }
+}
+
+/*
+ * Returns the data of a verified string table section and its usable size,
+ * trimmed back to the last terminator so every offset below it is a
+ * terminated string.
+ */
+const char *shelf_get_strtab(shelfobj_t *desc, uint32_t index, uint64_t *size)
+{
+    const char *strtab;
+
+    *size = 0;
+
+    if (index >= desc->hdr.e_shnum || (strtab = (const char *) shelf_sect_ptr(desc, index)) == NULL)
+        return NULL;
+
+    *size = desc->sht[index].sh_size;
+
+    while (*size > 0 && strtab[*size - 1] != '\0')
+        (*size)--;
+
+    return strtab;
+}
+
+/*
+ * Decode .symtab into desc->symtab. shelf_open() does this unless it was
+ * given SHELF_OPEN_LAZY_SYMBOLS, in which case the lookups call it on first
+ * use. A missing table is not an error; failure is only reported for
+ * allocation errors and, on strict descriptors, for out of range names.
+ */
+int shelf_load_symtab(shelfobj_t *desc)
+{
+    shelfsect_t *symtab_sect, *strtab_sect = NULL;
+
+    PROFILER_IN();
+
+    if (desc == NULL)
+        PROFILER_RERR("Null argument passed to shelf_load_symtab()\n", -1);
+
+    if (desc->symtab_loaded)
+        PROFILER_ROUT(0, "%d");
+
+    desc->symtab_loaded = 1;
+    symtab_sect = get_section_by_name(desc, ".symtab");
+
+    if (symtab_sect != NULL && symtab_sect->verified &&
+        symtab_sect->shdr->sh_link < desc->hdr.e_shnum) {
+        strtab_sect = &desc->sect_list[symtab_sect->shdr->sh_link];
+    }
+
+    if (strtab_sect == NULL || !strtab_sect->verified)
+        PROFILER_ROUT(0, "%d");
+
+    size_t sym_size = desc->ei_class == ELFCLASS64 ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym);
+    size_t num_symbols = symtab_sect->shdr->sh_size / sym_size;
+
+    desc->symtab = malloc(num_symbols * sizeof(shelfsym_t));
+
+    if (desc->symtab == NULL && num_symbols != 0)
+        PROFILER_RERR("Malloc for symtab failed", -1);
+
+    desc->symcount = num_symbols;
+
+    unsigned char *symtab_base = shelf_sect_ptr_unchecked(desc, symtab_sect->index);
+
+    for (size_t i = 0; i < num_symbols; i++)
+        shelf_decode_sym(desc, symtab_base + sym_size * i, &desc->symtab[i]);
+
+    /*
+     * Check all name offsets in one pass, then resolve names without any
+     * per-symbol bounds checks. A string table that is not terminated is
+     * treated as empty.
+     */
+    char *strtab = (char *) shelf_sect_ptr_unchecked(desc, strtab_sect->index);
+    uint64_t strtab_size = strtab_sect->shdr->sh_size;
+
+    if (strtab_size == 0 || strtab[strtab_size - 1] != '\0')
+        strtab_size = 0;
+
+    if (shelf_verify_symbols(desc, strtab_size) != 0 && (desc->flags & SHELF_OPEN_STRICT))
+        PROFILER_RERR(shelf_error, -1);
+
+    for (size_t i = 0; i < num_symbols; i++) {
+        desc->symtab[i].name = desc->symtab[i].st_name < strtab_size
+            ? strtab + desc->symtab[i].st_name
+            : NULL;
+    }
+
+    PROFILER_ROUT(0, "%d");
+}
+
+/*
+ * Decode .dynsym into desc->dynsym the first time it is needed.
+ */
+shelfsym_t *shelf_load_dynsym(shelfobj_t *desc, size_t *count)
+{
+    const unsigned char *base = NULL;
+    const char *strtab;
+    uint64_t strsz;
+    size_t sym_size, n;
+    uint32_t index = 0;
+
+    PROFILER_IN();
+
+    if (desc == NULL)
+        PROFILER_RERR("Null argument passed to shelf_load_dynsym()\n", NULL);
+
+    if (desc->dynsym != NULL) {
+        if (count)
+            *count = desc->dynsymcount;
+        PROFILER_ROUT(desc->dynsym, "shelfsym_t *: %p");
+    }
+
+    for (uint32_t i = 0; i < desc->hdr.e_shnum && base == NULL; i++) {
+        if (desc->sht[i].sh_type == SHT_DYNSYM) {
+            base = shelf_sect_ptr(desc, i);
+            index = i;
+        }
+    }
+
+    if (base == NULL)
+        PROFILER_RERR("No dynamic symbol table in file\n", NULL);
+
+    sym_size = desc->ei_class == ELFCLASS64 ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym);
+    n = desc->sht[index].sh_size / sym_size;
+    strtab = shelf_get_strtab(desc, desc->sht[index].sh_link, &strsz);
+
+    if ((desc->dynsym = malloc((n ? n : 1) * sizeof(shelfsym_t))) == NULL)
+        PROFILER_RERR("Malloc for dynsym failed\n", NULL);
+
+    for (size_t i = 0; i < n; i++) {
+        shelf_decode_sym(desc, base + i * sym_size, &desc->dynsym[i]);
+        desc->dynsym[i].name = desc->dynsym[i].st_name < strsz
+            ? (char *) strtab + desc->dynsym[i].st_name
+            : NULL;
+    }
+
+    desc->dynsymcount = n;
+
+    if (count)
+        *count = n;
+
+    PROFILER_ROUT(desc->dynsym, "shelfsym_t *: %p");
+}
+
+static shelfsym_t *find_by_name(shelfsym_t *syms, size_t count, const char *name)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (syms[i].name != NULL && syms[i].st_shndx != SHN_UNDEF && !strcmp(syms[i].name, name))
+            return &syms[i];
+    }
+
+    return NULL;
+}
+
+/*
+ * Best match for `addr` in one table: the defined symbol containing it, or
+ * failing that the closest one starting below it.
+ */
+static shelfsym_t *find_by_addr(shelfsym_t *syms, size_t count, Elf64_Addr addr, shelfsym_t *best)
+{
+    for (size_t i = 0; i < count; i++) {
+        shelfsym_t *s = &syms[i];
+        uint8_t type = ELF64_ST_TYPE(s->st_info);
+
+        if (s->st_shndx == SHN_UNDEF || s->st_value > addr || s->name == NULL || *s->name == '\0' ||
+            type == STT_SECTION || type == STT_FILE || type == STT_TLS) {
+            continue;
+        }
+
+        int contains = addr - s->st_value < s->st_size;
+        int best_contains = best != NULL && addr - best->st_value < best->st_size;
+
+        if (best == NULL || (contains && !best_contains) ||
+            (contains == best_contains && s->st_value > best->st_value)) {
+            best = s;
+        }
+    }
+
+    return best;
+}
+
+shelfsym_t *shelf_get_symbol_by_name(shelfobj_t *desc, const char *name)
+{
+    shelfsym_t *sym = NULL;
+
+    PROFILER_IN();
+
+    if (desc == NULL || name == NULL)
+        PROFILER_RERR("Null argument passed to shelf_get_symbol_by_name()\n", NULL);
+
+    for (shelfobj_t *d = desc; d != NULL && sym == NULL; d = d->debug) {
+        shelf_load_symtab(d);
+
+        if ((sym = find_by_name(d->symtab, d->symcount, name)) == NULL &&
+            shelf_load_dynsym(d, NULL) != NULL) {
+            sym = find_by_name(d->dynsym, d->dynsymcount, name);
+        }
+    }
+
+    PROFILER_ROUT(sym, "shelfsym_t *: %p");
+}
+
+shelfsym_t *shelf_get_symbol_by_addr(shelfobj_t *desc, Elf64_Addr addr, uint64_t *offset)
+{
+    shelfsym_t *sym = NULL;
+
+    PROFILER_IN();
+
+    if (desc == NULL)
+        PROFILER_RERR("Null argument passed to shelf_get_symbol_by_addr()\n", NULL);
+
+    for (shelfobj_t *d = desc; d != NULL; d = d->debug) {
+        shelf_load_symtab(d);
+        sym = find_by_addr(d->symtab, d->symcount, addr, sym);
+
+        if (shelf_load_dynsym(d, NULL) != NULL)
+            sym = find_by_addr(d->dynsym, d->dynsymcount, addr, sym);
+    }
+
+    if (sym != NULL && offset != NULL)
+        *offset = addr - sym->st_value;
+
+    PROFILER_ROUT(sym, "shelfsym_t *: %p");
+}
+
+static uint32_t fnv1a(uint32_t h, const char *s, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char) s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/*
+ * Hash of a (name, version) pair. An unversioned key hashes like the bare
+ * name.
+ */
+static uint32_t symver_hash(const char *name, size_t name_len, const char *ver, size_t ver_len)
+{
+    uint32_t h = fnv1a(2166136261u, name, name_len);
+
+    if (ver_len)
+        h = fnv1a(fnv1a(h, "@", 1), ver, ver_len);
+
+    return h;
+}
+
+/* Doubles the version name hash, keeping it at most half full. */
+static int grow_name_slots(shelfsymver_t *sv)
+{
+    size_t size = sv->name_slots ? (sv->name_mask + 1) * 2 : 16;
+    uint32_t *slots = calloc(size, sizeof(uint32_t));
+
+    if (slots == NULL)
+        return -1;
+
+    for (size_t i = 0; i < sv->nnames; i++) {
+        size_t s = fnv1a(2166136261u, sv->names[i], strlen(sv->names[i])) & (size - 1);
+
+        while (slots[s] != 0)
+            s = (s + 1) & (size - 1);
+
+        slots[s] = i + 1;
+    }
+
+    free(sv->name_slots);
+    sv->name_slots = slots;
+    sv->name_mask = size - 1;
+
+    return 0;
+}
+
+/* Returns the id of a version name, adding it if new, or UINT32_MAX on failure. */
+static uint32_t intern_name(shelfsymver_t *sv, const char *name)
+{
+    size_t i;
+
+    if ((sv->nnames + 1) * 2 > (sv->name_slots ? sv->name_mask + 1 : 0) && grow_name_slots(sv) != 0)
+        return UINT32_MAX;
+
+    for (i = fnv1a(2166136261u, name, strlen(name)) & sv->name_mask; sv->name_slots[i] != 0;
+         i = (i + 1) & sv->name_mask) {
+        if (!strcmp(sv->names[sv->name_slots[i] - 1], name))
+            return sv->name_slots[i] - 1;
+    }
+
+    if (sv->nnames == sv->names_cap) {
+        size_t cap = sv->names_cap ? sv->names_cap * 2 : 16;
+        const char **names = realloc(sv->names, cap * sizeof(char *));
+
+        if (names == NULL)
+            return UINT32_MAX;
+
+        sv->names = names;
+        sv->names_cap = cap;
+    }
+
+    sv->names[sv->nnames] = name;
+    sv->name_slots[i] = sv->nnames + 1;
+
+    return sv->nnames++;
+}
+
+static int set_index(shelfsymver_t *sv, uint16_t index, uint32_t name, const char *file)
+{
+    if (name == UINT32_MAX)
+        return -1;
+
+    index &= VERSYM_VERSION;
+
+    if (index >= sv->nindex) {
+        size_t n = index + 1;
+        uint32_t *names = realloc(sv->index_name, n * sizeof(uint32_t));
+        const char **files = realloc(sv->index_file, n * sizeof(char *));
+
+        if (names) sv->index_name = names;
+        if (files) sv->index_file = files;
+
+        if (names == NULL || files == NULL)
+            return -1;
+
+        for (size_t i = sv->nindex; i < n; i++) {
+            sv->index_name[i] = 0;
+            sv->index_file[i] = NULL;
+        }
+
+        sv->nindex = n;
+    }
+
+    sv->index_name[index] = name;
+    sv->index_file[index] = file;
+
+    return 0;
+}
+
+/* Both parsers skip malformed entries and fail only when out of memory. */
+static int parse_verdef(shelfobj_t *desc, shelfsymver_t *sv, uint32_t sect)
+{
+    const unsigned char *p = shelf_sect_ptr(desc, sect);
+    uint64_t size = desc->sht[sect].sh_size, off = 0, strsz;
+    const char *strtab = shelf_get_strtab(desc, desc->sht[sect].sh_link, &strsz);
+
+    if (p == NULL || strtab == NULL)
+        return 0;
+
+    for (uint32_t i = 0; i < desc->sht[sect].sh_info && size - off >= sizeof(Elf64_Verdef); i++) {
+        uint16_t flags = desc->read_word(p + off + 2);
+        uint16_t ndx = desc->read_word(p + off + 4);
+        uint32_t aux = desc->read_dword(p + off + 12);
+        uint32_t next = desc->read_dword(p + off + 16);
+
+        // The base entry names the file; its index stays the unversioned "".
+        if (!(flags & VER_FLG_BASE) && aux <= size - off && size - off - aux >= sizeof(Elf64_Verdaux)) {
+            uint32_t name = desc->read_dword(p + off + aux);
+
+            if (name < strsz && set_index(sv, ndx, intern_name(sv, strtab + name), NULL) != 0)
+                return -1;
+        }
+
+        if (next == 0 || next > size - off)
+            break;
+
+        off += next;
+    }
+
+    return 0;
+}
+
+static int parse_verneed(shelfobj_t *desc, shelfsymver_t *sv, uint32_t sect)
+{
+    const unsigned char *p = shelf_sect_ptr(desc, sect);
+    uint64_t size = desc->sht[sect].sh_size, off = 0, strsz;
+    const char *strtab = shelf_get_strtab(desc, desc->sht[sect].sh_link, &strsz);
+
+    if (p == NULL || strtab == NULL)
+        return 0;
+
+    for (uint32_t i = 0; i < desc->sht[sect].sh_info && size - off >= sizeof(Elf64_Verneed); i++) {
+        uint16_t cnt = desc->read_word(p + off + 2);
+        uint32_t file = desc->read_dword(p + off + 4);
+        uint32_t aux = desc->read_dword(p + off + 8);
+        uint32_t next = desc->read_dword(p + off + 12);
+        uint64_t aoff = off + aux;
+
+        for (uint16_t j = 0; j < cnt && aoff <= size && size - aoff >= sizeof(Elf64_Vernaux); j++) {
+            uint16_t other = desc->read_word(p + aoff + 6);
+            uint32_t name = desc->read_dword(p + aoff + 8);
+            uint32_t anext = desc->read_dword(p + aoff + 12);
+
+            if (name < strsz &&
+                set_index(sv, other, intern_name(sv, strtab + name), file < strsz ? strtab + file : NULL) != 0)
+                return -1;
+
+            if (anext == 0)
+                break;
+
+            aoff += anext;
+        }
+
+        if (next == 0 || next > size - off)
+            break;
+
+        off += next;
+    }
+
+    return 0;
+}
+
+static void table_insert(shelfsymver_t *sv, uint32_t hash, uint32_t sym, uint32_t bare)
+{
+    size_t i = hash & sv->mask;
+
+    while (sv->table[i].sym != 0)
+        i = (i + 1) & sv->mask;
+
+    sv->table[i].hash = hash;
+    sv->table[i].sym = sym + 1;
+    sv->table[i].bare = bare;
+}
+
+void shelf_symver_free(shelfobj_t *desc)
+{
+    if (desc == NULL)
+        return;
+
+    if (desc->symver != NULL) {
+        free(desc->symver->versym);
+        free(desc->symver->verid);
+        free(desc->symver->names);
+        free(desc->symver->name_slots);
+        free(desc->symver->index_name);
+        free(desc->symver->index_file);
+        free(desc->symver->table);
+        free(desc->symver);
+        desc->symver = NULL;
+    }
+
+    free(desc->dynsym);
+    desc->dynsym = NULL;
+    desc->dynsymcount = 0;
+}
+
+/*
+ * Decode versym, verdef and verneed into flat arrays parallel to .dynsym and
+ * build the versioned name hash.
+ */
+shelfsymver_t *shelf_load_symver(shelfobj_t *desc)
+{
+    shelfsymver_t *sv;
+    size_t count;
+
+    PROFILER_IN();
+
+    if (desc == NULL)
+        PROFILER_RERR("Null argument passed to shelf_load_symver()\n", NULL);
+
+    if (desc->symver != NULL)
+        PROFILER_ROUT(desc->symver, "shelfsymver_t *: %p");
+
+    if (shelf_load_dynsym(desc, &count) == NULL)
+        PROFILER_RERR(shelf_error, NULL);
+
+    if ((sv = calloc(1, sizeof(shelfsymver_t))) == NULL)
+        PROFILER_RERR("Malloc for symbol versions failed\n", NULL);
+
+    size_t cap = 16;
+
+    while (cap < count * 4)
+        cap <<= 1;
+
+    sv->versym = calloc(count ? count : 1, sizeof(uint16_t));
+    sv->verid = calloc(count ? count : 1, sizeof(uint32_t));
+    sv->table = calloc(cap, sizeof(shelfsymverslot_t));
+    sv->mask = cap - 1;
+
+    if (!sv->versym || !sv->verid || !sv->table || intern_name(sv, "") != 0) {
+        desc->symver = sv;
+        shelf_symver_free(desc);
+        PROFILER_RERR("Malloc for symbol version tables failed\n", NULL);
+    }
+
+    for (uint32_t i = 0; i < desc->hdr.e_shnum; i++) {
+        const unsigned char *p;
+        int r = 0;
+
+        switch (desc->sht[i].sh_type) {
+            case SHT_GNU_versym:
+                if ((p = shelf_sect_ptr(desc, i)) == NULL)
+                    break;
+                for (size_t j = 0; j < count && j < desc->sht[i].sh_size / sizeof(Elf64_Versym); j++)
+                    sv->versym[j] = desc->read_word(p + j * sizeof(Elf64_Versym));
+                break;
+            case SHT_GNU_verdef:
+                r = parse_verdef(desc, sv, i);
+                break;
+            case SHT_GNU_verneed:
+                r = parse_verneed(desc, sv, i);
+                break;
+        }
+
+        if (r != 0) {
+            desc->symver = sv;
+            shelf_symver_free(desc);
+            PROFILER_RERR("Malloc for symbol version names failed\n", NULL);
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        uint16_t ndx = sv->versym[i] & VERSYM_VERSION;
+        sv->verid[i] = ndx < sv->nindex ? sv->index_name[ndx] : 0;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const char *name = desc->dynsym[i].name;
+        const char *ver = sv->names[sv->verid[i]];
+
+        /* Imports carry verneed versions but aren't what a lookup is after. */
+        if (name == NULL || *name == '\0' || desc->dynsym[i].st_shndx == SHN_UNDEF)
+            continue;
+
+        size_t name_len = strlen(name);
+
+        table_insert(sv, symver_hash(name, name_len, ver, strlen(ver)), i, 0);
+
+        /* The default version of a definition also answers to its bare name. */
+        if (*ver && !(sv->versym[i] & VERSYM_HIDDEN))
+            table_insert(sv, symver_hash(name, name_len, "", 0), i, 1);
+    }
+
+    desc->symver = sv;
+
+    PROFILER_ROUT(sv, "shelfsymver_t *: %p");
+}
+
+/*
+ * Returns the version name of dynamic symbol `index`, "" for unversioned
+ * symbols. `hidden` is set for non-default versions.
+ */
+const char *shelf_get_symbol_version(shelfobj_t *desc, size_t index, int *hidden)
+{
+    shelfsymver_t *sv = shelf_load_symver(desc);
+
+    if (sv == NULL || index >= desc->dynsymcount)
+        return NULL;
+
+    if (hidden)
+        *hidden = (sv->versym[index] & VERSYM_HIDDEN) != 0;
+
+    return sv->names[sv->verid[index]];
+}
+
+/*
+ * Look up a dynamic symbol definition by "name@VERSION", "name@@VERSION" or
+ * a bare name. "@@" and the bare name only match default versions (or, for
+ * the bare name, unversioned symbols); "@" matches any version.
+ */
+shelfsym_t *shelf_get_symbol_by_versioned_name(shelfobj_t *desc, const char *name)
+{
+    shelfsymver_t *sv;
+    const char *at, *ver = "";
+    size_t name_len, ver_len = 0;
+    int dflt = 0;
+
+    PROFILER_IN();
+
+    if (desc == NULL || name == NULL)
+        PROFILER_RERR("Null argument passed to shelf_get_symbol_by_versioned_name()\n", NULL);
+
+    if ((sv = shelf_load_symver(desc)) == NULL)
+        PROFILER_RERR(shelf_error, NULL);
+
+    if ((at = strchr(name, '@')) != NULL) {
+        name_len = at - name;
+        dflt = at[1] == '@';
+        ver = at + 1 + dflt;
+        ver_len = strlen(ver);
+    } else {
+        name_len = strlen(name);
+    }
+
+    uint32_t hash = symver_hash(name, name_len, ver, ver_len);
+
+    for (size_t i = hash & sv->mask; sv->table[i].sym != 0; i = (i + 1) & sv->mask) {
+        const shelfsymverslot_t *slot = &sv->table[i];
+        shelfsym_t *sym = &desc->dynsym[slot->sym - 1];
+
+        if (slot->hash != hash || strncmp(sym->name, name, name_len) || sym->name[name_len] != '\0')
+            continue;
+
+        if (ver_len == 0 ? (slot->bare || sv->verid[slot->sym - 1] == 0)
+                         : (!slot->bare && !strcmp(sv->names[sv->verid[slot->sym - 1]], ver) &&
+                            !(dflt && (sv->versym[slot->sym - 1] & VERSYM_HIDDEN)))) {
+            PROFILER_ROUT(sym, "shelfsym_t *: %p");
+        }
+    }
+
+    PROFILER_ROUT(NULL, "shelfsym_t *: %p");
+}
+
+/*
+ * Adds `sym`, named `name`, to the symbol table `symtab`. See
+ * shelf_layout_add_symbol() for where it goes.
+ */
+int elfsh_insert_symbol(shelfobj_t *desc, shelfsect_t *symtab, shelfsym_t *sym, char *name)
+{
+    PROFILER_IN();
+
+    if (desc == NULL || symtab == NULL || sym == NULL || name == NULL)
+        PROFILER_RERR("Null argument passed to elfsh_insert_symbol()\n", -1);
+
+    if (shelf_layout_add_symbol(desc, symtab->index, sym, name) != 0)
+        PROFILER_RERR(shelf_error, -1);
+
+    PROFILER_ROUT(0, "%d");
+}
+
+/*
+ * Renames a symbol of desc->symtab or desc->dynsym. The decoded symbol's
+ * name is updated right away, and put back if the rename is rolled back;
+ * the file's once it is written.
+ */
+int elfsh_set_symbol_name(shelfobj_t *desc, shelfsym_t *s, char *name)
+{
+    shelfsect_t *table = NULL;
+    shelfsectiter_t it;
+    size_t index;
+
+    PROFILER_IN();
+
+    if (desc == NULL || s == NULL || name == NULL)
+        PROFILER_RERR("Null argument passed to elfsh_set_symbol_name()\n", -1);
+
+    if (desc->symtab != NULL && s >= desc->symtab && s < desc->symtab + desc->symcount) {
+        table = get_section_by_name(desc, ".symtab");
+        index = s - desc->symtab;
+    } else if (desc->dynsym != NULL && s >= desc->dynsym && s < desc->dynsym + desc->dynsymcount) {
+        shelf_sect_iter_init(&it, desc, SHT_DYNSYM, 0, 0);
+        table = shelf_sect_iter_next(&it);
+        index = s - desc->dynsym;
+    }
+
+    if (table == NULL)
+        PROFILER_RERR("Symbol is not from one of the descriptor's tables", -1);
+
+    if (shelf_layout_rename_symbol(desc, table->index, index, name) != 0)
+        PROFILER_RERR(shelf_error, -1);
+
+    PROFILER_ROUT(0, "%d");
+}
+
+/*
+ * Adds a global function symbol to .symtab, `sctidx` being the index of
+ * the section holding it.
+ */
+int elfsh_insert_funcsym(shelfobj_t *desc, char *name, Elf64_Addr vaddr, uint32_t sz, uint32_t sctidx)
+{
+    shelfsym_t sym = { 0 };
+    shelfsect_t *symtab;
+
+    PROFILER_IN();
+
+    if (desc == NULL || name == NULL)
+        PROFILER_RERR("Null argument passed to elfsh_insert_funcsym()\n", -1);
+
+    if ((symtab = get_section_by_name(desc, ".symtab")) == NULL)
+        PROFILER_RERR("No .symtab to add to", -1);
+
+    sym.st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+    sym.st_shndx = sctidx;
+    sym.st_value = vaddr;
+    sym.st_size = sz;
+
+    PROFILER_ROUT(elfsh_insert_symbol(desc, symtab, &sym, name), "%d");
+}
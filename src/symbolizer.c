@@ -0,0 +1,616 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "shelf.h"
+#include "shelf_profiler.h"
+#include "symbol.h"
+#include "buildid.h"
+#include "debuginfo.h"
+#include "process.h"
+#include "symbolizer.h"
+
+
+static uint64_t hash_more(uint64_t h, const void *p, size_t len)
+{
+    const unsigned char *s = p;
+
+    for (size_t i = 0; i < len; i++) {
+        h ^= s[i];
+        h *= 1099511628211ull;
+    }
+
+    return h;
+}
+
+static uint64_t hash_bytes(const char *s, size_t len)
+{
+    return hash_more(14695981039346656037ull, s, len);
+}
+
+static uint64_t module_hash(const shelfmodule_t *mod)
+{
+    if (mod->inode == 0) {
+        uint64_t h = hash_bytes(mod->path, strlen(mod->path));
+
+        h = hash_more(h, &mod->size, sizeof(mod->size));
+
+        return hash_more(h, mod->build_id, mod->build_id_len);
+    }
+
+    uint64_t key[2] = { ((uint64_t) mod->dev_major << 32) | mod->dev_minor, mod->inode };
+
+    return hash_bytes((const char *) key, sizeof(key));
+}
+
+static int same_file(const shelfmap_t *a, const shelfmap_t *b)
+{
+    return a->dev_major == b->dev_major && a->dev_minor == b->dev_minor &&
+           a->inode == b->inode && (a->inode != 0 || !strcmp(a->path, b->path));
+}
+
+static int module_is(const shelfmodule_t *mod, const shelfmodule_t *key)
+{
+    if (mod->dev_major != key->dev_major || mod->dev_minor != key->dev_minor ||
+        mod->inode != key->inode)
+        return 0;
+
+    return key->inode != 0 ||
+           (!strcmp(mod->path, key->path) && mod->size == key->size &&
+            mod->build_id_len == key->build_id_len &&
+            !memcmp(mod->build_id, key->build_id, key->build_id_len));
+}
+
+static int table_grow(shelfdesccache_t *cache)
+{
+    size_t cap = cache->mask ? (cache->mask + 1) * 2 : 64;
+    shelfmodule_t **table = calloc(cap, sizeof(shelfmodule_t *));
+
+    if (table == NULL)
+        return -1;
+
+    for (size_t i = 0; cache->mask && i <= cache->mask; i++) {
+        shelfmodule_t *mod = cache->table[i];
+
+        if (mod == NULL)
+            continue;
+
+        size_t j = module_hash(mod) & (cap - 1);
+
+        while (table[j] != NULL)
+            j = (j + 1) & (cap - 1);
+
+        table[j] = mod;
+    }
+
+    free(cache->table);
+    cache->table = table;
+    cache->mask = cap - 1;
+
+    return 0;
+}
+
+static int cmp_addrsym(const void *a, const void *b)
+{
+    const shelfaddrsym_t *x = a, *y = b;
+
+    if (x->addr != y->addr)
+        return x->addr < y->addr ? -1 : 1;
+
+    // Of several names for one address keep the one with a size.
+    return (x->size < y->size) - (x->size > y->size);
+}
+
+static size_t collect_functions(const shelfsym_t *syms, size_t count, shelfaddrsym_t *out)
+{
+    size_t n = 0;
+
+    for (size_t i = 0; syms != NULL && i < count; i++) {
+        int type = ELF64_ST_TYPE(syms[i].st_info);
+
+        if ((type != STT_FUNC && type != STT_GNU_IFUNC) || syms[i].st_shndx == SHN_UNDEF ||
+            syms[i].st_value == 0 || syms[i].name == NULL)
+            continue;
+
+        out[n].addr = syms[i].st_value;
+        out[n].size = syms[i].st_size;
+        out[n].name = syms[i].name;
+        n++;
+    }
+
+    return n;
+}
+
+/*
+ * Build a module's address table from .symtab, or from a separate debug
+ * file when the module is stripped, plus .dynsym. Aliases collapse to one
+ * entry per address.
+ */
+static int index_functions(shelfdesccache_t *cache, shelfmodule_t *mod)
+{
+    shelfobj_t *desc = mod->desc;
+    shelfobj_t *full = desc;
+    size_t ndyn = 0;
+
+    if (shelf_load_symtab(desc) != 0)
+        return -1;
+
+    if (desc->symcount == 0 && shelf_open_debug(desc, cache->debugidx) != NULL &&
+        shelf_load_symtab(desc->debug) == 0) {
+        full = desc->debug;
+    }
+
+    shelf_load_dynsym(desc, &ndyn);
+
+    mod->syms = malloc((full->symcount + ndyn + 1) * sizeof(shelfaddrsym_t));
+
+    if (mod->syms == NULL)
+        return -1;
+
+    size_t n = collect_functions(full->symtab, full->symcount, mod->syms);
+
+    n += collect_functions(desc->dynsym, ndyn, mod->syms + n);
+    qsort(mod->syms, n, sizeof(shelfaddrsym_t), cmp_addrsym);
+
+    size_t kept = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        if (kept == 0 || mod->syms[kept - 1].addr != mod->syms[i].addr)
+            mod->syms[kept++] = mod->syms[i];
+    }
+
+    mod->nsyms = kept;
+
+    return 0;
+}
+
+/*
+ * Open the file behind a mapping. The copy under /proc/<pid>/root is the
+ * one the process sees, even from another mount namespace; it is only used
+ * if it is still the same inode. Deleted or replaced files, and files with
+ * no inode, are rebuilt from the process's memory instead.
+ */
+static shelfobj_t *open_module(shelfsymbolizer_t *sym, const shelfmap_t *maps, size_t count,
+                               const shelfmap_t *map)
+{
+    char path[4096 + 64];
+    struct stat st;
+
+    if (map->inode != 0 && map->path[0] == '/') {
+        snprintf(path, sizeof(path), "/proc/%d/root%s", (int) sym->pid, map->path);
+
+        for (int i = 0; i < 2; i++) {
+            const char *p = i ? map->path : path;
+
+            if (stat(p, &st) == 0 && st.st_ino == map->inode &&
+                major(st.st_dev) == map->dev_major && minor(st.st_dev) == map->dev_minor) {
+                shelfobj_t *desc = shelf_open(p);
+
+                if (desc != NULL)
+                    return desc;
+            }
+        }
+    }
+
+    if (sym->proc == NULL && (sym->proc = shelf_proc_attach(sym->pid)) == NULL)
+        return NULL;
+
+    // The ELF header is in the mapping of offset zero of the same file.
+    for (size_t i = 0; i < count; i++) {
+        if (maps[i].offset == 0 && same_file(&maps[i], map))
+            return shelf_proc_open_image(sym->proc, maps[i].start);
+    }
+
+    shelf_error = "Mapping has no ELF header in memory";
+    return NULL;
+}
+
+/*
+ * Find or open the module behind a mapping. Returns NULL, and caches
+ * nothing, if the mapping isn't an ELF file we can read.
+ */
+static shelfmodule_t *cache_get(shelfsymbolizer_t *sym, const shelfmap_t *maps, size_t count,
+                                const shelfmap_t *map)
+{
+    shelfdesccache_t *cache = sym->cache;
+    shelfmodule_t *mod, key = { 0 };
+    shelfobj_t *desc = NULL;
+    size_t i = 0;
+
+    key.dev_major = map->dev_major;
+    key.dev_minor = map->dev_minor;
+    key.inode = map->inode;
+    key.path = map->path;
+
+    /*
+     * Without an inode only the image tells modules apart: the vDSOs of
+     * 32 and 64-bit processes share a name but not their code.
+     */
+    if (map->inode == 0) {
+        ssize_t len;
+
+        if ((desc = open_module(sym, maps, count, map)) == NULL)
+            return NULL;
+
+        key.size = map->end - map->start;
+
+        if ((len = shelf_get_build_id(desc, key.build_id)) > 0)
+            key.build_id_len = len;
+    }
+
+    if (cache->table != NULL) {
+        i = module_hash(&key) & cache->mask;
+
+        for (; cache->table[i] != NULL; i = (i + 1) & cache->mask) {
+            if (module_is(cache->table[i], &key)) {
+                if (desc != NULL)
+                    shelf_close(&desc);
+                return cache->table[i];
+            }
+        }
+    }
+
+    if ((mod = malloc(sizeof(shelfmodule_t))) == NULL) {
+        if (desc != NULL)
+            shelf_close(&desc);
+        return NULL;
+    }
+
+    *mod = key;
+
+    if ((mod->path = strdup(map->path)) == NULL) {
+        if (desc != NULL)
+            shelf_close(&desc);
+        free(mod);
+        return NULL;
+    }
+
+    mod->desc = desc != NULL ? desc : open_module(sym, maps, count, map);
+
+    if (mod->desc == NULL || index_functions(cache, mod) != 0 ||
+        ((cache->count + 1) * 2 > cache->mask + 1 && table_grow(cache) != 0)) {
+        if (mod->desc != NULL)
+            shelf_close(&mod->desc);
+        free(mod->syms);
+        free(mod->path);
+        free(mod);
+        return NULL;
+    }
+
+    i = module_hash(mod) & cache->mask;
+
+    while (cache->table[i] != NULL)
+        i = (i + 1) & cache->mask;
+
+    cache->table[i] = mod;
+    cache->count++;
+
+    return mod;
+}
+
+static void module_free(shelfmodule_t *mod)
+{
+    shelf_close(&mod->desc);
+    free(mod->syms);
+    free(mod->path);
+    free(mod);
+}
+
+shelfdesccache_t *shelf_desccache_new(shelfdebugidx_t *debugidx)
+{
+    shelfdesccache_t *cache;
+
+    PROFILER_IN();
+
+    if ((cache = calloc(1, sizeof(shelfdesccache_t))) == NULL)
+        PROFILER_RERR("Malloc for descriptor cache failed", NULL);
+
+    cache->debugidx = debugidx;
+
+    PROFILER_ROUT(cache, "shelfdesccache_t *: %p");
+}
+
+/*
+ * Close every module no symbolizer is using. Returns how many were closed.
+ */
+size_t shelf_desccache_prune(shelfdesccache_t *cache)
+{
+    size_t pruned = 0;
+
+    if (cache == NULL || cache->table == NULL)
+        return 0;
+
+    shelfmodule_t **old = cache->table;
+    size_t mask = cache->mask;
+
+    cache->table = NULL;
+    cache->mask = 0;
+    cache->count = 0;
+
+    for (size_t i = 0; i <= mask; i++) {
+        if (old[i] == NULL)
+            continue;
+
+        if (old[i]->refs == 0) {
+            module_free(old[i]);
+            pruned++;
+            continue;
+        }
+
+        // Reinserting can't fail on allocation once the table has room.
+        if ((cache->count + 1) * 2 > cache->mask + 1)
+            table_grow(cache);
+
+        size_t j = module_hash(old[i]) & cache->mask;
+
+        while (cache->table[j] != NULL)
+            j = (j + 1) & cache->mask;
+
+        cache->table[j] = old[i];
+        cache->count++;
+    }
+
+    free(old);
+
+    return pruned;
+}
+
+void shelf_desccache_free(shelfdesccache_t *cache)
+{
+    if (cache == NULL)
+        return;
+
+    for (size_t i = 0; cache->table && i <= cache->mask; i++) {
+        if (cache->table[i] != NULL)
+            module_free(cache->table[i]);
+    }
+
+    free(cache->table);
+    free(cache);
+}
+
+/*
+ * Create a symbolizer for `pid`. Modules are shared through `cache`; with
+ * a NULL cache the symbolizer gets a private one.
+ */
+shelfsymbolizer_t *shelf_symbolizer_new(pid_t pid, shelfdesccache_t *cache)
+{
+    shelfsymbolizer_t *sym;
+
+    PROFILER_IN();
+
+    if ((sym = calloc(1, sizeof(shelfsymbolizer_t))) == NULL)
+        PROFILER_RERR("Malloc for symbolizer failed", NULL);
+
+    sym->pid = pid;
+    sym->cache = cache;
+
+    if (cache == NULL) {
+        if ((sym->cache = shelf_desccache_new(NULL)) == NULL) {
+            free(sym);
+            PROFILER_RERR(shelf_error, NULL);
+        }
+        sym->owns_cache = 1;
+    }
+
+    if (shelf_symbolizer_refresh(sym) < 0) {
+        shelf_symbolizer_free(sym);
+        PROFILER_RERR(shelf_error, NULL);
+    }
+
+    PROFILER_ROUT(sym, "shelfsymbolizer_t *: %p");
+}
+
+static void release_modules(shelfsymbolizer_t *sym)
+{
+    for (size_t i = 0; i < sym->nmods; i++)
+        sym->mods[i].mod->refs--;
+
+    free(sym->mods);
+    sym->mods = NULL;
+    sym->nmods = 0;
+}
+
+void shelf_symbolizer_free(shelfsymbolizer_t *sym)
+{
+    if (sym == NULL)
+        return;
+
+    release_modules(sym);
+    shelf_proc_detach(sym->proc);
+
+    if (sym->owns_cache)
+        shelf_desccache_free(sym->cache);
+
+    free(sym);
+}
+
+/*
+ * Link time address of the start of an executable mapping, from the
+ * PT_LOAD that holds its file offset.
+ */
+static int mapping_bias(const shelfobj_t *desc, const shelfmap_t *map, uint64_t *bias)
+{
+    for (size_t i = 0; i < desc->hdr.e_phnum; i++) {
+        const Elf64_Phdr *ph = &desc->pht[i];
+        uint64_t align = ph->p_align > 1 ? ph->p_align : 1;
+
+        if (ph->p_type != PT_LOAD || !(ph->p_flags & PF_X))
+            continue;
+
+        if (map->offset < (ph->p_offset & ~(align - 1)) || map->offset >= ph->p_offset + ph->p_filesz)
+            continue;
+
+        *bias = map->start - (ph->p_vaddr + (map->offset - ph->p_offset));
+        return 0;
+    }
+
+    return -1;
+}
+
+/*
+ * Re-read the process's mappings. The module table is only rebuilt when
+ * the maps text has changed since the last refresh, so calling this once
+ * per sampling interval is cheap. Returns 1 if the table was rebuilt, 0 if
+ * nothing changed and -1 on error.
+ */
+int shelf_symbolizer_refresh(shelfsymbolizer_t *sym)
+{
+    shelfmap_t *maps;
+    shelfprocmod_t *mods;
+    size_t len, count, n = 0;
+    char *text;
+
+    PROFILER_IN();
+
+    if (sym == NULL)
+        PROFILER_RERR("Null argument passed to shelf_symbolizer_refresh()\n", -1);
+
+    if ((text = shelf_proc_maps_text(sym->pid, &len)) == NULL)
+        PROFILER_RERR(shelf_error, -1);
+
+    uint64_t hash = hash_bytes(text, len);
+
+    if (sym->mods != NULL && hash == sym->maps_hash) {
+        free(text);
+        PROFILER_ROUT(0, "%d");
+    }
+
+    int ret = shelf_proc_maps_parse(text, len, &maps, &count);
+
+    free(text);
+
+    if (ret != 0)
+        PROFILER_RERR(shelf_error, -1);
+
+    if ((mods = malloc((count ? count : 1) * sizeof(shelfprocmod_t))) == NULL) {
+        shelf_proc_maps_free(maps, count);
+        PROFILER_RERR("Malloc for module table failed", -1);
+    }
+
+    // The process may have loaded new code over memory we have cached.
+    shelf_proc_invalidate(sym->proc);
+
+    for (size_t i = 0; i < count; i++) {
+        const shelfmap_t *map = &maps[i];
+        shelfmodule_t *mod;
+
+        // Anonymous executable memory is JIT code with nothing to open.
+        if (!(map->prot & PF_X) || map->path[0] == '\0' ||
+            (map->inode == 0 && strcmp(map->path, "[vdso]")))
+            continue;
+
+        if ((mod = cache_get(sym, maps, count, map)) == NULL ||
+            mapping_bias(mod->desc, map, &mods[n].bias) != 0)
+            continue;
+
+        mods[n].start = map->start;
+        mods[n].end = map->end;
+        mods[n].mod = mod;
+        mod->refs++;
+        n++;
+    }
+
+    shelf_proc_maps_free(maps, count);
+    release_modules(sym);
+
+    sym->mods = mods;
+    sym->nmods = n;
+    sym->maps_hash = hash;
+    sym->hint = 0;
+
+    PROFILER_ROUT(1, "%d");
+}
+
+static const shelfprocmod_t *find_module(shelfsymbolizer_t *sym, uint64_t pc)
+{
+    const shelfprocmod_t *mods = sym->mods;
+
+    // Samples cluster, so the module of the last hit is worth one compare.
+    if (sym->hint < sym->nmods && pc >= mods[sym->hint].start && pc < mods[sym->hint].end)
+        return &mods[sym->hint];
+
+    size_t lo = 0, hi = sym->nmods;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (mods[mid].start <= pc)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == 0 || pc >= mods[lo - 1].end)
+        return NULL;
+
+    sym->hint = lo - 1;
+
+    return &mods[lo - 1];
+}
+
+/*
+ * Resolve one PC to module, function and offset. Returns 0 if the PC is
+ * in a known module, whether or not a function covers it, and -1 if not.
+ */
+int shelf_symbolize(shelfsymbolizer_t *sym, uint64_t pc, shelfsymloc_t *loc)
+{
+    const shelfprocmod_t *pm;
+
+    if (sym == NULL || loc == NULL || (pm = find_module(sym, pc)) == NULL)
+        return -1;
+
+    const shelfmodule_t *mod = pm->mod;
+    uint64_t addr = pc - pm->bias;
+    size_t lo = 0, hi = mod->nsyms;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (mod->syms[mid].addr <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    loc->module = mod->path;
+    loc->addr = addr;
+    loc->symbol = NULL;
+    loc->offset = addr;
+
+    if (lo > 0) {
+        const shelfaddrsym_t *s = &mod->syms[lo - 1];
+
+        if (s->size == 0 || addr - s->addr < s->size) {
+            loc->symbol = s->name;
+            loc->offset = addr - s->addr;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Resolve `count` PCs. Returns how many landed in a known module; the
+ * others get a NULL module.
+ */
+size_t shelf_symbolize_batch(shelfsymbolizer_t *sym, const uint64_t *pcs, size_t count,
+                             shelfsymloc_t *locs)
+{
+    size_t found = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (shelf_symbolize(sym, pcs[i], &locs[i]) == 0) {
+            found++;
+        } else {
+            memset(&locs[i], 0, sizeof(shelfsymloc_t));
+        }
+    }
+
+    return found;
+}
@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shelf.h"
+#include "shelf_profiler.h"
+#include "iter.h"
+#include "symcompact.h"
+
+
+/* Worst case bytes per entry: four 10-byte varints and st_info. */
+#define ENTRY_MAX 41
+
+static size_t put_varint(unsigned char *dst, uint64_t v)
+{
+    size_t n = 0;
+
+    while (v >= 0x80) {
+        dst[n++] = (unsigned char) v | 0x80;
+        v >>= 7;
+    }
+    dst[n++] = (unsigned char) v;
+
+    return n;
+}
+
+static uint64_t get_varint(const unsigned char **src)
+{
+    const unsigned char *p = *src;
+    uint64_t v = 0;
+
+    for (int shift = 0; ; shift += 7) {
+        v |= (uint64_t) (*p & 0x7f) << shift;
+        if (!(*p++ & 0x80))
+            break;
+    }
+
+    *src = p;
+
+    return v;
+}
+
+/*
+ * Addresses are stored as the signed gap from the end of the previous
+ * symbol, which for packed code is usually just alignment padding.
+ */
+static uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+    return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+/*
+ * Decode the entry at *src. `prev_end` is the end address of the previous
+ * entry in the block, or the block's base address for the first one.
+ */
+static void decode_entry(const shelfsymcompact_t *comp, const unsigned char **src,
+                         uint64_t prev_end, shelfsym_t *sym)
+{
+    uint64_t packed;
+
+    sym->st_value = prev_end + unzigzag(get_varint(src));
+    sym->st_size = get_varint(src);
+    packed = get_varint(src);
+    sym->st_shndx = (uint16_t) (packed >> 8);
+    sym->st_other = (unsigned char) packed;
+    sym->st_name = (uint32_t) get_varint(src);
+    sym->st_info = *(*src)++;
+    sym->name = sym->st_name < comp->strsz ? (char *) comp->strtab + sym->st_name : NULL;
+}
+
+static int cmp_addr(const void *a, const void *b)
+{
+    const shelfsym_t *x = a, *y = b;
+
+    if (x->st_value != y->st_value)
+        return x->st_value < y->st_value ? -1 : 1;
+
+    // Larger symbols last, so a lookup settles on them among aliases.
+    return (x->st_size > y->st_size) - (x->st_size < y->st_size);
+}
+
+/*
+ * Build the compact form of .symtab or .dynsym. Entries are read through a
+ * symbol stream, so the descriptor's shelfsym_t arrays are never built;
+ * only a temporary array of the kept symbols is needed for sorting.
+ */
+shelfsymcompact_t *shelf_symcompact_build(shelfobj_t *desc, int table)
+{
+    shelfsymcompact_t *comp;
+    shelfsymstream_t st;
+    shelfsym_t sym, *tmp;
+    size_t n = 0;
+
+    PROFILER_IN();
+
+    if (shelf_sym_stream_init(&st, desc, table) != 0)
+        PROFILER_RERR(shelf_error, NULL);
+
+    if ((comp = calloc(1, sizeof(shelfsymcompact_t))) == NULL)
+        PROFILER_RERR("Malloc for compact symbol table failed\n", NULL);
+
+    comp->strtab = st.strtab;
+    comp->strsz = st.strsz;
+
+    if ((tmp = malloc((st.count ? st.count : 1) * sizeof(shelfsym_t))) == NULL) {
+        free(comp);
+        PROFILER_RERR("Malloc for compact symbol table failed\n", NULL);
+    }
+
+    while (shelf_sym_stream_next(&st, &sym)) {
+        uint8_t type = ELF64_ST_TYPE(sym.st_info);
+
+        if (sym.st_shndx != SHN_UNDEF && sym.name != NULL && *sym.name != '\0' &&
+            type != STT_SECTION && type != STT_FILE) {
+            tmp[n++] = sym;
+        }
+    }
+
+    qsort(tmp, n, sizeof(shelfsym_t), cmp_addr);
+
+    comp->count = n;
+    comp->nblocks = (n + SHELF_SYMBLOCK - 1) / SHELF_SYMBLOCK;
+    comp->blocks = malloc((comp->nblocks ? comp->nblocks : 1) * sizeof(shelfsymblock_t));
+    comp->data = malloc(n * ENTRY_MAX + 1);
+
+    if (comp->blocks == NULL || comp->data == NULL) {
+        free(tmp);
+        shelf_symcompact_free(comp);
+        PROFILER_RERR("Malloc for compact symbol table failed\n", NULL);
+    }
+
+    unsigned char *p = comp->data;
+    uint64_t prev_end = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        if (i % SHELF_SYMBLOCK == 0) {
+            comp->blocks[i / SHELF_SYMBLOCK].addr = tmp[i].st_value;
+            comp->blocks[i / SHELF_SYMBLOCK].offset = p - comp->data;
+            prev_end = tmp[i].st_value;
+        }
+
+        p += put_varint(p, zigzag((int64_t) (tmp[i].st_value - prev_end)));
+        p += put_varint(p, tmp[i].st_size);
+        p += put_varint(p, (uint64_t) tmp[i].st_shndx << 8 | tmp[i].st_other);
+        p += put_varint(p, tmp[i].st_name);
+        *p++ = tmp[i].st_info;
+        prev_end = tmp[i].st_value + tmp[i].st_size;
+    }
+
+    free(tmp);
+
+    // Give back the worst case slack.
+    comp->data_len = p - comp->data;
+    unsigned char *shrunk = realloc(comp->data, comp->data_len ? comp->data_len : 1);
+
+    if (shrunk != NULL)
+        comp->data = shrunk;
+
+    PROFILER_ROUT(comp, "shelfsymcompact_t *: %p");
+}
+
+void shelf_symcompact_free(shelfsymcompact_t *comp)
+{
+    if (comp == NULL)
+        return;
+
+    free(comp->blocks);
+    free(comp->data);
+    free(comp);
+}
+
+/*
+ * Heap bytes held by the table, for comparing against count * sizeof(shelfsym_t).
+ */
+size_t shelf_symcompact_memsize(const shelfsymcompact_t *comp)
+{
+    return sizeof(*comp) + comp->nblocks * sizeof(shelfsymblock_t) + comp->data_len;
+}
+
+/*
+ * Decode entry `index`, counted in address order.
+ */
+int shelf_symcompact_get(const shelfsymcompact_t *comp, size_t index, shelfsym_t *sym)
+{
+    if (comp == NULL || index >= comp->count)
+        return -1;
+
+    const shelfsymblock_t *blk = &comp->blocks[index / SHELF_SYMBLOCK];
+    const unsigned char *p = comp->data + blk->offset;
+    uint64_t prev_end = blk->addr;
+
+    for (size_t i = 0; i <= index % SHELF_SYMBLOCK; i++) {
+        decode_entry(comp, &p, prev_end, sym);
+        prev_end = sym->st_value + sym->st_size;
+    }
+
+    return 0;
+}
+
+/*
+ * Find the symbol at or closest below `addr`, decoding only the block it
+ * lives in. `offset` receives addr - st_value.
+ */
+int shelf_symcompact_lookup(const shelfsymcompact_t *comp, Elf64_Addr addr,
+                            shelfsym_t *sym, uint64_t *offset)
+{
+    size_t lo = 0, hi;
+
+    if (comp == NULL || comp->nblocks == 0 || addr < comp->blocks[0].addr)
+        return -1;
+
+    hi = comp->nblocks;
+
+    // Last block starting at or below addr.
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (comp->blocks[mid].addr <= addr)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    const unsigned char *p = comp->data + comp->blocks[lo].offset;
+    const unsigned char *end = lo + 1 < comp->nblocks ? comp->data + comp->blocks[lo + 1].offset
+                                                      : comp->data + comp->data_len;
+    shelfsym_t cur;
+
+    decode_entry(comp, &p, comp->blocks[lo].addr, sym);
+    cur = *sym;
+
+    while (p < end) {
+        decode_entry(comp, &p, cur.st_value + cur.st_size, &cur);
+
+        if (cur.st_value > addr)
+            break;
+
+        *sym = cur;
+    }
+
+    if (offset != NULL)
+        *offset = addr - sym->st_value;
+
+    return 0;
+}
@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shelf.h"
+#include "shelf_profiler.h"
+#include "symbol.h"
+#include "iter.h"
+#include "symquery.h"
+
+
+/* Symbols evaluated per step; one result word. */
+#define BLOCK 64
+
+shelfsymcols_t *shelf_symcols_load(shelfobj_t *desc, int table)
+{
+    shelfsymcols_t *cols;
+    shelfsym_t *syms;
+    size_t n;
+
+    PROFILER_IN();
+
+    if (desc == NULL || (table != SHELF_SYMTAB_STATIC && table != SHELF_SYMTAB_DYNAMIC))
+        PROFILER_RERR("Invalid argument passed to shelf_symcols_load()\n", NULL);
+
+    if (desc->symcols[table] != NULL)
+        PROFILER_ROUT(desc->symcols[table], "shelfsymcols_t *: %p");
+
+    if (table == SHELF_SYMTAB_STATIC) {
+        if (shelf_load_symtab(desc) != 0)
+            PROFILER_RERR(shelf_error, NULL);
+        syms = desc->symtab;
+        n = desc->symcount;
+    } else if ((syms = shelf_load_dynsym(desc, &n)) == NULL) {
+        n = 0;
+    }
+
+    if (syms == NULL)
+        n = 0;
+
+    /*
+     * One allocation holds every column, widest first so each stays
+     * naturally aligned.
+     */
+    size_t bytes = n * (2 * sizeof(uint64_t) + sizeof(char *) + sizeof(uint16_t) + 3);
+
+    if ((cols = calloc(1, sizeof(shelfsymcols_t) + bytes)) == NULL)
+        PROFILER_RERR("Malloc for symbol columns failed\n", NULL);
+
+    unsigned char *p = (unsigned char *) (cols + 1);
+
+    cols->count = n;
+    cols->value = (uint64_t *) p;       p += n * sizeof(uint64_t);
+    cols->size = (uint64_t *) p;        p += n * sizeof(uint64_t);
+    cols->name = (const char **) p;     p += n * sizeof(char *);
+    cols->shndx = (uint16_t *) p;       p += n * sizeof(uint16_t);
+    cols->type = p;                     p += n;
+    cols->bind = p;                     p += n;
+    cols->vis = p;
+
+    for (size_t i = 0; i < n; i++) {
+        cols->value[i] = syms[i].st_value;
+        cols->size[i] = syms[i].st_size;
+        cols->name[i] = syms[i].name;
+        cols->shndx[i] = syms[i].st_shndx;
+        cols->type[i] = ELF64_ST_TYPE(syms[i].st_info);
+        cols->bind[i] = ELF64_ST_BIND(syms[i].st_info);
+        cols->vis[i] = syms[i].st_other & 0x3;
+    }
+
+    desc->symcols[table] = cols;
+
+    PROFILER_ROUT(cols, "shelfsymcols_t *: %p");
+}
+
+void shelf_symcols_free(shelfobj_t *desc)
+{
+    if (desc == NULL)
+        return;
+
+    for (int i = 0; i < 2; i++) {
+        free(desc->symcols[i]);
+        desc->symcols[i] = NULL;
+    }
+}
+
+void shelf_symquery_init(shelfsymquery_t *query)
+{
+    memset(query, 0, sizeof(*query));
+    query->shndx = SHELF_ITER_ANY;
+    query->value_max = UINT64_MAX;
+    query->size_max = UINT64_MAX;
+}
+
+/*
+ * Each predicate below is a branch-free loop over one column of a block,
+ * and-ing into a byte mask, so the compiler can vectorize it. Predicates
+ * left at their match-anything defaults are skipped entirely.
+ */
+static void filter_mask(uint8_t *m, const uint8_t *col, size_t n, uint32_t mask)
+{
+    for (size_t i = 0; i < n; i++)
+        m[i] &= (mask >> (col[i] & 31)) & 1;
+}
+
+static void filter_range(uint8_t *m, const uint64_t *col, size_t n, uint64_t lo, uint64_t hi)
+{
+    for (size_t i = 0; i < n; i++)
+        m[i] &= (col[i] >= lo) & (col[i] <= hi);
+}
+
+static void filter_shndx(uint8_t *m, const uint16_t *col, size_t n, uint16_t shndx)
+{
+    for (size_t i = 0; i < n; i++)
+        m[i] &= col[i] == shndx;
+}
+
+static uint64_t pack_mask(const uint8_t *m, size_t n)
+{
+    uint64_t word = 0;
+
+    for (size_t i = 0; i < n; i++)
+        word |= (uint64_t) m[i] << i;
+
+    return word;
+}
+
+/*
+ * Evaluate `query` over a symbol table. `bits` must hold
+ * SHELF_SYMQUERY_WORDS(count) words, where count is the table's symbol
+ * count; bit i is set when symbol i matches. Returns the number of matches.
+ */
+ssize_t shelf_symquery_bitmap(shelfobj_t *desc, int table, const shelfsymquery_t *query,
+                              uint64_t *bits)
+{
+    const shelfsymcols_t *cols;
+    size_t prefix_len = 0;
+    ssize_t matches = 0;
+    uint8_t m[BLOCK];
+
+    PROFILER_IN();
+
+    if (query == NULL || bits == NULL)
+        PROFILER_RERR("Null argument passed to shelf_symquery_bitmap()\n", -1);
+
+    if ((cols = shelf_symcols_load(desc, table)) == NULL)
+        PROFILER_RERR(shelf_error, -1);
+
+    if (query->prefix != NULL)
+        prefix_len = strlen(query->prefix);
+
+    for (size_t base = 0; base < cols->count; base += BLOCK) {
+        size_t n = cols->count - base < BLOCK ? cols->count - base : BLOCK;
+
+        memset(m, 1, n);
+
+        if (query->type_mask)
+            filter_mask(m, cols->type + base, n, query->type_mask);
+        if (query->bind_mask)
+            filter_mask(m, cols->bind + base, n, query->bind_mask);
+        if (query->vis_mask)
+            filter_mask(m, cols->vis + base, n, query->vis_mask);
+        if (query->shndx != SHELF_ITER_ANY)
+            filter_shndx(m, cols->shndx + base, n, (uint16_t) query->shndx);
+        if (query->value_min != 0 || query->value_max != UINT64_MAX)
+            filter_range(m, cols->value + base, n, query->value_min, query->value_max);
+        if (query->size_min != 0 || query->size_max != UINT64_MAX)
+            filter_range(m, cols->size + base, n, query->size_min, query->size_max);
+
+        uint64_t word = pack_mask(m, n);
+
+        /* Names are only compared for symbols that survived the cheap columns. */
+        if (prefix_len) {
+            for (uint64_t w = word; w; w &= w - 1) {
+                size_t i = __builtin_ctzll(w);
+                const char *name = cols->name[base + i];
+
+                if (name == NULL || strncmp(name, query->prefix, prefix_len))
+                    word &= ~(1ULL << i);
+            }
+        }
+
+        bits[base / BLOCK] = word;
+        matches += __builtin_popcountll(word);
+    }
+
+    PROFILER_ROUT(matches, "%zd");
+}
+
+/*
+ * Expand a result bitmap over `count` symbols into ascending indices. `out`
+ * must have room for every match. Returns the number written.
+ */
+size_t shelf_symquery_indices(const uint64_t *bits, size_t count, uint32_t *out)
+{
+    size_t n = 0;
+
+    for (size_t w = 0; w < SHELF_SYMQUERY_WORDS(count); w++) {
+        for (uint64_t word = bits[w]; word; word &= word - 1)
+            out[n++] = (uint32_t) (w * 64 + __builtin_ctzll(word));
+    }
+
+    return n;
+}
@@ -1,17 +1,2087 @@
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "shelf.h"
+#include "section.h"
+#include "symbol.h"
+#include "shelf_compress.h"
+#include "reloc.h"
+#include "dynamic.h"
+#include "buildid.h"
+#include "debuginfo.h"
+#include "iter.h"
+#include "symquery.h"
+#include "nameidx.h"
+#include "symcompact.h"
+#include "segment.h"
+#include "core.h"
+#include "process.h"
+#include "symbolizer.h"
+#include "journal.h"
+#include "layout.h"
+#include "strtab.h"
+
+/*
+ * Library tests. Each test works on its own copy of this program, or on
+ * files it writes itself, in a temporary directory removed at exit.
+ */
+
+static int failures;
+static char dir[] = "/tmp/shelftest.XXXXXX";
+
+#define CHECK(cond)                                                             \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, \
+                    __func__, #cond);                                           \
+            failures++;                                                         \
+        }                                                                       \
+    } while (0)
+
+static char *path_in_dir(const char *name)
+{
+    static char paths[8][256];
+    static int next;
+    char *path = paths[next++ % 8];
+
+    snprintf(path, sizeof(paths[0]), "%s/%s", dir, name);
+
+    return path;
+}
+
+static int write_file(const char *path, const void *buf, size_t len)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ssize_t ret;
+
+    if (fd < 0)
+        return -1;
+
+    ret = write(fd, buf, len);
+    close(fd);
+
+    return ret == (ssize_t) len ? 0 : -1;
+}
+
+static void *read_file(const char *path, size_t *len)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    unsigned char *buf;
+
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st) != 0 || (buf = malloc(st.st_size ? st.st_size : 1)) == NULL ||
+        pread(fd, buf, st.st_size, 0) != st.st_size) {
+        close(fd);
+        return NULL;
+    }
+
+    close(fd);
+    *len = st.st_size;
+
+    return buf;
+}
+
+/* Copies the file at `src` to `name` in the test directory. */
+static char *copy_to_dir(const char *src, const char *name)
+{
+    char *path = path_in_dir(name);
+    size_t len;
+    void *buf = read_file(src, &len);
+
+    if (buf == NULL || write_file(path, buf, len) != 0) {
+        fprintf(stderr, "Can't write fixture %s\n", path);
+        exit(1);
+    }
+
+    free(buf);
+
+    return path;
+}
+
+/* Copies this program to `name` in the test directory. */
+static char *fixture(const char *name)
+{
+    return copy_to_dir("/proc/self/exe", name);
+}
+
+static int same_file_bytes(const char *a, const char *b)
+{
+    size_t alen, blen;
+    void *abuf = read_file(a, &alen);
+    void *bbuf = read_file(b, &blen);
+    int same = abuf != NULL && bbuf != NULL && alen == blen && memcmp(abuf, bbuf, alen) == 0;
+
+    free(abuf);
+    free(bbuf);
+
+    return same;
+}
+
+/*
+ * Copies this program to `name` with sh_offset of the section `sect` set to
+ * `offset`, or with the whole section header table moved to `offset` when
+ * `sect` is NULL.
+ */
+static char *misplaced(const char *name, const char *sect, uint64_t offset)
+{
+    char *path = fixture(name);
+    shelfobj_t *desc = shelf_open(path);
+    shelfsect_t *s = NULL;
+    Elf64_Ehdr hdr;
+    size_t len;
+    unsigned char *buf = read_file(path, &len);
+
+    if (desc == NULL || buf == NULL ||
+        (sect != NULL && (s = get_section_by_name(desc, (char *) sect)) == NULL)) {
+        fprintf(stderr, "Can't set up fixture %s\n", path);
+        exit(1);
+    }
+
+    memcpy(&hdr, buf, sizeof(hdr));
+
+    if (s != NULL)
+        memcpy(buf + hdr.e_shoff + s->index * hdr.e_shentsize + offsetof(Elf64_Shdr, sh_offset),
+               &offset, sizeof(offset));
+    else
+        memcpy(buf + offsetof(Elf64_Ehdr, e_shoff), &offset, sizeof(offset));
+
+    shelf_close(&desc);
+
+    if (write_file(path, buf, len) != 0)
+        exit(1);
 
-#include "elf.h"
-#include "elf_constants.h"
+    free(buf);
+
+    return path;
+}
+
+static void test_verify(shelfobj_t *self)
+{
+    shelfobj_t *desc;
+    shelfsect_t *sect;
+
+    // Sections that passed verification are readable, SHT_NOBITS ones only as zero pages.
+    CHECK(self->sht_verified && self->pht_verified && !self->hdr_corrupt);
+    CHECK((sect = get_section_by_name(self, ".text")) != NULL && sect->verified);
+    CHECK(sect != NULL && shelf_sect_ptr(self, sect->index) == get_section_data(self, sect));
+    CHECK((sect = get_section_by_name(self, ".bss")) != NULL && sect->verified);
+    CHECK(sect != NULL && shelf_sect_ptr(self, sect->index) == NULL);
+    CHECK(sect != NULL && get_section_data(self, sect) != NULL && sect->data_owner == SECT_DATA_ANON);
+    CHECK(shelf_sect_ptr(self, self->hdr.e_shnum) == NULL);
+
+    // A section past the end of the file is quarantined, the rest still reads.
+    char *path = misplaced("verify.section", ".comment", 1ULL << 40);
+    uint32_t comment = get_section_by_name(self, ".comment")->index;
+
+    CHECK(shelf_open_flags(path, SHELF_OPEN_STRICT) == NULL);
+    desc = shelf_open(path);
+    CHECK(desc != NULL);
+
+    if (desc != NULL) {
+        CHECK(desc->sht_verified && !desc->hdr_corrupt);
+        CHECK((sect = get_section_by_index(desc, comment)) != NULL && !sect->verified);
+        CHECK(sect != NULL && *sect->name == '\0' && get_section_by_name(desc, ".comment") == NULL);
+        CHECK(sect != NULL && !desc->sect_verified[sect->index]);
+        CHECK(sect != NULL && shelf_sect_ptr(desc, sect->index) == NULL);
+        CHECK(sect != NULL && get_section_data(desc, sect) == NULL);
+        CHECK((sect = get_section_by_name(desc, ".text")) != NULL && get_section_data(desc, sect) != NULL);
+        CHECK(shelf_get_symbol_by_name(desc, "main") != NULL);
+        shelf_close(&desc);
+    }
 
-int main(void) {
-    printf("Hello, World!\n");
+    // So is a section header table that doesn't fit: no sections are decoded.
+    path = misplaced("verify.table", NULL, 1ULL << 40);
 
-    Elf_Desc *desc = Elf_Open("./lib/libelfbutcher.so");
+    CHECK(shelf_open_flags(path, SHELF_OPEN_STRICT) == NULL);
+    desc = shelf_open(path);
+    CHECK(desc != NULL);
 
     if (desc != NULL) {
-        printf("Huzzah!\n");
-        Elf_Dump_Header(desc);
+        CHECK(!desc->sht_verified && desc->pht_verified && desc->hdr_corrupt);
+        CHECK(desc->sht[1].sh_type == SHT_NULL && desc->sht[1].sh_offset == 0);
+        CHECK(get_section_by_name(desc, ".text") == NULL);
+        CHECK(shelf_sect_ptr(desc, 1) == NULL);
+        shelf_close(&desc);
+    }
+}
+
+static void test_section_data(void)
+{
+    shelfobj_t *desc = shelf_open("/proc/self/exe");
+    shelfsect_t *sect = NULL;
+    const unsigned char *ro;
+    unsigned char *rw, head[4];
+
+    CHECK(desc != NULL && (sect = get_section_by_name(desc, ".comment")) != NULL);
+
+    if (desc == NULL || sect == NULL) {
+        shelf_close(&desc);
+        return;
+    }
+
+    // Reads are views into the mapping, nothing is copied.
+    ro = get_section_data(desc, sect);
+    CHECK(ro == desc->data + sect->shdr->sh_offset);
+    CHECK(sect->data == NULL && sect->data_owner == SECT_DATA_NONE);
+    memcpy(head, ro, sizeof(head));
+
+    // The first write access copies, later reads and writes share the copy.
+    rw = get_section_data_rw(desc, sect);
+    CHECK(rw != NULL && rw != ro && sect->data == rw && sect->data_owner == SECT_DATA_MALLOC);
+    CHECK(rw != NULL && sect->data_len == sect->shdr->sh_size && memcmp(rw, ro, sect->data_len) == 0);
+    CHECK(get_section_data_rw(desc, sect) == rw && get_section_data(desc, sect) == rw);
+
+    if (rw != NULL)
+        memcpy(rw, "ZZZZ", 4);
+
+    CHECK(memcmp(ro, head, sizeof(head)) == 0);
+
+    // Dropping the copy goes back to the file's bytes.
+    release_section_data(sect);
+    CHECK(sect->data == NULL && sect->data_owner == SECT_DATA_NONE);
+    CHECK(get_section_data(desc, sect) == ro);
+
+    shelf_close(&desc);
+}
+
+#ifdef SHELF_HAVE_ZLIB
+/*
+ * Wraps `len` bytes in a zlib stream of one stored block, which any inflater
+ * reads back, and returns the stream length.
+ */
+static size_t zlib_stored(const unsigned char *src, uint16_t len, unsigned char *dst)
+{
+    uint32_t a = 1, b = 0;
+
+    dst[0] = 0x78;
+    dst[1] = 0x01;
+    dst[2] = 0x01;
+    dst[3] = len & 0xff;
+    dst[4] = len >> 8;
+    dst[5] = ~len & 0xff;
+    dst[6] = (uint16_t) ~len >> 8;
+    memcpy(dst + 7, src, len);
+
+    for (size_t i = 0; i < len; i++) {
+        a = (a + src[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+
+    dst[7 + len] = b >> 8;
+    dst[8 + len] = b;
+    dst[9 + len] = a >> 8;
+    dst[10 + len] = a;
+
+    return 11 + len;
+}
+
+/* Returns 1 if `sect` had to be inflated, 0 if it was cached. */
+static int inflated(shelfobj_t *desc, shelfsect_t *sect)
+{
+    return shelf_decompress_sections(desc, &sect, 1, 1);
+}
+#endif
+
+static void test_compress(void)
+{
+#ifdef SHELF_HAVE_ZLIB
+    enum { N = 1000 };
+    char *path = fixture("compress");
+    char *out = path_in_dir("compress.out");
+    shelf_Shdr shdr = { .sh_type = SHT_PROGBITS, .sh_addralign = 1 };
+    static unsigned char plain[3][N], buf[N + 64];
+    shelfobj_t *desc = shelf_open(path);
+    shelfsect_t *a, *b, *c, *raw;
+    const unsigned char *data;
+    uint64_t packed, size;
+    size_t len;
+
+    CHECK(desc != NULL);
+
+    if (desc == NULL)
+        return;
+
+    for (size_t i = 0; i < N; i++) {
+        plain[0][i] = i;
+        plain[1][i] = i * 3;
+        plain[2][i] = i * 5;
+    }
+
+    // One old style .zdebug section, two SHF_COMPRESSED ones and an uncompressed .zdebug one.
+    memcpy(buf, "ZLIB\0\0\0\0\0\0", 10);
+    buf[10] = N >> 8;
+    buf[11] = N & 0xff;
+    len = 12 + zlib_stored(plain[0], N, buf + 12);
+    CHECK(add_section(desc, ".zdebug_a", &shdr, buf, len) != NULL);
+
+    shdr.sh_flags = SHF_COMPRESSED;
+    shdr.sh_addralign = 8;
+
+    for (int i = 1; i < 3; i++) {
+        Elf64_Chdr chdr = { .ch_type = ELFCOMPRESS_ZLIB, .ch_size = N, .ch_addralign = 1 };
+
+        memcpy(buf, &chdr, sizeof(chdr));
+        len = sizeof(chdr) + zlib_stored(plain[i], N, buf + sizeof(chdr));
+        CHECK(add_section(desc, i == 1 ? ".debug_b" : ".debug_c", &shdr, buf, len) != NULL);
+    }
+
+    shdr.sh_flags = 0;
+    shdr.sh_addralign = 1;
+    CHECK(add_section(desc, ".zdebug_raw", &shdr, "plain", 6) != NULL);
+    CHECK(shelf_write(desc, out) > 0);
+    shelf_close(&desc);
+
+    desc = shelf_open(out);
+    CHECK(desc != NULL);
+
+    if (desc == NULL)
+        return;
+
+    a = get_section_by_name(desc, ".zdebug_a");
+    b = get_section_by_name(desc, ".debug_b");
+    c = get_section_by_name(desc, ".debug_c");
+    raw = get_section_by_name(desc, ".zdebug_raw");
+    CHECK(a != NULL && b != NULL && c != NULL && raw != NULL);
+
+    if (a == NULL || b == NULL || c == NULL || raw == NULL) {
+        shelf_close(&desc);
+        return;
+    }
+
+    CHECK(shelf_section_is_compressed(desc, a) && shelf_section_is_compressed(desc, b));
+    CHECK(!shelf_section_is_compressed(desc, raw));
+    CHECK(shelf_section_sizes(desc, a, &packed, &size) == 0 && packed == a->shdr->sh_size && size == N);
+    CHECK(shelf_section_sizes(desc, raw, &packed, &size) == 0 && packed == 6 && size == 6);
+
+    // Reads come back inflated, the unmagicked .zdebug one as is.
+    CHECK((data = get_section_data(desc, a)) != NULL && memcmp(data, plain[0], N) == 0);
+    CHECK((data = get_section_data(desc, b)) != NULL && memcmp(data, plain[1], N) == 0);
+    CHECK(get_section_data(desc, raw) == desc->data + raw->shdr->sh_offset);
+
+    // With room for two, the least recently used one goes first.
+    shelf_zcache_set_limit(desc, 2 * N + N / 2);
+    get_section_data(desc, a);
+    CHECK((data = get_section_data(desc, c)) != NULL && memcmp(data, plain[2], N) == 0);
+    CHECK(!inflated(desc, a));
+    CHECK(!inflated(desc, c));
+    CHECK(inflated(desc, b));
+    CHECK(inflated(desc, a));
+
+    // A section larger than the limit is still handed out.
+    shelf_zcache_set_limit(desc, N / 2);
+    CHECK((data = get_section_data(desc, b)) != NULL && memcmp(data, plain[1], N) == 0);
+    CHECK(inflated(desc, c));
+
+    // Batches skip cached and uncompressed sections and inflate the rest once.
+    shelfsect_t *batch[] = { a, b, a, raw, c, b };
+
+    shelf_zcache_set_limit(desc, SHELF_ZCACHE_DEFAULT_LIMIT);
+    CHECK(shelf_decompress_sections(desc, batch, 6, 4) == 2);
+    CHECK(shelf_decompress_sections(desc, batch, 6, 4) == 0);
+    CHECK((data = get_section_data(desc, a)) != NULL && memcmp(data, plain[0], N) == 0);
+
+    shelf_close(&desc);
+#endif
+}
+
+static void test_reloc(shelfobj_t *desc)
+{
+    // Two groups, sorted by type: one R_X86_64_64 and two R_X86_64_RELATIVE.
+    uint64_t offset[] = { 0x1010, 0x1000, 0x1008 };
+    uint32_t type[] = { R_X86_64_64, R_X86_64_RELATIVE, R_X86_64_RELATIVE };
+    uint32_t sym[] = { 2, 0, 0 };
+    int64_t addend[] = { 4, 0x10, 0x20 };
+    uint32_t index[] = { 2, 0, 1 };
+    uint32_t group_type[] = { R_X86_64_64, R_X86_64_RELATIVE };
+    size_t group_start[] = { 0, 1, 3 };
+    shelfreltab_t tab = {
+        .rela = 1, .machine = EM_X86_64, .count = 3,
+        .offset = offset, .type = type, .sym = sym, .addend = addend, .index = index,
+        .ngroups = 2, .group_type = group_type, .group_start = group_start,
+    };
+    uint64_t symvals[] = { 0, 0, 0x5000 };
+    unsigned char buf[24] = { 0 };
+    size_t start, count;
+
+    CHECK(shelf_reltab_group(&tab, R_X86_64_RELATIVE, &start, &count) == 0);
+    CHECK(start == 1 && count == 2);
+
+    CHECK(shelf_reloc_apply_relative(desc, &tab, buf, 0x1000, sizeof(buf), 0x400000) == 2);
+    CHECK(desc->read_qword(buf) == 0x400010);
+    CHECK(desc->read_qword(buf + 8) == 0x400020);
+
+    CHECK(shelf_reloc_apply_group(desc, &tab, R_X86_64_64, buf, 0x1000, sizeof(buf), 0,
+                                  symvals, 3) == 1);
+    CHECK(desc->read_qword(buf + 16) == 0x5004);
+
+    // A symbol past the resolved ones, and a target past the buffer.
+    CHECK(shelf_reloc_apply_group(desc, &tab, R_X86_64_64, buf, 0x1000, sizeof(buf), 0,
+                                  symvals, 2) == -1);
+    CHECK(shelf_reloc_apply_group(desc, &tab, R_X86_64_64, buf, 0x1000, 16, 0,
+                                  symvals, 3) == -1);
+
+    // Sections decoded from a file are grouped the same way.
+    size_t ntabs;
+    shelfreltab_t **tabs = shelf_reltab_load_all(desc, &ntabs);
+
+    for (size_t i = 0; tabs != NULL && i < ntabs; i++) {
+        CHECK(tabs[i]->group_start[0] == 0);
+        CHECK(tabs[i]->group_start[tabs[i]->ngroups] == tabs[i]->count);
+
+        for (size_t g = 1; g < tabs[i]->ngroups; g++)
+            CHECK(tabs[i]->group_type[g - 1] < tabs[i]->group_type[g]);
+
+        shelf_reltab_free(tabs[i]);
+    }
+
+    free(tabs);
+}
+
+static void test_dynamic(void)
+{
+    shelfobj_t *desc = shelf_open(TESTLIB);
+    const shelfdynent_t *needed;
+    int has_libc = 0;
+    size_t count;
+    uint64_t val;
+
+    CHECK(desc != NULL && shelf_dyn_load(desc) != NULL);
+
+    if (desc == NULL || desc->dyn == NULL) {
+        shelf_close(&desc);
+        return;
+    }
+
+    CHECK(shelf_dyn_has(desc, DT_STRTAB) && shelf_dyn_has(desc, DT_SYMTAB));
+    CHECK(!shelf_dyn_has(desc, DT_NULL));
+    CHECK(shelf_dyn_get(desc, DT_STRSZ, &val) == 0 && val >= desc->dyn->strsz);
+    CHECK(desc->dyn->strtab != NULL);
+    CHECK(shelf_dyn_soname(desc) != NULL && strcmp(shelf_dyn_soname(desc), "libshelftest.so.1") == 0);
+
+    // Repeated tags form one run, in file order.
+    needed = shelf_dyn_get_all(desc, DT_NEEDED, &count);
+    CHECK(needed != NULL && count == shelf_dyn_needed_count(desc));
+
+    for (size_t i = 0; needed != NULL && i < count; i++) {
+        CHECK(needed[i].tag == DT_NEEDED);
+        has_libc |= shelf_dyn_needed(desc, i) != NULL && strcmp(shelf_dyn_needed(desc, i), "libc.so.6") == 0;
+    }
+
+    CHECK(has_libc);
+    CHECK(shelf_dyn_needed(desc, count) == NULL);
+    shelf_close(&desc);
+
+    // Loadable segments moved past the end of the file leave no string table.
+    char *path = copy_to_dir(TESTLIB, "dynamic.past_eof");
+    size_t len;
+    unsigned char *buf = read_file(path, &len);
+    Elf64_Ehdr hdr;
+
+    CHECK(buf != NULL && len >= sizeof(hdr));
+
+    if (buf == NULL)
+        return;
+
+    memcpy(&hdr, buf, sizeof(hdr));
+
+    for (size_t i = 0; i < hdr.e_phnum; i++) {
+        Elf64_Phdr ph;
+        unsigned char *at = buf + hdr.e_phoff + i * hdr.e_phentsize;
+
+        memcpy(&ph, at, sizeof(ph));
+
+        if (ph.p_type == PT_LOAD) {
+            ph.p_offset = 0x100000;
+            memcpy(at, &ph, sizeof(ph));
+        }
+    }
+
+    CHECK(write_file(path, buf, len) == 0);
+    free(buf);
+
+    desc = shelf_open(path);
+    CHECK(desc != NULL);
+
+    if (desc != NULL && shelf_dyn_load(desc) != NULL) {
+        CHECK(desc->dyn->strtab == NULL && desc->dyn->strsz == 0);
+        CHECK(shelf_dyn_soname(desc) == NULL);
+    }
+
+    shelf_close(&desc);
+}
+
+/* Index of the first dynamic symbol named `name`, or SIZE_MAX. */
+static size_t dynsym_index(shelfobj_t *desc, const char *name)
+{
+    size_t count;
+    shelfsym_t *syms = shelf_load_dynsym(desc, &count);
+
+    for (size_t i = 0; syms != NULL && i < count; i++) {
+        if (syms[i].name != NULL && strcmp(syms[i].name, name) == 0)
+            return i;
+    }
+
+    return SIZE_MAX;
+}
+
+static void test_symver(void)
+{
+    shelfobj_t *desc = shelf_open(TESTLIB);
+    shelfsym_t *sym, *v1, *v2;
+    const char *ver;
+    size_t pid;
+    int hidden;
+
+    CHECK(desc != NULL && shelf_load_symver(desc) != NULL);
+
+    if (desc == NULL || desc->symver == NULL) {
+        shelf_close(&desc);
+        return;
+    }
+
+    // Unversioned definitions have index VER_NDX_GLOBAL, not the file's base version.
+    pid = dynsym_index(desc, "shelf_test_pid");
+    CHECK(pid != SIZE_MAX && desc->symver->versym[pid] == VER_NDX_GLOBAL);
+    CHECK(pid != SIZE_MAX && (ver = shelf_get_symbol_version(desc, pid, &hidden)) != NULL &&
+          *ver == '\0' && !hidden);
+
+    ver = shelf_get_symbol_version(desc, dynsym_index(desc, "getpid"), NULL);
+    CHECK(ver != NULL && strcmp(ver, "GLIBC_2.2.5") == 0);
+
+    // Both versions of shelf_test_one, the default one also under its bare name.
+    v1 = shelf_get_symbol_by_versioned_name(desc, "shelf_test_one@LIBSHELFTEST_1");
+    v2 = shelf_get_symbol_by_versioned_name(desc, "shelf_test_one@@LIBSHELFTEST_2");
+    CHECK(v1 != NULL && v2 != NULL && v1 != v2);
+    CHECK(v1 != NULL && shelf_get_symbol_version(desc, v1 - desc->dynsym, &hidden) != NULL && hidden);
+    CHECK(v2 != NULL && (sym = shelf_get_symbol_by_name(desc, "shelf_test_one_v2")) != NULL &&
+          sym->st_value == v2->st_value);
+    CHECK(shelf_get_symbol_by_versioned_name(desc, "shelf_test_one") == v2);
+    CHECK(shelf_get_symbol_by_versioned_name(desc, "shelf_test_one@LIBSHELFTEST_2") == v2);
+    CHECK(shelf_get_symbol_by_versioned_name(desc, "shelf_test_one@@LIBSHELFTEST_1") == NULL);
+
+    // Unversioned symbols answer to their bare name only.
+    sym = shelf_get_symbol_by_versioned_name(desc, "shelf_test_pid");
+    CHECK(sym != NULL && pid != SIZE_MAX && sym == &desc->dynsym[pid]);
+    CHECK(shelf_get_symbol_by_versioned_name(desc, "shelf_test_pid@@libshelftest.so.1") == NULL);
+
+    // Imports aren't definitions to look up.
+    CHECK(shelf_get_symbol_by_versioned_name(desc, "getpid@GLIBC_2.2.5") == NULL);
+
+    shelf_close(&desc);
+}
+
+/* Writes a copy of `src` to `name` with a .gnu_debuglink naming `link`. */
+static char *with_debuglink(const char *src, const char *name, const char *link, uint32_t crc)
+{
+    shelf_Shdr shdr = { .sh_type = SHT_PROGBITS, .sh_addralign = 4 };
+    shelfobj_t *desc = shelf_open(src);
+    char *path = path_in_dir(name);
+    unsigned char buf[256] = { 0 };
+    size_t len = (strlen(link) + 4) & ~(size_t) 3;
+
+    memcpy(buf, link, strlen(link));
+    memcpy(buf + len, &crc, sizeof(crc));
+
+    if (desc == NULL || add_section(desc, ".gnu_debuglink", &shdr, buf, len + 4) == NULL ||
+        shelf_write(desc, path) < 0) {
+        fprintf(stderr, "Can't write fixture %s\n", path);
+        exit(1);
+    }
+
+    shelf_close(&desc);
+
+    return path;
+}
+
+static void test_buildid(void)
+{
+    unsigned char id[SHELF_BUILD_ID_MAX], other[SHELF_BUILD_ID_MAX];
+    shelfobj_t *desc = shelf_open(TESTLIB);
+    char name[64];
+    uint32_t crc = 0;
+    ssize_t len;
+
+    // The header-only reader and the open descriptor agree.
+    CHECK((len = shelf_read_build_id(TESTLIB, id)) == 20);
+    CHECK(desc != NULL && shelf_get_build_id(desc, other) == len && memcmp(id, other, 20) == 0);
+    shelf_close(&desc);
+
+    // Without a PT_NOTE segment the note sections are searched instead.
+    char *path = copy_to_dir(TESTLIB, "buildid.nophdr");
+    size_t size;
+    unsigned char *buf = read_file(path, &size);
+    Elf64_Ehdr hdr;
+
+    CHECK(buf != NULL);
+
+    if (buf == NULL)
+        return;
+
+    memcpy(&hdr, buf, sizeof(hdr));
+
+    for (size_t i = 0; i < hdr.e_phnum; i++) {
+        Elf64_Phdr ph;
+        unsigned char *at = buf + hdr.e_phoff + i * hdr.e_phentsize;
+
+        memcpy(&ph, at, sizeof(ph));
+
+        if (ph.p_type == PT_NOTE) {
+            ph.p_type = PT_NULL;
+            memcpy(at, &ph, sizeof(ph));
+        }
+    }
+
+    CHECK(write_file(path, buf, size) == 0);
+    free(buf);
+
+    CHECK(shelf_read_build_id(path, other) == 20 && memcmp(id, other, 20) == 0);
+    desc = shelf_open(path);
+    CHECK(desc != NULL && shelf_get_build_id(desc, other) == 20 && memcmp(id, other, 20) == 0);
+    shelf_close(&desc);
+
+    // Debuglinks give the name and CRC, when the name fits.
+    CHECK(shelf_read_debuglink(TESTLIB, name, sizeof(name), &crc) == -1);
+    path = with_debuglink(TESTLIB, "buildid.link", "libshelftest.debug", 0x12345678);
+    CHECK(shelf_read_debuglink(path, name, sizeof(name), &crc) == 18);
+    CHECK(strcmp(name, "libshelftest.debug") == 0 && crc == 0x12345678);
+    CHECK(shelf_read_debuglink(path, name, 18, NULL) == -1);
+    CHECK(shelf_read_debuglink(path_in_dir("buildid.missing"), name, sizeof(name), NULL) == -1);
+}
+
+static void test_debuginfo(void)
+{
+    unsigned char id[SHELF_BUILD_ID_MAX];
+    char hex[2 * 20 + 1], *found;
+    char *root = path_in_dir("debugroot");
+    char *cache = path_in_dir("debugidx.cache");
+    shelfdebugidx_t *idx, *other;
+    shelfobj_t *desc = shelf_open(TESTLIB);
+
+    CHECK(desc != NULL && shelf_get_build_id(desc, id) == 20);
+
+    if (desc == NULL)
+        return;
+
+    for (int i = 0; i < 20; i++)
+        sprintf(hex + 2 * i, "%02x", id[i]);
+
+    CHECK(mkdir(root, 0755) == 0);
+    CHECK(mkdir(path_in_dir("debugroot/sub"), 0755) == 0);
+
+    // The build-id index is walked once, persisted, and loaded back over the same roots.
+    char *indexed = copy_to_dir(TESTLIB, "debugroot/sub/libshelftest.so.debug");
+
+    idx = shelf_debugidx_new(cache);
+    CHECK(idx != NULL && shelf_debugidx_add_root(idx, root) == 0);
+    CHECK((found = (char *) shelf_debugidx_lookup(idx, id, 20)) != NULL && strcmp(found, indexed) == 0);
+    CHECK(access(cache, R_OK) == 0);
+    CHECK((found = shelf_find_debug_file(desc, idx)) != NULL && strcmp(found, indexed) == 0);
+    free(found);
+    shelf_debugidx_free(idx);
+
+    unlink(indexed);
+    idx = shelf_debugidx_new(cache);
+    CHECK(idx != NULL && shelf_debugidx_add_root(idx, root) == 0);
+    CHECK((found = (char *) shelf_debugidx_lookup(idx, id, 20)) != NULL && strcmp(found, indexed) == 0);
+    CHECK(shelf_debugidx_rebuild(idx) == 0 && shelf_debugidx_lookup(idx, id, 20) == NULL);
+
+    // A cache built over other roots is ignored.
+    copy_to_dir(TESTLIB, "debugroot/sub/libshelftest.so.debug");
+    other = shelf_debugidx_new(cache);
+    CHECK(other != NULL && shelf_debugidx_add_root(other, path_in_dir("debugroot/sub")) == 0);
+    CHECK(other != NULL && shelf_debugidx_lookup(other, id, 20) != NULL);
+    shelf_debugidx_free(other);
+    unlink(indexed);
+
+    // The .build-id tree comes first.
+    char tree[128];
+
+    snprintf(tree, sizeof(tree), "debugroot/.build-id");
+    CHECK(mkdir(path_in_dir(tree), 0755) == 0);
+    snprintf(tree, sizeof(tree), "debugroot/.build-id/%.2s", hex);
+    CHECK(mkdir(path_in_dir(tree), 0755) == 0);
+    snprintf(tree, sizeof(tree), "debugroot/.build-id/%.2s/%s.debug", hex, hex + 2);
+
+    char *linked = copy_to_dir(TESTLIB, tree);
+
+    CHECK((found = shelf_find_debug_file(desc, idx)) != NULL && strcmp(found, linked) == 0);
+    free(found);
+    CHECK(shelf_open_debug(desc, idx) != NULL && desc->debug != NULL);
+    CHECK(shelf_open_debug(desc, idx) == desc->debug);
+    CHECK(shelf_get_symbol_by_name(desc->debug, "shelf_test_pid") != NULL);
+    shelf_close(&desc);
+    unlink(linked);
+    shelf_debugidx_free(idx);
+
+    // Then the debuglink, next to the binary or in its .debug directory.
+    char *bin = with_debuglink(TESTLIB, "debugbin", "debugbin.debug", 0);
+
+    idx = shelf_debugidx_new(NULL);
+    CHECK(idx != NULL && shelf_debugidx_add_root(idx, root) == 0);
+    desc = shelf_open(bin);
+    CHECK(desc != NULL && shelf_find_debug_file(desc, idx) == NULL);
+
+    CHECK(mkdir(path_in_dir(".debug"), 0755) == 0);
+    char *in_debug = copy_to_dir(TESTLIB, ".debug/debugbin.debug");
+
+    CHECK(desc != NULL && (found = shelf_find_debug_file(desc, idx)) != NULL && strcmp(found, in_debug) == 0);
+    free(found);
+
+    char *beside = copy_to_dir(TESTLIB, "debugbin.debug");
+
+    CHECK(desc != NULL && (found = shelf_find_debug_file(desc, idx)) != NULL && strcmp(found, beside) == 0);
+    free(found);
+
+    // A debug file with another build-id isn't taken.
+    unlink(beside);
+    unlink(in_debug);
+    copy_to_dir("/proc/self/exe", "debugbin.debug");
+    CHECK(desc != NULL && shelf_find_debug_file(desc, idx) == NULL);
+
+    shelf_close(&desc);
+    shelf_debugidx_free(idx);
+}
+
+static int stop_at_second(shelfobj_t *desc, shelfsect_t *sect, size_t index, void *arg)
+{
+    (void) desc;
+    (void) sect;
+    (void) index;
+
+    return ++*(int *) arg == 2 ? 7 : 0;
+}
+
+static void test_iter(shelfobj_t *desc)
+{
+    shelfsect_t **nulls = get_sections_by_type(desc, SHT_NULL);
+    shelfsectiter_t sit;
+    shelfsymiter_t yit;
+    shelfsegiter_t git;
+    shelfsect_t *sect;
+    shelfsym_t *sym;
+    Elf64_Phdr *ph;
+    size_t want, got;
+    int calls = 0, found_main = 0;
+
+    // The array getter still returns section 0.
+    CHECK(nulls != NULL && nulls[0] == &desc->sect_list[0] && nulls[1] == NULL);
+    free(nulls);
+
+    // Executable sections, by flags, skipping section 0.
+    want = got = 0;
+
+    for (size_t i = 1; i < desc->hdr.e_shnum; i++)
+        want += (desc->sht[i].sh_flags & (SHF_ALLOC | SHF_EXECINSTR)) == (SHF_ALLOC | SHF_EXECINSTR);
+
+    shelf_sect_iter_init(&sit, desc, SHELF_ITER_ANY, SHF_ALLOC | SHF_EXECINSTR, 0);
+
+    while ((sect = shelf_sect_iter_next(&sit)) != NULL) {
+        CHECK(sit.index == (size_t) sect->index && sect->index != 0);
+        got++;
+    }
+
+    CHECK(want > 0 && got == want);
+
+    // Non-allocated sections, by a cleared flag.
+    want = got = 0;
+
+    for (size_t i = 1; i < desc->hdr.e_shnum; i++)
+        want += !(desc->sht[i].sh_flags & SHF_ALLOC);
+
+    shelf_sect_iter_init(&sit, desc, SHELF_ITER_ANY, 0, SHF_ALLOC);
+
+    while (shelf_sect_iter_next(&sit) != NULL)
+        got++;
+
+    CHECK(want > 0 && got == want);
+    CHECK(shelf_sect_visit(desc, SHELF_ITER_ANY, 0, 0, stop_at_second, &calls) == 7 && calls == 2);
+
+    // Defined global functions of .symtab.
+    want = got = 0;
+    CHECK(shelf_load_symtab(desc) == 0 && desc->symtab != NULL);
+
+    for (size_t i = 0; i < desc->symcount; i++) {
+        sym = &desc->symtab[i];
+        want += ELF64_ST_TYPE(sym->st_info) == STT_FUNC && ELF64_ST_BIND(sym->st_info) == STB_GLOBAL &&
+                sym->st_shndx != SHN_UNDEF;
+    }
+
+    CHECK(shelf_sym_iter_init(&yit, desc, SHELF_SYMTAB_STATIC, STT_FUNC, 1 << STB_GLOBAL, 1) == 0);
+
+    while ((sym = shelf_sym_iter_next(&yit)) != NULL) {
+        CHECK(sym == &desc->symtab[yit.index] && sym->st_shndx != SHN_UNDEF);
+        found_main |= sym->name != NULL && strcmp(sym->name, "main") == 0;
+        got++;
+    }
+
+    CHECK(want > 0 && got == want && found_main);
+
+    // Without the defined filter imports are returned too.
+    want = got = 0;
+    CHECK(shelf_sym_iter_init(&yit, desc, SHELF_SYMTAB_DYNAMIC, SHELF_ITER_ANY, 0, 0) == 0);
+
+    while ((sym = shelf_sym_iter_next(&yit)) != NULL) {
+        want += sym->st_shndx == SHN_UNDEF;
+        got++;
+    }
+
+    CHECK(want > 0 && got == desc->dynsymcount);
+
+    // Executable loadable segments.
+    want = got = 0;
+
+    for (size_t i = 0; i < desc->hdr.e_phnum; i++)
+        want += desc->pht[i].p_type == PT_LOAD && (desc->pht[i].p_flags & PF_X);
+
+    shelf_seg_iter_init(&git, desc, PT_LOAD, PF_X, 0);
+
+    while ((ph = shelf_seg_iter_next(&git)) != NULL) {
+        CHECK(ph == &desc->pht[git.index]);
+        got++;
+    }
+
+    CHECK(want > 0 && got == want);
+}
+
+static void test_sym_stream(shelfobj_t *self)
+{
+    shelfobj_t *desc = shelf_open_flags("/proc/self/exe", SHELF_OPEN_LAZY_SYMBOLS);
+    shelfsymstream_t st;
+    shelfsym_t sym;
+    size_t n = 0, same = 0;
+
+    CHECK(desc != NULL && !desc->symtab_loaded && desc->symtab == NULL);
+
+    if (desc == NULL)
+        return;
+
+    // The stream decodes the same entries as the eager load, without making it.
+    CHECK(shelf_sym_stream_init(&st, desc, SHELF_SYMTAB_STATIC) == 0 && st.count == self->symcount);
+
+    while (shelf_sym_stream_next(&st, &sym)) {
+        const shelfsym_t *want = &self->symtab[n++];
+
+        same += sym.st_value == want->st_value && sym.st_info == want->st_info &&
+                sym.st_shndx == want->st_shndx && sym.name != NULL && want->name != NULL &&
+                strcmp(sym.name, want->name) == 0;
+    }
+
+    CHECK(n == self->symcount && same == n);
+    CHECK(!shelf_sym_stream_next(&st, &sym));
+    CHECK(!desc->symtab_loaded && desc->symtab == NULL);
+
+    // Lookups load the table on first use.
+    CHECK(shelf_get_symbol_by_name(desc, "main") != NULL);
+    CHECK(desc->symtab_loaded && desc->symcount == self->symcount);
+    shelf_close(&desc);
+
+    // Dynamic tables stream too, names included.
+    size_t count;
+    shelfsym_t *dynsym = NULL;
+
+    desc = shelf_open(TESTLIB);
+    CHECK(desc != NULL && (dynsym = shelf_load_dynsym(desc, &count)) != NULL);
+
+    if (desc != NULL && dynsym != NULL) {
+        n = same = 0;
+        CHECK(shelf_sym_stream_init(&st, desc, SHELF_SYMTAB_DYNAMIC) == 0 && st.count == count);
+
+        while (shelf_sym_stream_next(&st, &sym)) {
+            const shelfsym_t *want = &dynsym[n++];
+
+            same += sym.st_value == want->st_value &&
+                    (sym.name == want->name || (sym.name != NULL && want->name != NULL &&
+                                                strcmp(sym.name, want->name) == 0));
+        }
+
+        CHECK(n == count && same == n);
+    }
+
+    CHECK(shelf_sym_stream_init(&st, desc, 2) == -1);
+    shelf_close(&desc);
+}
+
+/* Evaluates `q` on one symbol the slow way. */
+static int symquery_match(const shelfsymquery_t *q, const shelfsym_t *s)
+{
+    uint32_t type = 1u << ELF64_ST_TYPE(s->st_info), bind = 1u << ELF64_ST_BIND(s->st_info);
+    uint32_t vis = 1u << (s->st_other & 3);
+
+    return (!q->type_mask || (q->type_mask & type)) && (!q->bind_mask || (q->bind_mask & bind)) &&
+           (!q->vis_mask || (q->vis_mask & vis)) &&
+           (q->shndx == SHELF_ITER_ANY || q->shndx == s->st_shndx) &&
+           s->st_value >= q->value_min && s->st_value <= q->value_max &&
+           s->st_size >= q->size_min && s->st_size <= q->size_max &&
+           (q->prefix == NULL || (s->name != NULL && !strncmp(s->name, q->prefix, strlen(q->prefix))));
+}
+
+/* Checks that the bitmap and indices for `q` agree with symquery_match(). */
+static void check_symquery(shelfobj_t *desc, const shelfsymquery_t *q, int expect_some)
+{
+    size_t count = desc->symcount, words = SHELF_SYMQUERY_WORDS(count);
+    uint64_t *bits = calloc(words ? words : 1, sizeof(uint64_t));
+    uint32_t *idx = malloc((count ? count : 1) * sizeof(uint32_t));
+    size_t want = 0, same = 0;
+    ssize_t got;
+
+    CHECK(bits != NULL && idx != NULL);
+
+    if (bits == NULL || idx == NULL) {
+        free(bits);
+        free(idx);
+        return;
+    }
+
+    got = shelf_symquery_bitmap(desc, SHELF_SYMTAB_STATIC, q, bits);
+
+    for (size_t i = 0; i < count; i++) {
+        int match = symquery_match(q, &desc->symtab[i]);
+
+        want += match;
+        same += match == !!(bits[i / 64] & (1ULL << (i % 64)));
     }
 
-    printf("Goodbye, World!\n");
+    CHECK(got == (ssize_t) want && same == count);
+    CHECK(!expect_some || want > 0);
+    CHECK(shelf_symquery_indices(bits, count, idx) == want);
+
+    for (size_t i = 0; i < want; i++)
+        CHECK(symquery_match(q, &desc->symtab[idx[i]]) && (i == 0 || idx[i - 1] < idx[i]));
+
+    free(bits);
+    free(idx);
+}
+
+static void test_symquery(shelfobj_t *self)
+{
+    shelfsymcols_t *cols = shelf_symcols_load(self, SHELF_SYMTAB_STATIC);
+    shelfsect_t *text = get_section_by_name(self, ".text");
+    shelfsym_t *main_sym = shelf_get_symbol_by_name(self, "main");
+    shelfsymquery_t q;
+
+    CHECK(cols != NULL && cols->count == self->symcount);
+    CHECK(shelf_symcols_load(self, SHELF_SYMTAB_STATIC) == cols);
+    CHECK(text != NULL && main_sym != NULL);
+
+    if (cols == NULL || text == NULL || main_sym == NULL)
+        return;
+
+    // Every symbol, then single predicates, then conjunctions of them.
+    shelf_symquery_init(&q);
+    check_symquery(self, &q, 1);
+
+    q.type_mask = 1 << STT_FUNC;
+    check_symquery(self, &q, 1);
+
+    q.bind_mask = 1 << STB_GLOBAL;
+    q.shndx = text->index;
+    check_symquery(self, &q, 1);
+
+    q.value_min = main_sym->st_value;
+    q.value_max = main_sym->st_value;
+    check_symquery(self, &q, 1);
+
+    shelf_symquery_init(&q);
+    q.prefix = "test_";
+    q.size_min = 1;
+    q.bind_mask = 1 << STB_LOCAL;
+    check_symquery(self, &q, 1);
+
+    q.vis_mask = 1 << STV_HIDDEN;
+    check_symquery(self, &q, 0);
+
+    shelf_symquery_init(&q);
+    q.prefix = "no such symbol";
+    check_symquery(self, &q, 0);
+}
+
+/* Checks a substring search against a scan of the symbol table. */
+static void check_substr(shelfobj_t *desc, const shelfnameidx_t *idx, const char *needle, int expect_some)
+{
+    size_t want = 0, got, seen = 0;
+    uint32_t *out = malloc((desc->symcount ? desc->symcount : 1) * sizeof(uint32_t));
+    unsigned char *hit = calloc(desc->symcount ? desc->symcount : 1, 1);
+
+    CHECK(out != NULL && hit != NULL);
+
+    if (out == NULL || hit == NULL) {
+        free(out);
+        free(hit);
+        return;
+    }
+
+    for (size_t i = 0; i < desc->symcount; i++)
+        want += desc->symtab[i].name != NULL && strstr(desc->symtab[i].name, needle) != NULL;
+
+    got = shelf_nameidx_substr(idx, needle, out, desc->symcount);
+    CHECK(got == want);
+    CHECK(!expect_some || want > 0);
+
+    for (size_t i = 0; i < got && i < desc->symcount; i++) {
+        CHECK(out[i] < desc->symcount && strstr(desc->symtab[out[i]].name, needle) != NULL);
+        seen += out[i] < desc->symcount && !hit[out[i]]++;
+    }
+
+    CHECK(seen == got);
+
+    // A short buffer still gets the full count.
+    CHECK(want < 2 || shelf_nameidx_substr(idx, needle, out, 1) == want);
+
+    free(out);
+    free(hit);
+}
+
+static void test_nameidx(shelfobj_t *self)
+{
+    shelfnameidx_t *idx = shelf_nameidx_load(self, SHELF_SYMTAB_STATIC);
+    size_t named = 0, want = 0, first, count;
+
+    CHECK(idx != NULL && shelf_nameidx_load(self, SHELF_SYMTAB_STATIC) == idx);
+
+    if (idx == NULL)
+        return;
+
+    for (size_t i = 0; i < self->symcount; i++) {
+        const char *name = self->symtab[i].name;
+
+        named += name != NULL && *name != '\0';
+        want += name != NULL && strncmp(name, "test_", 5) == 0;
+    }
+
+    // Names are sorted, so a prefix is one run.
+    CHECK(idx->count == named);
+
+    for (size_t i = 1; i < idx->count; i++)
+        CHECK(strcmp(idx->names[i - 1], idx->names[i]) <= 0);
+
+    count = shelf_nameidx_prefix(idx, "test_", &first);
+    CHECK(count == want && count > 0);
+
+    for (size_t i = first; i < first + count && i < idx->count; i++) {
+        CHECK(strncmp(idx->names[i], "test_", 5) == 0);
+        CHECK(self->symtab[idx->order[i]].name == idx->names[i]);
+    }
+
+    CHECK(shelf_nameidx_prefix(idx, "", &first) == named && first == 0);
+    CHECK(shelf_nameidx_prefix(idx, "no such symbol", &first) == 0);
+
+    // Long needles go through the trigrams, short ones scan.
+    check_substr(self, idx, "_symquery", 1);
+    check_substr(self, idx, "ma", 1);
+    check_substr(self, idx, "q", 1);
+    check_substr(self, idx, "no such symbol", 0);
+}
+
+/* Whether `s` has a twin in the symbol table of `desc`. */
+static int in_symtab(shelfobj_t *desc, const shelfsym_t *s)
+{
+    for (size_t i = 0; i < desc->symcount; i++) {
+        const shelfsym_t *t = &desc->symtab[i];
+
+        if (t->st_value == s->st_value && t->st_size == s->st_size && t->st_info == s->st_info &&
+            t->st_other == s->st_other && t->st_shndx == s->st_shndx && t->name != NULL &&
+            s->name != NULL && strcmp(t->name, s->name) == 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+static void test_symcompact(shelfobj_t *self)
+{
+    shelfsymcompact_t *comp = shelf_symcompact_build(self, SHELF_SYMTAB_STATIC);
+    shelfsym_t *main_sym = shelf_get_symbol_by_name(self, "main");
+    shelfsym_t sym, prev = { 0 };
+    size_t want = 0, found = 0, sorted = 0;
+    uint64_t offset;
+
+    CHECK(comp != NULL && main_sym != NULL);
+
+    if (comp == NULL || main_sym == NULL) {
+        shelf_symcompact_free(comp);
+        return;
+    }
+
+    // Defined, named symbols other than sections and files, in address order.
+    for (size_t i = 0; i < self->symcount; i++) {
+        const shelfsym_t *s = &self->symtab[i];
+        int type = ELF64_ST_TYPE(s->st_info);
+
+        want += s->st_shndx != SHN_UNDEF && s->name != NULL && *s->name != '\0' &&
+                type != STT_SECTION && type != STT_FILE;
+    }
+
+    CHECK(comp->count == want && want > SHELF_SYMBLOCK);
+    CHECK(comp->nblocks == (want + SHELF_SYMBLOCK - 1) / SHELF_SYMBLOCK);
+    CHECK(shelf_symcompact_memsize(comp) < want * sizeof(shelfsym_t));
+
+    for (size_t i = 0; i < comp->count; i++) {
+        if (shelf_symcompact_get(comp, i, &sym) != 0)
+            break;
+
+        found += in_symtab(self, &sym);
+        sorted += i == 0 || prev.st_value <= sym.st_value;
+        prev = sym;
+    }
+
+    CHECK(found == want && sorted == want);
+    CHECK(shelf_symcompact_get(comp, comp->count, &sym) != 0);
+
+    // Lookups land on the closest symbol at or below the address.
+    CHECK(shelf_symcompact_lookup(comp, main_sym->st_value + 1, &sym, &offset) == 0);
+    CHECK(sym.name != NULL && strcmp(sym.name, "main") == 0 && offset == 1);
+    CHECK(shelf_symcompact_get(comp, 0, &sym) == 0);
+    CHECK(sym.st_value == 0 || shelf_symcompact_lookup(comp, sym.st_value - 1, &sym, &offset) == -1);
+
+    shelf_symcompact_free(comp);
+}
+
+/* Index of the first program header of `type`, or -1. */
+static int segment_of_type(shelfobj_t *desc, uint32_t type)
+{
+    for (int i = 0; i < desc->hdr.e_phnum; i++) {
+        if (desc->pht[i].p_type == type)
+            return i;
+    }
+
+    return -1;
+}
+
+static void test_segmap(shelfobj_t *self)
+{
+    shelfsegmap_t *map = shelf_segmap_load(self);
+    shelfsect_t *text = get_section_by_name(self, ".text");
+    shelfsect_t *dynamic = get_section_by_name(self, ".dynamic");
+    size_t agree = 0, transposed = 0;
+    int pt_dynamic = segment_of_type(self, PT_DYNAMIC);
+
+    CHECK(map != NULL && shelf_segmap_load(self) == map);
+    CHECK(text != NULL && dynamic != NULL && pt_dynamic >= 0);
+
+    if (map == NULL || text == NULL || dynamic == NULL || pt_dynamic < 0)
+        return;
+
+    CHECK(map->nsects == self->hdr.e_shnum && map->nsegs == self->hdr.e_phnum);
+
+    // Both matrices say what the one-pair predicate says.
+    for (size_t s = 0; s < map->nsects; s++) {
+        for (size_t p = 0; p < map->nsegs; p++) {
+            int in = shelf_segmap_contains(map, s, p);
+            const uint64_t *row = shelf_segmap_sections_of(map, p);
+
+            agree += in == !!shelf_section_in_segment(self, &self->sht[s], &self->pht[p]);
+            transposed += in == (int) ((row[s / 64] >> (s % 64)) & 1);
+        }
+    }
+
+    CHECK(agree == map->nsects * map->nsegs && transposed == agree);
+
+    // Section 0 is in nothing, .text in an executable PT_LOAD, .dynamic in PT_DYNAMIC.
+    int text_in_load = 0;
+
+    for (size_t p = 0; p < map->nsegs; p++) {
+        CHECK(!shelf_segmap_contains(map, 0, p));
+        text_in_load |= shelf_segmap_contains(map, text->index, p) &&
+                        self->pht[p].p_type == PT_LOAD && (self->pht[p].p_flags & PF_X);
+    }
+
+    CHECK(text_in_load);
+    CHECK(shelf_segmap_contains(map, dynamic->index, pt_dynamic));
+    CHECK(!shelf_segmap_contains(map, text->index, pt_dynamic));
+    CHECK(!shelf_segmap_contains(map, map->nsects, 0) && shelf_segmap_segments_of(map, map->nsects) == NULL);
+}
+
+static void test_translate(shelfobj_t *self)
+{
+    shelfsect_t *bss = get_section_by_name(self, ".bss");
+    shelfsym_t *main_sym = shelf_get_symbol_by_name(self, "main");
+    const shelfloadseg_t *seg;
+    uint64_t vaddrs[8], offsets[8], off, addr, end = 0;
+    uint8_t status[8];
+    size_t n = 0, checked = 0, in_file = 0;
+
+    CHECK(bss != NULL && main_sym != NULL && shelf_loadidx_load(self) != NULL);
+
+    if (bss == NULL || main_sym == NULL || self->loadidx == NULL)
+        return;
+
+    // Allocated sections translate to their own offsets and back.
+    for (size_t i = 1; i < self->hdr.e_shnum; i++) {
+        const shelf_Shdr *sh = &self->sht[i];
+
+        if (!(sh->sh_flags & SHF_ALLOC) || sh->sh_type == SHT_NOBITS || sh->sh_size == 0)
+            continue;
+
+        CHECK(shelf_vaddr_to_offset(self, sh->sh_addr, &off) == SHELF_ADDR_IN_FILE && off == sh->sh_offset);
+        CHECK(shelf_offset_to_vaddr(self, sh->sh_offset + sh->sh_size - 1, &addr) == SHELF_ADDR_IN_FILE &&
+              addr == sh->sh_addr + sh->sh_size - 1);
+        checked++;
+    }
+
+    CHECK(checked > 0);
+
+    for (size_t i = 0; i < self->loadidx->count; i++) {
+        const shelfloadseg_t *s = &self->loadidx->by_vaddr[i];
+
+        CHECK(i == 0 || self->loadidx->by_vaddr[i - 1].vaddr <= s->vaddr);
+        CHECK(i == 0 || self->loadidx->by_offset[i - 1].offset <= self->loadidx->by_offset[i].offset);
+        CHECK(self->pht[s->index].p_type == PT_LOAD && self->pht[s->index].p_vaddr == s->vaddr);
+
+        if (s->vaddr + s->memsz > end)
+            end = s->vaddr + s->memsz;
+    }
+
+    // The bss tail has no file bytes, addresses past every segment aren't mapped.
+    CHECK(shelf_vaddr_to_offset(self, bss->shdr->sh_addr, &off) == SHELF_ADDR_IN_MEMSZ);
+    CHECK(shelf_vaddr_to_offset(self, end, &off) == SHELF_ADDR_UNMAPPED);
+    CHECK(shelf_offset_to_vaddr(self, self->file_stat.st_size, &addr) == SHELF_ADDR_UNMAPPED);
+
+    seg = shelf_loadseg_find(self, main_sym->st_value);
+    CHECK(seg != NULL && seg->vaddr <= main_sym->st_value && main_sym->st_value - seg->vaddr < seg->filesz);
+    CHECK(shelf_loadseg_find(self, end) == NULL);
+
+    // Batches agree with one at a time translation, in any order.
+    vaddrs[n++] = main_sym->st_value;
+    vaddrs[n++] = end + 0x1000;
+    vaddrs[n++] = main_sym->st_value + 1;
+    vaddrs[n++] = bss->shdr->sh_addr;
+    vaddrs[n++] = self->loadidx->by_vaddr[0].vaddr;
+    vaddrs[n++] = main_sym->st_value;
+
+    CHECK(shelf_vaddr_to_offset_batch(self, vaddrs, offsets, status, n) == 4);
+
+    for (size_t i = 0; i < n; i++) {
+        int one = shelf_vaddr_to_offset(self, vaddrs[i], &off);
+
+        CHECK(status[i] == one && (one != SHELF_ADDR_IN_FILE || offsets[i] == off));
+        in_file += one == SHELF_ADDR_IN_FILE;
+    }
+
+    CHECK(in_file == 4);
+}
+
+/* Appends a "CORE" note to `buf` at `*off`, padding the payload to 4 bytes. */
+static void put_note(unsigned char *buf, size_t *off, uint32_t type, const void *desc, uint32_t descsz)
+{
+    uint32_t nhdr[3] = { 5, descsz, type };
+
+    memcpy(buf + *off, nhdr, sizeof(nhdr));
+    memcpy(buf + *off + 12, "CORE", 5);
+    memcpy(buf + *off + 20, desc, descsz);
+    *off += 20 + ((descsz + 3) & ~(size_t) 3);
+}
+
+/* A 64-bit core header with its program headers at 64, in host byte order. */
+static void put_core_header(unsigned char *buf, uint16_t phnum)
+{
+    Elf64_Ehdr hdr = { 0 };
+
+    hdr.e_ident[EI_MAG0] = ELFMAG0;
+    hdr.e_ident[EI_MAG1] = ELFMAG1;
+    hdr.e_ident[EI_MAG2] = ELFMAG2;
+    hdr.e_ident[EI_MAG3] = ELFMAG3;
+    hdr.e_ident[EI_CLASS] = ELFCLASS64;
+    hdr.e_ident[EI_DATA] = *(const unsigned char *) &(uint16_t) { 1 } ? ELFDATA2LSB : ELFDATA2MSB;
+    hdr.e_ident[EI_VERSION] = EV_CURRENT;
+    hdr.e_type = ET_CORE;
+    hdr.e_machine = EM_X86_64;
+    hdr.e_version = EV_CURRENT;
+    hdr.e_phoff = 64;
+    hdr.e_ehsize = 64;
+    hdr.e_phentsize = 56;
+    hdr.e_phnum = phnum;
+    memcpy(buf, &hdr, sizeof(hdr));
+}
+
+/*
+ * Writes a core with two threads, an auxiliary vector, a SIGSEGV siginfo,
+ * an NT_FILE note listing its mappings out of order, two pages of memory
+ * at 0x10000 with a bss tail, and section headers like gcore's.
+ */
+static int write_note_core(const char *path)
+{
+    enum { PAGE = 4096 };
+    size_t len = 3 * PAGE, off = 64 + 2 * 56;
+    unsigned char *buf = calloc(1, len);
+    unsigned char prstatus[336] = { 0 }, siginfo[128] = { 0 };
+    uint64_t auxv[] = { 6, PAGE, 9, 0x401000, 0, 0 };
+    uint64_t files[] = { 2, PAGE, 0x30000, 0x31000, 2, 0x10000, 0x12000, 0 };
+    static const char names[] = "/lib/b.so\0/bin/a";
+    unsigned char filenote[sizeof(files) + sizeof(names)];
+    Elf64_Phdr pht[2];
+    Elf64_Shdr sht[3] = { { 0 } };
+    Elf64_Ehdr hdr;
+    int ret;
+
+    if (buf == NULL)
+        return -1;
+
+    put_core_header(buf, 2);
+
+    for (uint32_t pid = 1234; pid <= 1235; pid++) {
+        uint16_t sig = 11;
+        uint32_t ids[2] = { pid, 1 };
+
+        memcpy(prstatus + 12, &sig, sizeof(sig));
+        memcpy(prstatus + 32, ids, sizeof(ids));
+        memset(prstatus + 112, pid & 0xff, 27 * 8);
+        put_note(buf, &off, NT_PRSTATUS, prstatus, sizeof(prstatus));
+    }
+
+    put_note(buf, &off, NT_AUXV, auxv, sizeof(auxv));
+
+    int32_t si[2] = { 11, 0 };
+    uint64_t addr = 0xdeadbeef;
+
+    memcpy(siginfo, si, sizeof(si));
+    memcpy(siginfo + 8, &si[0], sizeof(si[0]));
+    memcpy(siginfo + 16, &addr, sizeof(addr));
+    put_note(buf, &off, NT_SIGINFO, siginfo, sizeof(siginfo));
+
+    memcpy(filenote, files, sizeof(files));
+    memcpy(filenote + sizeof(files), names, sizeof(names));
+    put_note(buf, &off, NT_FILE, filenote, sizeof(filenote));
+
+    pht[0] = (Elf64_Phdr) { .p_type = PT_NOTE, .p_offset = 64 + 2 * 56,
+                            .p_filesz = off - (64 + 2 * 56), .p_align = 4 };
+    pht[1] = (Elf64_Phdr) { .p_type = PT_LOAD, .p_flags = PF_R | PF_W, .p_offset = PAGE,
+                            .p_vaddr = 0x10000, .p_filesz = 2 * PAGE, .p_memsz = 3 * PAGE,
+                            .p_align = PAGE };
+    memcpy(buf + 64, pht, sizeof(pht));
+
+    for (size_t i = 0; i < 2 * PAGE; i++)
+        buf[PAGE + i] = i / 7;
+
+    // Section headers in the first page's slack, e_shstrndx naming the last.
+    sht[2].sh_type = SHT_STRTAB;
+    memcpy(&hdr, buf, sizeof(hdr));
+    hdr.e_shoff = PAGE - sizeof(sht);
+    hdr.e_shentsize = sizeof(Elf64_Shdr);
+    hdr.e_shnum = 3;
+    hdr.e_shstrndx = 2;
+    memcpy(buf, &hdr, sizeof(hdr));
+    memcpy(buf + hdr.e_shoff, sht, sizeof(sht));
+
+    ret = off <= hdr.e_shoff ? write_file(path, buf, len) : -1;
+    free(buf);
+
+    return ret;
+}
+
+static void test_core_notes(void)
+{
+    char *path = path_in_dir("notes.core");
+    shelfobj_t *desc;
+    shelfcore_t *core;
+    uint64_t val;
+
+    CHECK(write_note_core(path) == 0);
+    desc = shelf_open(path);
+    CHECK(desc != NULL && desc->core != NULL);
+
+    if (desc == NULL || (core = desc->core) == NULL) {
+        shelf_close(&desc);
+        return;
+    }
+
+    // Cores are read without mapping them.
+    CHECK(desc->data == NULL);
+    CHECK(core->nall == 5);
+
+    CHECK(core->nthreads == 2);
+    CHECK(core->threads[0].pid == 1234 && core->threads[1].pid == 1235);
+    CHECK(core->threads[0].ppid == 1 && core->threads[0].signo == 11);
+    CHECK(core->threads[1].regs_len == 27 * 8 && core->threads[1].regs[0] == (1235 & 0xff));
+
+    CHECK(core->nauxv == 3);
+    CHECK(shelf_core_auxv_get(desc, 9, &val) == 0 && val == 0x401000);
+    CHECK(shelf_core_auxv_get(desc, 7, &val) == -1);
+
+    CHECK(core->si_signo == 11 && core->si_addr == 0xdeadbeef);
+
+    // Mappings are sorted by address and their offsets scaled by the page size.
+    CHECK(core->nfiles == 2 && core->page_size == 4096);
+    CHECK(core->nfiles == 2 && core->files[0].start == 0x10000 &&
+          strcmp(core->files[0].path, "/bin/a") == 0);
+    CHECK(core->nfiles == 2 && core->files[1].offset == 2 * 4096);
+    CHECK(shelf_core_file_at(desc, 0x11fff) == &core->files[0]);
+    CHECK(shelf_core_file_at(desc, 0x12000) == NULL);
+
+    // The file's section headers are ignored rather than read out of bounds.
+    CHECK(desc->hdr.e_shnum == 0 && desc->hdr.e_shstrndx == 0);
+    CHECK(get_section_by_name(desc, ".shstrtab") == NULL);
+
+    shelf_close(&desc);
+}
+
+static void test_core_read(void)
+{
+    enum { PAGE = 4096, BASE = 0x10000 };
+    char *path = path_in_dir("read.core");
+    unsigned char out[16], want[16];
+    shelfcorecache_t *cache;
+    shelfobj_t *desc;
+
+    CHECK(write_note_core(path) == 0);
+    desc = shelf_open(path);
+    CHECK(desc != NULL && desc->core != NULL && desc->data == NULL);
+
+    if (desc == NULL || desc->core == NULL) {
+        shelf_close(&desc);
+        return;
+    }
+
+    // A read across two file pages fills two cache slots, the same read again hits them.
+    for (size_t i = 0; i < sizeof(want); i++)
+        want[i] = (PAGE - 8 + i) / 7;
+
+    CHECK(shelf_core_read(desc, BASE + PAGE - 8, out, sizeof(out)) == sizeof(out));
+    CHECK(memcmp(out, want, sizeof(out)) == 0);
+    CHECK((cache = desc->core->cache) != NULL);
+
+    if (cache == NULL) {
+        shelf_close(&desc);
+        return;
+    }
+
+    CHECK(cache->misses == 2 && cache->hits == 0);
+    memset(out, 0, sizeof(out));
+    CHECK(shelf_core_read(desc, BASE + PAGE - 8, out, sizeof(out)) == sizeof(out));
+    CHECK(memcmp(out, want, sizeof(out)) == 0);
+    CHECK(cache->misses == 2 && cache->hits == 2);
+
+    // Past p_filesz reads zeroes, past p_memsz the read comes up short.
+    memset(out, 0xff, sizeof(out));
+    CHECK(shelf_core_read(desc, BASE + 2 * PAGE - 4, out, 8) == 8);
+    CHECK(out[0] == (unsigned char) ((2 * PAGE - 4) / 7) && out[3] == (unsigned char) ((2 * PAGE - 1) / 7));
+    CHECK(out[4] == 0 && out[7] == 0);
+    CHECK(shelf_core_read(desc, BASE + 3 * PAGE - 4, out, 8) == 4);
+    CHECK(shelf_core_read(desc, BASE + 3 * PAGE, out, 8) == -1);
+    CHECK(shelf_core_read(desc, BASE - 1, out, 1) == -1);
+    shelf_close(&desc);
+
+    // Mapped cores read the same bytes without the cache.
+    desc = shelf_open_flags(path, SHELF_OPEN_MAP_CORE);
+    CHECK(desc != NULL && desc->data != NULL);
+
+    if (desc != NULL) {
+        CHECK(shelf_core_read(desc, BASE + PAGE - 8, out, sizeof(out)) == sizeof(out));
+        CHECK(memcmp(out, want, sizeof(out)) == 0);
+        CHECK(desc->core == NULL || desc->core->cache == NULL);
+    }
+
+    shelf_close(&desc);
+}
+
+/*
+ * Writes a core file with one NT_FILE note mapping two pages of `backing`
+ * and three segments: the first page as it is in the file, the second
+ * changed, and an anonymous segment whose first page is zero.
+ */
+static int write_core(const char *path, const char *backing, const unsigned char *pages)
+{
+    enum { PAGE = 4096, PHNUM = 4, NOTE_OFF = 64 + PHNUM * 56 };
+    size_t pathlen = strlen(backing) + 1;
+    size_t descsz = 2 * 8 + 2 * 3 * 8 + 2 * pathlen;
+    size_t notesz = 12 + 8 + ((descsz + 3) & ~(size_t) 3);
+    size_t len = 5 * PAGE;
+    unsigned char *buf = calloc(1, len);
+    Elf64_Phdr *pht = (Elf64_Phdr *) (buf + 64);
+    uint64_t file[8] = { 2, PAGE, 0x10000, 0x11000, 0, 0x11000, 0x12000, 1 };
+    unsigned char *note = malloc(descsz);
+    size_t off = NOTE_OFF;
+    int ret;
+
+    if (buf == NULL || note == NULL || NOTE_OFF + notesz > PAGE) {
+        free(buf);
+        free(note);
+        return -1;
+    }
+
+    put_core_header(buf, PHNUM);
+
+    pht[0] = (Elf64_Phdr) { .p_type = PT_NOTE, .p_offset = NOTE_OFF, .p_filesz = notesz, .p_align = 4 };
+
+    memcpy(note, file, sizeof(file));
+    memcpy(note + sizeof(file), backing, pathlen);
+    memcpy(note + sizeof(file) + pathlen, backing, pathlen);
+    put_note(buf, &off, NT_FILE, note, descsz);
+    free(note);
+
+    pht[1] = (Elf64_Phdr) { .p_type = PT_LOAD, .p_flags = PF_R | PF_X, .p_offset = PAGE,
+                            .p_vaddr = 0x10000, .p_filesz = PAGE, .p_memsz = PAGE, .p_align = PAGE };
+    memcpy(buf + PAGE, pages, PAGE);
+
+    pht[2] = (Elf64_Phdr) { .p_type = PT_LOAD, .p_flags = PF_R, .p_offset = 2 * PAGE,
+                            .p_vaddr = 0x11000, .p_filesz = PAGE, .p_memsz = PAGE, .p_align = PAGE };
+    memcpy(buf + 2 * PAGE, pages + PAGE, PAGE);
+    buf[2 * PAGE + 100] ^= 0xff;
+
+    pht[3] = (Elf64_Phdr) { .p_type = PT_LOAD, .p_flags = PF_R | PF_W, .p_offset = 3 * PAGE,
+                            .p_vaddr = 0x20000, .p_filesz = 2 * PAGE, .p_memsz = 2 * PAGE, .p_align = PAGE };
+    memset(buf + 4 * PAGE, 0x5a, PAGE);
+
+    ret = write_file(path, buf, len);
+    free(buf);
+
+    return ret;
+}
+
+static void test_coremin(void)
+{
+    enum { PAGE = 4096 };
+    char *backing = path_in_dir("core.backing");
+    char *path = path_in_dir("core");
+    char *out = path_in_dir("core.min");
+    unsigned char *pages = malloc(2 * PAGE);
+    shelfcoreminstats_t stats;
+    shelfobj_t *desc;
+
+    for (size_t i = 0; pages != NULL && i < 2 * PAGE; i++)
+        pages[i] = i * 13 + 7;
+
+    CHECK(pages != NULL && write_file(backing, pages, 2 * PAGE) == 0);
+    CHECK(pages != NULL && write_core(path, backing, pages) == 0);
+    free(pages);
+
+    desc = shelf_open(path);
+    CHECK(desc != NULL && desc->core != NULL && desc->core->nfiles == 2);
+
+    if (desc == NULL)
+        return;
+
+    // Only the segment matching its file is dropped.
+    CHECK(shelf_core_minimize(desc, out, 0, &stats) == 0);
+    CHECK(stats.dropped == 1);
+    CHECK(stats.zero_pages == 1);
+    CHECK(stats.in_size == 5 * PAGE);
+    shelf_close(&desc);
+
+    desc = shelf_open(out);
+    CHECK(desc != NULL && desc->hdr.e_phnum == 4);
+
+    if (desc == NULL)
+        return;
+
+    CHECK(desc->pht[1].p_filesz == 0 && desc->pht[1].p_memsz == PAGE);
+    CHECK(desc->pht[2].p_filesz == PAGE);
+    CHECK(desc->pht[3].p_filesz == 2 * PAGE);
+
+    unsigned char byte;
+
+    CHECK(shelf_core_read(desc, 0x11000 + 100, &byte, 1) == 1);
+    CHECK(byte == (unsigned char) (((PAGE + 100) * 13 + 7) ^ 0xff));
+    CHECK(shelf_core_read(desc, 0x20000, &byte, 1) == 1 && byte == 0);
+    CHECK(shelf_core_read(desc, 0x21000, &byte, 1) == 1 && byte == 0x5a);
+
+    shelf_close(&desc);
+}
+
+static void test_proc_cache(void)
+{
+    size_t len = (SHELF_PROC_CACHE_PAGES + 2) * SHELF_PROC_PAGE;
+    unsigned char *mem = aligned_alloc(SHELF_PROC_PAGE, len);
+    unsigned char out[16];
+    shelfproc_t *proc = shelf_proc_attach(getpid());
+    uint64_t base = (uintptr_t) mem;
+
+    CHECK(mem != NULL && proc != NULL);
+
+    if (mem == NULL || proc == NULL) {
+        free(mem);
+        shelf_proc_detach(proc);
+        return;
+    }
+
+    for (size_t i = 0; i < len; i++)
+        mem[i] = i * 7 + i / SHELF_PROC_PAGE;
+
+    // Fill every slot, then read across a cached page and one that isn't.
+    CHECK(shelf_proc_read(proc, base, out, 1) == 1);
+
+    for (size_t p = 2; p < SHELF_PROC_CACHE_PAGES + 1; p++)
+        CHECK(shelf_proc_read(proc, base + p * SHELF_PROC_PAGE, out, 1) == 1);
+
+    CHECK(shelf_proc_read(proc, base + SHELF_PROC_PAGE - 8, out, sizeof(out)) == sizeof(out));
+    CHECK(memcmp(out, mem + SHELF_PROC_PAGE - 8, sizeof(out)) == 0);
+
+    // Cached pages are served again until invalidated.
+    uint64_t syscalls = proc->syscalls;
+
+    CHECK(shelf_proc_read(proc, base + SHELF_PROC_PAGE, out, 4) == 4);
+    CHECK(proc->syscalls == syscalls);
+
+    mem[SHELF_PROC_PAGE] ^= 0xff;
+    shelf_proc_invalidate(proc);
+    CHECK(shelf_proc_read(proc, base + SHELF_PROC_PAGE, out, 4) == 4);
+    CHECK(out[0] == mem[SHELF_PROC_PAGE]);
+
+    shelf_proc_detach(proc);
+    free(mem);
+}
+
+static void test_symbolizer(void)
+{
+    shelfdesccache_t *cache = shelf_desccache_new(NULL);
+    shelfsymbolizer_t *sym = shelf_symbolizer_new(getpid(), cache), *other;
+    uint64_t pcs[3] = { (uintptr_t) test_symbolizer + 4, 0x10, (uintptr_t) shelf_open };
+    shelfsymloc_t loc, locs[3];
+    char exe[PATH_MAX] = "", libshelf[PATH_MAX] = "";
+    Dl_info info;
+    void *lib;
+
+    CHECK(cache != NULL && sym != NULL);
+    CHECK(realpath("/proc/self/exe", exe) != NULL);
+    CHECK(dladdr((void *) shelf_open, &info) != 0 && realpath(info.dli_fname, libshelf) != NULL);
+
+    if (cache == NULL || sym == NULL) {
+        shelf_symbolizer_free(sym);
+        shelf_desccache_free(cache);
+        return;
+    }
+
+    // Our own functions, and the library's.
+    CHECK(shelf_symbolize(sym, (uintptr_t) test_symbolizer, &loc) == 0);
+    CHECK(loc.module != NULL && strcmp(loc.module, exe) == 0);
+    CHECK(loc.symbol != NULL && strcmp(loc.symbol, "test_symbolizer") == 0 && loc.offset == 0);
+
+    CHECK(shelf_symbolize_batch(sym, pcs, 3, locs) == 2);
+    CHECK(locs[0].symbol != NULL && strcmp(locs[0].symbol, "test_symbolizer") == 0 && locs[0].offset == 4);
+    CHECK(locs[1].module == NULL && locs[1].symbol == NULL);
+    CHECK(locs[2].module != NULL && strcmp(locs[2].module, libshelf) == 0);
+    CHECK(locs[2].symbol != NULL && strcmp(locs[2].symbol, "shelf_open") == 0 && locs[2].offset == 0);
+    CHECK(shelf_symbolize(sym, 0x10, &loc) == -1);
+
+    // Libraries loaded later show up after a refresh.
+    CHECK((lib = dlopen(TESTLIB, RTLD_NOW)) != NULL);
+
+    if (lib != NULL) {
+        uint64_t pc = (uintptr_t) dlsym(lib, "shelf_test_pid");
+
+        CHECK(pc != 0 && shelf_symbolize(sym, pc, &loc) == -1);
+        CHECK(shelf_symbolizer_refresh(sym) == 1);
+        CHECK(shelf_symbolize(sym, pc, &loc) == 0 && loc.symbol != NULL &&
+              strcmp(loc.symbol, "shelf_test_pid") == 0);
+    }
+
+    // A second symbolizer shares the cached modules.
+    size_t modules = cache->count;
+
+    other = shelf_symbolizer_new(getpid(), cache);
+    CHECK(other != NULL && cache->count == modules);
+    CHECK(other != NULL && shelf_symbolize(other, (uintptr_t) shelf_open, &loc) == 0 &&
+          loc.module == locs[2].module);
+
+    // Modules stay open while used.
+    CHECK(shelf_desccache_prune(cache) == 0);
+    shelf_symbolizer_free(other);
+    shelf_symbolizer_free(sym);
+    CHECK(shelf_desccache_prune(cache) == modules && cache->count == 0);
+    shelf_desccache_free(cache);
+
+    if (lib != NULL)
+        dlclose(lib);
+}
+
+static void test_write(void)
+{
+    char *path = fixture("write");
+    char *out = path_in_dir("write.out");
+    size_t len, out_len;
+    unsigned char *src, *dst = NULL, *rw;
+    shelfobj_t *desc = shelf_open(path);
+    shelfsect_t *sect = NULL;
+    uint64_t at = 0;
+
+    CHECK(desc != NULL && (sect = get_section_by_name(desc, ".comment")) != NULL);
+
+    if (desc == NULL || sect == NULL) {
+        shelf_close(&desc);
+        return;
+    }
+
+    // An untouched descriptor writes back the file it was read from.
+    CHECK(shelf_write(desc, out) == desc->file_stat.st_size);
+    CHECK(same_file_bytes(path, out));
+
+    // Edits land where they belong and nowhere else.
+    CHECK((rw = get_section_data_rw(desc, sect)) != NULL);
+
+    if (rw != NULL)
+        memcpy(rw, "WWWW", 4);
+
+    at = sect->shdr->sh_offset;
+    desc->hdr.e_flags = 0x5a5a;
+    CHECK(shelf_write(desc, out) == desc->file_stat.st_size);
+
+    src = read_file(path, &len);
+    CHECK(src != NULL && (dst = read_file(out, &out_len)) != NULL && out_len == len);
+
+    if (src != NULL && dst != NULL && out_len == len) {
+        Elf64_Ehdr hdr;
+        size_t differ = 0;
+
+        memcpy(&hdr, dst, sizeof(hdr));
+        CHECK(hdr.e_flags == 0x5a5a && memcmp(dst + at, "WWWW", 4) == 0);
+
+        for (size_t i = 0; i < len; i++) {
+            int edited = (i >= at && i < at + 4) ||
+                         (i >= offsetof(Elf64_Ehdr, e_flags) && i < offsetof(Elf64_Ehdr, e_flags) + 4);
+
+            differ += !edited && src[i] != dst[i];
+        }
+
+        CHECK(differ == 0);
+    }
+
+    free(src);
+    free(dst);
+
+    // Writing over the descriptor's own file leaves it readable.
+    CHECK(shelf_write(desc, path) == desc->file_stat.st_size);
+    CHECK(same_file_bytes(path, out));
+    CHECK((sect = get_section_by_name(desc, ".text")) != NULL && get_section_data(desc, sect) != NULL);
+
+    // A failed write leaves nothing behind.
+    CHECK(shelf_write(desc, path_in_dir("no/such/dir")) == -1 && shelf_error != NULL);
+    CHECK(access(path_in_dir("no"), F_OK) != 0);
+
+    shelf_close(&desc);
+}
+
+/* Reads the first `len` bytes of .comment in the file at `path`. */
+static int comment_head(const char *path, void *buf, size_t len)
+{
+    shelfobj_t *desc = shelf_open(path);
+    shelfsect_t *sect = NULL;
+    const void *data;
+    int ret = -1;
+
+    if (desc == NULL)
+        return -1;
+
+    if ((sect = get_section_by_name(desc, ".comment")) != NULL &&
+        sect->shdr->sh_size >= len && (data = get_section_data(desc, sect)) != NULL) {
+        memcpy(buf, data, len);
+        ret = 0;
+    }
+
+    shelf_close(&desc);
+
+    return ret;
+}
+
+static void test_journal(void)
+{
+    char *path = fixture("journal");
+    char *out = path_in_dir("journal.out");
+    char *orig = path_in_dir("journal.orig");
+    unsigned char before[4], after[4];
+    shelfobj_t *desc;
+    shelfsect_t *sect = NULL;
+
+    CHECK(comment_head(path, before, sizeof(before)) == 0);
+    fixture("journal.orig");
+
+    // Rolled back writes are gone from reads.
+    desc = shelf_open(path);
+    CHECK(desc != NULL && (sect = get_section_by_name(desc, ".comment")) != NULL);
+
+    if (desc == NULL || sect == NULL)
+        return;
+
+    CHECK(shelf_journal_begin(desc) != NULL);
+    CHECK(shelf_journal_write(desc, sect->shdr->sh_offset, "XXXX", 4) == 0);
+    CHECK(memcmp(get_section_data(desc, sect), "XXXX", 4) == 0);
+    shelf_journal_rollback(desc);
+    CHECK(desc->journal == NULL);
+    CHECK(memcmp(get_section_data(desc, sect), before, 4) == 0);
+
+    // Committed ones reach the output and leave the source alone.
+    CHECK(shelf_journal_begin(desc) != NULL);
+    CHECK(shelf_journal_write(desc, sect->shdr->sh_offset, "XXXX", 4) == 0);
+    CHECK(shelf_journal_commit(desc, out) > 0);
+    shelf_close(&desc);
+
+    CHECK(comment_head(out, after, sizeof(after)) == 0 && memcmp(after, "XXXX", 4) == 0);
+    CHECK(same_file_bytes(path, orig));
+
+    // Writes through a patched file's section data wait for the commit.
+    desc = shelf_open_flags(path, SHELF_OPEN_PATCH);
+    CHECK(desc != NULL && (sect = get_section_by_name(desc, ".comment")) != NULL);
+
+    if (desc != NULL && sect != NULL) {
+        unsigned char *rw;
+
+        CHECK(shelf_journal_begin(desc) != NULL);
+        CHECK((rw = get_section_data_rw(desc, sect)) != NULL);
+
+        if (rw != NULL)
+            memcpy(rw, "YYYY", 4);
+
+        shelf_journal_rollback(desc);
+    }
+
+    shelf_close(&desc);
+    CHECK(same_file_bytes(path, orig));
+
+    // Closing with an open transaction drops it.
+    desc = shelf_open(path);
+    CHECK(desc != NULL && shelf_journal_begin(desc) != NULL);
+    CHECK(desc != NULL && shelf_journal_write(desc, 0x40, "x", 1) == 0);
+    shelf_close(&desc);
+    CHECK(desc == NULL);
+    CHECK(same_file_bytes(path, orig));
+}
+
+static void test_layout(void)
+{
+    char *path = fixture("layout");
+    char *out = path_in_dir("layout.out");
+    shelf_Shdr shdr = { .sh_type = SHT_PROGBITS, .sh_addralign = 1 };
+    shelfobj_t *desc = shelf_open(path);
+    shelfsect_t *sect;
+    uint64_t text_size = 0;
+    void *text = NULL;
+
+    CHECK(desc != NULL);
+
+    if (desc == NULL)
+        return;
+
+    if ((sect = get_section_by_name(desc, ".text")) != NULL &&
+        (text = malloc(sect->shdr->sh_size)) != NULL) {
+        text_size = sect->shdr->sh_size;
+        memcpy(text, get_section_data(desc, sect), text_size);
+    }
+
+    CHECK(add_section(desc, ".shelf.added", &shdr, "added", 6) != NULL);
+    CHECK(remove_section(desc, ".comment") == 0);
+
+    // Changes made in a rolled back transaction are dropped with it.
+    CHECK(shelf_journal_begin(desc) != NULL);
+    CHECK(add_section(desc, ".shelf.during", &shdr, "during", 7) != NULL);
+    shelf_journal_rollback(desc);
+
+    CHECK(shelf_write(desc, out) > 0);
+    shelf_close(&desc);
+
+    desc = shelf_open(out);
+    CHECK(desc != NULL);
+
+    if (desc == NULL) {
+        free(text);
+        return;
+    }
+
+    CHECK(get_section_by_name(desc, ".comment") == NULL);
+    CHECK(get_section_by_name(desc, ".shelf.during") == NULL);
+    CHECK((sect = get_section_by_name(desc, ".shelf.added")) != NULL);
+    CHECK(sect != NULL && strcmp(get_section_data(desc, sect), "added") == 0);
+
+    // Untouched sections carry the same bytes.
+    CHECK(text != NULL && (sect = get_section_by_name(desc, ".text")) != NULL);
+    CHECK(sect != NULL && sect->shdr->sh_size == text_size &&
+          memcmp(get_section_data(desc, sect), text, text_size) == 0);
+
+    free(text);
+    shelf_close(&desc);
+}
+
+static void test_strtab(void)
+{
+    shelfstrtab_t *tab = shelf_strtab_new(NULL, 0);
+    shelfstrtab_t *copy;
+    uint32_t rela, text, tail, empty;
+
+    CHECK(tab != NULL);
+
+    rela = shelf_strtab_add(tab, ".rela.text");
+    text = shelf_strtab_add(tab, ".text");
+    tail = shelf_strtab_add(tab, "text");
+    empty = shelf_strtab_add(tab, "");
+
+    CHECK(shelf_strtab_add(tab, ".text") == text);
+    CHECK(shelf_strtab_hosts(tab, "xt"));
+    CHECK(!shelf_strtab_hosts(tab, "data"));
+    CHECK(shelf_strtab_offset(tab, text) == UINT32_MAX);
+
+    CHECK(shelf_strtab_finalize(tab) == 0);
+
+    // Only ".rela.text" is stored; the others point into it.
+    CHECK(tab->size == 1 + sizeof(".rela.text"));
+    CHECK(shelf_strtab_offset(tab, empty) == 0);
+    CHECK(shelf_strtab_offset(tab, rela) == 1);
+    CHECK(shelf_strtab_offset(tab, text) == 1 + strlen(".rela"));
+    CHECK(shelf_strtab_offset(tab, tail) == 1 + strlen(".rela."));
+    CHECK(strcmp(tab->data + shelf_strtab_offset(tab, text), ".text") == 0);
+
+    copy = shelf_strtab_copy(tab);
+    CHECK(copy != NULL && copy->count == tab->count && !copy->finalized);
+    CHECK(copy != NULL && strcmp(shelf_strtab_str(copy, tail), "text") == 0);
+
+    shelf_strtab_free(copy);
+    shelf_strtab_free(tab);
+
+    // Strings of an existing table keep their offsets and host new ones.
+    static const char base[] = "\0foo\0.bar\0";
+
+    tab = shelf_strtab_new(base, sizeof(base) - 1);
+    CHECK(tab != NULL);
+
+    uint32_t bar = shelf_strtab_add(tab, "bar");
+    uint32_t baz = shelf_strtab_add(tab, "baz");
+
+    CHECK(shelf_strtab_finalize(tab) == 0);
+    CHECK(shelf_strtab_offset(tab, bar) == 6);
+    CHECK(shelf_strtab_offset(tab, baz) == sizeof(base) - 1);
+    CHECK(tab->size == sizeof(base) - 1 + sizeof("baz"));
+    CHECK(memcmp(tab->data, base, sizeof(base) - 1) == 0);
+
+    shelf_strtab_free(tab);
+}
+
+static void test_symbol_edit(void)
+{
+    char *path = fixture("symedit");
+    char *out = path_in_dir("symedit.out");
+    shelfobj_t *desc = shelf_open(path);
+    shelfsect_t *symtab, *dynsym;
+    shelfsym_t *sym;
+    shelfnameidx_t *idx;
+    uint64_t value;
+    size_t first;
+
+    CHECK(desc != NULL);
+
+    if (desc == NULL)
+        return;
+
+    symtab = get_section_by_name(desc, ".symtab");
+    sym = shelf_get_symbol_by_name(desc, "main");
+    CHECK(symtab != NULL && sym != NULL);
+
+    if (symtab == NULL || sym == NULL) {
+        shelf_close(&desc);
+        return;
+    }
+
+    value = sym->st_value;
+    idx = shelf_nameidx_load(desc, SHELF_SYMTAB_STATIC);
+    CHECK(idx != NULL && shelf_nameidx_prefix(idx, "shelf_renamed_", &first) == 0);
+
+    // A rolled back rename gives the decoded symbol its name back.
+    CHECK(shelf_journal_begin(desc) != NULL);
+    CHECK(elfsh_set_symbol_name(desc, sym, "shelf_rolled_back") == 0);
+    CHECK(sym->name != NULL && strcmp(sym->name, "shelf_rolled_back") == 0);
+    shelf_journal_rollback(desc);
+    CHECK(sym->name != NULL && strcmp(sym->name, "main") == 0);
+    CHECK(shelf_get_symbol_by_name(desc, "main") == sym);
+
+    // Lookups and the name index see a rename right away.
+    CHECK(shelf_layout_rename_symbol(desc, symtab->index, sym - desc->symtab,
+                                     "shelf_renamed_main") == 0);
+    CHECK(shelf_get_symbol_by_name(desc, "main") == NULL);
+    CHECK(shelf_get_symbol_by_name(desc, "shelf_renamed_main") == sym);
+    idx = shelf_nameidx_load(desc, SHELF_SYMTAB_STATIC);
+    CHECK(idx != NULL && shelf_nameidx_prefix(idx, "shelf_renamed_", &first) == 1);
+    CHECK(idx != NULL && idx->order[first] == sym - desc->symtab);
+
+    // Dynamic symbols of a linked file keep their names.
+    if ((dynsym = get_section_by_name(desc, ".dynsym")) != NULL)
+        CHECK(shelf_layout_rename_symbol(desc, dynsym->index, 1, "shelf_renamed_dyn") == -1);
+
+    CHECK(shelf_write(desc, out) > 0);
+    shelf_close(&desc);
+
+    desc = shelf_open(out);
+    CHECK(desc != NULL);
+
+    if (desc == NULL)
+        return;
+
+    CHECK(shelf_get_symbol_by_name(desc, "main") == NULL);
+    CHECK((sym = shelf_get_symbol_by_name(desc, "shelf_renamed_main")) != NULL);
+    CHECK(sym != NULL && sym->st_value == value);
+
+    shelf_close(&desc);
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    (void) st;
+    (void) flag;
+    (void) ftw;
+
+    return remove(path);
+}
+
+static void cleanup(void)
+{
+    nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+int main(void)
+{
+    shelfobj_t *self;
+
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    atexit(cleanup);
+
+    if ((self = shelf_open("/proc/self/exe")) == NULL) {
+        fprintf(stderr, "Can't open /proc/self/exe: %s\n", shelf_error);
+        return 1;
+    }
+
+    test_verify(self);
+    test_section_data();
+    test_compress();
+    test_reloc(self);
+    test_dynamic();
+    test_symver();
+    test_buildid();
+    test_debuginfo();
+    test_iter(self);
+    test_sym_stream(self);
+    test_symquery(self);
+    test_nameidx(self);
+    test_symcompact(self);
+    test_segmap(self);
+    test_translate(self);
+    test_core_notes();
+    test_core_read();
+    test_coremin();
+    test_proc_cache();
+    test_symbolizer();
+    test_write();
+    test_journal();
+    test_layout();
+    test_strtab();
+    test_symbol_edit();
+
+    shelf_close(&self);
+
+    if (failures)
+        fprintf(stderr, "%d check(s) failed\n", failures);
+    else
+        printf("All tests passed\n");
+
+    return failures != 0;
 }
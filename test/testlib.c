@@ -0,0 +1,23 @@
+/* A small shared library for the tests to read. */
+
+#include <unistd.h>
+
+/* shelf_test_one@LIBSHELFTEST_1, and the default shelf_test_one@@LIBSHELFTEST_2. */
+__asm__(".symver shelf_test_one_v1, shelf_test_one@LIBSHELFTEST_1");
+__asm__(".symver shelf_test_one_v2, shelf_test_one@@LIBSHELFTEST_2");
+
+int shelf_test_one_v1(void)
+{
+    return 1;
+}
+
+int shelf_test_one_v2(void)
+{
+    return 2;
+}
+
+/* Not named in the version script, so unversioned. */
+int shelf_test_pid(void)
+{
+    return getpid();
+}
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "shelf.h"
+#include "core.h"
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-d] [-H] <core> <output>\n", argv0);
+    fprintf(stderr, "  -d  write zero pages instead of leaving holes\n");
+    fprintf(stderr, "  -H  drop ELF header pages of file-backed mappings too\n");
+}
+
+int main(int argc, char **argv)
+{
+    shelfcoreminstats_t stats;
+    shelfobj_t *desc;
+    int flags = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "dH")) != -1) {
+        switch (opt) {
+        case 'd':
+            flags |= SHELF_COREMIN_DENSE;
+            break;
+        case 'H':
+            flags |= SHELF_COREMIN_NO_ELF_HEADS;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if ((desc = shelf_open(argv[optind])) == NULL) {
+        fprintf(stderr, "%s: %s\n", argv[optind], shelf_error);
+        return 1;
+    }
+
+    if (shelf_core_minimize(desc, argv[optind + 1], flags, &stats) != 0) {
+        fprintf(stderr, "%s: %s\n", argv[optind + 1], shelf_error);
+        shelf_close(&desc);
+        return 1;
+    }
+
+    printf("%s: %llu bytes -> %llu bytes on disk (%llu apparent), "
+           "%zu segments dropped, %llu zero pages\n",
+           argv[optind + 1],
+           (unsigned long long) stats.in_size,
+           (unsigned long long) stats.written,
+           (unsigned long long) stats.out_size,
+           stats.dropped,
+           (unsigned long long) stats.zero_pages);
+
+    shelf_close(&desc);
+
+    return 0;
+}